@@ -0,0 +1,408 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "symnmf.h"
+#include "kernels.h"
+#include "pool.h"
+#include "rng.h"
+#include "batch.h"
+
+/* jobs with fewer cells than this run as a single task, so that small jobs pack onto workers */
+#define BATCH_SPLIT_CELLS 250000
+/* rows per task of a split job */
+#define BATCH_BLOCK_ROWS 64
+#define BATCH_MAX_PATH 4096
+
+/* one line of the manifest and the state of its computation */
+typedef struct
+{
+    char goal[16];
+    char *file;
+    int k;
+    char *output;
+    thread_pool *pool;
+    int n;
+    int d;
+    double **points;
+    /* similarity rows, normalized in place for norm */
+    double **A;
+    double *degrees;
+    /* H packed row after row and the W*H being filled while a product runs on the blocks */
+    const double *packed;
+    double **WH;
+    int failed;
+} batch_job;
+
+/* rows [first, last) of a job and their formatted output */
+typedef struct
+{
+    batch_job *job;
+    int first;
+    int last;
+    char *text;
+    size_t length;
+} row_block;
+
+/* Helper function to format rows of a matrix (or of the diagonal matrix of the degrees) like
+   print_matrix */
+static void format_block(row_block *block, double **M, double *diagonal)
+{
+    FILE *out = open_memstream(&block->text, &block->length);
+    char number[FORMAT_FIXED4_MAX + 1];
+    int n = block->job->n, i, j, length;
+
+    for (i = block->first; i < block->last; i++)
+    {
+        for (j = 0; j < n; j++)
+        {
+            length = format_fixed4(number, diagonal != NULL ? (i == j ? diagonal[i] : 0.0) : M[i][j]);
+            number[length++] = j < n - 1 ? ',' : '\n';
+            fwrite(number, 1, length, out);
+        }
+    }
+    fclose(out);
+}
+
+/* task computing the similarity rows of a block and their degrees, formatting them unless the
+   goal is norm (which needs every degree first) */
+static void compute_block(void *arg)
+{
+    row_block *block = (row_block *)arg;
+    batch_job *job = block->job;
+    distance_kernel distance = select_distance(job->d);
+    int i, j;
+
+    for (i = block->first; i < block->last; i++)
+    {
+        double *row = job->A[i];
+        for (j = 0; j < job->n; j++)
+        {
+            row[j] = j == i ? 0.0 : exp(-0.5 * distance(job->points[i], job->points[j], job->d));
+        }
+        /* summed in column order, like ddgc */
+        job->degrees[i] = 0.0;
+        for (j = 0; j < job->n; j++)
+        {
+            job->degrees[i] += row[j];
+        }
+    }
+    if (strcmp(job->goal, "sym") == 0)
+    {
+        format_block(block, job->A, NULL);
+    }
+    else if (strcmp(job->goal, "ddg") == 0)
+    {
+        format_block(block, NULL, job->degrees);
+    }
+}
+
+/* task normalizing the rows of a block as normc does and formatting them for the norm goal, the
+   degrees are already turned into D^-1/2 */
+static void normalize_block(void *arg)
+{
+    row_block *block = (row_block *)arg;
+    batch_job *job = block->job;
+    int i, j;
+
+    for (i = block->first; i < block->last; i++)
+    {
+        for (j = 0; j < job->n; j++)
+        {
+            job->A[i][j] = job->degrees[i] * job->A[i][j] * job->degrees[j];
+        }
+    }
+    if (strcmp(job->goal, "norm") == 0)
+    {
+        format_block(block, job->A, NULL);
+    }
+}
+
+/* Helper function to run a task on every block, in parallel when there is more than one */
+static void run_blocks(batch_job *job, row_block *blocks, int count, pool_task task)
+{
+    task_group group;
+    int b;
+
+    if (count == 1)
+    {
+        task(&blocks[0]);
+        return;
+    }
+    group.pending = 0;
+    for (b = 0; b < count; b++)
+    {
+        pool_submit_group(job->pool, &group, task, &blocks[b]);
+    }
+    pool_wait(job->pool, &group);
+}
+
+/* task computing the rows of W*H of a block against the packed H */
+static void product_block(void *arg)
+{
+    row_block *block = (row_block *)arg;
+    batch_job *job = block->job;
+    product_kernel product = select_product(job->k);
+    int i;
+
+    for (i = block->first; i < block->last; i++)
+    {
+        product(job->WH[i], job->A[i], job->packed, job->n, job->k);
+    }
+}
+
+/* the normalized rows of a job and its row blocks, seen as an affinity operator */
+typedef struct
+{
+    batch_job *job;
+    row_block *blocks;
+    int count;
+} job_affinity;
+
+/* W*H of a job, one task per row block so that the iterations of a large job spread over the pool;
+   every row is the same product as matrix_multiplication */
+static double **job_multiply(void *data, double **H, int n, int k)
+{
+    job_affinity *affinity = (job_affinity *)data;
+    batch_job *job = affinity->job;
+    double *packed = pack_matrix(H, n, k);
+
+    job->packed = packed;
+    job->WH = initialize_matrix(n, k);
+    run_blocks(job, affinity->blocks, affinity->count, product_block);
+    free(packed);
+    job->packed = NULL;
+    return job->WH;
+}
+
+/* rows of W*H of a job */
+static double **job_multiply_rows(void *data, const int *rows, int count, double **H, int n, int k)
+{
+    return dense_rows_multiply(((job_affinity *)data)->job->A, rows, count, H, n, k);
+}
+
+/* ||W||^2 of a job */
+static double job_norm2(void *data, int n)
+{
+    return dense_norm2(((job_affinity *)data)->job->A, n);
+}
+
+/* Helper function to run symnmf on the normalized rows of a job from the default H of the CLI,
+   writing H for the symnmf goal and one label per line for analysis. W*H runs on the row blocks of
+   the job, so a large job does not hold a single worker for the whole solve */
+static void factorize_job(batch_job *job, row_block *blocks, int count, FILE *out)
+{
+    symnmf_params params;
+    job_affinity affinity;
+    affinity_op op;
+    double **H, **start;
+    char number[FORMAT_FIXED4_MAX + 1];
+    int *labels, i, j, length;
+
+    affinity.job = job;
+    affinity.blocks = blocks;
+    affinity.count = count;
+    op.data = &affinity;
+    op.multiply = job_multiply;
+    op.multiply_rows = job_multiply_rows;
+    op.norm2 = job_norm2;
+    op.destroy = NULL;
+
+    symnmf_default_params(&params);
+    start = random_H(job->n, job->k, numpy_mean(job->A, job->n), RNG_MT19937, 0);
+    H = symnmf_op(start, &op, job->n, job->k, &params);
+    free_matrix(start, job->n);
+    if (strcmp(job->goal, "symnmf") == 0)
+    {
+        for (i = 0; i < job->n; i++)
+        {
+            for (j = 0; j < job->k; j++)
+            {
+                length = format_fixed4(number, H[i][j]);
+                number[length++] = j < job->k - 1 ? ',' : '\n';
+                fwrite(number, 1, length, out);
+            }
+        }
+    }
+    else
+    {
+        labels = analysisc(H, job->n, job->k);
+        for (i = 0; i < job->n; i++)
+        {
+            fprintf(out, "%d\n", labels[i]);
+        }
+        free(labels);
+    }
+    free_matrix(H, job->n);
+}
+
+/* task running one whole job: large jobs split into row blocks that other workers can steal */
+static void run_job(void *arg)
+{
+    batch_job *job = (batch_job *)arg;
+    row_block *blocks;
+    FILE *out;
+    int count, b, factorized = strcmp(job->goal, "symnmf") == 0 || strcmp(job->goal, "analysis") == 0;
+
+    if (strcmp(job->goal, "sym") != 0 && strcmp(job->goal, "ddg") != 0 && strcmp(job->goal, "norm") != 0 &&
+        !factorized)
+    {
+        job->failed = 1;
+        return;
+    }
+    job->points = load_points(job->file, &job->n, &job->d);
+    if (job->points == NULL || (factorized && (job->k <= 0 || job->k >= job->n)))
+    {
+        if (job->points != NULL)
+        {
+            free_matrix(job->points, job->n);
+            job->points = NULL;
+        }
+        job->failed = 1;
+        return;
+    }
+
+    count = (double)job->n * job->n < BATCH_SPLIT_CELLS ? 1 : (job->n + BATCH_BLOCK_ROWS - 1) / BATCH_BLOCK_ROWS;
+    blocks = (row_block *)calloc(count, sizeof(row_block));
+    for (b = 0; b < count; b++)
+    {
+        blocks[b].job = job;
+        blocks[b].first = (int)((double)job->n * b / count);
+        blocks[b].last = (int)((double)job->n * (b + 1) / count);
+    }
+    job->A = initialize_matrix(job->n, job->n);
+    job->degrees = (double *)malloc(job->n * sizeof(double));
+
+    run_blocks(job, blocks, count, compute_block);
+    if (strcmp(job->goal, "norm") == 0 || factorized)
+    {
+        for (b = 0; b < job->n; b++)
+        {
+            job->degrees[b] = 1.0 / sqrt(job->degrees[b]);
+        }
+        run_blocks(job, blocks, count, normalize_block);
+    }
+
+    out = fopen(job->output, "w");
+    if (out != NULL && factorized)
+    {
+        factorize_job(job, blocks, count, out);
+    }
+    for (b = 0; b < count; b++)
+    {
+        if (out != NULL && blocks[b].text != NULL && fwrite(blocks[b].text, 1, blocks[b].length, out) != blocks[b].length)
+        {
+            job->failed = 1;
+        }
+        free(blocks[b].text);
+    }
+    job->failed = job->failed || out == NULL || fclose(out) != 0;
+
+    free(blocks);
+    free_matrix(job->A, job->n);
+    free(job->degrees);
+    free_matrix(job->points, job->n);
+    job->points = NULL;
+}
+
+/* Helper function to free the jobs of a manifest */
+static void free_jobs(batch_job *jobs, int count)
+{
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        free(jobs[i].file);
+        free(jobs[i].output);
+    }
+    free(jobs);
+}
+
+/* Helper function to read the jobs of a manifest, returns NULL when it cannot be read or parsed */
+static batch_job *read_manifest(const char *manifest, int *count)
+{
+    FILE *file = fopen(manifest, "r");
+    char line[3 * BATCH_MAX_PATH], path[BATCH_MAX_PATH], output[BATCH_MAX_PATH], *start;
+    batch_job *jobs = NULL;
+    int capacity = 0;
+
+    if (!file)
+    {
+        return NULL;
+    }
+    *count = 0;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        batch_job job;
+
+        start = line + strspn(line, " \t");
+        if (*start == '#' || *start == '\n' || *start == '\0')
+        {
+            continue;
+        }
+        memset(&job, 0, sizeof(job));
+        if (sscanf(start, "%15s %4095s %d %4095s", job.goal, path, &job.k, output) != 4)
+        {
+            free_jobs(jobs, *count);
+            fclose(file);
+            return NULL;
+        }
+        job.file = (char *)malloc(strlen(path) + 1);
+        strcpy(job.file, path);
+        job.output = (char *)malloc(strlen(output) + 1);
+        strcpy(job.output, output);
+        if (*count == capacity)
+        {
+            capacity = capacity > 0 ? capacity * 2 : 64;
+            jobs = (batch_job *)realloc(jobs, capacity * sizeof(batch_job));
+        }
+        jobs[(*count)++] = job;
+    }
+    fclose(file);
+    return jobs;
+}
+
+/* function to run the jobs of a manifest */
+int run_batch(const char *manifest, int threads)
+{
+    batch_job *jobs;
+    thread_pool *pool;
+    task_group group;
+    int count, i, failed = 0;
+
+    jobs = read_manifest(manifest, &count);
+    if (threads <= 0)
+    {
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (jobs == NULL)
+    {
+        return 1;
+    }
+    /* pick the kernels before the workers start instead of racing on the first pick */
+    active_kernels();
+    if ((pool = pool_create(threads > 0 ? threads : 1)) == NULL)
+    {
+        free_jobs(jobs, count);
+        return 1;
+    }
+
+    /* largest first would be better still, but sizes are unknown until the files are read;
+       stealing the oldest work evens the load out either way */
+    group.pending = 0;
+    for (i = 0; i < count; i++)
+    {
+        jobs[i].pool = pool;
+        pool_submit_group(pool, &group, run_job, &jobs[i]);
+    }
+    pool_wait(pool, &group);
+    pool_destroy(pool);
+
+    for (i = 0; i < count; i++)
+    {
+        printf("%s %s\n", jobs[i].failed ? "failed" : "ok", jobs[i].output);
+        failed = failed || jobs[i].failed;
+    }
+    free_jobs(jobs, count);
+    return failed;
+}
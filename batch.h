@@ -0,0 +1,11 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+/* Function to run every job of a manifest on a work-stealing pool of the given number of threads
+   (0 for one per core). Each manifest line is "<goal> <file> <k> <output>", empty lines and lines
+   starting with # are skipped. The goals are those of the CLI: sym, ddg and norm ignore k, symnmf
+   and analysis start from the default H of the CLI. Prints one status line per job, returns 0 when
+   all succeeded */
+int run_batch(const char *manifest, int threads);
+
+#endif /* BATCH_H */
@@ -0,0 +1,718 @@
+import filecmp
+import json
+import math
+import os
+import subprocess
+import sys
+import tempfile
+import time
+import numpy as np
+import pandas as pd
+import sklearn.metrics as sk
+import mysymnmf
+import client
+
+
+# read the points of an input file the same way symnmf.py does
+def read_points(file_name):
+    data = pd.read_csv(file_name, header=None)
+    return [x.tolist() for index, x in data.iterrows()]
+
+
+# random initialization of H used by symnmf.py
+def initial_H(W_mean, n_points, k):
+    np.random.seed(0)
+    return np.random.uniform(0, 2 * math.sqrt(W_mean / k), size=(n_points, k)).tolist()
+
+
+# labels of a final H, as analysis.py assigns them
+def labels_of(H, n_points, k):
+    return mysymnmf.analysis(H, n_points, k)
+
+
+# solve on W (dense list or affinity) and return H, the solver info and the elapsed time
+def timed_solve(H, W, n_points, k):
+    start = time.perf_counter()
+    output, info = mysymnmf.solve(H, W, n_points, k)
+    return output, info, time.perf_counter() - start
+
+
+# objective and label agreement of the randomized sketch against the exact path for several ranks
+def bench_sketch(k, file_name, ranks):
+    points = read_points(file_name)
+    n_points = len(points)
+    W = mysymnmf.norm(points, n_points, len(points[0]))
+    H0 = initial_H(np.mean(W), n_points, k)
+
+    exact_H, exact_info, exact_time = timed_solve(H0, W, n_points, k)
+    exact_labels = labels_of(exact_H, n_points, k)
+    exact_objective = mysymnmf.objective(W, exact_H, n_points, k)
+
+    print("{:>8} {:>10} {:>6} {:>10} {:>10} {:>12} {:>9}".format(
+        "rank", "W error", "iters", "sketch s", "solve s", "objective", "ARI"))
+    print("{:>8} {:>10} {:>6} {:>10} {:>10.4f} {:>12.6f} {:>9.4f}".format(
+        "exact", "-", exact_info["iterations"], "-", exact_time, exact_objective, 1.0))
+    for rank in ranks:
+        start = time.perf_counter()
+        A = mysymnmf.sketch(W, n_points, rank)
+        sketch_time = time.perf_counter() - start
+        error = mysymnmf.affinity_info(A)["error"]
+
+        H, info, solve_time = timed_solve(H0, A, n_points, k)
+        objective = mysymnmf.objective(W, H, n_points, k)
+        agreement = sk.adjusted_rand_score(exact_labels, labels_of(H, n_points, k))
+        print("{:>8} {:>10.4f} {:>6} {:>10.4f} {:>10.4f} {:>12.6f} {:>9.4f}".format(
+            rank, error, info["iterations"], sketch_time, solve_time, objective, agreement))
+
+
+# error analysis of the quantized storage formats of W against the dense one: bytes of W, relative
+# error of the stored matrix, iterations, solve time, objective on the exact W and label agreement
+def bench_quantize(k, file_name, formats, threads):
+    points = read_points(file_name)
+    n_points = len(points)
+    W = mysymnmf.norm(points, n_points, len(points[0]))
+    H0 = initial_H(np.mean(W), n_points, k)
+    exact_H, exact_info, exact_time = timed_solve(H0, W, n_points, k)
+    exact_labels = labels_of(exact_H, n_points, k)
+
+    print("{:>8} {:>10} {:>10} {:>6} {:>10} {:>12} {:>9} {:>9}".format(
+        "format", "W MB", "W error", "iters", "solve s", "objective", "ARI", "changed"))
+    print("{:>8} {:>10.2f} {:>10} {:>6} {:>10.4f} {:>12.6f} {:>9.4f} {:>9}".format(
+        "double", n_points * n_points * 8 / 1e6, "-", exact_info["iterations"], exact_time,
+        mysymnmf.objective(W, exact_H, n_points, k), 1.0, 0))
+    for name in formats:
+        A = mysymnmf.quantize(W, n_points, name, threads=threads)
+        H, info, solve_time = timed_solve(H0, A, n_points, k)
+        labels = labels_of(H, n_points, k)
+        size = n_points * n_points * (1 if name == "int8" else 2) / 1e6
+        print("{:>8} {:>10.2f} {:>10.2e} {:>6} {:>10.4f} {:>12.6f} {:>9.4f} {:>9}".format(
+            name, size, mysymnmf.affinity_info(A)["error"], info["iterations"], solve_time,
+            mysymnmf.objective(W, H, n_points, k), sk.adjusted_rand_score(exact_labels, labels),
+            sum(a != b for a, b in zip(exact_labels, labels))))
+
+
+# warm-started refit after appending the last fraction of the points, against a cold fit of all points
+def bench_refit(k, file_name, fraction):
+    points = read_points(file_name)
+    n_points, dim = len(points), len(points[0])
+    n_old = n_points - max(1, int(n_points * fraction))
+    old, new = points[:n_old], points[n_old:]
+
+    W_old = mysymnmf.norm(old, n_old, dim)
+    H_old, info, _ = timed_solve(initial_H(np.mean(W_old), n_old, k), W_old, n_old, k)
+    model = os.path.join(tempfile.mkdtemp(), "model.bin")
+    mysymnmf.save_model(model, old, H_old, n_old, dim, k, keep_affinity=True)
+
+    start = time.perf_counter()
+    warm_H, warm_info = mysymnmf.refit(model, new, len(new), dim)
+    warm_time = time.perf_counter() - start
+    os.remove(model)
+
+    start = time.perf_counter()
+    W = mysymnmf.norm(points, n_points, dim)
+    cold_H, cold_info = mysymnmf.solve(initial_H(np.mean(W), n_points, k), W, n_points, k)
+    cold_time = time.perf_counter() - start
+
+    agreement = sk.adjusted_rand_score(labels_of(cold_H, n_points, k), labels_of(warm_H, n_points, k))
+    print("{:>6} {:>6} {:>6} {:>10} {:>12}".format("mode", "added", "iters", "seconds", "objective"))
+    print("{:>6} {:>6} {:>6} {:>10.4f} {:>12.6f}".format(
+        "cold", n_points, cold_info["iterations"], cold_time, mysymnmf.objective(W, cold_H, n_points, k)))
+    print("{:>6} {:>6} {:>6} {:>10.4f} {:>12.6f}".format(
+        "warm", len(new), warm_info["iterations"], warm_time, mysymnmf.objective(W, warm_H, n_points, k)))
+    print("label agreement (ARI): {:.4f}".format(agreement))
+
+
+# labels for k = 2 .. max_k read off one cluster tree against one independent symnmf per k, as choosing
+# k with symnmf.py takes today: time, iterations and the agreement (ARI) of the two labellings
+def bench_hierarchy(file_name, max_k):
+    points = read_points(file_name)
+    n_points = len(points)
+    W = mysymnmf.norm(points, n_points, len(points[0]))
+
+    start = time.perf_counter()
+    tree_labels, info = mysymnmf.hierarchy(W, n_points, max_k)
+    tree_time = time.perf_counter() - start
+
+    print("{:>4} {:>6} {:>10} {:>12}".format("k", "iters", "solve s", "ARI vs tree"))
+    flat_time = 0.0
+    for k in range(2, max_k + 1):
+        H, flat_info, solve_time = timed_solve(initial_H(np.mean(W), n_points, k), W, n_points, k)
+        flat_time += solve_time
+        print("{:>4} {:>6} {:>10.4f} {:>12.4f}".format(
+            k, flat_info["iterations"], solve_time, sk.adjusted_rand_score(labels_of(H, n_points, k), tree_labels[k - 1])))
+    print("independent solves: {:.4f} s, one tree of {} leaves: {:.4f} s ({} rank-2 iterations)".format(
+        flat_time, info["leaves"], tree_time, info["iterations"]))
+
+
+# iterations and time to convergence from the random, spectral and k-means++ initializations, on
+# one or more input files
+def bench_init(k, file_names):
+    print("{:>24} {:>9} {:>6} {:>8} {:>8} {:>8} {:>12} {:>11}".format(
+        "file", "init", "iters", "init s", "solve s", "total s", "objective", "silhouette"))
+    for file_name in file_names:
+        points = read_points(file_name)
+        n_points = len(points)
+        W = mysymnmf.norm(points, n_points, len(points[0]))
+        for method in ("random", "spectral", "kmeans++"):
+            start = time.perf_counter()
+            if method == "random":
+                H0 = initial_H(np.mean(W), n_points, k)
+            else:
+                H0 = mysymnmf.initialize(W, n_points, k, method=method)
+            init_time = time.perf_counter() - start
+            H, info, solve_time = timed_solve(H0, W, n_points, k)
+            labels = labels_of(H, n_points, k)
+            silhouette = sk.silhouette_score(points, labels) if 1 < len(set(labels)) < n_points else float("nan")
+            print("{:>24} {:>9} {:>6} {:>8.4f} {:>8.4f} {:>8.4f} {:>12.6f} {:>11.4f}".format(
+                os.path.basename(file_name)[-24:], method, info["iterations"], init_time, solve_time,
+                init_time + solve_time, mysymnmf.objective(W, H, n_points, k), silhouette))
+
+
+# answers of the daemon against the CLI on inputs its cache must tell apart: two inline inputs whose
+# bytes share the FNV-1a hash of their key, and a file rewritten in place at the same size within the
+# same second. Returns 1 when any answer differs
+def check_daemon():
+    here = os.path.dirname(os.path.abspath(__file__))
+    folder = tempfile.mkdtemp()
+    socket_path = os.path.join(folder, "symnmfd.sock")
+    file_name = os.path.join(folder, "input.txt")
+    daemon = subprocess.Popen([os.path.join(here, "symnmfd"), socket_path])
+    while not os.path.exists(socket_path):
+        time.sleep(0.01)
+
+    def cli(goal, text):
+        with open(file_name, "w") as file:
+            file.write(text)
+        return subprocess.run([os.path.join(here, "symnmf"), goal, file_name], capture_output=True,
+                              text=True).stdout
+
+    failed = 0
+    # both hash to 0xea1e43e6
+    for points in ([[0.0], [0.6187557104882884]], [[0.0], [0.22953000578185356]]):
+        expected = cli("sym", "".join(",".join(repr(x) for x in row) + "\n" for row in points))
+        ok = client.run_points(socket_path, "sym", 2, points) == expected
+        print("data {}: {}".format(points[1][0], "ok" if ok else "differs"))
+        failed |= not ok
+    # the same size and whole second of modification time, only the nanoseconds differ
+    for text, nanoseconds in (("0.0\n1.0\n", 1), ("0.0\n2.0\n", 2)):
+        expected = cli("sym", text)
+        os.utime(file_name, ns=(1700000000 * 10 ** 9, 1700000000 * 10 ** 9 + nanoseconds))
+        ok = client.run_file(socket_path, "sym", 2, file_name) == expected
+        print("file {}: {}".format(text.split()[1], "ok" if ok else "differs"))
+        failed |= not ok
+    client.shutdown(socket_path)
+    daemon.wait()
+    os.remove(file_name)
+    return 1 if failed else 0
+
+
+# seconds taken by each of several runs of a function, sorted
+def latencies(func, repeats):
+    times = []
+    for _ in range(repeats):
+        start = time.perf_counter()
+        func()
+        times.append(time.perf_counter() - start)
+    return sorted(times)
+
+
+# end-to-end latency of the daemon with a warm cache against the cold C and Python CLI paths
+def bench_daemon(k, goal, file_name, repeats):
+    here = os.path.dirname(os.path.abspath(__file__))
+    socket_path = os.path.join(tempfile.mkdtemp(), "symnmfd.sock")
+    daemon = subprocess.Popen([os.path.join(here, "symnmfd"), socket_path])
+    while not os.path.exists(socket_path):
+        time.sleep(0.01)
+
+    def quiet(args):
+        subprocess.run(args, stdout=subprocess.DEVNULL, check=True)
+
+    rows = []
+    if goal in ("sym", "ddg", "norm"):
+        rows.append(("C CLI", latencies(lambda: quiet([os.path.join(here, "symnmf"), goal, file_name]), repeats)))
+    rows.append(("python CLI", latencies(
+        lambda: quiet([sys.executable, os.path.join(here, "symnmf.py"), str(k), goal, file_name]), repeats)))
+    rows.append(("daemon cold", latencies(lambda: client.run_file(socket_path, goal, k, file_name), 1)))
+    rows.append(("daemon warm", latencies(lambda: client.run_file(socket_path, goal, k, file_name), repeats)))
+    client.shutdown(socket_path)
+    daemon.wait()
+
+    print("{:>12} {:>10} {:>10} {:>10}".format("path", "p50 ms", "p95 ms", "runs"))
+    for name, times in rows:
+        p50, p95 = times[len(times) // 2], times[min(len(times) - 1, int(len(times) * 0.95))]
+        print("{:>12} {:>10.2f} {:>10.2f} {:>10}".format(name, p50 * 1000, p95 * 1000, len(times)))
+
+
+# one batch run on a manifest of skewed sizes (a few large files, many small ones) against one
+# process per job
+def bench_batch(goal, threads, small, large):
+    here = os.path.dirname(os.path.abspath(__file__))
+    folder = tempfile.mkdtemp()
+    sizes = [1000] * large + [50] * small
+    manifest = os.path.join(folder, "manifest.txt")
+    with open(manifest, "w") as out:
+        for i, n_points in enumerate(sizes):
+            file_name = os.path.join(folder, "input_{}.txt".format(i))
+            generate(n_points, 4, file_name)
+            out.write("{} {} 0 {}\n".format(goal, file_name, os.path.join(folder, "output_{}.txt".format(i))))
+
+    def per_process():
+        for i in range(len(sizes)):
+            with open(os.path.join(folder, "output_{}.txt".format(i)), "w") as out:
+                subprocess.run([os.path.join(here, "symnmf"), goal, os.path.join(folder, "input_{}.txt".format(i))],
+                               stdout=out, check=True)
+
+    def batch():
+        subprocess.run([os.path.join(here, "symnmf"), "batch", manifest, "--threads={}".format(threads)],
+                       stdout=subprocess.DEVNULL, check=True)
+
+    print("{} jobs ({} of 1000 points, {} of 50 points)".format(len(sizes), large, small))
+    for name, func in (("per process", per_process), ("batch", batch)):
+        print("{:>12} {:>10.3f} s".format(name, latencies(func, 3)[1]))
+
+
+# high-water resident set of a running process in MB (its current one with field="VmRSS:"),
+# None once it exited
+def peak_rss(pid, field="VmHWM:"):
+    try:
+        with open("/proc/{}/status".format(pid)) as status:
+            for line in status:
+                if line.startswith(field):
+                    return int(line.split()[1]) / 1024
+    except OSError:
+        pass
+    return None
+
+
+# run a command with its output sent to a file, returning (status, seconds, peak RSS in MB).
+# ru_maxrss of a child includes the size of this process at fork, so the peak is sampled from
+# /proc instead: it is a high-water mark, only the last couple of milliseconds can be missed
+def measured_run(args, output_file, timeout, env=None):
+    with open(output_file, "w") as out:
+        start = time.perf_counter()
+        process = subprocess.Popen(args, stdout=out, stderr=subprocess.DEVNULL, env=env)
+        peak = None
+        while process.poll() is None:
+            sample = peak_rss(process.pid)
+            peak = sample if peak is None or (sample or 0.0) > peak else peak
+            if time.perf_counter() - start > timeout:
+                process.kill()
+                process.wait()
+                return "timeout", time.perf_counter() - start, peak
+            time.sleep(0.002)
+        seconds = time.perf_counter() - start
+    return ("ok" if process.returncode == 0 else "error"), seconds, peak
+
+
+# largest absolute difference between two printed matrices, None when their shapes differ
+def max_deviation(file_a, file_b):
+    worst = 0.0
+    with open(file_a) as a, open(file_b) as b:
+        for line_a, line_b in zip(a, b):
+            row_a, row_b = np.fromstring(line_a, sep=","), np.fromstring(line_b, sep=",")
+            if row_a.shape != row_b.shape:
+                return None
+            if row_a.size:
+                worst = max(worst, float(np.max(np.abs(row_a - row_b))))
+        if a.readline() or b.readline():
+            return None
+    return worst
+
+
+# build the Prev_final_100 CLI and extension into a scratch folder, leaving its tracked files alone
+def build_previous(folder):
+    here = os.path.dirname(os.path.abspath(__file__))
+    prev = os.path.join(here, "Prev_final_100")
+    subprocess.run(["gcc", "-ansi", "-Wall", "-Wextra", "-Werror", "-pedantic-errors", "-O2", "-o",
+                    os.path.join(folder, "symnmf"), os.path.join(prev, "symnmf.c"), "-lm"], check=True)
+    subprocess.run([sys.executable, "setup.py", "build_ext", "--build-lib", folder, "--build-temp",
+                    os.path.join(folder, "obj")], cwd=prev, check=True, stdout=subprocess.DEVNULL)
+    return prev
+
+
+# command line of a goal for each implementation: C CLI for the matrices, regress-solve for symnmf,
+# which writes the solver time of the extension to timing_file
+def regress_commands(goal, k, file_name, prev_build, timing_file):
+    here = os.path.dirname(os.path.abspath(__file__))
+    if goal == "symnmf":
+        return {name: [sys.executable, os.path.abspath(__file__), "regress-solve", name, str(k), file_name,
+                       timing_file] for name in ("current", "previous")}
+    return {"current": [os.path.join(here, "symnmf"), goal, file_name],
+            "previous": [os.path.join(prev_build, "symnmf"), goal, file_name]}
+
+
+# symnmf of one implementation timed in-process around its extension call, so interpreter startup and
+# the imports of either Python CLI stay out of the comparison: W and H are built as its CLI builds them,
+# H is printed as its CLI prints it, and the solver seconds and the peak RSS above the interpreter
+# with its imports go to timing_file
+def regress_solve(name, k, file_name, timing_file):
+    resident = peak_rss(os.getpid(), "VmRSS:")
+    with open(file_name) as file:
+        points = [[float(x) for x in line.split(",")] for line in file if line.strip()]
+    n_points = len(points)
+    np.random.seed(0)
+    if name == "previous":
+        import symnmfmodule
+        W = symnmfmodule.norm(points)
+        high = 2 * np.sqrt(np.mean(np.array(W)) / k)
+        H = [[high * np.random.uniform() for _ in range(k)] for _ in range(n_points)]
+        start = time.perf_counter()
+        H = symnmfmodule.symnmf(H, W)
+    else:
+        W = mysymnmf.norm(points, n_points, len(points[0]))
+        H = np.random.uniform(0, 2 * math.sqrt(np.mean(W) / k), size=(n_points, k)).tolist()
+        start = time.perf_counter()
+        H = mysymnmf.symnmf(H, W, n_points, k)
+    seconds = time.perf_counter() - start
+    for row in H:
+        print(",".join("%.4f" % value for value in row))
+    with open(timing_file, "w") as file:
+        file.write("{!r} {!r}".format(seconds, peak_rss(os.getpid()) - resident))
+
+
+# differences below these are noise on short runs and never flagged
+REGRESS_MIN_SECONDS = 0.02
+REGRESS_MIN_MB = 2.0
+
+
+# whether a measurement grew beyond the relative threshold and the noise floor
+def grew(new, old, threshold, floor):
+    return new is not None and old is not None and new > old * (1 + threshold) and new - old > floor
+
+
+# flags of one (goal, n) row: output mismatch, current slower than previous, regression against baseline
+def regress_flags(row, baseline, threshold):
+    flags = []
+    current, previous = row["current"], row["previous"]
+    if row["deviation"] is None and current["status"] == previous["status"] == "ok":
+        flags.append("SHAPE")
+    elif row["deviation"] is not None and row["deviation"] > 1.5e-4:
+        flags.append("MISMATCH")
+    if current["status"] != "ok":
+        flags.append(current["status"].upper())
+    elif previous["status"] == "ok" and grew(current["seconds"], previous["seconds"], threshold,
+                                            REGRESS_MIN_SECONDS):
+        flags.append("SLOWER-THAN-PREV")
+    base = baseline.get((row["goal"], row["n"]))
+    if base is not None and current["status"] == "timeout" and base["status"] == "ok":
+        flags.append("TIME-REGRESSION")
+    if base is not None and current["status"] == "ok" and base["status"] == "ok":
+        if grew(current["seconds"], base["seconds"], threshold, REGRESS_MIN_SECONDS):
+            flags.append("TIME-REGRESSION")
+        if grew(current["rss_mb"], base["rss_mb"], threshold, REGRESS_MIN_MB):
+            flags.append("RSS-REGRESSION")
+    return flags
+
+
+# current against Prev_final_100 over a size sweep: wall time, peak RSS and output deviation per
+# goal, flagged against a stored baseline; returns 1 when anything regressed
+def bench_regress(sizes, goals, k, dim, repeats, timeout, threshold, baseline_file, json_file):
+    here = os.path.dirname(os.path.abspath(__file__))
+    folder = tempfile.mkdtemp()
+    build_previous(folder)
+    env = dict(os.environ, PYTHONPATH=folder)
+    timing_file = os.path.join(folder, "solve_seconds.txt")
+    baseline = {}
+    if baseline_file is not None and os.path.exists(baseline_file):
+        with open(baseline_file) as file:
+            baseline = {(row["goal"], row["n"]): row["current"] for row in json.load(file)["rows"]}
+
+    rows = []
+    for n_points in sizes:
+        file_name = os.path.join(folder, "input_{}.txt".format(n_points))
+        generate(n_points, dim, file_name)
+        for goal in goals:
+            row = {"goal": goal, "n": n_points}
+            outputs = {}
+            for name, args in regress_commands(goal, k, file_name, folder, timing_file).items():
+                outputs[name] = os.path.join(folder, "{}_{}.txt".format(name, goal))
+                runs = []
+                for _ in range(repeats):
+                    runs.append(measured_run(args, outputs[name], timeout, env if name == "previous" else None))
+                    if runs[-1][0] != "ok":
+                        break
+                    # symnmf is compared on what regress_solve measured inside the process
+                    if goal == "symnmf":
+                        with open(timing_file) as file:
+                            runs[-1] = (runs[-1][0],) + tuple(float(x) for x in file.read().split())
+                # fastest run against the largest peak seen
+                status = runs[-1][0]
+                peaks = [run[2] for run in runs if run[2] is not None]
+                row[name] = {"status": status, "seconds": min(run[1] for run in runs),
+                             "rss_mb": max(peaks) if peaks else None}
+            ok = row["current"]["status"] == row["previous"]["status"] == "ok"
+            row["deviation"] = max_deviation(outputs["current"], outputs["previous"]) if ok else None
+            row["flags"] = regress_flags(row, baseline, threshold)
+            rows.append(row)
+            for output in outputs.values():
+                os.remove(output)
+        os.remove(file_name)
+
+    print("{:>7} {:>6} {:>10} {:>10} {:>9} {:>9} {:>9}  {}".format(
+        "goal", "n", "current s", "prev s", "cur MB", "prev MB", "max dev", "flags"))
+    def seconds(run):
+        return "{:.3f}".format(run["seconds"]) if run["status"] == "ok" else run["status"]
+
+    def megabytes(run):
+        return "-" if run["rss_mb"] is None else "{:.1f}".format(run["rss_mb"])
+
+    for row in rows:
+        print("{:>7} {:>6} {:>10} {:>10} {:>9} {:>9} {:>9}  {}".format(
+            row["goal"], row["n"], seconds(row["current"]), seconds(row["previous"]), megabytes(row["current"]),
+            megabytes(row["previous"]), "-" if row["deviation"] is None else "{:.1e}".format(row["deviation"]),
+            " ".join(row["flags"])))
+
+    report = {"k": k, "dim": dim, "repeats": repeats, "threshold": threshold, "rows": rows}
+    if json_file is not None:
+        with open(json_file, "w") as file:
+            json.dump(report, file, indent=2)
+    regressed = any(flag in ("MISMATCH", "SHAPE", "ERROR", "TIME-REGRESSION", "RSS-REGRESSION")
+                    for row in rows for flag in row["flags"])
+    return 1 if regressed else 0
+
+
+# mini-batch epochs followed by full iterations against full iterations only, for several batch sizes
+def bench_stochastic(k, file_name, batches, epochs):
+    points = read_points(file_name)
+    n_points = len(points)
+    W = mysymnmf.norm(points, n_points, len(points[0]))
+    H0 = initial_H(np.mean(W), n_points, k)
+
+    print("{:>8} {:>8} {:>8} {:>10} {:>12} {:>9}".format("batch", "steps", "iters", "solve s", "objective", "ARI"))
+    full_H, full_info, full_time = timed_solve(H0, W, n_points, k)
+    full_labels = labels_of(full_H, n_points, k)
+    print("{:>8} {:>8} {:>8} {:>10.4f} {:>12.6f} {:>9.4f}".format(
+        "full", "-", full_info["iterations"], full_time, mysymnmf.objective(W, full_H, n_points, k), 1.0))
+    for batch in batches:
+        start = time.perf_counter()
+        H, info = mysymnmf.solve(H0, W, n_points, k, batch=batch, epochs=epochs)
+        solve_time = time.perf_counter() - start
+        print("{:>8} {:>8} {:>8} {:>10.4f} {:>12.6f} {:>9.4f}".format(
+            batch, info["stochastic_steps"], info["iterations"], solve_time, mysymnmf.objective(W, H, n_points, k),
+            sk.adjusted_rand_score(full_labels, labels_of(H, n_points, k))))
+
+
+# time and peak RSS of a goal printed whole against streamed with --rows, for the C and Python CLIs,
+# checking both print the same matrix
+def bench_rows(goal, sizes, dim=5, timeout=600):
+    here = os.path.dirname(os.path.abspath(__file__))
+    print("{:>8} {:>8} {:>10} {:>10} {:>10} {:>10} {:>9}".format(
+        "n", "cli", "whole s", "whole MB", "rows s", "rows MB", "same"))
+    with tempfile.TemporaryDirectory() as folder:
+        for n_points in sizes:
+            input_file = os.path.join(folder, "points_{}.txt".format(n_points))
+            generate(n_points, dim, input_file)
+            for cli, args in (("c", [os.path.join(here, "symnmf"), goal, input_file]),
+                              ("python", [sys.executable, os.path.join(here, "symnmf.py"), "2", goal, input_file])):
+                whole_file, rows_file = os.path.join(folder, "whole.txt"), os.path.join(folder, "rows.txt")
+                whole = measured_run(args, whole_file, timeout)
+                rows = measured_run(args + ["--rows"], rows_file, timeout)
+                same = whole[0] == rows[0] == "ok" and max_deviation(whole_file, rows_file) == 0.0
+                print("{:>8} {:>8} {:>10.3f} {:>10.1f} {:>10.3f} {:>10.1f} {:>9}".format(
+                    n_points, cli, whole[1], whole[2] or 0.0, rows[1], rows[2] or 0.0, "yes" if same else "NO"))
+
+
+# time and peak RSS of the C CLI run as a pipeline against its --sequential stages, for each goal,
+# checking both print the same bytes
+def bench_pipeline(goals, sizes, threads, dim=5, timeout=600):
+    here = os.path.dirname(os.path.abspath(__file__))
+    print("{:>8} {:>6} {:>8} {:>12} {:>12} {:>10} {:>10} {:>9}".format(
+        "n", "goal", "threads", "sequential s", "pipeline s", "seq MB", "pipe MB", "same"))
+    with tempfile.TemporaryDirectory() as folder:
+        for n_points in sizes:
+            input_file = os.path.join(folder, "points_{}.txt".format(n_points))
+            generate(n_points, dim, input_file)
+            for goal in goals:
+                args = [os.path.join(here, "symnmf"), goal, input_file, "--threads={}".format(threads)]
+                sequential_file, pipeline_file = os.path.join(folder, "seq.txt"), os.path.join(folder, "pipe.txt")
+                sequential = measured_run(args + ["--sequential"], sequential_file, timeout)
+                pipelined = measured_run(args, pipeline_file, timeout)
+                same = sequential[0] == pipelined[0] == "ok" and filecmp.cmp(sequential_file, pipeline_file, shallow=False)
+                print("{:>8} {:>6} {:>8} {:>12.3f} {:>12.3f} {:>10.1f} {:>10.1f} {:>9}".format(
+                    n_points, goal, threads, sequential[1], pipelined[1], sequential[2] or 0.0,
+                    pipelined[2] or 0.0, "yes" if same else "NO"))
+
+
+# bytes of W streamed per second by the W*H passes of a profiled CLI run, from its calc stage
+def product_throughput(args, n_points, timeout):
+    run = subprocess.run(args + ["--profile"], stdout=subprocess.DEVNULL, stderr=subprocess.PIPE,
+                         timeout=timeout, text=True)
+    calc = json.loads(run.stderr)["stages"]["calc"]
+    return calc["calls"] * n_points * n_points * 8 / calc["seconds"] / 1e9 if calc["seconds"] > 0 else 0.0
+
+
+# symnmf of the C CLI with W in memory against W out of core in a scratch file (--memory, --scratch):
+# time, peak RSS and the throughput of the W*H passes, checking both print the same H. The scratch
+# directory should be on the device to measure (NVMe); the page cache still holds what fits in it
+def bench_outofcore(k, sizes, memory, scratch, threads, dim=5, timeout=3600):
+    here = os.path.dirname(os.path.abspath(__file__))
+    print("{:>8} {:>10} {:>10} {:>10} {:>10} {:>10} {:>9}".format(
+        "n", "mode", "W MB", "time s", "peak MB", "W*H GB/s", "same"))
+    with tempfile.TemporaryDirectory(dir=scratch) as folder:
+        for n_points in sizes:
+            input_file = os.path.join(folder, "points_{}.txt".format(n_points))
+            generate(n_points, dim, input_file)
+            args = [os.path.join(here, "symnmf"), "symnmf", input_file, "--k={}".format(k),
+                    "--threads={}".format(threads)]
+            modes = (("memory", args), ("outofcore", args + ["--memory={}".format(memory), "--scratch=" + folder]))
+            outputs = []
+            for mode, mode_args in modes:
+                output_file = os.path.join(folder, mode + ".txt")
+                status, seconds, peak = measured_run(mode_args, output_file, timeout)
+                outputs.append(output_file if status == "ok" else None)
+                print("{:>8} {:>10} {:>10.1f} {:>10.3f} {:>10.1f} {:>10.2f} {:>9}".format(
+                    n_points, mode, n_points * n_points * 8 / 1e6, seconds, peak or 0.0,
+                    product_throughput(mode_args, n_points, timeout) if status == "ok" else 0.0,
+                    "-" if mode == "memory" else "yes" if None not in outputs and filecmp.cmp(*outputs, shallow=False) else "NO"))
+
+
+# n points of dimension d drawn around a few random centers, and the center of each
+def clustered_points(n_points, dim, clusters=5):
+    rng = np.random.default_rng(0)
+    centers = rng.uniform(-5, 5, size=(clusters, dim))
+    truth = rng.integers(clusters, size=n_points)
+    return centers[truth] + rng.normal(size=(n_points, dim)), truth
+
+
+# write n points of dimension d drawn around a few random centers, in the input file format
+def generate(n_points, dim, file_name, clusters=5):
+    points, _ = clustered_points(n_points, dim, clusters)
+    np.savetxt(file_name, points, fmt="%.4f", delimiter=",")
+
+
+# multilevel symnmf on the nearest neighbour graph against the dense exact solver, which only runs
+# while its n x n matrix stays small; ARI is against the generating centers
+def bench_multilevel(k, sizes, dim=5, exact_limit=4000):
+    print("{:>8} {:>10} {:>8} {:>10} {:>12} {:>9} {:>9} {:>8} {}".format(
+        "n", "solver", "iters", "time s", "objective", "ARI", "ARI exact", "knn", "levels"))
+    for n_points in sizes:
+        points, truth = clustered_points(n_points, dim, k)
+        points = points.tolist()
+        start = time.perf_counter()
+        H, info = mysymnmf.multilevel(points, n_points, dim, k)
+        multilevel_time = time.perf_counter() - start
+        labels = labels_of(H, n_points, k)
+        objective, exact_labels = float("nan"), None
+
+        if n_points <= exact_limit:
+            start = time.perf_counter()
+            W = mysymnmf.norm(points, n_points, dim)
+            exact_H, exact_info, _ = timed_solve(initial_H(np.mean(W), n_points, k), W, n_points, k)
+            exact_time = time.perf_counter() - start
+            exact_labels = labels_of(exact_H, n_points, k)
+            objective = mysymnmf.objective(W, H, n_points, k)
+            print("{:>8} {:>10} {:>8} {:>10.3f} {:>12.6f} {:>9.4f} {:>9}".format(
+                n_points, "exact", exact_info["iterations"], exact_time, mysymnmf.objective(W, exact_H, n_points, k),
+                sk.adjusted_rand_score(truth, exact_labels), "-"))
+        print("{:>8} {:>10} {:>8} {:>10.3f} {:>12.6f} {:>9.4f} {:>9} {:>8} {}".format(
+            n_points, "multilevel", "{}+{}".format(info["coarsest_iterations"], info["refine_iterations"]),
+            multilevel_time, objective, sk.adjusted_rand_score(truth, labels),
+            "-" if exact_labels is None else "{:.4f}".format(sk.adjusted_rand_score(exact_labels, labels)),
+            info["knn"], "/".join(str(size) for size in info["levels"])))
+
+
+# nearest neighbour graphs by KD-tree and NN-descent against brute force, which only runs (and
+# gives the recall) up to brute_limit points
+def bench_knn(dims, sizes, neighbors=32, brute_limit=20000):
+    print("{:>8} {:>4} {:>8} {:>10} {:>10} {:>8}".format("n", "d", "method", "time s", "brute s", "recall"))
+    for dim in dims:
+        for n_points in sizes:
+            points, _ = clustered_points(n_points, dim, 8)
+            points = points.tolist()
+            for method in ("kdtree", "descent"):
+                _, info = mysymnmf.knn(points, n_points, dim, neighbors, method=method,
+                                       recall=n_points <= brute_limit)
+                print("{:>8} {:>4} {:>8} {:>10.3f} {:>10} {:>8}".format(
+                    n_points, dim, method, info["seconds"],
+                    "{:.3f}".format(info["brute_seconds"]) if "recall" in info else "-",
+                    "{:.4f}".format(info["recall"]) if "recall" in info else "-"))
+
+
+USAGE = """usage: python3 benchmark.py <command> ...
+  sketch <k> <file> [r1,r2,...]   randomized sketch against the exact solver
+  quantize <k> <file> [f1,f2,...] [threads]
+                                  16- and 8-bit storage of W against doubles: error, labels and time
+  hierarchy <file> [max k]        labels for every k read off one rank-2 cluster tree against one solve per k
+  refit <k> <file> [fraction]     warm-started refit against a cold fit of all points
+  init <k> <file> [file ...]      iterations to convergence from random, spectral and k-means++ H
+  stochastic <k> <file> [b1,b2,...] [epochs]
+                                  mini-batch epochs then full iterations against full iterations
+  outofcore <k> [n1,n2,...] [memory MB] [scratch dir] [threads]
+                                  symnmf with W out of core against W in memory: time, RSS, W*H throughput
+  rows <goal> [n1,n2,...]         peak memory of a goal printed whole against streamed with --rows
+  pipeline [g1,g2,...] [n1,n2,...] [threads]
+                                  the C CLI pipelined against its --sequential stages: time and memory
+  multilevel <k> [n1,n2,...]      multilevel symnmf on the kNN graph against the dense solver
+  knn [d1,d2,...] [n1,n2,...]     kNN graph by KD-tree and NN-descent: time and recall against brute force
+  generate <n> <d> <file>         write a clustered input file of n points of dimension d
+  daemon <k> <goal> <file> [runs] symnmfd with a warm cache against the cold CLI paths
+  daemon-check                    symnmfd against the CLI on inputs its cache must tell apart
+  batch <goal> [threads] [small] [large]
+                                  one batch process against one process per job
+  regress [--sizes=N,..] [--goals=G,..] [--k=K] [--dim=D] [--repeats=R] [--timeout=S] [--threshold=T]
+          [--baseline=FILE] [--json=FILE]
+                                  current against Prev_final_100: time, peak RSS and deviation,
+                                  flagged against a baseline (a previous --json report); symnmf
+                                  is timed around the solver call of each extension"""
+
+
+def main():
+    command = sys.argv[1] if len(sys.argv) > 1 else ""
+    args = sys.argv[2:]
+
+    if command == "sketch" and len(args) >= 2:
+        ranks = [int(r) for r in args[2].split(",")] if len(args) > 2 else [2, 4, 8, 16, 32]
+        bench_sketch(int(args[0]), args[1], ranks)
+    elif command == "quantize" and len(args) >= 2:
+        formats = args[2].split(",") if len(args) > 2 else ["fixed16", "bf16", "int8"]
+        bench_quantize(int(args[0]), args[1], formats, int(args[3]) if len(args) > 3 else 0)
+    elif command == "hierarchy" and len(args) >= 1:
+        bench_hierarchy(args[0], int(args[1]) if len(args) > 1 else 10)
+    elif command == "refit" and len(args) >= 2:
+        bench_refit(int(args[0]), args[1], float(args[2]) if len(args) > 2 else 0.05)
+    elif command == "init" and len(args) >= 2:
+        bench_init(int(args[0]), args[1:])
+    elif command == "stochastic" and len(args) >= 2:
+        batches = [int(b) for b in args[2].split(",")] if len(args) > 2 else [64, 256, 1024]
+        bench_stochastic(int(args[0]), args[1], batches, int(args[3]) if len(args) > 3 else 10)
+    elif command == "rows" and len(args) >= 1:
+        bench_rows(args[0], [int(n) for n in args[1].split(",")] if len(args) > 1 else [1000, 4000])
+    elif command == "outofcore" and len(args) >= 1:
+        sizes = [int(n) for n in args[1].split(",")] if len(args) > 1 else [4000, 12000]
+        bench_outofcore(int(args[0]), sizes, int(args[2]) if len(args) > 2 else 64, args[3] if len(args) > 3 else None,
+                        int(args[4]) if len(args) > 4 else os.cpu_count() or 1)
+    elif command == "pipeline":
+        goals = args[0].split(",") if len(args) > 0 else ["sym", "ddg", "norm"]
+        sizes = [int(n) for n in args[1].split(",")] if len(args) > 1 else [1000, 5000]
+        bench_pipeline(goals, sizes, int(args[2]) if len(args) > 2 else os.cpu_count() or 1)
+    elif command == "multilevel" and len(args) >= 1:
+        sizes = [int(n) for n in args[1].split(",")] if len(args) > 1 else [1000, 4000, 20000]
+        bench_multilevel(int(args[0]), sizes)
+    elif command == "knn":
+        dims = [int(d) for d in args[0].split(",")] if len(args) > 0 else [2, 5, 16, 32]
+        bench_knn(dims, [int(n) for n in args[1].split(",")] if len(args) > 1 else [5000, 20000])
+    elif command == "generate" and len(args) == 3:
+        generate(int(args[0]), int(args[1]), args[2])
+    elif command == "daemon" and len(args) >= 3:
+        bench_daemon(int(args[0]), args[1], args[2], int(args[3]) if len(args) > 3 else 20)
+    elif command == "daemon-check":
+        sys.exit(check_daemon())
+    elif command == "batch" and len(args) >= 1:
+        counts = [int(a) for a in args[1:4]] + [0, 200, 4][len(args) - 1:]
+        bench_batch(args[0], counts[0], counts[1], counts[2])
+    elif command == "regress-solve" and len(args) == 4:
+        regress_solve(args[0], int(args[1]), args[2], args[3])
+    elif command == "regress":
+        options = dict(arg[2:].split("=", 1) for arg in args if arg.startswith("--") and "=" in arg)
+        sys.exit(bench_regress([int(n) for n in options.get("sizes", "250,1000,4000,20000").split(",")],
+                               options.get("goals", "sym,ddg,norm,symnmf").split(","),
+                               int(options.get("k", 5)), int(options.get("dim", 5)), int(options.get("repeats", 3)),
+                               float(options.get("timeout", 600)), float(options.get("threshold", 0.2)),
+                               options.get("baseline"), options.get("json")))
+    else:
+        print(USAGE)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,249 @@
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "symnmf.h"
+#include "checkpoint.h"
+
+/* file signature and format version of checkpoints */
+#define CHECKPOINT_MAGIC "SNCK"
+#define CHECKPOINT_VERSION 1
+
+struct checkpoint_writer
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char *file_name;
+    char *temp_name;
+    int n;
+    int k;
+    unsigned long fingerprint;
+    /* snapshot owned by the writer while busy is set */
+    double *H;
+    double *history;
+    int iteration;
+    int done;
+    int pending;
+    int busy;
+    int stop;
+    int failed;
+};
+
+/* Helper function to mix bytes into a 32-bit FNV-1a hash */
+static unsigned long fnv1a(unsigned long hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    size_t i;
+    for (i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash = (hash * 16777619UL) & 0xffffffffUL;
+    }
+    return hash;
+}
+
+/* function to calculate a fingerprint of the matrix behind an affinity operator, hashing W
+   applied to a fixed probe vector so that it works for dense and factorized forms alike */
+unsigned long affinity_fingerprint(affinity_op *op, int n, int k)
+{
+    double **probe = initialize_matrix(n, 1);
+    double **product;
+    unsigned long hash = 2166136261UL;
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        probe[i][0] = 1.0 + (i % 7) / 7.0;
+    }
+    product = op->multiply(op->data, probe, n, 1);
+    hash = fnv1a(hash, &n, sizeof(n));
+    hash = fnv1a(hash, &k, sizeof(k));
+    for (i = 0; i < n; i++)
+    {
+        hash = fnv1a(hash, &product[i][0], sizeof(double));
+    }
+    free_matrix(probe, n);
+    free_matrix(product, n);
+    return hash;
+}
+
+/* Helper function to write the current snapshot to a temporary file and move it into place */
+static int write_snapshot(checkpoint_writer *writer)
+{
+    FILE *file = fopen(writer->temp_name, "wb");
+    int header[6];
+    size_t cells = (size_t)writer->n * writer->k;
+    int failed;
+
+    if (!file)
+    {
+        return 1;
+    }
+    header[0] = CHECKPOINT_VERSION;
+    header[1] = writer->n;
+    header[2] = writer->k;
+    header[3] = writer->iteration;
+    header[4] = writer->done;
+    header[5] = 0;
+
+    failed = fwrite(CHECKPOINT_MAGIC, 1, 4, file) != 4 || fwrite(header, sizeof(int), 6, file) != 6;
+    failed = failed || fwrite(&writer->fingerprint, sizeof(unsigned long), 1, file) != 1;
+    failed = failed || fwrite(writer->history, sizeof(double), writer->iteration, file) != (size_t)writer->iteration;
+    failed = failed || fwrite(writer->H, sizeof(double), cells, file) != cells;
+    failed = fclose(file) != 0 || failed;
+    /* rename is atomic, a crash mid-write leaves the previous checkpoint intact */
+    return failed || rename(writer->temp_name, writer->file_name) != 0;
+}
+
+/* body of the writer thread: write snapshots as they arrive until asked to stop */
+static void *writer_main(void *arg)
+{
+    checkpoint_writer *writer = (checkpoint_writer *)arg;
+
+    pthread_mutex_lock(&writer->lock);
+    for (;;)
+    {
+        while (!writer->pending && !writer->stop)
+        {
+            pthread_cond_wait(&writer->cond, &writer->lock);
+        }
+        if (!writer->pending)
+        {
+            break;
+        }
+        writer->pending = 0;
+        writer->busy = 1;
+        pthread_mutex_unlock(&writer->lock);
+
+        if (write_snapshot(writer))
+        {
+            writer->failed = 1;
+        }
+
+        pthread_mutex_lock(&writer->lock);
+        writer->busy = 0;
+        pthread_cond_broadcast(&writer->cond);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+/* function to start a writer thread for checkpoints of an n x k H */
+checkpoint_writer *checkpoint_open(const char *file_name, int n, int k, int max_iter, unsigned long fingerprint)
+{
+    checkpoint_writer *writer = (checkpoint_writer *)calloc(1, sizeof(checkpoint_writer));
+
+    writer->file_name = (char *)malloc(strlen(file_name) + 1);
+    strcpy(writer->file_name, file_name);
+    writer->temp_name = (char *)malloc(strlen(file_name) + 5);
+    sprintf(writer->temp_name, "%s.tmp", file_name);
+    writer->n = n;
+    writer->k = k;
+    writer->fingerprint = fingerprint;
+    writer->H = (double *)malloc((size_t)n * k * sizeof(double));
+    writer->history = (double *)malloc((max_iter > 0 ? max_iter : 1) * sizeof(double));
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+    if (pthread_create(&writer->thread, NULL, writer_main, writer) != 0)
+    {
+        pthread_mutex_destroy(&writer->lock);
+        pthread_cond_destroy(&writer->cond);
+        free(writer->file_name);
+        free(writer->temp_name);
+        free(writer->H);
+        free(writer->history);
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+/* function to hand a snapshot to the writer, dropped when the writer is still busy unless wait is set */
+void checkpoint_submit(checkpoint_writer *writer, double **H, int iteration, const double *history, int done, int wait)
+{
+    int i;
+
+    pthread_mutex_lock(&writer->lock);
+    while (wait && (writer->busy || writer->pending))
+    {
+        pthread_cond_wait(&writer->cond, &writer->lock);
+    }
+    if (writer->busy)
+    {
+        pthread_mutex_unlock(&writer->lock);
+        return;
+    }
+
+    /* an O(n*k) copy is all the hot loop pays, the file is written by the thread */
+    for (i = 0; i < writer->n; i++)
+    {
+        memcpy(writer->H + (size_t)i * writer->k, H[i], writer->k * sizeof(double));
+    }
+    memcpy(writer->history, history, iteration * sizeof(double));
+    writer->iteration = iteration;
+    writer->done = done;
+    writer->pending = 1;
+    pthread_cond_signal(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+/* function to wait for the last snapshot and stop the writer, returns 0 when every write succeeded */
+int checkpoint_close(checkpoint_writer *writer)
+{
+    int failed;
+
+    pthread_mutex_lock(&writer->lock);
+    writer->stop = 1;
+    pthread_cond_signal(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+
+    failed = writer->failed;
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->cond);
+    free(writer->file_name);
+    free(writer->temp_name);
+    free(writer->H);
+    free(writer->history);
+    free(writer);
+    return failed;
+}
+
+/* function to read a checkpoint into H and history, returns 0 on success, 1 when there is no
+   checkpoint file and -1 when it does not belong to this n, k and fingerprint */
+int checkpoint_load(const char *file_name, int n, int k, int max_iter, unsigned long fingerprint,
+                    double **H, int *iteration, double *history, int *done)
+{
+    FILE *file = fopen(file_name, "rb");
+    char magic[4];
+    int header[6];
+    unsigned long stored;
+    int i, failed;
+
+    if (!file)
+    {
+        return 1;
+    }
+    failed = fread(magic, 1, 4, file) != 4 || memcmp(magic, CHECKPOINT_MAGIC, 4) != 0;
+    failed = failed || fread(header, sizeof(int), 6, file) != 6 || header[0] != CHECKPOINT_VERSION;
+    failed = failed || fread(&stored, sizeof(unsigned long), 1, file) != 1;
+    failed = failed || header[1] != n || header[2] != k || stored != fingerprint;
+    failed = failed || header[3] < 0 || header[3] > max_iter;
+    failed = failed || fread(history, sizeof(double), header[3], file) != (size_t)header[3];
+    for (i = 0; i < n && !failed; i++)
+    {
+        failed = fread(H[i], sizeof(double), k, file) != (size_t)k;
+    }
+    fclose(file);
+    if (failed)
+    {
+        return -1;
+    }
+
+    *iteration = header[3];
+    *done = header[4];
+    return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "symnmf.h"
+
+/* Background writer of symnmf checkpoints */
+typedef struct checkpoint_writer checkpoint_writer;
+
+/* Function to calculate a fingerprint of the matrix behind an affinity operator */
+unsigned long affinity_fingerprint(affinity_op *op, int n, int k);
+
+/* Function to start a writer thread for checkpoints of an n x k H */
+checkpoint_writer *checkpoint_open(const char *file_name, int n, int k, int max_iter, unsigned long fingerprint);
+
+/* Function to hand a snapshot to the writer: H before iteration "iteration", the deltas of the
+   iterations done so far and whether H is already the final result. Unless wait is set, the
+   snapshot is dropped when the previous one is still being written, so the caller never stalls */
+void checkpoint_submit(checkpoint_writer *writer, double **H, int iteration, const double *history, int done, int wait);
+
+/* Function to wait for the last snapshot and stop the writer, returns 0 when every write succeeded */
+int checkpoint_close(checkpoint_writer *writer);
+
+/* Function to read a checkpoint into H and history, returns 0 on success, 1 when there is no
+   checkpoint file and -1 when it does not belong to this n, k and fingerprint */
+int checkpoint_load(const char *file_name, int n, int k, int max_iter, unsigned long fingerprint,
+                    double **H, int *iteration, double *history, int *done);
+
+#endif /* CHECKPOINT_H */
@@ -0,0 +1,65 @@
+import socket
+import struct
+import sys
+
+
+# error answered by the daemon, carrying its message
+class DaemonError(Exception):
+    pass
+
+
+# send one request line (and optional binary payload) to the daemon and return the answer body
+def request(socket_path, line, payload=b""):
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as conn:
+        conn.connect(socket_path)
+        conn.sendall(line.encode() + b"\n" + payload)
+        reader = conn.makefile("rb")
+        status = reader.readline().decode().rstrip("\n")
+        if status.startswith("ERR"):
+            raise DaemonError(status[4:])
+        if not status.startswith("OK "):
+            raise DaemonError("bad answer: " + status)
+        return reader.read(int(status[3:])).decode()
+
+
+# run a goal on a file the daemon can read, returning the text the CLI would print
+def run_file(socket_path, goal, k, file_name):
+    return request(socket_path, "FILE {} {} {}".format(goal, k, file_name))
+
+
+# run a goal on points sent inline as native doubles
+def run_points(socket_path, goal, k, points):
+    n_points, dim = len(points), len(points[0])
+    payload = b"".join(struct.pack("={}d".format(dim), *row) for row in points)
+    return request(socket_path, "DATA {} {} {} {}".format(goal, k, n_points, dim), payload)
+
+
+# cache counters of the daemon
+def stats(socket_path):
+    return request(socket_path, "STATS")
+
+
+def shutdown(socket_path):
+    request(socket_path, "SHUTDOWN")
+
+
+def main():
+    # same arguments as symnmf.py, with the daemon socket in front
+    args = sys.argv[1:]
+    if len(args) == 2 and args[1] == "stats":
+        print(stats(args[0]), end="")
+    elif len(args) == 2 and args[1] == "shutdown":
+        shutdown(args[0])
+    elif len(args) == 4:
+        try:
+            print(run_file(args[0], args[2], int(args[1]), args[3]), end="")
+        except (DaemonError, OSError, ValueError):
+            print("An Error Has Occurred")
+            sys.exit(1)
+    else:
+        print("usage: python3 client.py <socket> <k> <goal> <file> | <socket> stats | <socket> shutdown")
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
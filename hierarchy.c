@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include "symnmf.h"
+#include "rng.h"
+#include "hierarchy.h"
+
+/* iterations of a rank-2 solve, as the full symnmf */
+#define RANK2_MAX_ITER 300
+
+/*
+ * Reading the labels for every k off one tree replaces a full O(n^2 k) solve per candidate k. A
+ * split only solves the submatrix of W on the points of one cluster with k = 2: the Gram matrix
+ * H^T H is three sums, (H H^T H)_i follows from it in four products, and a W*H pass keeps the two
+ * entries of a row of H next to each other and both sums in registers. The splits of a level of
+ * the tree together touch each entry of W at most once per iteration, and the levels below work on
+ * ever smaller blocks.
+ */
+
+/* Helper function to draw the starting h of a rank-2 solve like initial_H of symnmf.py, uniform in
+   [0, 2 * sqrt(mean / 2)), the two entries of a row next to each other */
+static void rank2_start(double **S, int m, rng_state *rng, double *h)
+{
+    double sum = 0.0, high;
+    int t, u;
+
+    for (t = 0; t < m; t++)
+    {
+        for (u = 0; u < m; u++)
+        {
+            sum += S[t][u];
+        }
+    }
+    high = 2.0 * sqrt(sum / ((double)m * m) / 2.0);
+    for (t = 0; t < 2 * m; t++)
+    {
+        h[t] = high * rng_uniform(rng);
+    }
+}
+
+/* Helper function to run the rank-2 multiplicative updates on the m x m matrix S from h, returning
+   the iterations run; h holds the last iterate */
+static int rank2_solve(double **S, int m, double *h)
+{
+    double *next = (double *)malloc(2 * m * sizeof(double)), *swap;
+    double g00, g01, g11, delta, wh0, wh1, d0, d1, h0, h1;
+    int iter, t, u;
+
+    for (iter = 1; iter <= RANK2_MAX_ITER; iter++)
+    {
+        g00 = g01 = g11 = 0.0;
+        for (t = 0; t < m; t++)
+        {
+            g00 += h[2 * t] * h[2 * t];
+            g01 += h[2 * t] * h[2 * t + 1];
+            g11 += h[2 * t + 1] * h[2 * t + 1];
+        }
+        delta = 0.0;
+        for (t = 0; t < m; t++)
+        {
+            const double *row = S[t];
+            wh0 = wh1 = 0.0;
+            for (u = 0; u < m; u++)
+            {
+                wh0 += row[u] * h[2 * u];
+                wh1 += row[u] * h[2 * u + 1];
+            }
+            h0 = h[2 * t];
+            h1 = h[2 * t + 1];
+            d0 = h0 * g00 + h1 * g01;
+            d1 = h0 * g01 + h1 * g11;
+            /* a row or a column that reached zero stays there instead of becoming NaN */
+            next[2 * t] = d0 > 0.0 ? h0 * (0.5 + 0.5 * (wh0 / d0)) : 0.0;
+            next[2 * t + 1] = d1 > 0.0 ? h1 * (0.5 + 0.5 * (wh1 / d1)) : 0.0;
+            delta += (next[2 * t] - h0) * (next[2 * t] - h0) + (next[2 * t + 1] - h1) * (next[2 * t + 1] - h1);
+        }
+        swap = h;
+        h = next;
+        next = swap;
+        if (delta < EPSILON)
+        {
+            break;
+        }
+    }
+    /* after an odd number of swaps the last iterate is in the caller's scratch buffer */
+    if (iter > RANK2_MAX_ITER)
+    {
+        iter = RANK2_MAX_ITER;
+    }
+    if (iter % 2 == 1)
+    {
+        memcpy(next, h, 2 * m * sizeof(double));
+        free(h);
+    }
+    else
+    {
+        free(next);
+    }
+    return iter;
+}
+
+/* Helper function to propose the split of a leaf: solve the submatrix of W on its points with k = 2,
+   move the points of the first column to the front of its range and score the split by its
+   normalized cut */
+static void propose_split(cluster_tree *tree, double **W, int id, rng_state *rng)
+{
+    cluster_node *node = &tree->nodes[id];
+    int m = node->size, *members = tree->members + node->first, *order, t, u, left = 0;
+    double **S, *h, volume[2], cut = 0.0;
+    char *right;
+
+    node->ncut = HUGE_VAL;
+    node->left_size = 0;
+    if (m < HIERARCHY_MIN_SIZE)
+    {
+        return;
+    }
+    /* the root of a fresh tree is W itself */
+    S = m == tree->n && id == 0 ? W : initialize_matrix(m, m);
+    if (S != W)
+    {
+        for (t = 0; t < m; t++)
+        {
+            for (u = 0; u < m; u++)
+            {
+                S[t][u] = W[members[t]][members[u]];
+            }
+        }
+    }
+    h = (double *)malloc(2 * m * sizeof(double));
+    rank2_start(S, m, rng, h);
+    node->iterations = rank2_solve(S, m, h);
+    tree->iterations += node->iterations;
+
+    /* argmax of each row, ties going to the first column as in analysisc */
+    right = (char *)malloc(m);
+    for (t = 0; t < m; t++)
+    {
+        right[t] = h[2 * t + 1] > h[2 * t];
+        left += !right[t];
+    }
+    volume[0] = volume[1] = 0.0;
+    for (t = 0; t < m; t++)
+    {
+        for (u = 0; u < m; u++)
+        {
+            volume[(int)right[t]] += S[t][u];
+            cut += right[t] != right[u] ? S[t][u] : 0.0;
+        }
+    }
+    /* cut counted both ways above */
+    cut /= 2.0;
+    if (left > 0 && left < m && volume[0] > 0.0 && volume[1] > 0.0)
+    {
+        node->ncut = cut / volume[0] + cut / volume[1];
+        node->left_size = left;
+        order = (int *)malloc(m * sizeof(int));
+        for (t = 0, u = 0; t < m; t++)
+        {
+            if (!right[t])
+            {
+                order[u++] = members[t];
+            }
+        }
+        for (t = 0; t < m; t++)
+        {
+            if (right[t])
+            {
+                order[u++] = members[t];
+            }
+        }
+        memcpy(members, order, m * sizeof(int));
+        free(order);
+    }
+    if (S != W)
+    {
+        free_matrix(S, m);
+    }
+    free(right);
+    free(h);
+}
+
+/* Helper function to add a leaf over members[first .. first + size - 1] */
+static int add_node(cluster_tree *tree, int first, int size, int parent)
+{
+    cluster_node *node = &tree->nodes[tree->count];
+
+    node->first = first;
+    node->size = size;
+    node->parent = parent;
+    node->left = node->right = -1;
+    node->left_size = 0;
+    node->ncut = HUGE_VAL;
+    node->created = tree->num_splits;
+    node->split = -1;
+    node->iterations = 0;
+    return tree->count++;
+}
+
+/* function to grow a cluster tree of W up to max_k leaves */
+cluster_tree *hierarchy_build(double **W, int n, int max_k, unsigned long seed)
+{
+    cluster_tree *tree = (cluster_tree *)malloc(sizeof(cluster_tree));
+    rng_state *rng = (rng_state *)malloc(sizeof(rng_state));
+    int capacity = 2 * (max_k > 1 ? max_k : 1) - 1, i, best;
+    cluster_node *node;
+
+    tree->n = n;
+    tree->count = 0;
+    tree->nodes = (cluster_node *)malloc(capacity * sizeof(cluster_node));
+    tree->members = (int *)malloc(n * sizeof(int));
+    tree->splits = (int *)malloc(capacity * sizeof(int));
+    tree->num_splits = 0;
+    tree->iterations = 0;
+    for (i = 0; i < n; i++)
+    {
+        tree->members[i] = i;
+    }
+    rng_seed(rng, RNG_MT19937, seed);
+
+    add_node(tree, 0, n, -1);
+    if (max_k > 1)
+    {
+        propose_split(tree, W, 0, rng);
+    }
+    while (tree->num_splits + 1 < max_k)
+    {
+        /* the leaf whose proposed split cuts the least, the first one on ties */
+        best = -1;
+        for (i = 0; i < tree->count; i++)
+        {
+            if (tree->nodes[i].left < 0 && tree->nodes[i].ncut < HUGE_VAL &&
+                (best < 0 || tree->nodes[i].ncut < tree->nodes[best].ncut))
+            {
+                best = i;
+            }
+        }
+        if (best < 0)
+        {
+            break;
+        }
+        node = &tree->nodes[best];
+        node->split = tree->num_splits;
+        tree->splits[tree->num_splits++] = best;
+        node->left = add_node(tree, node->first, node->left_size, best);
+        node = &tree->nodes[best];
+        node->right = add_node(tree, node->first + node->left_size, node->size - node->left_size, best);
+        /* leaves that will never be split need no proposal */
+        if (tree->num_splits + 1 < max_k)
+        {
+            propose_split(tree, W, tree->nodes[best].left, rng);
+            propose_split(tree, W, tree->nodes[best].right, rng);
+        }
+    }
+    free(rng);
+    return tree;
+}
+
+/* function returning the labels of the points for k clusters */
+int *hierarchy_labels(cluster_tree *tree, int k)
+{
+    int *labels = (int *)malloc(tree->n * sizeof(int));
+    int splits = k - 1 < tree->num_splits ? k - 1 : tree->num_splits;
+    int i, t, label = 0, position = 0;
+
+    /* the leaves after the first splits cover members in order, so walk members by leaf */
+    while (position < tree->n)
+    {
+        for (i = 0; i < tree->count; i++)
+        {
+            cluster_node *node = &tree->nodes[i];
+            if (node->first == position && node->created <= splits && (node->split < 0 || node->split >= splits))
+            {
+                break;
+            }
+        }
+        for (t = 0; t < tree->nodes[i].size; t++)
+        {
+            labels[tree->members[position + t]] = label;
+        }
+        position += tree->nodes[i].size;
+        label++;
+    }
+    return labels;
+}
+
+/* Helper function to free a cluster tree */
+void free_cluster_tree(cluster_tree *tree)
+{
+    if (tree == NULL)
+    {
+        return;
+    }
+    free(tree->nodes);
+    free(tree->members);
+    free(tree->splits);
+    free(tree);
+}
@@ -0,0 +1,56 @@
+#ifndef HIERARCHY_H
+#define HIERARCHY_H
+
+#include "symnmf.h"
+
+/* Clusters smaller than this are never split */
+#define HIERARCHY_MIN_SIZE 4
+
+/* Node of a cluster tree, holding the points members[first .. first + size - 1] of the tree. Every
+   leaf carries the split the rank-2 solve proposes for it: its first left_size members go left */
+typedef struct
+{
+    int first;
+    int size;
+    int parent;
+    /* children, -1 while the node is a leaf */
+    int left;
+    int right;
+    int left_size;
+    /* normalized cut of the proposed split, cut / vol(left) + cut / vol(right); HUGE_VAL when the
+       node cannot be split */
+    double ncut;
+    /* splits made before the node was created and before it was split (-1 while it is a leaf) */
+    int created;
+    int split;
+    int iterations;
+} cluster_node;
+
+/* Tree of clusters grown by splitting one leaf at a time, the root holding every point */
+typedef struct
+{
+    int n;
+    int count;
+    cluster_node *nodes;
+    int *members;
+    /* nodes in the order they were split */
+    int *splits;
+    int num_splits;
+    /* rank-2 update iterations of all the solves */
+    int iterations;
+} cluster_tree;
+
+/* Function to grow a cluster tree of W up to max_k leaves. Every leaf is split in two by a rank-2
+   symnmf of the submatrix of W on its points, whose 2 x 2 Gram matrix has a closed form; the leaf
+   with the smallest normalized cut is split next. The starting H of each solve is drawn like that
+   of symnmf.py from one MT19937 generator seeded with seed. Stops early when no leaf can be split */
+cluster_tree *hierarchy_build(double **W, int n, int max_k, unsigned long seed);
+
+/* Function returning the labels of the points for k clusters, the leaves after the first k - 1
+   splits (all of them when the tree has fewer), numbered in the order of their points in members */
+int *hierarchy_labels(cluster_tree *tree, int k);
+
+/* Helper function to free a cluster tree */
+void free_cluster_tree(cluster_tree *tree);
+
+#endif /* HIERARCHY_H */
@@ -0,0 +1,481 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include "symnmf.h"
+#include "rng.h"
+#include "lowrank.h"
+#include "init.h"
+
+/* Lanczos steps beyond 2k, enough for the top k Ritz pairs of a normalized affinity to settle */
+#define LANCZOS_EXTRA 40
+/* Lloyd rounds after the k-means++ seeding */
+#define KMEANS_ROUNDS 10
+/* random sign probes estimating the squared row norms of W */
+#define NORM_PROBES 32
+/* seedings of k-means++, the clustering with the largest sum of cosines is kept */
+#define KMEANS_RESTARTS 3
+
+/* function to parse an initialization name */
+int init_method(const char *name)
+{
+    if (strcmp(name, "spectral") == 0)
+    {
+        return INIT_SPECTRAL;
+    }
+    if (strcmp(name, "kmeans++") == 0)
+    {
+        return INIT_KMEANSPP;
+    }
+    return -1;
+}
+
+/* Helper function to calculate W*v for a single vector, in is an n x 1 scratch matrix */
+static void multiply_vector(affinity_op *op, int n, double *v, double **in, double *out)
+{
+    double **product;
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        in[i][0] = v[i];
+    }
+    product = op->multiply(op->data, in, n, 1);
+    for (i = 0; i < n; i++)
+    {
+        out[i] = product[i][0];
+    }
+    free_matrix(product, n);
+}
+
+/* Helper function to replace the zeros of H by its mean (or by the scale of the random
+   initialization when H is all zeros), multiplicative updates never move a zero */
+static void fill_zeros(double **H, int n, int k, affinity_op *op)
+{
+    double mean = 0.0;
+    int i, j;
+
+    for (i = 0; i < n; i++)
+    {
+        for (j = 0; j < k; j++)
+        {
+            mean += H[i][j];
+        }
+    }
+    mean /= (double)n * k;
+    if (mean <= 0.0)
+    {
+        mean = sqrt(affinity_mean(op, n) / k);
+    }
+    for (i = 0; i < n; i++)
+    {
+        for (j = 0; j < k; j++)
+        {
+            if (H[i][j] <= 0.0)
+            {
+                H[i][j] = mean;
+            }
+        }
+    }
+}
+
+/* function to build H from the top k eigenvectors of W found by Lanczos iterations */
+double **spectral_init(affinity_op *op, int n, int k, unsigned int seed)
+{
+    int m = n < 2 * k + LANCZOS_EXTRA ? n : 2 * k + LANCZOS_EXTRA;
+    /* Lanczos basis, one vector per row */
+    double **Q = initialize_matrix(m + 1, n);
+    double *alpha = (double *)calloc(m, sizeof(double));
+    double *beta = (double *)calloc(m, sizeof(double));
+    double *w = (double *)malloc(n * sizeof(double));
+    double **column = initialize_matrix(n, 1);
+    double **H = initialize_matrix(n, k);
+    double **T, **Y, *values, norm = 0.0;
+    int steps = 0, i, j, a, pass;
+    rng_state rng;
+
+    rng_seed(&rng, RNG_MT19937, seed);
+    for (i = 0; i < n; i++)
+    {
+        Q[0][i] = rng_uniform(&rng) - 0.5;
+        norm += Q[0][i] * Q[0][i];
+    }
+    for (i = 0; i < n; i++)
+    {
+        Q[0][i] /= sqrt(norm);
+    }
+
+    for (j = 0; j < m; j++)
+    {
+        multiply_vector(op, n, Q[j], column, w);
+        steps = j + 1;
+        for (i = 0; i < n; i++)
+        {
+            alpha[j] += Q[j][i] * w[i];
+        }
+        /* full reorthogonalization against the whole basis, twice, instead of the three-term
+           recurrence alone: the basis is small and the Ritz vectors stay clean */
+        for (pass = 0; pass < 2; pass++)
+        {
+            for (a = 0; a <= j; a++)
+            {
+                double dot = 0.0;
+                for (i = 0; i < n; i++)
+                {
+                    dot += Q[a][i] * w[i];
+                }
+                for (i = 0; i < n; i++)
+                {
+                    w[i] -= dot * Q[a][i];
+                }
+            }
+        }
+        for (i = 0; i < n; i++)
+        {
+            beta[j] += w[i] * w[i];
+        }
+        beta[j] = sqrt(beta[j]);
+        if (beta[j] <= 1e-12)
+        {
+            /* the basis spans an invariant subspace, its Ritz pairs are exact */
+            break;
+        }
+        for (i = 0; i < n; i++)
+        {
+            Q[j + 1][i] = w[i] / beta[j];
+        }
+    }
+
+    /* eigenpairs of the tridiagonal projection, then the Ritz vectors of the top k */
+    T = initialize_matrix(steps, steps);
+    Y = initialize_matrix(steps, steps);
+    values = (double *)malloc(steps * sizeof(double));
+    for (j = 0; j < steps; j++)
+    {
+        T[j][j] = alpha[j];
+        if (j + 1 < steps)
+        {
+            T[j][j + 1] = T[j + 1][j] = beta[j];
+        }
+    }
+    symmetric_eigen(T, steps, values, Y);
+
+    for (a = 0; a < k && a < steps; a++)
+    {
+        double positive = 0.0, negative = 0.0, sign, scale = sqrt(values[a] > 0.0 ? values[a] : 0.0);
+        for (i = 0; i < n; i++)
+        {
+            w[i] = 0.0;
+            for (j = 0; j < steps; j++)
+            {
+                w[i] += Q[j][i] * Y[j][a];
+            }
+            if (w[i] > 0.0)
+            {
+                positive += w[i] * w[i];
+            }
+            else
+            {
+                negative += w[i] * w[i];
+            }
+        }
+        /* W ~ sum of lambda v v^T, keep the sign part of v carrying most of its mass */
+        sign = positive >= negative ? 1.0 : -1.0;
+        for (i = 0; i < n; i++)
+        {
+            H[i][a] = sign * w[i] > 0.0 ? scale * sign * w[i] : 0.0;
+        }
+    }
+    fill_zeros(H, n, k, op);
+
+    free_matrix(Q, m + 1);
+    free_matrix(T, steps);
+    free_matrix(Y, steps);
+    free_matrix(column, n);
+    free(values);
+    free(alpha);
+    free(beta);
+    free(w);
+    return H;
+}
+
+/* Helper function to build the n x k matrix combining each cluster: Z[l][j] = weights[l] / |C_j|
+   for l in C_j, W Z then holds the weighted mean rows of the clusters */
+static double **cluster_means(int *labels, double *weights, int n, int k)
+{
+    double **Z = initialize_matrix(n, k);
+    int *sizes = (int *)calloc(k, sizeof(int));
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        sizes[labels[i]]++;
+    }
+    for (i = 0; i < n; i++)
+    {
+        Z[i][labels[i]] = (weights != NULL ? weights[i] : 1.0) / sizes[labels[i]];
+    }
+    free(sizes);
+    return Z;
+}
+
+/* Helper function to sample a row by D^2 sampling, uniformly when every row coincides with a seed */
+static int sample_row(double *min_dist, int n, rng_state *rng)
+{
+    double total = 0.0, target, running = 0.0;
+    int i, chosen = -1;
+
+    for (i = 0; i < n; i++)
+    {
+        total += min_dist[i];
+    }
+    target = rng_uniform(rng) * total;
+    for (i = 0; i < n; i++)
+    {
+        if (min_dist[i] > 0.0)
+        {
+            chosen = i;
+            running += min_dist[i];
+            if (running > target)
+            {
+                break;
+            }
+        }
+    }
+    return chosen >= 0 ? chosen : (int)(rng_uniform(rng) * n);
+}
+
+/* Helper function to estimate 1 / ||W_i|| for every row from random sign probes, the rows being
+   only reached through products */
+static void inverse_row_norms(affinity_op *op, int n, double *inverse_norms, rng_state *rng)
+{
+    double **probes = initialize_matrix(n, NORM_PROBES);
+    double **projected;
+    int i, p;
+
+    for (i = 0; i < n; i++)
+    {
+        for (p = 0; p < NORM_PROBES; p++)
+        {
+            probes[i][p] = rng_uniform(rng) < 0.5 ? -1.0 : 1.0;
+        }
+    }
+    /* E[(W z)_i^2] = ||W_i||^2 for independent random signs z */
+    projected = op->multiply(op->data, probes, n, NORM_PROBES);
+    for (i = 0; i < n; i++)
+    {
+        double norm = 0.0;
+        for (p = 0; p < NORM_PROBES; p++)
+        {
+            norm += projected[i][p] * projected[i][p];
+        }
+        norm = sqrt(norm / NORM_PROBES);
+        inverse_norms[i] = norm > 0.0 ? 1.0 / norm : 0.0;
+    }
+    free_matrix(probes, n);
+    free_matrix(projected, n);
+}
+
+/* Helper function to seed k clusters of the rows of W by greedy D^2 sampling on their directions
+   (rows of a normalized W differ in scale with the degree): every step samples a few candidates
+   and keeps the one lowering the potential most. labels receives the nearest seed of every row */
+static void seed_clusters(affinity_op *op, int n, int k, int *labels, double *inverse_norms,
+                          rng_state *rng)
+{
+    int trials = 2 + (int)log((double)k);
+    double **units = initialize_matrix(n, trials);
+    double **rows, **gram;
+    double *min_dist = (double *)malloc(n * sizeof(double));
+    double *row_norms = (double *)malloc(trials * sizeof(double));
+    int *candidates = (int *)malloc(trials * sizeof(int));
+    int i, c, t, best;
+
+    for (i = 0; i < n; i++)
+    {
+        min_dist[i] = 1.0;
+    }
+
+    for (c = 0; c < k; c++)
+    {
+        double best_potential = HUGE_VAL;
+
+        for (t = 0; t < trials; t++)
+        {
+            candidates[t] = c == 0 && t > 0 ? candidates[0] : sample_row(min_dist, n, rng);
+            if (c == 0 && t == 0)
+            {
+                candidates[t] = (int)(rng_uniform(rng) * n);
+            }
+            units[candidates[t]][t] = 1.0;
+        }
+        /* the candidate rows are the columns W e_c, their products with all rows W (W e_c) */
+        rows = op->multiply(op->data, units, n, trials);
+        gram = op->multiply(op->data, rows, n, trials);
+        for (t = 0; t < trials; t++)
+        {
+            units[candidates[t]][t] = 0.0;
+            row_norms[t] = 0.0;
+            for (i = 0; i < n; i++)
+            {
+                row_norms[t] += rows[i][t] * rows[i][t];
+            }
+            row_norms[t] = sqrt(row_norms[t]);
+        }
+
+        /* 1 - cosine is half the squared distance between the unit rows */
+        best = 0;
+        for (t = 0; t < trials; t++)
+        {
+            double potential = 0.0;
+            for (i = 0; i < n; i++)
+            {
+                double dist = row_norms[t] > 0.0 ? 1.0 - gram[i][t] * inverse_norms[i] / row_norms[t] : 1.0;
+                potential += dist < min_dist[i] ? (dist > 0.0 ? dist : 0.0) : min_dist[i];
+            }
+            if (potential < best_potential)
+            {
+                best_potential = potential;
+                best = t;
+            }
+        }
+        for (i = 0; i < n; i++)
+        {
+            double dist = row_norms[best] > 0.0 ? 1.0 - gram[i][best] * inverse_norms[i] / row_norms[best] : 1.0;
+            dist = i == candidates[best] || dist < 0.0 ? 0.0 : dist;
+            if (c == 0 || dist < min_dist[i])
+            {
+                min_dist[i] = dist;
+                labels[i] = c;
+            }
+        }
+        free_matrix(rows, n);
+        free_matrix(gram, n);
+    }
+
+    free_matrix(units, n);
+    free(min_dist);
+    free(row_norms);
+    free(candidates);
+}
+
+/* Helper function to run spherical Lloyd rounds on labels, returns the sum of the cosines of the
+   rows to their centroids. The centroids of the unit rows are M = W Z (W is symmetric) and the
+   products of the rows with them are W M; a row joins the centroid of largest cosine, in which its
+   own norm is the same for every cluster and drops out */
+static double lloyd_rounds(affinity_op *op, int n, int k, int *labels, double *inverse_norms)
+{
+    double **Z, **M, **G;
+    double *center_norms = (double *)malloc(k * sizeof(double));
+    double objective = 0.0;
+    int round, changed = 1, i, j;
+
+    for (round = 0; round < KMEANS_ROUNDS && changed; round++)
+    {
+        Z = cluster_means(labels, inverse_norms, n, k);
+        M = op->multiply(op->data, Z, n, k);
+        G = op->multiply(op->data, M, n, k);
+        for (j = 0; j < k; j++)
+        {
+            center_norms[j] = 0.0;
+            for (i = 0; i < n; i++)
+            {
+                center_norms[j] += M[i][j] * M[i][j];
+            }
+            center_norms[j] = sqrt(center_norms[j]);
+        }
+        changed = 0;
+        objective = 0.0;
+        for (i = 0; i < n; i++)
+        {
+            int best = labels[i];
+            for (j = 0; j < k; j++)
+            {
+                /* G[i][j] / |M_j| > G[i][best] / |M_best| without dividing by an empty cluster */
+                if (G[i][j] * center_norms[best] > G[i][best] * center_norms[j])
+                {
+                    best = j;
+                }
+            }
+            changed = changed || best != labels[i];
+            labels[i] = best;
+            if (center_norms[best] > 0.0)
+            {
+                objective += G[i][best] * inverse_norms[i] / center_norms[best];
+            }
+        }
+        free_matrix(Z, n);
+        free_matrix(M, n);
+        free_matrix(G, n);
+    }
+    free(center_norms);
+    return objective;
+}
+
+/* function to build H from a k-means clustering of the rows of W */
+double **kmeanspp_init(affinity_op *op, int n, int k, unsigned int seed)
+{
+    int *labels = (int *)calloc(n, sizeof(int));
+    int *trial_labels = (int *)calloc(n, sizeof(int));
+    double **Z, **H;
+    double *inverse_norms = (double *)malloc(n * sizeof(double));
+    double *within = (double *)calloc(k, sizeof(double));
+    int *sizes = (int *)calloc(k, sizeof(int));
+    double objective, best_objective = -HUGE_VAL;
+    int restart, i, j;
+    rng_state rng;
+
+    /* Lloyd never splits two clusters sharing a seed, so keep the best of a few seedings */
+    rng_seed(&rng, RNG_MT19937, seed);
+    inverse_row_norms(op, n, inverse_norms, &rng);
+    for (restart = 0; restart < KMEANS_RESTARTS; restart++)
+    {
+        seed_clusters(op, n, k, trial_labels, inverse_norms, &rng);
+        objective = lloyd_rounds(op, n, k, trial_labels, inverse_norms);
+        if (objective > best_objective)
+        {
+            best_objective = objective;
+            memcpy(labels, trial_labels, n * sizeof(int));
+        }
+    }
+
+    /* H[i][j] = (mean affinity of i to cluster j) / sqrt(mean affinity inside cluster j), which is
+       sqrt(a) on the diagonal blocks of an ideal W = sum of a 1 1^T */
+    Z = cluster_means(labels, NULL, n, k);
+    H = op->multiply(op->data, Z, n, k);
+    for (i = 0; i < n; i++)
+    {
+        within[labels[i]] += H[i][labels[i]];
+        sizes[labels[i]]++;
+    }
+    for (j = 0; j < k; j++)
+    {
+        double scale = sizes[j] > 0 && within[j] > 0.0 ? 1.0 / sqrt(within[j] / sizes[j]) : 0.0;
+        for (i = 0; i < n; i++)
+        {
+            H[i][j] *= scale;
+        }
+    }
+    fill_zeros(H, n, k, op);
+
+    free_matrix(Z, n);
+    free(labels);
+    free(trial_labels);
+    free(inverse_norms);
+    free(within);
+    free(sizes);
+    return H;
+}
+
+/* function to run an initialization by method */
+double **initialize_H(affinity_op *op, int n, int k, int method, unsigned int seed)
+{
+    if (method == INIT_SPECTRAL)
+    {
+        return spectral_init(op, n, k, seed);
+    }
+    if (method == INIT_KMEANSPP)
+    {
+        return kmeanspp_init(op, n, k, seed);
+    }
+    return NULL;
+}
@@ -0,0 +1,26 @@
+#ifndef INIT_H
+#define INIT_H
+
+#include "symnmf.h"
+
+/* Initializations of H offered next to the uniform random one of symnmf.py */
+#define INIT_SPECTRAL 0
+#define INIT_KMEANSPP 1
+
+/* Function to parse an initialization name ("spectral" or "kmeans++"), returns -1 when unknown */
+int init_method(const char *name);
+
+/* Function to build H from the top k eigenvectors of W, found by Lanczos iterations that only need
+   products W*v: each eigenvector keeps its larger sign part, scaled by the root of its eigenvalue,
+   and the zeros are filled with the mean of H so the multiplicative updates can still move them */
+double **spectral_init(affinity_op *op, int n, int k, unsigned int seed);
+
+/* Function to build H from a k-means clustering of the rows of W (greedy k-means++ seeding, then a
+   few Lloyd rounds, best of a few restarts), with H[i][j] the mean affinity of point i to cluster j over the root of the mean
+   affinity inside cluster j. Rows are only reached through products W*V */
+double **kmeanspp_init(affinity_op *op, int n, int k, unsigned int seed);
+
+/* Function to run an initialization by method, NULL for an unknown method */
+double **initialize_H(affinity_op *op, int n, int k, int method, unsigned int seed);
+
+#endif /* INIT_H */
@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "kernels.h"
+
+/*
+ * Timing of the specialized kernels against the generic loops for every instruction set this
+ * CPU supports, run with "make kernel-bench". The distance kernel is timed per dimension d as in
+ * sym, the Gram, update and argmax kernels per rank k as in one symnmf iteration and analysis, and
+ * the row product per rank k as in the W*H of one iteration.
+ */
+
+#define BENCH_POINTS 2000
+#define BENCH_ROUNDS 50
+
+/* Helper function to fill an array with uniform numbers in (0, 1] */
+static double *random_array(int size)
+{
+    double *values = (double *)malloc(size * sizeof(double));
+    int i;
+    for (i = 0; i < size; i++)
+    {
+        values[i] = (rand() + 1.0) / ((double)RAND_MAX + 1.0);
+    }
+    return values;
+}
+
+/* Helper function to time all pairwise distances of BENCH_POINTS points of dimension d */
+static double time_distance(distance_kernel distance, double *points, int d, double *sink)
+{
+    clock_t start = clock();
+    int round, i, j;
+
+    for (round = 0; round < BENCH_ROUNDS / 10; round++)
+    {
+        for (i = 0; i < BENCH_POINTS; i++)
+        {
+            for (j = 0; j < i; j++)
+            {
+                *sink += distance(points + i * d, points + j * d, d);
+            }
+        }
+    }
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+/* Helper function to time the Gram, update and argmax kernels over BENCH_POINTS rows of rank k */
+static double time_update(gram_kernel gram, update_kernel update, argmax_kernel argmax,
+                          double *H, double *WH, int k, double *sink)
+{
+    double *HtH = (double *)malloc(k * k * sizeof(double));
+    double *next = (double *)malloc(BENCH_POINTS * k * sizeof(double));
+    double sums[2] = {0.0, 0.0};
+    clock_t start = clock();
+    int round, i;
+
+    for (round = 0; round < BENCH_ROUNDS * 10; round++)
+    {
+        for (i = 0; i < k * k; i++)
+        {
+            HtH[i] = 0.0;
+        }
+        for (i = 0; i < BENCH_POINTS; i++)
+        {
+            gram(HtH, H + i * k, k);
+        }
+        for (i = 0; i < BENCH_POINTS; i++)
+        {
+            update(next + i * k, H + i * k, WH + i * k, HtH, k, sums);
+            *sink += argmax(next + i * k, k);
+        }
+    }
+    *sink += sums[0];
+    free(HtH);
+    free(next);
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+/* Helper function to time the rows of W*H for a BENCH_POINTS x BENCH_POINTS W and H of rank k */
+static double time_product(product_kernel product, double *W, double *H, int k, double *sink)
+{
+    double *WH = (double *)malloc(BENCH_POINTS * k * sizeof(double));
+    clock_t start = clock();
+    int round, i;
+
+    for (round = 0; round < BENCH_ROUNDS / 10; round++)
+    {
+        for (i = 0; i < BENCH_POINTS * k; i++)
+        {
+            WH[i] = 0.0;
+        }
+        for (i = 0; i < BENCH_POINTS; i++)
+        {
+            product(WH + i * k, W + (size_t)i * BENCH_POINTS, H, BENCH_POINTS, k);
+        }
+        *sink += WH[round % (BENCH_POINTS * k)];
+    }
+    free(WH);
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+/* Helper function to print the distance table of the active kernel set */
+static void bench_distances(const int *dims, int count, double *base, double *sink)
+{
+    const kernel_set *set = active_kernels();
+    double generic, specialized, *points;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        points = random_array(BENCH_POINTS * dims[i]);
+        generic = time_distance(set->distance[0], points, dims[i], sink);
+        specialized = time_distance(select_distance(dims[i]), points, dims[i], sink);
+        if (base[i] == 0.0)
+        {
+            base[i] = generic;
+        }
+        printf("%8s %6d %12.4f %12.4f %8.2f %8.2f\n", set->isa, dims[i], generic, specialized,
+               generic / specialized, base[i] / specialized);
+        free(points);
+    }
+}
+
+/* Helper function to print the update table of the active kernel set */
+static void bench_updates(const int *ranks, int count, double *base, double *sink)
+{
+    const kernel_set *set = active_kernels();
+    double generic, specialized, *H, *WH;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        H = random_array(BENCH_POINTS * ranks[i]);
+        WH = random_array(BENCH_POINTS * ranks[i]);
+        generic = time_update(set->gram[0], set->update[0], set->argmax[0], H, WH, ranks[i], sink);
+        specialized = time_update(select_gram(ranks[i]), select_update(ranks[i]), select_argmax(ranks[i]),
+                                  H, WH, ranks[i], sink);
+        if (base[i] == 0.0)
+        {
+            base[i] = generic;
+        }
+        printf("%8s %6d %12.4f %12.4f %8.2f %8.2f\n", set->isa, ranks[i], generic, specialized,
+               generic / specialized, base[i] / specialized);
+        free(H);
+        free(WH);
+    }
+}
+
+/* Helper function to print the W*H table of the active kernel set */
+static void bench_products(const int *ranks, int count, double *base, double *W, double *sink)
+{
+    const kernel_set *set = active_kernels();
+    double generic, specialized, *H;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        H = random_array(BENCH_POINTS * ranks[i]);
+        generic = time_product(set->product[0], W, H, ranks[i], sink);
+        specialized = time_product(select_product(ranks[i]), W, H, ranks[i], sink);
+        if (base[i] == 0.0)
+        {
+            base[i] = generic;
+        }
+        printf("%8s %6d %12.4f %12.4f %8.2f %8.2f\n", set->isa, ranks[i], generic, specialized,
+               generic / specialized, base[i] / specialized);
+        free(H);
+    }
+}
+
+int main(void)
+{
+    static const int dims[] = {2, 3, 4, 8, 12, 16, 24};
+    static const int ranks[] = {2, 3, 4, 5, 8, 10, 16, 20, 24};
+    static const char *isas[] = {"base", "avx2", "avx512"};
+    double distance_base[sizeof(dims) / sizeof(dims[0])] = {0.0};
+    double update_base[sizeof(ranks) / sizeof(ranks[0])] = {0.0};
+    double product_base[sizeof(ranks) / sizeof(ranks[0])] = {0.0};
+    double sink = 0.0, *W;
+    unsigned int i;
+
+    /* "speedup" is against the generic loop of the same set, "vs base" against the generic
+       loop without ISA extensions; sizes above the specialized range show the fallback */
+    srand(0);
+    printf("%8s %6s %12s %12s %8s %8s\n", "isa", "d", "generic s", "special s", "speedup", "vs base");
+    for (i = 0; i < sizeof(isas) / sizeof(isas[0]); i++)
+    {
+        if (use_kernels(isas[i]) == 0)
+        {
+            bench_distances(dims, sizeof(dims) / sizeof(dims[0]), distance_base, &sink);
+        }
+    }
+
+    printf("\n%8s %6s %12s %12s %8s %8s\n", "isa", "k", "generic s", "special s", "speedup", "vs base");
+    for (i = 0; i < sizeof(isas) / sizeof(isas[0]); i++)
+    {
+        if (use_kernels(isas[i]) == 0)
+        {
+            bench_updates(ranks, sizeof(ranks) / sizeof(ranks[0]), update_base, &sink);
+        }
+    }
+
+    W = random_array(BENCH_POINTS * BENCH_POINTS);
+    printf("\n%8s %6s %12s %12s %8s %8s\n", "isa", "k", "generic s", "product s", "speedup", "vs base");
+    for (i = 0; i < sizeof(isas) / sizeof(isas[0]); i++)
+    {
+        if (use_kernels(isas[i]) == 0)
+        {
+            bench_products(ranks, sizeof(ranks) / sizeof(ranks[0]), product_base, W, &sink);
+        }
+    }
+    free(W);
+    fprintf(stderr, "checksum %g\n", sink);
+    return 0;
+}
@@ -0,0 +1,311 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kernels.h"
+
+/*
+ * Every kernel body is written once as a macro with the size as a compile-time constant. It is
+ * instantiated for d = 1..KERNEL_MAX_D and k = 1..KERNEL_MAX_K, so the compiler sees constant trip
+ * counts it can unroll completely and keep in registers, and once more with the runtime size for
+ * the generic fallback. On x86 the whole family is compiled again for AVX2 and AVX-512 through
+ * target attributes, so one binary carries all of them and picks one at run time. Floating point
+ * contraction stays off (-ansi implies it, setup.py asks for it), so no set uses FMA and all of
+ * them give identical results.
+ *
+ * The family covers what runs per pair of points or per iteration: the distances of sym, the row
+ * products of W*H, and the Gram, update and argmax of H. The exp of sym stays the libm call, and
+ * the O(n^2) sums of the degrees and of ||W||^2 run once per matrix, adding in an order the
+ * results depend on, so they are left to the compiler.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86 1
+#endif
+
+/* code generation attribute of each instruction set */
+#define TARGET_base
+#ifdef KERNELS_X86
+#define TARGET_avx2 __attribute__((target("avx2")))
+#define TARGET_avx512 __attribute__((target("avx512f")))
+#endif
+
+#define KERNEL_SIZES_D(X, ISA) X(1, ISA) X(2, ISA) X(3, ISA) X(4, ISA) X(5, ISA) X(6, ISA) \
+    X(7, ISA) X(8, ISA) X(9, ISA) X(10, ISA) X(11, ISA) X(12, ISA) X(13, ISA) X(14, ISA) X(15, ISA) X(16, ISA)
+#define KERNEL_SIZES_K(X, ISA) X(1, ISA) X(2, ISA) X(3, ISA) X(4, ISA) X(5, ISA) X(6, ISA) \
+    X(7, ISA) X(8, ISA) X(9, ISA) X(10, ISA) X(11, ISA) X(12, ISA) X(13, ISA) X(14, ISA) X(15, ISA) \
+    X(16, ISA) X(17, ISA) X(18, ISA) X(19, ISA) X(20, ISA)
+
+#define DISTANCE_BODY(D)                \
+    {                                   \
+        double distance = 0.0;          \
+        int i;                          \
+        for (i = 0; i < (D); i++)       \
+        {                               \
+            double diff = a[i] - b[i];  \
+            distance += diff * diff;    \
+        }                               \
+        return distance;                \
+    }
+
+#define GRAM_BODY(K)                                                \
+    {                                                               \
+        int a, b;                                                   \
+        /* each product is formed once and added to both halves */  \
+        for (a = 0; a < (K); a++)                                   \
+        {                                                           \
+            gram[a * (K) + a] += h[a] * h[a];                       \
+            for (b = a + 1; b < (K); b++)                           \
+            {                                                       \
+                double product = h[a] * h[b];                       \
+                gram[a * (K) + b] += product;                       \
+                gram[b * (K) + a] += product;                       \
+            }                                                       \
+        }                                                           \
+    }
+
+#define UPDATE_BODY(K)                                                                  \
+    {                                                                                   \
+        int j, l;                                                                       \
+        double step, trace = 0.0;                                                       \
+        for (j = 0; j < (K); j++)                                                       \
+        {                                                                               \
+            /* an approximated W*H can dip below zero, which must not flip the sign */  \
+            double w = wh[j] > 0.0 ? wh[j] : 0.0;                                       \
+            double hhth = 0.0;                                                          \
+            /* the Gram matrix is symmetric, so row j is read instead of column j */    \
+            for (l = 0; l < (K); l++)                                                   \
+            {                                                                           \
+                hhth += h[l] * gram[j * (K) + l];                                       \
+            }                                                                           \
+            next[j] = h[j] * (0.5 + 0.5 * (w / hhth));                                  \
+            step = next[j] - h[j];                                                      \
+            sums[0] += step * step;                                                     \
+            trace += h[j] * wh[j];                                                      \
+        }                                                                               \
+        sums[1] += trace;                                                               \
+    }
+
+#define ARGMAX_BODY(K)                  \
+    {                                   \
+        double max_val = h[0];          \
+        int max_index = 0, j;           \
+        for (j = 1; j < (K); j++)       \
+        {                               \
+            if (h[j] > max_val)         \
+            {                           \
+                max_val = h[j];         \
+                max_index = j;          \
+            }                           \
+        }                               \
+        return max_index;               \
+    }
+
+/* column lists of the row products, written out so that every sum is a constant index the compiler
+   keeps in a register whatever it decides about unrolling */
+#define PRODUCT_COLUMNS_1(X) X(0)
+#define PRODUCT_COLUMNS_2(X) PRODUCT_COLUMNS_1(X) X(1)
+#define PRODUCT_COLUMNS_3(X) PRODUCT_COLUMNS_2(X) X(2)
+#define PRODUCT_COLUMNS_4(X) PRODUCT_COLUMNS_3(X) X(3)
+#define PRODUCT_COLUMNS_5(X) PRODUCT_COLUMNS_4(X) X(4)
+#define PRODUCT_COLUMNS_6(X) PRODUCT_COLUMNS_5(X) X(5)
+#define PRODUCT_COLUMNS_7(X) PRODUCT_COLUMNS_6(X) X(6)
+#define PRODUCT_COLUMNS_8(X) PRODUCT_COLUMNS_7(X) X(7)
+#define PRODUCT_COLUMNS_9(X) PRODUCT_COLUMNS_8(X) X(8)
+#define PRODUCT_COLUMNS_10(X) PRODUCT_COLUMNS_9(X) X(9)
+#define PRODUCT_COLUMNS_11(X) PRODUCT_COLUMNS_10(X) X(10)
+#define PRODUCT_COLUMNS_12(X) PRODUCT_COLUMNS_11(X) X(11)
+#define PRODUCT_COLUMNS_13(X) PRODUCT_COLUMNS_12(X) X(12)
+#define PRODUCT_COLUMNS_14(X) PRODUCT_COLUMNS_13(X) X(13)
+#define PRODUCT_COLUMNS_15(X) PRODUCT_COLUMNS_14(X) X(14)
+#define PRODUCT_COLUMNS_16(X) PRODUCT_COLUMNS_15(X) X(15)
+#define PRODUCT_COLUMNS_17(X) PRODUCT_COLUMNS_16(X) X(16)
+#define PRODUCT_COLUMNS_18(X) PRODUCT_COLUMNS_17(X) X(17)
+#define PRODUCT_COLUMNS_19(X) PRODUCT_COLUMNS_18(X) X(18)
+#define PRODUCT_COLUMNS_20(X) PRODUCT_COLUMNS_19(X) X(19)
+
+#define PRODUCT_LOAD(C) sums[C] = out[first + (C)];
+#define PRODUCT_ADD(C) sums[C] += ws * hs[C];
+#define PRODUCT_STORE(C) out[first + (C)] = sums[C];
+
+/* the sums of WIDTH columns of a row of W*H from column first on stay in registers while the row
+   of W streams by, H holding STRIDE columns */
+#define PRODUCT_COLUMNS(WIDTH, STRIDE)                                      \
+    {                                                                       \
+        double sums[WIDTH];                                                 \
+        int s;                                                              \
+        PRODUCT_COLUMNS_##WIDTH(PRODUCT_LOAD)                               \
+        for (s = 0; s < count; s++)                                         \
+        {                                                                   \
+            const double ws = w[s], *hs = h + (size_t)s * (STRIDE) + first; \
+            PRODUCT_COLUMNS_##WIDTH(PRODUCT_ADD)                            \
+        }                                                                   \
+        PRODUCT_COLUMNS_##WIDTH(PRODUCT_STORE)                              \
+    }
+
+/* a specialized row product takes all K columns in one pass over the row of W */
+#define PRODUCT_BODY(K)         \
+    {                           \
+        const int first = 0;    \
+        PRODUCT_COLUMNS(K, K)   \
+    }
+
+/* the generic one takes 8 columns per pass, then the rest one by one */
+#define PRODUCT_GENERIC_BODY                            \
+    {                                                   \
+        int first;                                      \
+        for (first = 0; first + 8 <= k; first += 8)     \
+        {                                               \
+            PRODUCT_COLUMNS(8, k)                       \
+        }                                               \
+        for (; first < k; first++)                      \
+        {                                               \
+            PRODUCT_COLUMNS(1, k)                       \
+        }                                               \
+    }
+
+/* specialized instances, the size argument only keeps the signature shared with the generic ones */
+#define DEFINE_DISTANCE(D, ISA) TARGET_##ISA \
+    static double distance_##ISA##_##D(const double *a, const double *b, int d) { (void)d; DISTANCE_BODY(D) }
+#define DEFINE_GRAM(K, ISA) TARGET_##ISA \
+    static void gram_##ISA##_##K(double *gram, const double *h, int k) { (void)k; GRAM_BODY(K) }
+#define DEFINE_UPDATE(K, ISA) TARGET_##ISA \
+    static void update_##ISA##_##K(double *next, const double *h, const double *wh, const double *gram, int k, \
+                                   double *sums) { (void)k; UPDATE_BODY(K) }
+#define DEFINE_ARGMAX(K, ISA) TARGET_##ISA \
+    static int argmax_##ISA##_##K(const double *h, int k) { (void)k; ARGMAX_BODY(K) }
+#define DEFINE_PRODUCT(K, ISA) TARGET_##ISA \
+    static void product_##ISA##_##K(double *out, const double *w, const double *h, int count, int k) \
+    { (void)k; PRODUCT_BODY(K) }
+
+/* generic instances, stored at index 0 of the tables */
+#define DEFINE_GENERIC(ISA) \
+    TARGET_##ISA static double distance_##ISA##_0(const double *a, const double *b, int d) DISTANCE_BODY(d) \
+    TARGET_##ISA static void gram_##ISA##_0(double *gram, const double *h, int k) GRAM_BODY(k) \
+    TARGET_##ISA static void update_##ISA##_0(double *next, const double *h, const double *wh, \
+                                              const double *gram, int k, double *sums) UPDATE_BODY(k) \
+    TARGET_##ISA static int argmax_##ISA##_0(const double *h, int k) ARGMAX_BODY(k) \
+    TARGET_##ISA static void product_##ISA##_0(double *out, const double *w, const double *h, int count, \
+                                               int k) PRODUCT_GENERIC_BODY
+
+#define DISTANCE_ENTRY(D, ISA) distance_##ISA##_##D,
+#define GRAM_ENTRY(K, ISA) gram_##ISA##_##K,
+#define UPDATE_ENTRY(K, ISA) update_##ISA##_##K,
+#define ARGMAX_ENTRY(K, ISA) argmax_##ISA##_##K,
+#define PRODUCT_ENTRY(K, ISA) product_##ISA##_##K,
+
+/* all kernels of one instruction set and their dispatch tables */
+#define DEFINE_KERNEL_SET(ISA) \
+    KERNEL_SIZES_D(DEFINE_DISTANCE, ISA) \
+    KERNEL_SIZES_K(DEFINE_GRAM, ISA) \
+    KERNEL_SIZES_K(DEFINE_UPDATE, ISA) \
+    KERNEL_SIZES_K(DEFINE_ARGMAX, ISA) \
+    KERNEL_SIZES_K(DEFINE_PRODUCT, ISA) \
+    DEFINE_GENERIC(ISA) \
+    static const kernel_set kernels_##ISA = { \
+        #ISA, \
+        {distance_##ISA##_0, KERNEL_SIZES_D(DISTANCE_ENTRY, ISA)}, \
+        {gram_##ISA##_0, KERNEL_SIZES_K(GRAM_ENTRY, ISA)}, \
+        {update_##ISA##_0, KERNEL_SIZES_K(UPDATE_ENTRY, ISA)}, \
+        {argmax_##ISA##_0, KERNEL_SIZES_K(ARGMAX_ENTRY, ISA)}, \
+        {product_##ISA##_0, KERNEL_SIZES_K(PRODUCT_ENTRY, ISA)}};
+
+DEFINE_KERNEL_SET(base)
+#ifdef KERNELS_X86
+DEFINE_KERNEL_SET(avx2)
+DEFINE_KERNEL_SET(avx512)
+#endif
+
+static const kernel_set *active = NULL;
+
+/* Helper function to find the best kernel set this CPU supports */
+static const kernel_set *best_kernels(void)
+{
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return &kernels_avx512;
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return &kernels_avx2;
+    }
+#endif
+    return &kernels_base;
+}
+
+/* function to switch to a kernel set by name */
+int use_kernels(const char *isa)
+{
+    const kernel_set *chosen = NULL;
+
+    if (strcmp(isa, "auto") == 0)
+    {
+        chosen = best_kernels();
+    }
+    else if (strcmp(isa, "base") == 0)
+    {
+        chosen = &kernels_base;
+    }
+#ifdef KERNELS_X86
+    else if (strcmp(isa, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+    {
+        chosen = &kernels_avx2;
+    }
+    else if (strcmp(isa, "avx512") == 0 && __builtin_cpu_supports("avx512f"))
+    {
+        chosen = &kernels_avx512;
+    }
+#endif
+    if (chosen == NULL)
+    {
+        return 1;
+    }
+    active = chosen;
+    return 0;
+}
+
+/* function returning the kernel set in use, chosen on first use */
+const kernel_set *active_kernels(void)
+{
+    if (active == NULL)
+    {
+        /* every thread that races here stores the same set */
+        const char *isa = getenv("SYMNMF_KERNELS");
+        if (isa == NULL || use_kernels(isa) != 0)
+        {
+            active = best_kernels();
+        }
+    }
+    return active;
+}
+
+/* function to pick the distance kernel for dimension d */
+distance_kernel select_distance(int d)
+{
+    return active_kernels()->distance[d >= 1 && d <= KERNEL_MAX_D ? d : 0];
+}
+
+/* function to pick the Gram kernel for rank k */
+gram_kernel select_gram(int k)
+{
+    return active_kernels()->gram[k >= 1 && k <= KERNEL_MAX_K ? k : 0];
+}
+
+/* function to pick the update kernel for rank k */
+update_kernel select_update(int k)
+{
+    return active_kernels()->update[k >= 1 && k <= KERNEL_MAX_K ? k : 0];
+}
+
+/* function to pick the argmax kernel for rank k */
+argmax_kernel select_argmax(int k)
+{
+    return active_kernels()->argmax[k >= 1 && k <= KERNEL_MAX_K ? k : 0];
+}
+
+/* function to pick the W*H row kernel for rank k */
+product_kernel select_product(int k)
+{
+    return active_kernels()->product[k >= 1 && k <= KERNEL_MAX_K ? k : 0];
+}
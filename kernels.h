@@ -0,0 +1,56 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+/* Largest dimension d and rank k with a kernel specialized at compile time, larger sizes run the
+   generic loops */
+#define KERNEL_MAX_D 16
+#define KERNEL_MAX_K 20
+
+/* Squared Euclidean distance of two d-vectors */
+typedef double (*distance_kernel)(const double *a, const double *b, int d);
+
+/* Accumulate h^T * h of one row h of H into the k x k (row-major) Gram matrix */
+typedef void (*gram_kernel)(double *gram, const double *h, int k);
+
+/* Multiplicative update of one row: next = h * (0.5 + 0.5 * max(wh, 0) / (h * gram)), in the same
+   pass sums[0] += ||next - h||^2 (entry by entry, in order) and sums[1] += h . wh */
+typedef void (*update_kernel)(double *next, const double *h, const double *wh, const double *gram, int k,
+                              double *sums);
+
+/* Index of the largest of k values, the first one on ties */
+typedef int (*argmax_kernel)(const double *h, int k);
+
+/* One row of W*H added into out: out[c] += w[s] * h[s * k + c] for s = 0 .. count - 1 in order, H
+   packed row after row. Every entry adds its terms in the order of matrix_multiplication, so W*H
+   built from it is identical for any split of the columns into consecutive calls */
+typedef void (*product_kernel)(double *out, const double *w, const double *h, int count, int k);
+
+/* All kernels compiled for one instruction set, entry s is specialized for size s and entry 0
+   is the generic loop. Every set adds up in the same order, so all of them give identical results */
+typedef struct
+{
+    const char *isa;
+    distance_kernel distance[KERNEL_MAX_D + 1];
+    gram_kernel gram[KERNEL_MAX_K + 1];
+    update_kernel update[KERNEL_MAX_K + 1];
+    argmax_kernel argmax[KERNEL_MAX_K + 1];
+    product_kernel product[KERNEL_MAX_K + 1];
+} kernel_set;
+
+/* Function returning the kernel set in use. On first use it is the best set this CPU supports
+   (checked with cpuid), unless the SYMNMF_KERNELS environment variable names another one */
+const kernel_set *active_kernels(void);
+
+/* Function to switch to the kernel set "base", "avx2", "avx512" or "auto" (the best supported),
+   returns 0 on success and 1 when this build or CPU lacks it */
+int use_kernels(const char *isa);
+
+/* Functions to pick the kernel of the active set for a size, the generic one when there is no
+   specialization */
+distance_kernel select_distance(int d);
+gram_kernel select_gram(int k);
+update_kernel select_update(int k);
+argmax_kernel select_argmax(int k);
+product_kernel select_product(int k);
+
+#endif /* KERNELS_H */
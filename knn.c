@@ -0,0 +1,804 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include "kernels.h"
+#include "pool.h"
+#include "rng.h"
+#include "knn.h"
+
+/* rows of a search handed to a worker at once */
+#define KNN_BLOCK_ROWS 256
+/* most points in a leaf of the KD-tree */
+#define KD_LEAF 16
+/* NN-descent stops after this many rounds, or earlier once a round changes fewer than
+   KNN_DESCENT_DELTA * n * k neighbours */
+#define KNN_DESCENT_ROUNDS 12
+#define KNN_DESCENT_DELTA 0.001
+/* random projection trees seeding NN-descent, split down to leaves of at most 2k points */
+#define KNN_DESCENT_TREES 4
+/* fraction of the k neighbours of a point whose fresh links join in a round, the others wait */
+#define KNN_DESCENT_SAMPLE 0.5
+
+/* states of a neighbour in NN-descent: tried in an earlier round, not tried yet, and not tried yet
+   but sampled to join in the current round */
+#define KNN_STALE 0
+#define KNN_FRESH 1
+#define KNN_SAMPLED 2
+
+/* neighbour candidate in a max-heap on distance, with its NN-descent state */
+typedef struct
+{
+    double dist;
+    int index;
+    int fresh;
+} knn_entry;
+
+/* node of the KD-tree: a leaf holds the points index[first .. first + count - 1], an inner node
+   sends points with coordinate axis below split to left and the others to right */
+typedef struct
+{
+    int first;
+    int count;
+    int left;
+    int right;
+    int axis;
+    double split;
+} kd_node;
+
+/* shared state of a search */
+typedef struct
+{
+    double **points;
+    int n;
+    int d;
+    int k;
+    distance_kernel distance;
+    /* the k nearest neighbours found so far of point i, at i * k */
+    knn_entry *heaps;
+    double *degrees;
+    /* KD-tree: the nodes and the points in leaf order */
+    kd_node *nodes;
+    int *index;
+    /* NN-descent: the heaps of the previous round and, for every point, up to k of the points that
+       list it, at i * k */
+    knn_entry *previous;
+    knn_entry *reverse;
+    int *reverse_count;
+    /* generator of the trees and the samples, drawn from the calling thread only */
+    rng_state *rng;
+} knn_job;
+
+/* block of rows [first, last) of a search */
+typedef struct
+{
+    knn_job *job;
+    int first;
+    int last;
+    long updates;
+} knn_block;
+
+/* function to parse a method name */
+int knn_method(const char *name)
+{
+    if (strcmp(name, "auto") == 0)
+    {
+        return KNN_AUTO;
+    }
+    if (strcmp(name, "brute") == 0)
+    {
+        return KNN_BRUTE;
+    }
+    if (strcmp(name, "kdtree") == 0)
+    {
+        return KNN_KDTREE;
+    }
+    if (strcmp(name, "descent") == 0)
+    {
+        return KNN_DESCENT;
+    }
+    return -1;
+}
+
+/* function returning the name of a method */
+const char *knn_method_name(int method)
+{
+    switch (method)
+    {
+    case KNN_BRUTE:
+        return "brute";
+    case KNN_KDTREE:
+        return "kdtree";
+    case KNN_DESCENT:
+        return "descent";
+    default:
+        return "auto";
+    }
+}
+
+/* function to resolve the automatic method */
+int knn_resolve(int method, int n, int d)
+{
+    if (method != KNN_AUTO)
+    {
+        return method;
+    }
+    if (n <= KNN_BRUTE_MAX_N)
+    {
+        return KNN_BRUTE;
+    }
+    return d <= KNN_KDTREE_MAX_D ? KNN_KDTREE : KNN_DESCENT;
+}
+
+/* Helper function to restore a max-heap after its root changed */
+static void sift_down(knn_entry *heap, int size, int i)
+{
+    for (;;)
+    {
+        int largest = i, left = 2 * i + 1, right = 2 * i + 2;
+        knn_entry tmp;
+        if (left < size && heap[left].dist > heap[largest].dist)
+        {
+            largest = left;
+        }
+        if (right < size && heap[right].dist > heap[largest].dist)
+        {
+            largest = right;
+        }
+        if (largest == i)
+        {
+            return;
+        }
+        tmp = heap[i];
+        heap[i] = heap[largest];
+        heap[largest] = tmp;
+        i = largest;
+    }
+}
+
+/* Helper function to offer a candidate to a heap of at most k entries, returns 1 when it was kept */
+static int heap_push(knn_entry *heap, int *size, int k, double dist, int index, int fresh)
+{
+    int i;
+    if (*size < k)
+    {
+        /* sift up */
+        i = (*size)++;
+        while (i > 0 && heap[(i - 1) / 2].dist < dist)
+        {
+            heap[i] = heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        heap[i].dist = dist;
+        heap[i].index = index;
+        heap[i].fresh = fresh;
+        return 1;
+    }
+    if (dist >= heap[0].dist)
+    {
+        return 0;
+    }
+    heap[0].dist = dist;
+    heap[0].index = index;
+    heap[0].fresh = fresh;
+    sift_down(heap, *size, 0);
+    return 1;
+}
+
+/* Helper function to order neighbours by distance, then by index */
+static int compare_entries(const void *a, const void *b)
+{
+    const knn_entry *left = (const knn_entry *)a, *right = (const knn_entry *)b;
+    if (left->dist != right->dist)
+    {
+        return left->dist < right->dist ? -1 : 1;
+    }
+    return (left->index > right->index) - (left->index < right->index);
+}
+
+/* Helper function to run a task on every block of rows, on the pool when there is one */
+static long run_blocks(knn_job *job, thread_pool *pool, pool_task task, int rows)
+{
+    int count = (job->n + rows - 1) / rows, b;
+    knn_block *blocks = (knn_block *)malloc(count * sizeof(knn_block));
+    task_group group;
+    long updates = 0;
+
+    group.pending = 0;
+    for (b = 0; b < count; b++)
+    {
+        blocks[b].job = job;
+        blocks[b].first = b * rows;
+        blocks[b].last = b == count - 1 ? job->n : (b + 1) * rows;
+        blocks[b].updates = 0;
+        if (pool == NULL || pool_submit_group(pool, &group, task, &blocks[b]) != 0)
+        {
+            task(&blocks[b]);
+        }
+    }
+    if (pool != NULL)
+    {
+        pool_wait(pool, &group);
+    }
+    for (b = 0; b < count; b++)
+    {
+        updates += blocks[b].updates;
+    }
+    free(blocks);
+    return updates;
+}
+
+/* task comparing every row of a block with all points, summing its degree on the way when asked */
+static void brute_rows(void *arg)
+{
+    knn_block *block = (knn_block *)arg;
+    knn_job *job = block->job;
+    int i, j, size;
+
+    for (i = block->first; i < block->last; i++)
+    {
+        knn_entry *heap = job->heaps + (size_t)i * job->k;
+        double degree = 0.0;
+        size = 0;
+        for (j = 0; j < job->n; j++)
+        {
+            double distance;
+            if (j == i)
+            {
+                continue;
+            }
+            distance = job->distance(job->points[i], job->points[j], job->d);
+            if (job->degrees != NULL)
+            {
+                degree += exp(-0.5 * distance);
+            }
+            heap_push(heap, &size, job->k, distance, j, KNN_STALE);
+        }
+        if (job->degrees != NULL)
+        {
+            job->degrees[i] = degree;
+        }
+    }
+}
+
+/* Helper function to move the nth smallest of count points along axis to index[nth], with the
+   smaller ones before it and the larger ones after it */
+static void select_nth(double **points, int *index, int count, int axis, int nth)
+{
+    int lo = 0, hi = count - 1;
+    while (lo < hi)
+    {
+        double pivot = points[index[lo + (hi - lo) / 2]][axis];
+        int i = lo, j = hi, tmp;
+        /* Hoare partition, which keeps runs of equal coordinates balanced */
+        while (i <= j)
+        {
+            while (points[index[i]][axis] < pivot)
+            {
+                i++;
+            }
+            while (points[index[j]][axis] > pivot)
+            {
+                j--;
+            }
+            if (i <= j)
+            {
+                tmp = index[i];
+                index[i++] = index[j];
+                index[j--] = tmp;
+            }
+        }
+        if (nth <= j)
+        {
+            hi = j;
+        }
+        else if (nth >= i)
+        {
+            lo = i;
+        }
+        else
+        {
+            return;
+        }
+    }
+}
+
+/* Helper function to build the subtree of the points index[first .. first + count - 1] at node
+   *used, split at the median of the coordinate of widest spread, returns the node */
+static int kd_build(knn_job *job, int first, int count, int *used)
+{
+    int node = (*used)++, axis = 0, i, a, half;
+    double widest = -1.0;
+    kd_node *kd = &job->nodes[node];
+
+    kd->first = first;
+    kd->count = count;
+    kd->left = -1;
+    kd->right = -1;
+    if (count <= KD_LEAF)
+    {
+        return node;
+    }
+    for (a = 0; a < job->d; a++)
+    {
+        double low = job->points[job->index[first]][a], high = low;
+        for (i = first + 1; i < first + count; i++)
+        {
+            double x = job->points[job->index[i]][a];
+            low = x < low ? x : low;
+            high = x > high ? x : high;
+        }
+        if (high - low > widest)
+        {
+            widest = high - low;
+            axis = a;
+        }
+    }
+    half = count / 2;
+    select_nth(job->points, job->index + first, count, axis, half);
+    kd->axis = axis;
+    kd->split = job->points[job->index[first + half]][axis];
+    kd->left = kd_build(job, first, half, used);
+    kd->right = kd_build(job, first + half, count - half, used);
+    return node;
+}
+
+/* Helper function to search the subtree of node for the neighbours of point self, nearer child first */
+static void kd_search(knn_job *job, int node, int self, knn_entry *heap, int *size)
+{
+    kd_node *kd = &job->nodes[node];
+    const double *q = job->points[self];
+    double gap;
+    int i;
+
+    if (kd->left < 0)
+    {
+        for (i = kd->first; i < kd->first + kd->count; i++)
+        {
+            int j = job->index[i];
+            if (j != self)
+            {
+                heap_push(heap, size, job->k, job->distance(q, job->points[j], job->d), j, KNN_STALE);
+            }
+        }
+        return;
+    }
+    gap = q[kd->axis] - kd->split;
+    /* points on the far side of the split are at least gap away */
+    kd_search(job, gap < 0.0 ? kd->left : kd->right, self, heap, size);
+    if (*size < job->k || gap * gap < heap[0].dist)
+    {
+        kd_search(job, gap < 0.0 ? kd->right : kd->left, self, heap, size);
+    }
+}
+
+/* task searching the tree for the rows of a block, taken in leaf order so neighbouring queries
+   walk the same paths */
+static void kd_rows(void *arg)
+{
+    knn_block *block = (knn_block *)arg;
+    knn_job *job = block->job;
+    int t;
+
+    for (t = block->first; t < block->last; t++)
+    {
+        int i = job->index[t], size = 0;
+        kd_search(job, 0, i, job->heaps + (size_t)i * job->k, &size);
+    }
+}
+
+/* Helper function to find the neighbours with a KD-tree: O(n log n) to build, and about
+   O(log n) per query in low dimension */
+static void kd_knn(knn_job *job, thread_pool *pool)
+{
+    int used = 0, i;
+
+    job->index = (int *)malloc(job->n * sizeof(int));
+    /* median splits keep every leaf above KD_LEAF / 2 points, bounding the number of nodes */
+    job->nodes = (kd_node *)malloc((4 * (size_t)job->n / KD_LEAF + 4) * sizeof(kd_node));
+    for (i = 0; i < job->n; i++)
+    {
+        job->index[i] = i;
+    }
+    kd_build(job, 0, job->n, &used);
+    run_blocks(job, pool, kd_rows, KNN_BLOCK_ROWS);
+    free(job->nodes);
+    free(job->index);
+}
+
+/* task running a round of NN-descent on the rows of a block: every point tries the neighbours of
+   its neighbours, forward and reverse, from the heaps of the previous round; a pair where neither
+   link was sampled is skipped, it was tried in an earlier round or waits for a later one */
+static void descent_rows(void *arg)
+{
+    knn_block *block = (knn_block *)arg;
+    knn_job *job = block->job;
+    int k = job->k;
+    /* seen[w] == i when w was already tried for point i */
+    int *seen = (int *)malloc(job->n * sizeof(int));
+    int i, s, t, w;
+
+    for (w = 0; w < job->n; w++)
+    {
+        seen[w] = -1;
+    }
+    for (i = block->first; i < block->last; i++)
+    {
+        knn_entry *heap = job->heaps + (size_t)i * k, *lists[2];
+        int counts[2], size = k, l;
+
+        /* the heap starts as the previous one, where the sampled entries are now stale */
+        memcpy(heap, job->previous + (size_t)i * k, k * sizeof(knn_entry));
+        seen[i] = i;
+        for (s = 0; s < k; s++)
+        {
+            heap[s].fresh = heap[s].fresh == KNN_FRESH ? KNN_FRESH : KNN_STALE;
+            seen[heap[s].index] = i;
+        }
+        lists[0] = job->previous + (size_t)i * k;
+        counts[0] = k;
+        lists[1] = job->reverse + (size_t)i * k;
+        counts[1] = job->reverse_count[i];
+        for (l = 0; l < 2; l++)
+        {
+            for (s = 0; s < counts[l]; s++)
+            {
+                int v = lists[l][s].index, m;
+                knn_entry *vlists[2];
+                int vcounts[2];
+                vlists[0] = job->previous + (size_t)v * k;
+                vcounts[0] = k;
+                vlists[1] = job->reverse + (size_t)v * k;
+                vcounts[1] = job->reverse_count[v];
+                for (m = 0; m < 2; m++)
+                {
+                    for (t = 0; t < vcounts[m]; t++)
+                    {
+                        w = vlists[m][t].index;
+                        if (seen[w] == i || (lists[l][s].fresh != KNN_SAMPLED && vlists[m][t].fresh != KNN_SAMPLED))
+                        {
+                            continue;
+                        }
+                        seen[w] = i;
+                        block->updates += heap_push(heap, &size, k, job->distance(job->points[i], job->points[w], job->d),
+                                                    w, KNN_FRESH);
+                    }
+                }
+            }
+        }
+    }
+    free(seen);
+}
+
+/* Helper function to prepare a round of NN-descent: sample the fresh neighbours of every point
+   that join, then list for every point up to k of the points that have it as a neighbour, sampled
+   uniformly when there are more */
+static void descent_sample(knn_job *job)
+{
+    int k = job->k, i, s, sample = (int)ceil(KNN_DESCENT_SAMPLE * k);
+    int *seen = (int *)calloc(job->n, sizeof(int));
+
+    for (i = 0; i < job->n; i++)
+    {
+        knn_entry *heap = job->heaps + (size_t)i * k;
+        int fresh = 0, wanted = sample;
+        job->reverse_count[i] = 0;
+        for (s = 0; s < k; s++)
+        {
+            fresh += heap[s].fresh == KNN_FRESH;
+        }
+        /* selection sampling: every fresh entry is taken with probability wanted / fresh left */
+        for (s = 0; s < k && wanted > 0; s++)
+        {
+            if (heap[s].fresh == KNN_FRESH)
+            {
+                if (rng_uniform(job->rng) * fresh < wanted)
+                {
+                    heap[s].fresh = KNN_SAMPLED;
+                    wanted--;
+                }
+                fresh--;
+            }
+        }
+    }
+    for (i = 0; i < job->n; i++)
+    {
+        for (s = 0; s < k; s++)
+        {
+            knn_entry entry = job->heaps[(size_t)i * k + s];
+            int v = entry.index, slot = seen[v]++;
+            entry.index = i;
+            if (slot >= k)
+            {
+                /* reservoir sampling */
+                slot = (int)(rng_uniform(job->rng) * (slot + 1));
+                if (slot >= k)
+                {
+                    continue;
+                }
+            }
+            else
+            {
+                job->reverse_count[v]++;
+            }
+            job->reverse[(size_t)v * k + slot] = entry;
+        }
+    }
+    free(seen);
+}
+
+/* Helper function to offer a fresh candidate to a heap being filled, unless the heap has it already */
+static void heap_offer(knn_entry *heap, int *size, int k, double dist, int index)
+{
+    int s;
+    if (*size == k && dist >= heap[0].dist)
+    {
+        return;
+    }
+    for (s = 0; s < *size && heap[s].index != index; s++)
+    {
+    }
+    if (s == *size)
+    {
+        heap_push(heap, size, k, dist, index, KNN_FRESH);
+    }
+}
+
+/* Helper function to split the points index[0 .. count - 1] by the hyperplane halfway between two
+   random ones, down to leaves of at most leaf points whose pairs all become candidates. Without
+   sizes the leaves are left alone and only the order of index matters */
+static void rp_split(knn_job *job, int *index, int count, int leaf, int *sizes, double *projections)
+{
+    int k = job->k, a, b, s, t, low;
+    double offset = 0.0;
+    const double *p, *q;
+
+    if (count <= leaf)
+    {
+        for (s = 0; s < count && sizes != NULL; s++)
+        {
+            for (t = s + 1; t < count; t++)
+            {
+                a = index[s];
+                b = index[t];
+                offset = job->distance(job->points[a], job->points[b], job->d);
+                heap_offer(job->heaps + (size_t)a * k, &sizes[a], k, offset, b);
+                heap_offer(job->heaps + (size_t)b * k, &sizes[b], k, offset, a);
+            }
+        }
+        return;
+    }
+    a = (int)(rng_uniform(job->rng) * count);
+    b = (int)(rng_uniform(job->rng) * (count - 1));
+    b += b >= a;
+    p = job->points[index[a]];
+    q = job->points[index[b]];
+    /* side of x: (p - q) . x against (p - q) . (p + q) / 2 */
+    for (t = 0; t < job->d; t++)
+    {
+        offset += (p[t] - q[t]) * (p[t] + q[t]) * 0.5;
+    }
+    for (s = 0; s < count; s++)
+    {
+        const double *x = job->points[index[s]];
+        projections[s] = -offset;
+        for (t = 0; t < job->d; t++)
+        {
+            projections[s] += (p[t] - q[t]) * x[t];
+        }
+    }
+    /* points on q's side go first */
+    low = 0;
+    for (s = 0; s < count; s++)
+    {
+        if (projections[s] < 0.0)
+        {
+            int tmp = index[s];
+            double value = projections[s];
+            index[s] = index[low];
+            projections[s] = projections[low];
+            index[low] = tmp;
+            projections[low++] = value;
+        }
+    }
+    /* duplicate points leave a side empty, they are split in halves instead */
+    if (low == 0 || low == count)
+    {
+        low = count / 2;
+    }
+    rp_split(job, index, low, leaf, sizes, projections);
+    rp_split(job, index + low, count - low, leaf, sizes, projections + low);
+}
+
+/* Helper function to find approximate neighbours by NN-descent from the candidates of random
+   projection trees. Every round reads
+   the graph of the previous one and writes a new one, so rows run in parallel without locks and
+   the result does not depend on the number of threads */
+static void descent_knn(knn_job *job, thread_pool *pool, int threads, unsigned int seed)
+{
+    int k = job->k, n = job->n, d = job->d, i, s, tree, round;
+    int rows = (n + 4 * threads - 1) / (4 * threads);
+    int *index = (int *)malloc(n * sizeof(int));
+    int *order = (int *)malloc(n * sizeof(int));
+    int *sizes = (int *)calloc(n, sizeof(int));
+    double *projections = (double *)malloc(n * sizeof(double));
+    double *values = (double *)malloc(((size_t)n * d + 1) * sizeof(double));
+    double **points = job->points;
+    knn_entry *swap;
+    rng_state rng;
+
+    /* a block allocates a marker per point, so there are a few blocks per thread rather than many */
+    rows = rows > KNN_BLOCK_ROWS ? rows : KNN_BLOCK_ROWS;
+    job->previous = (knn_entry *)malloc((size_t)n * k * sizeof(knn_entry));
+    job->reverse = (knn_entry *)malloc((size_t)n * k * sizeof(knn_entry));
+    job->reverse_count = (int *)malloc(n * sizeof(int));
+    rng_seed(&rng, RNG_MT19937, seed);
+    job->rng = &rng;
+
+    /* the search runs on a copy of the points in the leaf order of a first tree, so the points a
+       round reads together, and their heaps, sit close in memory */
+    for (i = 0; i < n; i++)
+    {
+        order[i] = i;
+    }
+    rp_split(job, order, n, 2 * k, NULL, projections);
+    job->points = (double **)malloc(n * sizeof(double *));
+    for (i = 0; i < n; i++)
+    {
+        job->points[i] = values + (size_t)i * d;
+        memcpy(job->points[i], points[order[i]], d * sizeof(double));
+        index[i] = i;
+    }
+
+    for (tree = 0; tree < KNN_DESCENT_TREES; tree++)
+    {
+        rp_split(job, index, n, 2 * k, sizes, projections);
+    }
+    /* points the trees left short of k candidates get random ones */
+    for (i = 0; i < n; i++)
+    {
+        while (sizes[i] < k)
+        {
+            int j = (int)(rng_uniform(job->rng) * n);
+            if (j != i)
+            {
+                heap_offer(job->heaps + (size_t)i * k, &sizes[i], k, job->distance(job->points[i], job->points[j], d), j);
+            }
+        }
+    }
+    for (round = 0; round < KNN_DESCENT_ROUNDS; round++)
+    {
+        long updates;
+        descent_sample(job);
+        swap = job->previous;
+        job->previous = job->heaps;
+        job->heaps = swap;
+        updates = run_blocks(job, pool, descent_rows, rows);
+        if (updates < KNN_DESCENT_DELTA * n * k)
+        {
+            break;
+        }
+    }
+
+    /* back to the numbering of the caller */
+    for (i = 0; i < n; i++)
+    {
+        for (s = 0; s < k; s++)
+        {
+            knn_entry entry = job->heaps[(size_t)i * k + s];
+            entry.index = order[entry.index];
+            job->previous[(size_t)order[i] * k + s] = entry;
+        }
+    }
+    swap = job->previous;
+    job->previous = job->heaps;
+    job->heaps = swap;
+    free(job->points);
+    job->points = points;
+    free(values);
+    free(index);
+    free(order);
+    free(sizes);
+    free(projections);
+    free(job->previous);
+    free(job->reverse);
+    free(job->reverse_count);
+}
+
+/* function to find the k nearest neighbours of every point */
+knn_graph *knn_search(double **points, int n, int d, int k, int method, int threads, unsigned int seed,
+                      double *degrees)
+{
+    knn_graph *graph = (knn_graph *)malloc(sizeof(knn_graph));
+    thread_pool *pool;
+    knn_job job;
+    int i, t;
+
+    k = k < n - 1 ? k : n - 1;
+    k = k > 0 ? k : 0;
+    method = knn_resolve(method, n, d);
+    job.points = points;
+    job.n = n;
+    job.d = d;
+    job.k = k;
+    /* selected here, not lazily by the workers */
+    job.distance = select_distance(d);
+    job.heaps = (knn_entry *)malloc(((size_t)n * k + 1) * sizeof(knn_entry));
+    job.degrees = method == KNN_BRUTE ? degrees : NULL;
+    pool = threads > 1 && n > KNN_BLOCK_ROWS ? pool_create(threads) : NULL;
+    threads = pool != NULL ? threads : 1;
+
+    if (k == 0)
+    {
+        /* nothing to search, and a single point has no degree */
+        for (i = 0; degrees != NULL && method == KNN_BRUTE && i < n; i++)
+        {
+            degrees[i] = 0.0;
+        }
+    }
+    else if (method == KNN_KDTREE)
+    {
+        kd_knn(&job, pool);
+    }
+    else if (method == KNN_DESCENT)
+    {
+        descent_knn(&job, pool, threads, seed);
+    }
+    else
+    {
+        run_blocks(&job, pool, brute_rows, KNN_BLOCK_ROWS);
+    }
+    if (pool != NULL)
+    {
+        pool_destroy(pool);
+    }
+
+    graph->n = n;
+    graph->k = k;
+    graph->neighbors = (int *)malloc(((size_t)n * k + 1) * sizeof(int));
+    graph->distances = (double *)malloc(((size_t)n * k + 1) * sizeof(double));
+    for (i = 0; i < n; i++)
+    {
+        knn_entry *heap = job.heaps + (size_t)i * k;
+        qsort(heap, k, sizeof(knn_entry), compare_entries);
+        for (t = 0; t < k; t++)
+        {
+            graph->neighbors[(size_t)i * k + t] = heap[t].index;
+            graph->distances[(size_t)i * k + t] = heap[t].dist;
+        }
+    }
+    free(job.heaps);
+    return graph;
+}
+
+/* function to calculate the recall of a neighbour graph against the exact one */
+double knn_recall(knn_graph *approx, knn_graph *exact)
+{
+    long found = 0;
+    int i, s, t;
+
+    if (approx->n != exact->n || exact->n == 0 || exact->k == 0)
+    {
+        return approx->n == exact->n ? 1.0 : 0.0;
+    }
+    for (i = 0; i < exact->n; i++)
+    {
+        for (t = 0; t < exact->k; t++)
+        {
+            int j = exact->neighbors[(size_t)i * exact->k + t];
+            for (s = 0; s < approx->k && approx->neighbors[(size_t)i * approx->k + s] != j; s++)
+            {
+            }
+            found += s < approx->k;
+        }
+    }
+    return (double)found / ((double)exact->n * exact->k);
+}
+
+/* helper function to free a neighbour graph */
+void free_knn(knn_graph *graph)
+{
+    free(graph->neighbors);
+    free(graph->distances);
+    free(graph);
+}
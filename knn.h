@@ -0,0 +1,47 @@
+#ifndef KNN_H
+#define KNN_H
+
+/* Nearest neighbour search methods: brute force compares all pairs, the KD-tree is exact and fast
+   in low dimension, NN-descent is approximate and keeps its speed in higher dimension; auto picks
+   brute force for small inputs, then the KD-tree up to KNN_KDTREE_MAX_D dimensions */
+#define KNN_AUTO 0
+#define KNN_BRUTE 1
+#define KNN_KDTREE 2
+#define KNN_DESCENT 3
+
+/* points below which auto searches by brute force */
+#define KNN_BRUTE_MAX_N 2000
+/* dimensions up to which auto uses the KD-tree */
+#define KNN_KDTREE_MAX_D 8
+
+/* The k nearest neighbours of every point (itself excluded), closest first: the neighbours of
+   point i and their squared distances are at i * k */
+typedef struct
+{
+    int n;
+    int k;
+    int *neighbors;
+    double *distances;
+} knn_graph;
+
+/* Function to parse a method name ("auto", "brute", "kdtree" or "descent"), returns -1 when unknown */
+int knn_method(const char *name);
+
+/* Function returning the name of a method */
+const char *knn_method_name(int method);
+
+/* Function to resolve KNN_AUTO for n points of dimension d, other methods are returned as they are */
+int knn_resolve(int method, int n, int d);
+
+/* Function to find the k nearest neighbours of every point on threads threads. degrees, when not
+   NULL and the method is brute force, receives the row sums of sym computed in the same pass */
+knn_graph *knn_search(double **points, int n, int d, int k, int method, int threads, unsigned int seed,
+                      double *degrees);
+
+/* Function to calculate the fraction of the neighbours in exact that approx also found */
+double knn_recall(knn_graph *approx, knn_graph *exact);
+
+/* Helper function to free a neighbour graph */
+void free_knn(knn_graph *graph);
+
+#endif /* KNN_H */
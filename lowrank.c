@@ -0,0 +1,648 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include "symnmf.h"
+#include "rng.h"
+#include "lowrank.h"
+
+/* eigenvalues below this fraction of the largest one are treated as zero */
+#define EIGEN_CUTOFF 1e-10
+/* number of rows used to estimate the approximation error */
+#define ERROR_SAMPLE_ROWS 64
+/* smallest degree accepted when normalizing an approximated matrix */
+#define MIN_DEGREE 1e-12
+
+/* function to compute all eigenvalues (descending) and eigenvectors (columns) of a symmetric matrix */
+void symmetric_eigen(double **A, int m, double *values, double **vectors)
+{
+    double **a = initialize_matrix(m, m);
+    int sweep, p, q, r;
+
+    for (p = 0; p < m; p++)
+    {
+        for (q = 0; q < m; q++)
+        {
+            a[p][q] = A[p][q];
+            vectors[p][q] = (p == q) ? 1.0 : 0.0;
+        }
+    }
+
+    /* cyclic Jacobi rotations until the off-diagonal part vanishes */
+    for (sweep = 0; sweep < 100; sweep++)
+    {
+        double off = 0.0, total = 0.0;
+        for (p = 0; p < m; p++)
+        {
+            for (q = 0; q < m; q++)
+            {
+                total += a[p][q] * a[p][q];
+                if (p != q)
+                {
+                    off += a[p][q] * a[p][q];
+                }
+            }
+        }
+        if (off <= 1e-24 * total)
+        {
+            break;
+        }
+
+        for (p = 0; p < m - 1; p++)
+        {
+            for (q = p + 1; q < m; q++)
+            {
+                double theta, t, c, s;
+                if (a[p][q] == 0.0)
+                {
+                    continue;
+                }
+                theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+                t = (theta >= 0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+                c = 1.0 / sqrt(t * t + 1.0);
+                s = t * c;
+                for (r = 0; r < m; r++)
+                {
+                    double arp = a[r][p], arq = a[r][q];
+                    a[r][p] = c * arp - s * arq;
+                    a[r][q] = s * arp + c * arq;
+                }
+                for (r = 0; r < m; r++)
+                {
+                    double apr = a[p][r], aqr = a[q][r];
+                    a[p][r] = c * apr - s * aqr;
+                    a[q][r] = s * apr + c * aqr;
+                }
+                for (r = 0; r < m; r++)
+                {
+                    double vrp = vectors[r][p], vrq = vectors[r][q];
+                    vectors[r][p] = c * vrp - s * vrq;
+                    vectors[r][q] = s * vrp + c * vrq;
+                }
+            }
+        }
+    }
+
+    for (p = 0; p < m; p++)
+    {
+        values[p] = a[p][p];
+    }
+    free_matrix(a, m);
+
+    /* selection sort by descending eigenvalue, swapping eigenvector columns along */
+    for (p = 0; p < m - 1; p++)
+    {
+        int best = p;
+        for (q = p + 1; q < m; q++)
+        {
+            if (values[q] > values[best])
+            {
+                best = q;
+            }
+        }
+        if (best != p)
+        {
+            double tmp = values[p];
+            values[p] = values[best];
+            values[best] = tmp;
+            for (r = 0; r < m; r++)
+            {
+                tmp = vectors[r][p];
+                vectors[r][p] = vectors[r][best];
+                vectors[r][best] = tmp;
+            }
+        }
+    }
+}
+
+/* Helper function to choose m distinct landmarks uniformly at random */
+static void sample_uniform(int n, int m, int *landmarks, rng_state *rng)
+{
+    int *order = (int *)malloc(n * sizeof(int));
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        order[i] = i;
+    }
+    /* partial Fisher-Yates shuffle */
+    for (i = 0; i < m; i++)
+    {
+        int j = i + (int)(rng_uniform(rng) * (n - i));
+        int tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+        landmarks[i] = order[i];
+    }
+    free(order);
+}
+
+/* Helper function to choose m landmarks by k-means++ seeding (D^2 sampling) */
+static void sample_kmeanspp(double **points, int n, int d, int m, int *landmarks, rng_state *rng)
+{
+    double *min_dist = (double *)malloc(n * sizeof(double));
+    int i, l;
+
+    landmarks[0] = (int)(rng_uniform(rng) * n);
+    for (i = 0; i < n; i++)
+    {
+        min_dist[i] = euclidean_distance(points[i], points[landmarks[0]], d);
+    }
+
+    for (l = 1; l < m; l++)
+    {
+        double total = 0.0, target, running = 0.0;
+        int chosen = -1;
+
+        for (i = 0; i < n; i++)
+        {
+            total += min_dist[i];
+        }
+        target = rng_uniform(rng) * total;
+        for (i = 0; i < n; i++)
+        {
+            if (min_dist[i] > 0.0)
+            {
+                chosen = i;
+                running += min_dist[i];
+                if (running > target)
+                {
+                    break;
+                }
+            }
+        }
+        if (chosen < 0)
+        {
+            /* every point coincides with a landmark, the rest add nothing */
+            chosen = (int)(rng_uniform(rng) * n);
+        }
+
+        landmarks[l] = chosen;
+        for (i = 0; i < n; i++)
+        {
+            double dist = euclidean_distance(points[i], points[chosen], d);
+            if (dist < min_dist[i])
+            {
+                min_dist[i] = dist;
+            }
+        }
+    }
+    free(min_dist);
+}
+
+/* Helper function to estimate the relative error of the unnormalized factor on sampled rows */
+static double nystrom_error(double **points, int n, int d, double **U0, int rank, rng_state *rng)
+{
+    int rows = n < ERROR_SAMPLE_ROWS ? n : ERROR_SAMPLE_ROWS;
+    int s, j, a;
+    double diff = 0.0, norm = 0.0;
+
+    for (s = 0; s < rows; s++)
+    {
+        int i = (rows == n) ? s : (int)(rng_uniform(rng) * n);
+        for (j = 0; j < n; j++)
+        {
+            double exact, approx = 0.0;
+            if (j == i)
+            {
+                continue;
+            }
+            exact = exp(-0.5 * euclidean_distance(points[i], points[j], d));
+            for (a = 0; a < rank; a++)
+            {
+                approx += U0[i][a] * U0[j][a];
+            }
+            diff += (exact - approx) * (exact - approx);
+            norm += exact * exact;
+        }
+    }
+    return norm > 0.0 ? sqrt(diff / norm) : 0.0;
+}
+
+/* function to build the Nystrom approximation of the normalized similarity matrix from m landmarks */
+lowrank *nystrom(double **points, int n, int d, int m, int sampling, unsigned int seed)
+{
+    lowrank *lr;
+    int *landmarks;
+    double **C, **Wmm, **vectors, **U0;
+    double *values, *col_sum;
+    int i, a, b, rank;
+    rng_state rng;
+
+    if (m > n)
+    {
+        m = n;
+    }
+    if (m < 1)
+    {
+        return NULL;
+    }
+
+    rng_seed(&rng, RNG_MT19937, seed);
+    landmarks = (int *)malloc(m * sizeof(int));
+    if (sampling == SAMPLING_KMEANSPP)
+    {
+        sample_kmeanspp(points, n, d, m, landmarks, &rng);
+    }
+    else
+    {
+        sample_uniform(n, m, landmarks, &rng);
+    }
+
+    /* n x m Gaussian block between all points and the landmarks, and the m x m block among landmarks */
+    C = initialize_matrix(n, m);
+    for (i = 0; i < n; i++)
+    {
+        for (a = 0; a < m; a++)
+        {
+            C[i][a] = exp(-0.5 * euclidean_distance(points[i], points[landmarks[a]], d));
+        }
+    }
+    Wmm = initialize_matrix(m, m);
+    for (a = 0; a < m; a++)
+    {
+        for (b = 0; b < m; b++)
+        {
+            Wmm[a][b] = C[landmarks[a]][b];
+        }
+    }
+
+    /* pseudo-inverse square root of the landmark block through its eigendecomposition */
+    values = (double *)malloc(m * sizeof(double));
+    vectors = initialize_matrix(m, m);
+    symmetric_eigen(Wmm, m, values, vectors);
+    rank = 0;
+    while (rank < m && values[rank] > EIGEN_CUTOFF * values[0])
+    {
+        rank++;
+    }
+    for (a = 0; a < m; a++)
+    {
+        for (b = 0; b < rank; b++)
+        {
+            vectors[a][b] /= sqrt(values[b]);
+        }
+    }
+
+    /* U0 = C * V * Lambda^(-1/2), so that the Gaussian kernel is ~ U0 * U0^T */
+    U0 = initialize_matrix(n, rank);
+    for (i = 0; i < n; i++)
+    {
+        for (a = 0; a < m; a++)
+        {
+            double c = C[i][a];
+            for (b = 0; b < rank; b++)
+            {
+                U0[i][b] += c * vectors[a][b];
+            }
+        }
+    }
+
+    lr = (lowrank *)malloc(sizeof(lowrank));
+    lr->n = n;
+    lr->rank = rank;
+    lr->error = nystrom_error(points, n, d, U0, rank, &rng);
+    lr->lambda = (double *)malloc(rank * sizeof(double));
+    lr->diag = (double *)malloc(n * sizeof(double));
+    for (b = 0; b < rank; b++)
+    {
+        lr->lambda[b] = 1.0;
+    }
+
+    /* degrees of the similarity matrix, whose diagonal is zero: d = U0 * (U0^T * 1) - diag(U0 * U0^T) */
+    col_sum = (double *)calloc(rank > 0 ? rank : 1, sizeof(double));
+    for (i = 0; i < n; i++)
+    {
+        for (b = 0; b < rank; b++)
+        {
+            col_sum[b] += U0[i][b];
+        }
+    }
+    for (i = 0; i < n; i++)
+    {
+        double degree = 0.0, row_sq = 0.0, scale;
+        for (b = 0; b < rank; b++)
+        {
+            degree += U0[i][b] * col_sum[b];
+            row_sq += U0[i][b] * U0[i][b];
+        }
+        degree -= row_sq;
+        scale = 1.0 / sqrt(degree > MIN_DEGREE ? degree : MIN_DEGREE);
+
+        /* U = D^(-1/2) * U0 and the diagonal correction zeroes the diagonal of U * U^T */
+        for (b = 0; b < rank; b++)
+        {
+            U0[i][b] *= scale;
+        }
+        lr->diag[i] = -row_sq * scale * scale;
+    }
+    lr->U = U0;
+
+    free(landmarks);
+    free(values);
+    free(col_sum);
+    free_matrix(C, n);
+    free_matrix(Wmm, m);
+    free_matrix(vectors, m);
+    return lr;
+}
+
+/* function returning a standard normal random number (Box-Muller) */
+static double normal_random(rng_state *rng)
+{
+    double u1 = 1.0 - rng_uniform(rng);
+    double u2 = rng_uniform(rng);
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * 3.14159265358979323846 * u2);
+}
+
+/* Helper function to orthonormalize the columns of an n x l matrix in place (modified Gram-Schmidt) */
+static void orthonormalize(double **Q, int n, int l)
+{
+    int i, a, b, pass;
+
+    for (a = 0; a < l; a++)
+    {
+        double norm = 0.0;
+        /* two passes keep the basis orthogonal to working precision */
+        for (pass = 0; pass < 2; pass++)
+        {
+            for (b = 0; b < a; b++)
+            {
+                double dot = 0.0;
+                for (i = 0; i < n; i++)
+                {
+                    dot += Q[i][a] * Q[i][b];
+                }
+                for (i = 0; i < n; i++)
+                {
+                    Q[i][a] -= dot * Q[i][b];
+                }
+            }
+        }
+        for (i = 0; i < n; i++)
+        {
+            norm += Q[i][a] * Q[i][a];
+        }
+        norm = sqrt(norm);
+        for (i = 0; i < n; i++)
+        {
+            Q[i][a] = norm > 0.0 ? Q[i][a] / norm : 0.0;
+        }
+    }
+}
+
+/* Helper function to calculate the relative Frobenius error of a factorization of a dense W */
+static double lowrank_error(double **W, lowrank *lr)
+{
+    int n = lr->n, i, j, a;
+    double diff = 0.0, norm = 0.0;
+    double *scaled = (double *)malloc((lr->rank > 0 ? lr->rank : 1) * sizeof(double));
+
+    for (i = 0; i < n; i++)
+    {
+        for (a = 0; a < lr->rank; a++)
+        {
+            scaled[a] = lr->U[i][a] * lr->lambda[a];
+        }
+        for (j = 0; j < n; j++)
+        {
+            double approx = (i == j) ? lr->diag[i] : 0.0;
+            for (a = 0; a < lr->rank; a++)
+            {
+                approx += scaled[a] * lr->U[j][a];
+            }
+            diff += (W[i][j] - approx) * (W[i][j] - approx);
+            norm += W[i][j] * W[i][j];
+        }
+    }
+    free(scaled);
+    return norm > 0.0 ? sqrt(diff / norm) : 0.0;
+}
+
+/* function to compute a rank-r eigendecomposition of a dense symmetric W by a randomized range finder */
+lowrank *randomized_eigen(double **W, int n, int r, int oversample, int power_iters, unsigned int seed)
+{
+    lowrank *lr;
+    double **Q, **Z, **Qt, **B, **vectors;
+    double *values;
+    int *order;
+    int l, i, a, b, q;
+    rng_state rng;
+
+    if (r > n)
+    {
+        r = n;
+    }
+    if (r < 1)
+    {
+        return NULL;
+    }
+    l = r + (oversample > 0 ? oversample : 0);
+    if (l > n)
+    {
+        l = n;
+    }
+
+    /* range of W applied to a Gaussian test matrix, sharpened by power iterations */
+    rng_seed(&rng, RNG_MT19937, seed);
+    Q = initialize_matrix(n, l);
+    for (i = 0; i < n; i++)
+    {
+        for (a = 0; a < l; a++)
+        {
+            Q[i][a] = normal_random(&rng);
+        }
+    }
+    for (q = 0; q <= power_iters; q++)
+    {
+        Z = matrix_multiplication(W, n, n, Q, n, l);
+        free_matrix(Q, n);
+        Q = Z;
+        orthonormalize(Q, n, l);
+    }
+
+    /* projection B = Q^T * W * Q and its small eigendecomposition */
+    Z = matrix_multiplication(W, n, n, Q, n, l);
+    Qt = transpose(Q, n, l);
+    B = matrix_multiplication(Qt, l, n, Z, n, l);
+    for (a = 0; a < l; a++)
+    {
+        for (b = 0; b < a; b++)
+        {
+            B[a][b] = B[b][a] = 0.5 * (B[a][b] + B[b][a]);
+        }
+    }
+    values = (double *)malloc(l * sizeof(double));
+    vectors = initialize_matrix(l, l);
+    symmetric_eigen(B, l, values, vectors);
+
+    /* keep the r eigenpairs of largest magnitude */
+    order = (int *)malloc(l * sizeof(int));
+    for (a = 0; a < l; a++)
+    {
+        order[a] = a;
+    }
+    for (a = 0; a < r; a++)
+    {
+        int best = a;
+        for (b = a + 1; b < l; b++)
+        {
+            if (fabs(values[order[b]]) > fabs(values[order[best]]))
+            {
+                best = b;
+            }
+        }
+        b = order[a];
+        order[a] = order[best];
+        order[best] = b;
+    }
+
+    lr = (lowrank *)malloc(sizeof(lowrank));
+    lr->n = n;
+    lr->rank = r;
+    lr->U = initialize_matrix(n, r);
+    lr->lambda = (double *)malloc(r * sizeof(double));
+    lr->diag = (double *)calloc(n, sizeof(double));
+    for (a = 0; a < r; a++)
+    {
+        lr->lambda[a] = values[order[a]];
+    }
+    for (i = 0; i < n; i++)
+    {
+        for (b = 0; b < l; b++)
+        {
+            double qib = Q[i][b];
+            for (a = 0; a < r; a++)
+            {
+                lr->U[i][a] += qib * vectors[b][order[a]];
+            }
+        }
+    }
+    lr->error = lowrank_error(W, lr);
+
+    free(values);
+    free(order);
+    free_matrix(vectors, l);
+    free_matrix(B, l);
+    free_matrix(Qt, l);
+    free_matrix(Z, n);
+    free_matrix(Q, n);
+    return lr;
+}
+
+/* function to calculate W*H for a factorized W in O(n*rank*k) */
+double **lowrank_multiply(lowrank *lr, double **H, int k)
+{
+    int n = lr->n, rank = lr->rank;
+    double **UtH = initialize_matrix(rank > 0 ? rank : 1, k);
+    double **output = initialize_matrix(n, k);
+    int i, a, c;
+
+    /* first thin product: lambda * U^T * H is rank x k */
+    for (i = 0; i < n; i++)
+    {
+        for (a = 0; a < rank; a++)
+        {
+            double u = lr->U[i][a];
+            for (c = 0; c < k; c++)
+            {
+                UtH[a][c] += u * H[i][c];
+            }
+        }
+    }
+    for (a = 0; a < rank; a++)
+    {
+        for (c = 0; c < k; c++)
+        {
+            UtH[a][c] *= lr->lambda[a];
+        }
+    }
+
+    /* second thin product plus the diagonal correction */
+    for (i = 0; i < n; i++)
+    {
+        for (c = 0; c < k; c++)
+        {
+            double sum = lr->diag[i] * H[i][c];
+            for (a = 0; a < rank; a++)
+            {
+                sum += lr->U[i][a] * UtH[a][c];
+            }
+            output[i][c] = sum;
+        }
+    }
+
+    free_matrix(UtH, rank > 0 ? rank : 1);
+    return output;
+}
+
+/* W*H callback of the affinity operator */
+static double **lowrank_op_multiply(void *data, double **H, int n, int k)
+{
+    (void)n;
+    return lowrank_multiply((lowrank *)data, H, k);
+}
+
+/* ||W||^2 callback of the affinity operator: with G = U^T U, ||U diag(lambda) U^T||^2 is the sum of
+   lambda_a lambda_b G_ab^2, and the diagonal adds its squares and twice its products with the
+   diagonal of U diag(lambda) U^T, all in O(n * rank^2) */
+static double lowrank_op_norm2(void *data, int n)
+{
+    lowrank *lr = (lowrank *)data;
+    int rank = lr->rank, i, a, b;
+    double *G = (double *)calloc(rank > 0 ? rank * rank : 1, sizeof(double));
+    double norm2 = 0.0;
+
+    for (i = 0; i < n; i++)
+    {
+        double inner = 0.0;
+        for (a = 0; a < rank; a++)
+        {
+            inner += lr->lambda[a] * lr->U[i][a] * lr->U[i][a];
+            for (b = 0; b < rank; b++)
+            {
+                G[a * rank + b] += lr->U[i][a] * lr->U[i][b];
+            }
+        }
+        norm2 += lr->diag[i] * lr->diag[i] + 2.0 * lr->diag[i] * inner;
+    }
+    for (a = 0; a < rank; a++)
+    {
+        for (b = 0; b < rank; b++)
+        {
+            norm2 += lr->lambda[a] * lr->lambda[b] * G[a * rank + b] * G[a * rank + b];
+        }
+    }
+    free(G);
+    return norm2;
+}
+
+/* destroy callback of the affinity operator */
+static void lowrank_op_destroy(void *data)
+{
+    free_lowrank((lowrank *)data);
+}
+
+/* function to wrap a factorized matrix as an affinity operator that owns it */
+void lowrank_op(lowrank *lr, affinity_op *op)
+{
+    op->data = lr;
+    op->multiply = lowrank_op_multiply;
+    /* a row of U diag(lambda) U^T H still needs all of U^T H */
+    op->multiply_rows = NULL;
+    op->norm2 = lowrank_op_norm2;
+    op->destroy = lowrank_op_destroy;
+}
+
+/* Helper function to free a factorized matrix */
+void free_lowrank(lowrank *lr)
+{
+    if (lr == NULL)
+    {
+        return;
+    }
+    free_matrix(lr->U, lr->n);
+    free(lr->lambda);
+    free(lr->diag);
+    free(lr);
+}
@@ -0,0 +1,41 @@
+#ifndef LOWRANK_H
+#define LOWRANK_H
+
+#include "symnmf.h"
+
+/* Landmark sampling strategies of the Nystrom approximation */
+#define SAMPLING_UNIFORM 0
+#define SAMPLING_KMEANSPP 1
+
+/* Symmetric matrix in factorized form: W ~ U * diag(lambda) * U^T + diag(diag) */
+typedef struct
+{
+    int n;
+    int rank;
+    double **U;
+    double *lambda;
+    double *diag;
+    /* relative Frobenius error of the approximation, negative when unknown */
+    double error;
+} lowrank;
+
+/* Function to compute all eigenvalues (descending) and eigenvectors (columns) of a symmetric matrix */
+void symmetric_eigen(double **A, int m, double *values, double **vectors);
+
+/* Function to build the Nystrom approximation of the normalized similarity matrix from m landmarks */
+lowrank *nystrom(double **points, int n, int d, int m, int sampling, unsigned int seed);
+
+/* Function to compute a rank-r eigendecomposition of a dense symmetric W with a randomized range
+   finder (r + oversample columns, power_iters power iterations) */
+lowrank *randomized_eigen(double **W, int n, int r, int oversample, int power_iters, unsigned int seed);
+
+/* Function to calculate W*H for a factorized W in O(n*rank*k) */
+double **lowrank_multiply(lowrank *lr, double **H, int k);
+
+/* Function to wrap a factorized matrix as an affinity operator that owns it */
+void lowrank_op(lowrank *lr, affinity_op *op);
+
+/* Helper function to free a factorized matrix */
+void free_lowrank(lowrank *lr);
+
+#endif /* LOWRANK_H */
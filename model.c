@@ -0,0 +1,522 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include "symnmf.h"
+#include "kernels.h"
+#include "model.h"
+
+/* file signature and format version of saved models */
+#define MODEL_MAGIC "SNMF"
+#define MODEL_VERSION 2
+/* coordinate descent sweeps of the nonnegative projection */
+#define PROJECTION_SWEEPS 50
+
+/* Helper function to copy a matrix */
+static double **copy_matrix(double **matrix, int rows, int cols)
+{
+    double **copy = initialize_matrix(rows, cols);
+    int i;
+    for (i = 0; i < rows; i++)
+    {
+        memcpy(copy[i], matrix[i], cols * sizeof(double));
+    }
+    return copy;
+}
+
+/* Helper function to derive the Gram matrix H^T * H of a model */
+static void model_gram(symnmf_model *model)
+{
+    double **Ht = transpose(model->H, model->n, model->k);
+    model->gram = matrix_multiplication(Ht, model->k, model->n, model->H, model->n, model->k);
+    free_matrix(Ht, model->k);
+}
+
+/* Helper function to calculate the row sums of a square matrix */
+static double *row_sums(double **matrix, int n)
+{
+    double *sums = (double *)malloc(n * sizeof(double));
+    int i, j;
+    for (i = 0; i < n; i++)
+    {
+        sums[i] = 0.0;
+        for (j = 0; j < n; j++)
+        {
+            sums[i] += matrix[i][j];
+        }
+    }
+    return sums;
+}
+
+/* function to build a model from the training points and the final H (both are copied),
+   keep_affinity stores the similarity matrix so that refits only compute new rows */
+symnmf_model *model_create(double **points, double **H, int n, int d, int k, int keep_affinity)
+{
+    symnmf_model *model = (symnmf_model *)malloc(sizeof(symnmf_model));
+
+    model->n = n;
+    model->d = d;
+    model->k = k;
+    model->points = copy_matrix(points, n, d);
+    model->H = copy_matrix(H, n, k);
+    if (keep_affinity)
+    {
+        model->affinity = symc(points, n, d);
+        model->degrees = row_sums(model->affinity, n);
+    }
+    else
+    {
+        model->affinity = NULL;
+        model->degrees = degree_vector(points, n, d);
+    }
+    model_gram(model);
+    return model;
+}
+
+/* Helper function to write the rows of a matrix, returns 0 on success */
+static int write_rows(FILE *file, double **matrix, int rows, int cols)
+{
+    int i;
+    for (i = 0; i < rows; i++)
+    {
+        if (fwrite(matrix[i], sizeof(double), cols, file) != (size_t)cols)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Helper function to read the rows of a matrix, returns 0 on success */
+static int read_rows(FILE *file, double **matrix, int rows, int cols)
+{
+    int i;
+    for (i = 0; i < rows; i++)
+    {
+        if (fread(matrix[i], sizeof(double), cols, file) != (size_t)cols)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* function to write a model to a binary file, returns 0 on success */
+int model_save(symnmf_model *model, const char *file_name)
+{
+    FILE *file = fopen(file_name, "wb");
+    int header[5];
+    int failed, i;
+
+    if (!file)
+    {
+        return 1;
+    }
+    header[0] = MODEL_VERSION;
+    header[1] = model->n;
+    header[2] = model->d;
+    header[3] = model->k;
+    header[4] = model->affinity != NULL;
+
+    failed = fwrite(MODEL_MAGIC, 1, 4, file) != 4 || fwrite(header, sizeof(int), 5, file) != 5;
+    failed = failed || write_rows(file, model->points, model->n, model->d);
+    failed = failed || fwrite(model->degrees, sizeof(double), model->n, file) != (size_t)model->n;
+    failed = failed || write_rows(file, model->H, model->n, model->k);
+    /* the similarity matrix is symmetric with a zero diagonal, only the strict lower triangle is stored */
+    for (i = 1; i < model->n && model->affinity != NULL && !failed; i++)
+    {
+        failed = fwrite(model->affinity[i], sizeof(double), i, file) != (size_t)i;
+    }
+    failed = fclose(file) != 0 || failed;
+    return failed;
+}
+
+/* function to read a model from a binary file, returns NULL on failure */
+symnmf_model *model_load(const char *file_name)
+{
+    FILE *file = fopen(file_name, "rb");
+    symnmf_model *model;
+    char magic[4];
+    int header[5] = {0, 0, 0, 0, 0};
+    int failed, i, j;
+
+    if (!file)
+    {
+        return NULL;
+    }
+    /* version 1 files have no affinity flag and no affinity */
+    if (fread(magic, 1, 4, file) != 4 || memcmp(magic, MODEL_MAGIC, 4) != 0 ||
+        fread(header, sizeof(int), 1, file) != 1 || header[0] < 1 || header[0] > MODEL_VERSION ||
+        fread(header + 1, sizeof(int), header[0] == 1 ? 3 : 4, file) != (size_t)(header[0] == 1 ? 3 : 4) ||
+        header[1] < 1 || header[2] < 1 || header[3] < 1)
+    {
+        fclose(file);
+        return NULL;
+    }
+
+    model = (symnmf_model *)malloc(sizeof(symnmf_model));
+    model->n = header[1];
+    model->d = header[2];
+    model->k = header[3];
+    model->points = initialize_matrix(model->n, model->d);
+    model->degrees = (double *)malloc(model->n * sizeof(double));
+    model->H = initialize_matrix(model->n, model->k);
+    model->gram = NULL;
+    model->affinity = header[4] ? initialize_matrix(model->n, model->n) : NULL;
+
+    failed = read_rows(file, model->points, model->n, model->d);
+    failed = failed || fread(model->degrees, sizeof(double), model->n, file) != (size_t)model->n;
+    failed = failed || read_rows(file, model->H, model->n, model->k);
+    for (i = 1; i < model->n && model->affinity != NULL && !failed; i++)
+    {
+        failed = fread(model->affinity[i], sizeof(double), i, file) != (size_t)i;
+        for (j = 0; j < i; j++)
+        {
+            model->affinity[j][i] = model->affinity[i][j];
+        }
+    }
+    fclose(file);
+    if (failed)
+    {
+        free_model(model);
+        return NULL;
+    }
+    model_gram(model);
+    return model;
+}
+
+/* function to project one new point onto H, filling its k nonnegative coefficients */
+void model_project(symnmf_model *model, double *point, double *h)
+{
+    int n = model->n, k = model->k;
+    double *w = (double *)malloc(n * sizeof(double));
+    double *b = (double *)calloc(k, sizeof(double));
+    double degree = 0.0, scale;
+    int i, c, e, sweep;
+
+    /* the new row of the similarity matrix, and the degree of the new point */
+    for (i = 0; i < n; i++)
+    {
+        w[i] = exp(-0.5 * euclidean_distance(point, model->points[i], model->d));
+        degree += w[i];
+    }
+    for (c = 0; c < k; c++)
+    {
+        h[c] = 0.0;
+    }
+    if (degree <= 0.0)
+    {
+        free(w);
+        free(b);
+        return;
+    }
+
+    /* normalized row w_i / sqrt(d_x * d_i), projected on H: b = H^T * w */
+    scale = 1.0 / sqrt(degree);
+    for (i = 0; i < n; i++)
+    {
+        double wi;
+        if (model->degrees[i] <= 0.0)
+        {
+            continue;
+        }
+        wi = w[i] * scale / sqrt(model->degrees[i]);
+        for (c = 0; c < k; c++)
+        {
+            b[c] += model->H[i][c] * wi;
+        }
+    }
+
+    /* min ||w - H*h||^2 over h >= 0 by projected coordinate descent on the k x k normal equations */
+    for (sweep = 0; sweep < PROJECTION_SWEEPS; sweep++)
+    {
+        for (c = 0; c < k; c++)
+        {
+            double gradient = -b[c];
+            if (model->gram[c][c] <= 0.0)
+            {
+                continue;
+            }
+            for (e = 0; e < k; e++)
+            {
+                gradient += model->gram[c][e] * h[e];
+            }
+            h[c] -= gradient / model->gram[c][c];
+            if (h[c] < 0.0)
+            {
+                h[c] = 0.0;
+            }
+        }
+    }
+
+    free(w);
+    free(b);
+}
+
+/* Helper function returning the index of the training point closest to a new point */
+static int nearest_point(symnmf_model *model, double *point)
+{
+    int i, best = 0;
+    double best_dist = euclidean_distance(point, model->points[0], model->d);
+
+    for (i = 1; i < model->n; i++)
+    {
+        double dist = euclidean_distance(point, model->points[i], model->d);
+        if (dist < best_dist)
+        {
+            best_dist = dist;
+            best = i;
+        }
+    }
+    return best;
+}
+
+/* function that for each new point returns its cluster index, in O(n*d + n*k) per point */
+int *model_assign(symnmf_model *model, double **points, int count)
+{
+    int *labels = (int *)malloc(count * sizeof(int));
+    double *h = (double *)malloc(model->k * sizeof(double));
+    int p, c;
+
+    for (p = 0; p < count; p++)
+    {
+        double best = 0.0;
+        labels[p] = -1;
+        model_project(model, points[p], h);
+        for (c = 0; c < model->k; c++)
+        {
+            if (h[c] > best)
+            {
+                best = h[c];
+                labels[p] = c;
+            }
+        }
+        if (labels[p] < 0)
+        {
+            /* the point is too far for any similarity to register, use its nearest training point */
+            int *nearest = analysisc(&model->H[nearest_point(model, points[p])], 1, model->k);
+            labels[p] = nearest[0];
+            free(nearest);
+        }
+    }
+
+    free(h);
+    return labels;
+}
+
+/* normalized similarity D^(-1/2) * A * D^(-1/2) of a refit applied without forming it: A is the
+   n x n block of the old points and the count x (n + count) rows of the appended ones */
+typedef struct
+{
+    int n;
+    int count;
+    double **old;
+    double **panel;
+    double *scale;
+} refit_affinity;
+
+/* W*H callback of the refit affinity operator, the sum of an entry running over columns in order */
+static double **refit_multiply(void *data, double **H, int total, int k)
+{
+    refit_affinity *norm = (refit_affinity *)data;
+    double *scaled = (double *)malloc(((size_t)total * k + 1) * sizeof(double));
+    double **output = initialize_matrix(total, k);
+    product_kernel product = select_product(k);
+    int n = norm->n, i, c, p;
+
+    for (i = 0; i < total; i++)
+    {
+        for (c = 0; c < k; c++)
+        {
+            scaled[(size_t)i * k + c] = norm->scale[i] * H[i][c];
+        }
+    }
+    /* old rows: the old block, then the columns of the new points read down the panel */
+    for (i = 0; i < n; i++)
+    {
+        double *out = output[i];
+        product(out, norm->old[i], scaled, n, k);
+        for (p = 0; p < norm->count; p++)
+        {
+            for (c = 0; c < k; c++)
+            {
+                out[c] += norm->panel[p][i] * scaled[(size_t)(n + p) * k + c];
+            }
+        }
+    }
+    for (p = 0; p < norm->count; p++)
+    {
+        product(output[n + p], norm->panel[p], scaled, total, k);
+    }
+    for (i = 0; i < total; i++)
+    {
+        for (c = 0; c < k; c++)
+        {
+            output[i][c] *= norm->scale[i];
+        }
+    }
+    free(scaled);
+    return output;
+}
+
+/* ||W||^2 callback of the refit affinity operator, the new rows counted for their columns too */
+static double refit_norm2(void *data, int total)
+{
+    refit_affinity *norm = (refit_affinity *)data;
+    double norm2 = 0.0;
+    int n = norm->n, i, j, p;
+
+    for (i = 0; i < n; i++)
+    {
+        for (j = 0; j < n; j++)
+        {
+            double w = norm->scale[i] * norm->old[i][j] * norm->scale[j];
+            norm2 += w * w;
+        }
+    }
+    for (p = 0; p < norm->count; p++)
+    {
+        for (j = 0; j < total; j++)
+        {
+            double w = norm->scale[n + p] * norm->panel[p][j] * norm->scale[j];
+            norm2 += j < n ? 2.0 * w * w : w * w;
+        }
+    }
+    return norm2;
+}
+
+/* function to refit a model after appending new points, warm-starting symnmf from its H */
+symnmf_model *model_refit(symnmf_model *model, double **new_points, int count, symnmf_params *params)
+{
+    int n = model->n, k = model->k, d = model->d, total = model->n + count;
+    symnmf_model *refit = (symnmf_model *)malloc(sizeof(symnmf_model));
+    refit_affinity norm;
+    affinity_op op;
+    double **H;
+    double floor_value = 0.0;
+    int i, j, c, p;
+
+    refit->n = total;
+    refit->d = d;
+    refit->k = k;
+    refit->points = initialize_matrix(total, d);
+    for (i = 0; i < total; i++)
+    {
+        memcpy(refit->points[i], i < n ? model->points[i] : new_points[i - n], d * sizeof(double));
+    }
+
+    /* the old block is reused when the model kept it and computed once otherwise; of the new points
+       only their rows are formed, never the whole total x total matrix */
+    norm.n = n;
+    norm.count = count;
+    norm.old = model->affinity != NULL ? model->affinity : symc(model->points, n, d);
+    norm.panel = initialize_matrix(count, total);
+    for (p = 0; p < count; p++)
+    {
+        for (j = 0; j < n + p; j++)
+        {
+            norm.panel[p][j] = exp(-0.5 * euclidean_distance(refit->points[n + p], refit->points[j], d));
+            if (j >= n)
+            {
+                norm.panel[j - n][n + p] = norm.panel[p][j];
+            }
+        }
+    }
+
+    /* old degrees only gain the new columns, new degrees are full row sums */
+    refit->degrees = (double *)malloc(total * sizeof(double));
+    for (i = 0; i < total; i++)
+    {
+        refit->degrees[i] = i < n ? model->degrees[i] : 0.0;
+        for (j = (i < n ? n : 0); j < total; j++)
+        {
+            refit->degrees[i] += i < n ? norm.panel[j - n][i] : norm.panel[i - n][j];
+        }
+    }
+
+    /* warm start: old rows of H as they are, new rows projected onto the old H */
+    H = initialize_matrix(total, k);
+    for (i = 0; i < n; i++)
+    {
+        for (c = 0; c < k; c++)
+        {
+            H[i][c] = model->H[i][c];
+            floor_value += model->H[i][c];
+        }
+    }
+    /* multiplicative updates never move an exact zero, so new rows get a small positive floor */
+    floor_value = 0.01 * floor_value / ((double)n * k);
+    for (i = n; i < total; i++)
+    {
+        model_project(model, refit->points[i], H[i]);
+        for (c = 0; c < k; c++)
+        {
+            if (H[i][c] < floor_value)
+            {
+                H[i][c] = floor_value;
+            }
+        }
+    }
+
+    norm.scale = (double *)malloc(total * sizeof(double));
+    for (i = 0; i < total; i++)
+    {
+        norm.scale[i] = refit->degrees[i] > 0.0 ? 1.0 / sqrt(refit->degrees[i]) : 0.0;
+    }
+    op.data = &norm;
+    op.multiply = refit_multiply;
+    op.multiply_rows = NULL;
+    op.norm2 = refit_norm2;
+    op.destroy = NULL;
+    refit->H = symnmf_op(H, &op, total, k, params);
+
+    /* a model that kept its similarity matrix keeps the grown one, assembled once the solve is done */
+    refit->affinity = NULL;
+    if (model->affinity != NULL)
+    {
+        refit->affinity = initialize_matrix(total, total);
+        for (i = 0; i < n; i++)
+        {
+            memcpy(refit->affinity[i], model->affinity[i], n * sizeof(double));
+        }
+        for (p = 0; p < count; p++)
+        {
+            memcpy(refit->affinity[n + p], norm.panel[p], total * sizeof(double));
+            for (j = 0; j < n; j++)
+            {
+                refit->affinity[j][n + p] = norm.panel[p][j];
+            }
+        }
+    }
+    else
+    {
+        free_matrix(norm.old, n);
+    }
+    model_gram(refit);
+
+    free_matrix(norm.panel, count);
+    free(norm.scale);
+    free_matrix(H, total);
+    return refit;
+}
+
+/* Helper function to free a model */
+void free_model(symnmf_model *model)
+{
+    if (model == NULL)
+    {
+        return;
+    }
+    free_matrix(model->points, model->n);
+    free_matrix(model->H, model->n);
+    free(model->degrees);
+    if (model->gram != NULL)
+    {
+        free_matrix(model->gram, model->k);
+    }
+    if (model->affinity != NULL)
+    {
+        free_matrix(model->affinity, model->n);
+    }
+    free(model);
+}
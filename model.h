@@ -0,0 +1,47 @@
+#ifndef MODEL_H
+#define MODEL_H
+
+#include "symnmf.h"
+
+/* Fitted symnmf model: the training points, their degrees in the similarity graph and the final H */
+typedef struct
+{
+    int n;
+    int d;
+    int k;
+    double **points;
+    double *degrees;
+    double **H;
+    /* k x k Gram matrix H^T * H, derived from H */
+    double **gram;
+    /* n x n similarity matrix, kept only when the model is meant to be refitted (NULL otherwise) */
+    double **affinity;
+} symnmf_model;
+
+/* Function to build a model from the training points and the final H (both are copied),
+   keep_affinity stores the similarity matrix so that refits only compute new rows. Without it every
+   refit recomputes the old n x n block first, so models meant to grow should keep it */
+symnmf_model *model_create(double **points, double **H, int n, int d, int k, int keep_affinity);
+
+/* Function to write a model to a binary file, returns 0 on success */
+int model_save(symnmf_model *model, const char *file_name);
+
+/* Function to read a model from a binary file, returns NULL on failure */
+symnmf_model *model_load(const char *file_name);
+
+/* Function to project one new point onto H, filling its k nonnegative coefficients */
+void model_project(symnmf_model *model, double *point, double *h);
+
+/* Function that for each new point returns its cluster index, in O(n*d + n*k) per point */
+int *model_assign(symnmf_model *model, double **points, int count);
+
+/* Function to refit a model after appending new points, warm-starting symnmf from its H;
+   params->iterations reports how many iterations the warm start needed. The products run on the old
+   block of the similarity matrix and the count rows of the new points, never on the whole matrix;
+   the old block is the kept one, or recomputed when the model has none */
+symnmf_model *model_refit(symnmf_model *model, double **new_points, int count, symnmf_params *params);
+
+/* Helper function to free a model */
+void free_model(symnmf_model *model);
+
+#endif /* MODEL_H */
@@ -0,0 +1,423 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include "symnmf.h"
+#include "rng.h"
+#include "init.h"
+#include "knn.h"
+#include "multilevel.h"
+
+/* coarsening stops when a level keeps more than this fraction of the nodes of the finer one */
+#define COARSEN_STALL 0.95
+
+/* entry of a row while the symmetric graph is assembled */
+typedef struct
+{
+    int col;
+    double value;
+} sparse_entry;
+
+/* function to fill the default multilevel parameters */
+void multilevel_default_params(multilevel_params *params)
+{
+    params->neighbors = 32;
+    params->knn = KNN_AUTO;
+    params->coarsest = 2000;
+    params->refine_iters = 10;
+    params->threads = 1;
+    params->seed = 0;
+    params->levels = 0;
+    params->coarsest_iterations = 0;
+    params->refine_iterations = 0;
+}
+
+/* Helper function to order the entries of a row by column */
+static int compare_entries(const void *a, const void *b)
+{
+    int left = ((const sparse_entry *)a)->col, right = ((const sparse_entry *)b)->col;
+    return (left > right) - (left < right);
+}
+
+/* Helper function to allocate a sparse affinity of n nodes and room for nnz entries */
+static sparse_affinity *alloc_sparse(int n, size_t nnz)
+{
+    sparse_affinity *graph = (sparse_affinity *)malloc(sizeof(sparse_affinity));
+    graph->n = n;
+    graph->start = (int *)calloc(n + 1, sizeof(int));
+    graph->cols = (int *)malloc((nnz > 0 ? nnz : 1) * sizeof(int));
+    graph->values = (double *)malloc((nnz > 0 ? nnz : 1) * sizeof(double));
+    graph->sizes = (double *)malloc(n * sizeof(double));
+    return graph;
+}
+
+/* function to build the normalized affinity restricted to nearest neighbours */
+sparse_affinity *knn_affinity(double **points, int n, int d, int neighbors, int method, int threads,
+                              unsigned int seed)
+{
+    double *degrees = (double *)malloc((n > 0 ? n : 1) * sizeof(double));
+    int *count = (int *)calloc(n + 1, sizeof(int));
+    int exact = knn_resolve(method, n, d) == KNN_BRUTE;
+    knn_graph *knn = knn_search(points, n, d, neighbors, method, threads, seed, degrees);
+    sparse_entry *entries;
+    int *fill;
+    sparse_affinity *graph;
+    int m = knn->k, i, t, e, nnz = 0;
+
+    /* every edge i -> j goes to row i and row j, duplicates are merged after sorting */
+    for (i = 0; i < n; i++)
+    {
+        count[i + 1] += m;
+        for (t = 0; t < m; t++)
+        {
+            count[knn->neighbors[(size_t)i * m + t] + 1]++;
+        }
+    }
+    for (i = 0; i < n; i++)
+    {
+        count[i + 1] += count[i];
+    }
+    entries = (sparse_entry *)malloc(((size_t)count[n] + 1) * sizeof(sparse_entry));
+    fill = (int *)malloc((n > 0 ? n : 1) * sizeof(int));
+    memcpy(fill, count, n * sizeof(int));
+    for (i = 0; i < n; i++)
+    {
+        for (t = 0; t < m; t++)
+        {
+            int j = knn->neighbors[(size_t)i * m + t];
+            double value = exp(-0.5 * knn->distances[(size_t)i * m + t]);
+            entries[fill[i]].col = j;
+            entries[fill[i]++].value = value;
+            entries[fill[j]].col = i;
+            entries[fill[j]++].value = value;
+        }
+    }
+    free_knn(knn);
+
+    graph = alloc_sparse(n, count[n]);
+    for (i = 0; i < n; i++)
+    {
+        double degree = 0.0;
+        qsort(entries + count[i], count[i + 1] - count[i], sizeof(sparse_entry), compare_entries);
+        graph->start[i] = nnz;
+        graph->sizes[i] = 1.0;
+        for (e = count[i]; e < count[i + 1]; e++)
+        {
+            if (nnz > graph->start[i] && graph->cols[nnz - 1] == entries[e].col)
+            {
+                continue;
+            }
+            graph->cols[nnz] = entries[e].col;
+            graph->values[nnz++] = entries[e].value;
+            degree += entries[e].value;
+        }
+        /* without the full pass of brute force the degrees sum over the kept edges */
+        degrees[i] = exact ? degrees[i] : degree;
+    }
+    graph->start[n] = nnz;
+
+    for (i = 0; i < n; i++)
+    {
+        degrees[i] = degrees[i] > 0.0 ? 1.0 / sqrt(degrees[i]) : 0.0;
+    }
+    for (i = 0; i < n; i++)
+    {
+        for (e = graph->start[i]; e < graph->start[i + 1]; e++)
+        {
+            int j = graph->cols[e];
+            /* the same product order from either end, so both copies of an edge are the same bits */
+            graph->values[e] = degrees[i < j ? i : j] * graph->values[e] * degrees[i < j ? j : i];
+        }
+    }
+
+    free(degrees);
+    free(entries);
+    free(count);
+    free(fill);
+    return graph;
+}
+
+/* Helper function to coarsen a graph by heavy-edge matching: nodes visited in random order join the
+   unmatched neighbour of largest mean affinity per pair of points, parent receives the node of the
+   coarse graph every node went to */
+static sparse_affinity *coarsen(sparse_affinity *fine, int *parent, rng_state *rng)
+{
+    int n = fine->n, coarse_n = 0, i, j, e, c, nnz = 0;
+    int *order = (int *)malloc(n * sizeof(int));
+    int *first = (int *)malloc(n * sizeof(int));
+    int *second = (int *)malloc(n * sizeof(int));
+    int *slot = (int *)malloc(n * sizeof(int));
+    sparse_affinity *coarse;
+
+    for (i = 0; i < n; i++)
+    {
+        order[i] = i;
+        parent[i] = -1;
+    }
+    for (i = n - 1; i > 0; i--)
+    {
+        int r = (int)(rng_uniform(rng) * (i + 1)), tmp = order[i];
+        order[i] = order[r];
+        order[r] = tmp;
+    }
+    for (j = 0; j < n; j++)
+    {
+        int best = -1;
+        double best_weight = 0.0;
+        i = order[j];
+        if (parent[i] >= 0)
+        {
+            continue;
+        }
+        for (e = fine->start[i]; e < fine->start[i + 1]; e++)
+        {
+            int other = fine->cols[e];
+            double weight = fine->values[e] / (fine->sizes[i] * fine->sizes[other]);
+            if (other != i && parent[other] < 0 && weight > best_weight)
+            {
+                best = other;
+                best_weight = weight;
+            }
+        }
+        first[coarse_n] = i;
+        second[coarse_n] = best;
+        parent[i] = coarse_n;
+        if (best >= 0)
+        {
+            parent[best] = coarse_n;
+        }
+        coarse_n++;
+    }
+
+    /* A_c = P^T A P: every fine entry lands on one coarse entry, so the fine count bounds the coarse one */
+    coarse = alloc_sparse(coarse_n, fine->start[n]);
+    for (c = 0; c < coarse_n; c++)
+    {
+        slot[c] = -1;
+    }
+    for (c = 0; c < coarse_n; c++)
+    {
+        int row_start = nnz, member;
+        coarse->start[c] = nnz;
+        coarse->sizes[c] = 0.0;
+        for (member = 0; member < 2; member++)
+        {
+            int node = member == 0 ? first[c] : second[c];
+            if (node < 0)
+            {
+                continue;
+            }
+            coarse->sizes[c] += fine->sizes[node];
+            for (e = fine->start[node]; e < fine->start[node + 1]; e++)
+            {
+                int col = parent[fine->cols[e]];
+                if (slot[col] < row_start)
+                {
+                    slot[col] = nnz;
+                    coarse->cols[nnz] = col;
+                    coarse->values[nnz++] = 0.0;
+                }
+                coarse->values[slot[col]] += fine->values[e];
+            }
+        }
+    }
+    coarse->start[coarse_n] = nnz;
+    coarse->cols = (int *)realloc(coarse->cols, (nnz > 0 ? nnz : 1) * sizeof(int));
+    coarse->values = (double *)realloc(coarse->values, (nnz > 0 ? nnz : 1) * sizeof(double));
+
+    free(order);
+    free(first);
+    free(second);
+    free(slot);
+    return coarse;
+}
+
+/* W*H for an affinity operator holding a sparse graph, W = S^-1/2 A S^-1/2 */
+static double **sparse_multiply(void *data, double **H, int n, int k)
+{
+    sparse_affinity *graph = (sparse_affinity *)data;
+    double **WH = initialize_matrix(n, k);
+    double *scale = (double *)malloc(n * sizeof(double));
+    int i, e, c;
+
+    for (i = 0; i < n; i++)
+    {
+        scale[i] = 1.0 / sqrt(graph->sizes[i]);
+    }
+    for (i = 0; i < n; i++)
+    {
+        double *out = WH[i];
+        for (e = graph->start[i]; e < graph->start[i + 1]; e++)
+        {
+            double w = graph->values[e] * scale[graph->cols[e]], *h = H[graph->cols[e]];
+            for (c = 0; c < k; c++)
+            {
+                out[c] += w * h[c];
+            }
+        }
+        for (c = 0; c < k; c++)
+        {
+            out[c] *= scale[i];
+        }
+    }
+    free(scale);
+    return WH;
+}
+
+/* rows of W*H for an affinity operator holding a sparse graph */
+static double **sparse_multiply_rows(void *data, const int *rows, int count, double **H, int n, int k)
+{
+    sparse_affinity *graph = (sparse_affinity *)data;
+    double **WH = initialize_matrix(count, k);
+    int t, e, c;
+
+    (void)n;
+    for (t = 0; t < count; t++)
+    {
+        int i = rows[t];
+        double *out = WH[t];
+        for (e = graph->start[i]; e < graph->start[i + 1]; e++)
+        {
+            double w = graph->values[e] / sqrt(graph->sizes[graph->cols[e]]), *h = H[graph->cols[e]];
+            for (c = 0; c < k; c++)
+            {
+                out[c] += w * h[c];
+            }
+        }
+        for (c = 0; c < k; c++)
+        {
+            out[c] /= sqrt(graph->sizes[i]);
+        }
+    }
+    return WH;
+}
+
+/* ||W||^2 of a sparse affinity seen as an affinity operator, each entry scaled as in sparse_multiply */
+static double sparse_norm2(void *data, int n)
+{
+    sparse_affinity *graph = (sparse_affinity *)data;
+    double norm2 = 0.0;
+    int i, e;
+
+    for (i = 0; i < n; i++)
+    {
+        for (e = graph->start[i]; e < graph->start[i + 1]; e++)
+        {
+            norm2 += graph->values[e] * graph->values[e] / (graph->sizes[i] * graph->sizes[graph->cols[e]]);
+        }
+    }
+    return norm2;
+}
+
+/* function to wrap a sparse affinity as an affinity operator */
+void sparse_op(sparse_affinity *graph, affinity_op *op)
+{
+    op->data = graph;
+    op->multiply = sparse_multiply;
+    op->multiply_rows = sparse_multiply_rows;
+    op->norm2 = sparse_norm2;
+    op->destroy = NULL;
+}
+
+/* function to run symnmf on a sparse affinity through coarser and coarser levels */
+double **multilevel_solve(sparse_affinity *graph, int k, multilevel_params *params)
+{
+    sparse_affinity *levels[MULTILEVEL_MAX_LEVELS];
+    int *parents[MULTILEVEL_MAX_LEVELS];
+    int count = 1, level, i, c;
+    double **H, **G, **next;
+    affinity_op op;
+    symnmf_params solve;
+    rng_state rng;
+
+    levels[0] = graph;
+    rng_seed(&rng, RNG_MT19937, params->seed);
+    while (count < MULTILEVEL_MAX_LEVELS && levels[count - 1]->n > params->coarsest)
+    {
+        sparse_affinity *fine = levels[count - 1];
+        int *parent = (int *)malloc(fine->n * sizeof(int));
+        sparse_affinity *coarse = coarsen(fine, parent, &rng);
+        /* a level too small for k clusters or one barely smaller than the last one ends coarsening */
+        if (coarse->n <= k || coarse->n > COARSEN_STALL * fine->n)
+        {
+            free_sparse(coarse);
+            free(parent);
+            break;
+        }
+        parents[count - 1] = parent;
+        levels[count++] = coarse;
+    }
+    params->levels = count;
+    for (level = 0; level < count; level++)
+    {
+        params->level_sizes[level] = levels[level]->n;
+    }
+
+    /* the coarsest level solves for G = S^1/2 H_c, since P^T W P ~ S H_c H_c^T S */
+    sparse_op(levels[count - 1], &op);
+    symnmf_default_params(&solve);
+    G = spectral_init(&op, levels[count - 1]->n, k, params->seed);
+    H = symnmf_op(G, &op, levels[count - 1]->n, k, &solve);
+    free_matrix(G, levels[count - 1]->n);
+    params->coarsest_iterations = solve.iterations;
+    params->refine_iterations = 0;
+
+    for (level = count - 2; level >= 0; level--)
+    {
+        sparse_affinity *fine = levels[level], *coarse = levels[level + 1];
+        /* every node takes the H of its aggregate: G_f[i] = sqrt(s_i / s_p) G_c[p] */
+        G = initialize_matrix(fine->n, k);
+        for (i = 0; i < fine->n; i++)
+        {
+            int p = parents[level][i];
+            double scale = sqrt(fine->sizes[i] / coarse->sizes[p]);
+            for (c = 0; c < k; c++)
+            {
+                G[i][c] = scale * H[p][c];
+            }
+        }
+        free_matrix(H, coarse->n);
+        free_sparse(coarse);
+        free(parents[level]);
+
+        sparse_op(fine, &op);
+        symnmf_default_params(&solve);
+        solve.max_iter = params->refine_iters;
+        next = params->refine_iters > 0 ? symnmf_op(G, &op, fine->n, k, &solve) : NULL;
+        if (next != NULL)
+        {
+            free_matrix(G, fine->n);
+            G = next;
+        }
+        params->refine_iterations += solve.iterations;
+        H = G;
+    }
+    return H;
+}
+
+/* function to run the multilevel symnmf of points on their nearest neighbour affinity */
+double **multilevel_symnmf(double **points, int n, int d, int k, multilevel_params *params)
+{
+    sparse_affinity *graph;
+    double **H;
+
+    params->knn = knn_resolve(params->knn, n, d);
+    graph = knn_affinity(points, n, d, params->neighbors, params->knn, params->threads, params->seed);
+    H = multilevel_solve(graph, k, params);
+    free_sparse(graph);
+    return H;
+}
+
+/* helper function to free a sparse affinity */
+void free_sparse(sparse_affinity *graph)
+{
+    if (graph == NULL)
+    {
+        return;
+    }
+    free(graph->start);
+    free(graph->cols);
+    free(graph->values);
+    free(graph->sizes);
+    free(graph);
+}
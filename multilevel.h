@@ -0,0 +1,66 @@
+#ifndef MULTILEVEL_H
+#define MULTILEVEL_H
+
+#include "symnmf.h"
+
+/* Most levels of a multilevel run, the finest graph included */
+#define MULTILEVEL_MAX_LEVELS 32
+
+/* Sparse symmetric affinity in compressed rows: row i holds the entries start[i] .. start[i + 1] - 1.
+   A node of a coarse level is an aggregate of sizes[i] points and its entries are the sums of the
+   affinities between the members, so the matrix it stands for is S^-1/2 A S^-1/2 */
+typedef struct
+{
+    int n;
+    int *start;
+    int *cols;
+    double *values;
+    double *sizes;
+} sparse_affinity;
+
+/* Parameters of a multilevel run, the fields after seed are filled on return */
+typedef struct
+{
+    /* nearest neighbours of every point kept in the finest graph */
+    int neighbors;
+    /* nearest neighbour search (knn.h), KNN_AUTO is replaced by the method it picked */
+    int knn;
+    /* coarsening stops once a level has at most this many nodes */
+    int coarsest;
+    /* update iterations on every level finer than the coarsest */
+    int refine_iters;
+    int threads;
+    unsigned int seed;
+    int levels;
+    int level_sizes[MULTILEVEL_MAX_LEVELS];
+    int coarsest_iterations;
+    int refine_iterations;
+} multilevel_params;
+
+/* Function to fill the default multilevel parameters (32 neighbours found by the automatic method,
+   2000 super-nodes, 10 iterations per level) */
+void multilevel_default_params(multilevel_params *params);
+
+/* Function to build the normalized affinity restricted to the nearest neighbours of every point
+   (kept when either point is among the neighbours of the other), found with the knn.h method.
+   By brute force the entries are those of norm, the degrees summing over all points, in O(n^2 d)
+   time; the KD-tree and NN-descent avoid the quadratic pass, so their degrees sum over the kept
+   edges only. Memory is O(n * neighbors) either way */
+sparse_affinity *knn_affinity(double **points, int n, int d, int neighbors, int method, int threads,
+                              unsigned int seed);
+
+/* Function to wrap a sparse affinity as an affinity operator, the graph stays owned by the caller */
+void sparse_op(sparse_affinity *graph, affinity_op *op);
+
+/* Function to run symnmf on a sparse affinity by coarsening it with heavy-edge matching down to
+   params->coarsest nodes, solving there from the spectral initialization, then prolonging H level
+   by level with params->refine_iters update iterations on each */
+double **multilevel_solve(sparse_affinity *graph, int k, multilevel_params *params);
+
+/* Function to run the multilevel symnmf of points on their nearest neighbour affinity */
+double **multilevel_symnmf(double **points, int n, int d, int k, multilevel_params *params);
+
+/* Helper function to free a sparse affinity */
+void free_sparse(sparse_affinity *graph);
+
+#endif /* MULTILEVEL_H */
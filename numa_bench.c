@@ -0,0 +1,108 @@
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "symnmf.h"
+#include "placement.h"
+
+/*
+ * Memory bandwidth of the parallel W*H pass for each placement of W, run with "make numa-bench"
+ * or "./numa_bench [n] [threads]". serial is the old layout: W zero-filled by one thread, so all
+ * its pages sit on one node. first-touch has every block of rows written first by the thread that
+ * multiplies it, interleave spreads the pages over all nodes. Each W*H streams the n x n doubles
+ * of W once, which is what the GB/s column counts.
+ */
+
+#define BENCH_K 8
+#define BENCH_DIM 4
+#define BENCH_ROUNDS 20
+
+/* Helper function to read a monotonic clock in seconds */
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Helper function to fill a matrix with uniform numbers in (0, 1] */
+static double **random_matrix(int rows, int cols)
+{
+    double **M = initialize_matrix(rows, cols);
+    int i, j;
+    for (i = 0; i < rows; i++)
+    {
+        for (j = 0; j < cols; j++)
+        {
+            M[i][j] = (rand() + 1.0) / ((double)RAND_MAX + 1.0);
+        }
+    }
+    return M;
+}
+
+/* Helper function to time building W and multiplying it by H under one placement */
+static void bench_placement(const char *name, placement *pl, double **points, double **H, int n)
+{
+    double start, build, multiply, checksum = 0.0;
+    double **W, **WH;
+    int round, i;
+
+    start = now();
+    W = placement_sym(points, n, BENCH_DIM, pl);
+    build = now() - start;
+
+    start = now();
+    for (round = 0; round < BENCH_ROUNDS; round++)
+    {
+        WH = placement_multiply(W, H, n, BENCH_K, pl);
+        for (i = 0; i < n; i++)
+        {
+            checksum += WH[i][0];
+        }
+        free_matrix(WH, n);
+    }
+    multiply = (now() - start) / BENCH_ROUNDS;
+
+    printf("%-12s %4s %10.3f %10.2f %10.2f   (checksum %.6e)\n", name, pl->pin ? "yes" : "no", build,
+           multiply * 1000, (double)n * n * sizeof(double) / multiply / 1e9, checksum);
+    free_matrix(W, n);
+}
+
+int main(int argc, char *argv[])
+{
+    int n = argc > 1 ? atoi(argv[1]) : 6000;
+    placement pl;
+    double **points, **H;
+
+    placement_default(&pl);
+    if (argc > 2)
+    {
+        pl.threads = atoi(argv[2]);
+    }
+    if (n <= 0 || pl.threads <= 0)
+    {
+        printf("usage: numa_bench [n] [threads]\n");
+        return 1;
+    }
+    srand(1);
+    points = random_matrix(n, BENCH_DIM);
+    H = random_matrix(n, BENCH_K);
+
+    printf("n=%d k=%d threads=%d, W is %.1f MB\n", n, BENCH_K, pl.threads, (double)n * n * sizeof(double) / 1e6);
+    printf("%-12s %4s %10s %10s %10s\n", "placement", "pin", "build s", "W*H ms", "GB/s");
+    pl.policy = PLACEMENT_SERIAL;
+    bench_placement("serial", &pl, points, H, n);
+    pl.policy = PLACEMENT_FIRST_TOUCH;
+    bench_placement("first-touch", &pl, points, H, n);
+    pl.pin = 1;
+    bench_placement("first-touch", &pl, points, H, n);
+    pl.policy = PLACEMENT_INTERLEAVE;
+    pl.pin = 0;
+    bench_placement("interleave", &pl, points, H, n);
+    pl.pin = 1;
+    bench_placement("interleave", &pl, points, H, n);
+
+    free_matrix(points, n);
+    free_matrix(H, n);
+    return 0;
+}
@@ -0,0 +1,434 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "symnmf.h"
+#include "kernels.h"
+#include "pool.h"
+#include "rng.h"
+#include "outofcore.h"
+
+/* doubles of a tile */
+#define OOC_TILE_SIZE ((size_t)OOC_TILE * OOC_TILE)
+
+/*
+ * When W does not fit in memory, it is written once to a scratch file and every W*H pass is a scan
+ * of that file from front to back, strip after strip. Each strip is advised for read-ahead
+ * (MADV_WILLNEED) window strips before it is needed, so the kernel reads it while the strips before
+ * it are multiplied, and dropped (MADV_DONTNEED) once multiplied, so what stays resident is bounded
+ * by the budget rather than by n^2. A tile is multiplied by the OOC_TILE rows of H it meets, which
+ * stay in cache for the whole tile.
+ */
+
+/* Helper function returning the first entry of tile (strip, column) of the mapped file */
+static const double *ooc_tile(const ooc_matrix *m, int strip, int column)
+{
+    return m->map + ((size_t)strip * m->tiles + column) * OOC_TILE_SIZE;
+}
+
+/* Helper function to advise the kernel about a strip of the mapped file */
+static void advise_strip(const ooc_matrix *m, int strip, int advice)
+{
+    if (strip >= 0 && strip < m->tiles)
+    {
+        madvise((void *)ooc_tile(m, strip, 0), (size_t)m->tiles * OOC_TILE_SIZE * sizeof(double), advice);
+    }
+}
+
+/* function returning the bytes of one strip of the scratch file of an n x n matrix */
+size_t ooc_strip_bytes(int n)
+{
+    return (size_t)(n + OOC_TILE - 1) / OOC_TILE * OOC_TILE_SIZE * sizeof(double);
+}
+
+/* function returning the bytes of the scratch file of an n x n matrix */
+size_t ooc_bytes(int n)
+{
+    size_t tiles = (size_t)(n + OOC_TILE - 1) / OOC_TILE;
+    return tiles * tiles * OOC_TILE_SIZE * sizeof(double);
+}
+
+/* tiles (strip, J), J <= strip, of norm and their mirrors, built by one task */
+typedef struct
+{
+    ooc_matrix *m;
+    int strip;
+    double **points;
+    int d;
+    const double *scale;
+    int failed;
+} ooc_build;
+
+/* Helper function to write a whole tile at its place in the file */
+static int write_tile(ooc_matrix *m, int strip, int column, const double *tile)
+{
+    const char *bytes = (const char *)tile;
+    size_t left = OOC_TILE_SIZE * sizeof(double);
+    off_t offset = (off_t)(((size_t)strip * m->tiles + column) * OOC_TILE_SIZE * sizeof(double));
+    ssize_t done;
+
+    while (left > 0)
+    {
+        if ((done = pwrite(m->fd, bytes, left, offset)) <= 0)
+        {
+            return -1;
+        }
+        bytes += done;
+        left -= (size_t)done;
+        offset += done;
+    }
+    return 0;
+}
+
+/* task computing the tiles of a strip left of the diagonal, writing each tile and its mirror. The
+   entries are those of norm_rows: scale[i] * exp(-0.5 * distance(x_i, x_j)) * scale[j], the mirror
+   multiplying in its own row order so both match normc bit for bit */
+static void build_strip(void *arg)
+{
+    ooc_build *task = (ooc_build *)arg;
+    ooc_matrix *m = task->m;
+    distance_kernel distance = select_distance(task->d);
+    double *tile = (double *)calloc(OOC_TILE_SIZE, sizeof(double));
+    double *mirror = (double *)calloc(OOC_TILE_SIZE, sizeof(double));
+    int I = task->strip, J, r, s;
+    int rows = m->n - I * OOC_TILE < OOC_TILE ? m->n - I * OOC_TILE : OOC_TILE;
+
+    for (J = 0; J <= I && !task->failed; J++)
+    {
+        int cols = m->n - J * OOC_TILE < OOC_TILE ? m->n - J * OOC_TILE : OOC_TILE;
+        if (cols < OOC_TILE)
+        {
+            /* the last tile of the row keeps zeros past column n */
+            memset(tile, 0, OOC_TILE_SIZE * sizeof(double));
+        }
+        for (r = 0; r < rows; r++)
+        {
+            int i = I * OOC_TILE + r;
+            for (s = 0; s < cols; s++)
+            {
+                int j = J * OOC_TILE + s;
+                double value = j == i ? 0.0 : exp(-0.5 * distance(task->points[i], task->points[j], task->d));
+                tile[(size_t)r * OOC_TILE + s] = task->scale[i] * value * task->scale[j];
+                mirror[(size_t)s * OOC_TILE + r] = task->scale[j] * value * task->scale[i];
+            }
+        }
+        if (write_tile(m, I, J, tile) != 0 || (J != I && write_tile(m, J, I, mirror) != 0))
+        {
+            task->failed = 1;
+        }
+    }
+    free(tile);
+    free(mirror);
+}
+
+/* row-major scan of the mapped file by ooc_fill, strip remembering which strip it is in */
+typedef struct
+{
+    ooc_matrix *m;
+    int strip;
+} ooc_scan;
+
+/* Helper function to copy count entries of the matrix in row-major order, from flat index first on,
+   adding their squares to norm2 in the same order as dense_norm2; every strip left is dropped */
+static void ooc_fill(void *data, size_t first, size_t count, double *values)
+{
+    ooc_scan *scan = (ooc_scan *)data;
+    ooc_matrix *m = scan->m;
+    size_t t = 0;
+
+    while (t < count)
+    {
+        int i = (int)((first + t) / m->n), j = (int)((first + t) % m->n);
+        int run = OOC_TILE - j % OOC_TILE, c;
+        const double *w = ooc_tile(m, i / OOC_TILE, j / OOC_TILE) + (size_t)(i % OOC_TILE) * OOC_TILE + j % OOC_TILE;
+
+        if (i / OOC_TILE != scan->strip)
+        {
+            advise_strip(m, scan->strip, MADV_DONTNEED);
+            scan->strip = i / OOC_TILE;
+            if (m->window > 0)
+            {
+                advise_strip(m, scan->strip + 1, MADV_WILLNEED);
+            }
+        }
+        run = (size_t)run < count - t ? run : (int)(count - t);
+        run = run < m->n - j ? run : m->n - j;
+        for (c = 0; c < run; c++)
+        {
+            values[t + c] = w[c];
+            m->norm2 += w[c] * w[c];
+        }
+        t += run;
+    }
+}
+
+/* function to write norm of the points to a scratch file */
+ooc_matrix *ooc_norm(double **points, int n, int d, const char *dir, size_t budget, int threads)
+{
+    ooc_matrix *m;
+    ooc_build *tasks;
+    ooc_scan scan;
+    task_group group;
+    double *degrees, *scale;
+    char *path;
+    size_t strips = budget / ooc_strip_bytes(n > 0 ? n : 1);
+    int I, j, failed = 0, workers;
+
+    /* whatever the budget, a product holds at least the strip it multiplies */
+    if (n < 1 || (budget > 0 && strips < 1))
+    {
+        return NULL;
+    }
+    dir = dir != NULL ? dir : getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+    path = (char *)malloc(strlen(dir) + 32);
+    sprintf(path, "%s/symnmf-w-XXXXXX", dir);
+    m = (ooc_matrix *)calloc(1, sizeof(ooc_matrix));
+    m->n = n;
+    m->tiles = (n + OOC_TILE - 1) / OOC_TILE;
+    m->bytes = ooc_bytes(n);
+    /* the file is unlinked at once, so it goes away with the descriptor however the process ends */
+    m->fd = mkstemp(path);
+    if (m->fd >= 0)
+    {
+        unlink(path);
+    }
+    free(path);
+    if (m->fd < 0 || ftruncate(m->fd, (off_t)m->bytes) != 0)
+    {
+        free_ooc(m);
+        return NULL;
+    }
+    m->pool = threads > 1 && m->tiles > 1 ? pool_create(threads) : NULL;
+
+    /* D^-1/2 from the degrees, which add up in the order of normc */
+    degrees = degree_vector(points, n, d);
+    scale = (double *)malloc(n * sizeof(double));
+    for (j = 0; j < n; j++)
+    {
+        scale[j] = 1.0 / sqrt(degrees[j]);
+    }
+    free(degrees);
+    tasks = (ooc_build *)calloc(m->tiles, sizeof(ooc_build));
+    group.pending = 0;
+    for (I = m->tiles - 1; I >= 0; I--)
+    {
+        tasks[I].m = m;
+        tasks[I].strip = I;
+        tasks[I].points = points;
+        tasks[I].d = d;
+        tasks[I].scale = scale;
+        if (m->pool == NULL || pool_submit_group(m->pool, &group, build_strip, &tasks[I]) != 0)
+        {
+            build_strip(&tasks[I]);
+        }
+    }
+    if (m->pool != NULL)
+    {
+        pool_wait(m->pool, &group);
+    }
+    for (I = 0; I < m->tiles; I++)
+    {
+        failed |= tasks[I].failed;
+    }
+    free(tasks);
+    free(scale);
+
+    m->map = failed ? MAP_FAILED : (const double *)mmap(NULL, m->bytes, PROT_READ, MAP_SHARED, m->fd, 0);
+    if (m->map == MAP_FAILED)
+    {
+        m->map = NULL;
+        free_ooc(m);
+        return NULL;
+    }
+    madvise((void *)m->map, m->bytes, MADV_SEQUENTIAL);
+
+    /* the strips being multiplied, one per worker, and the window read ahead share the budget: the
+       products run on no more workers than it holds strips, leaving one of them to read ahead when
+       it holds two or more */
+    workers = m->pool != NULL ? pool_size(m->pool) : 1;
+    if (budget > 0)
+    {
+        workers = strips > (size_t)workers ? workers : strips > 1 ? (int)strips - 1 : 1;
+        m->window = strips - workers < (size_t)m->tiles ? (int)(strips - workers) : m->tiles;
+    }
+    else
+    {
+        m->window = workers;
+    }
+    if (m->pool != NULL && workers < pool_size(m->pool))
+    {
+        pool_destroy(m->pool);
+        m->pool = workers > 1 ? pool_create(workers) : NULL;
+    }
+
+    m->norm2 = 0.0;
+    scan.m = m;
+    scan.strip = 0;
+    advise_strip(m, 0, MADV_WILLNEED);
+    m->mean = pairwise_mean(ooc_fill, &scan, (size_t)n * n);
+    advise_strip(m, scan.strip, MADV_DONTNEED);
+    return m;
+}
+
+/* rows of W*H of one strip */
+typedef struct
+{
+    ooc_matrix *m;
+    int strip;
+    const double *packed;
+    int k;
+    double **WH;
+} ooc_task;
+
+/* task calculating the rows of W*H of a strip tile by tile, each row adding the columns in order */
+static void strip_multiply(void *arg)
+{
+    ooc_task *task = (ooc_task *)arg;
+    ooc_matrix *m = task->m;
+    int I = task->strip, k = task->k, J, r;
+    product_kernel product = select_product(k);
+    int rows = m->n - I * OOC_TILE < OOC_TILE ? m->n - I * OOC_TILE : OOC_TILE;
+
+    advise_strip(m, I + m->window, MADV_WILLNEED);
+    for (J = 0; J < m->tiles; J++)
+    {
+        int cols = m->n - J * OOC_TILE < OOC_TILE ? m->n - J * OOC_TILE : OOC_TILE;
+        const double *tile = ooc_tile(m, I, J), *h = task->packed + (size_t)J * OOC_TILE * k;
+        for (r = 0; r < rows; r++)
+        {
+            product(task->WH[I * OOC_TILE + r], tile + (size_t)r * OOC_TILE, h, cols, k);
+        }
+    }
+    advise_strip(m, I, MADV_DONTNEED);
+}
+
+/* function to calculate W*H scanning the file strip by strip */
+double **ooc_multiply(ooc_matrix *m, double **H, int k)
+{
+    double **WH = initialize_matrix(m->n, k);
+    double *packed = pack_matrix(H, m->n, k);
+    ooc_task *tasks = (ooc_task *)malloc(m->tiles * sizeof(ooc_task));
+    task_group group;
+    int I;
+
+    for (I = 0; I < m->window; I++)
+    {
+        advise_strip(m, I, MADV_WILLNEED);
+    }
+    group.pending = 0;
+    for (I = 0; I < m->tiles; I++)
+    {
+        tasks[I].m = m;
+        tasks[I].strip = I;
+        tasks[I].packed = packed;
+        tasks[I].k = k;
+        tasks[I].WH = WH;
+        if (m->pool == NULL || pool_submit_group(m->pool, &group, strip_multiply, &tasks[I]) != 0)
+        {
+            strip_multiply(&tasks[I]);
+        }
+    }
+    if (m->pool != NULL)
+    {
+        pool_wait(m->pool, &group);
+    }
+    free(tasks);
+    free(packed);
+    return WH;
+}
+
+/* Helper function to drop the pages holding one row of a tile, cols entries long */
+static void drop_row(const ooc_matrix *m, const double *row, int cols)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t first = (size_t)(row - m->map) * sizeof(double), last = first + (size_t)cols * sizeof(double);
+
+    first -= first % page;
+    last += (page - last % page) % page;
+    madvise((void *)((const char *)m->map + first), last - first, MADV_DONTNEED);
+}
+
+/* function to calculate the given rows of W*H, one row at a time */
+double **ooc_multiply_rows(ooc_matrix *m, const int *rows, int count, double **H, int k)
+{
+    double **WH = initialize_matrix(count, k);
+    double *packed = pack_matrix(H, m->n, k);
+    product_kernel product = select_product(k);
+    int t, J;
+
+    for (t = 0; t < count; t++)
+    {
+        int I = rows[t] / OOC_TILE, r = rows[t] % OOC_TILE;
+        for (J = 0; J < m->tiles; J++)
+        {
+            int cols = m->n - J * OOC_TILE < OOC_TILE ? m->n - J * OOC_TILE : OOC_TILE;
+            const double *row = ooc_tile(m, I, J) + (size_t)r * OOC_TILE;
+            product(WH[t], row, packed + (size_t)J * OOC_TILE * k, cols, k);
+            drop_row(m, row, cols);
+        }
+    }
+    free(packed);
+    return WH;
+}
+
+/* W*H callback of the affinity operator */
+static double **ooc_op_multiply(void *data, double **H, int n, int k)
+{
+    (void)n;
+    return ooc_multiply((ooc_matrix *)data, H, k);
+}
+
+/* rows of W*H callback of the affinity operator */
+static double **ooc_op_multiply_rows(void *data, const int *rows, int count, double **H, int n, int k)
+{
+    (void)n;
+    return ooc_multiply_rows((ooc_matrix *)data, rows, count, H, k);
+}
+
+/* ||W||^2 callback of the affinity operator */
+static double ooc_op_norm2(void *data, int n)
+{
+    (void)n;
+    return ((ooc_matrix *)data)->norm2;
+}
+
+/* destroy callback of the affinity operator */
+static void ooc_op_destroy(void *data)
+{
+    free_ooc((ooc_matrix *)data);
+}
+
+/* function to wrap an out-of-core matrix as an affinity operator that owns it */
+void ooc_op(ooc_matrix *m, affinity_op *op)
+{
+    op->data = m;
+    op->multiply = ooc_op_multiply;
+    op->multiply_rows = ooc_op_multiply_rows;
+    op->norm2 = ooc_op_norm2;
+    op->destroy = ooc_op_destroy;
+}
+
+/* Helper function to unmap, close and free an out-of-core matrix */
+void free_ooc(ooc_matrix *m)
+{
+    if (m == NULL)
+    {
+        return;
+    }
+    if (m->pool != NULL)
+    {
+        pool_destroy(m->pool);
+    }
+    if (m->map != NULL)
+    {
+        munmap((void *)m->map, m->bytes);
+    }
+    if (m->fd >= 0)
+    {
+        close(m->fd);
+    }
+    free(m);
+}
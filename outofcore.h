@@ -0,0 +1,61 @@
+#ifndef OUTOFCORE_H
+#define OUTOFCORE_H
+
+#include <stddef.h>
+#include "symnmf.h"
+#include "pool.h"
+
+/* Rows and columns of a tile: 256 x 256 doubles are 512 KiB, a whole number of pages */
+#define OOC_TILE 256
+
+/* n x n matrix kept in a scratch file as OOC_TILE x OOC_TILE tiles, each stored row after row and
+   padded with zeros at the edges. Tile (I, J) is the J-th tile of strip I, the OOC_TILE rows from
+   I * OOC_TILE on, and the strips follow each other, so a W*H pass reads the file front to back */
+typedef struct
+{
+    int n;
+    int tiles;
+    /* the file mapped read-only, already unlinked, and its size */
+    int fd;
+    const double *map;
+    size_t bytes;
+    /* strips advised for read-ahead ahead of the one being multiplied, from the memory budget; 0 when
+       it only holds the strips being multiplied */
+    int window;
+    /* mean entry (as np.mean) and ||W||^2 */
+    double mean;
+    double norm2;
+    /* workers sharing the strips of every W*H, no more than the budget holds strips, NULL to multiply
+       on the calling thread */
+    thread_pool *pool;
+} ooc_matrix;
+
+/* Function returning the bytes of one strip of the scratch file of an n x n matrix */
+size_t ooc_strip_bytes(int n);
+
+/* Function returning the bytes of the scratch file of an n x n matrix */
+size_t ooc_bytes(int n);
+
+/* Function to write norm of the points to a scratch file in directory dir (NULL for $TMPDIR or /tmp)
+   without ever holding more than a tile per thread of it, the same entries normc would compute.
+   budget bounds the bytes of the file resident at once during products: they run on at most threads
+   workers, one strip each, and the strips left read ahead (0 for two strips a thread). Returns NULL
+   when budget is below ooc_strip_bytes(n) or the file cannot be created, written or mapped */
+ooc_matrix *ooc_norm(double **points, int n, int d, const char *dir, size_t budget, int threads);
+
+/* Function to calculate W*H scanning the file strip by strip, the strips ahead advised for read-ahead
+   and those done dropped from memory; the sums are added in the order of matrix_multiplication */
+double **ooc_multiply(ooc_matrix *m, double **H, int k);
+
+/* Function to calculate the given rows of W*H, count x k, reading each row tile by tile across its
+   strip and dropping its pages once multiplied, so that a mini-batch reads count rows of the file
+   instead of all of it; each row adds its sums in the order of ooc_multiply */
+double **ooc_multiply_rows(ooc_matrix *m, const int *rows, int count, double **H, int k);
+
+/* Function to wrap an out-of-core matrix as an affinity operator that owns it */
+void ooc_op(ooc_matrix *m, affinity_op *op);
+
+/* Helper function to unmap, close and free an out-of-core matrix */
+void free_ooc(ooc_matrix *m);
+
+#endif /* OUTOFCORE_H */
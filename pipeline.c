@@ -0,0 +1,482 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include "symnmf.h"
+#include "kernels.h"
+#include "profile.h"
+#include "pool.h"
+#include "pipeline.h"
+
+#define PIPE_SYM 0
+#define PIPE_DDG 1
+#define PIPE_NORM 2
+
+/* characters of a formatted entry and its separator in the common case, "0.1234," */
+#define PIPE_ENTRY_CHARS 7
+
+/*
+ * The sequential CLI reads the whole file twice, builds all of sym, then prints it, every stage
+ * waiting for the one before. Here the calling thread parses the file once, a block of
+ * PIPE_BLOCK_ROWS rows at a time, and every finished block is handed to the pool at once as the
+ * tiles (block, c), c <= block, of the lower triangle of sym, which only need rows already read.
+ * Once the input ends, the workers format the output a row block at a time while a writer thread
+ * writes the finished blocks in order; at most PIPE_QUEUE_PER_WORKER blocks per worker wait for it,
+ * so formatting and writing overlap without holding the whole text. Only the lower triangle is
+ * stored, half the memory of symc. Every entry is the exp(-0.5 * distance(x_i, x_j)) of symc, i > j,
+ * and the degrees are summed over whole rows in column order, so the output matches the sequential
+ * one byte for byte.
+ */
+
+typedef struct pipeline pipeline;
+
+/* task of the pool: tile (block, column) of sym, or one row block to sum or format */
+typedef struct
+{
+    pipeline *pipe;
+    int block;
+    int column;
+} pipe_task;
+
+struct pipeline
+{
+    int goal;
+    int n;
+    int d;
+    int blocks;
+    distance_kernel distance;
+    /* points of block b, row after row, and its rows of sym up to its last column */
+    double *points[PIPE_MAX_BLOCKS];
+    double *lower[PIPE_MAX_BLOCKS];
+    int rows[PIPE_MAX_BLOCKS];
+    int width[PIPE_MAX_BLOCKS];
+    pipe_task *tiles[PIPE_MAX_BLOCKS];
+    pipe_task tasks[PIPE_MAX_BLOCKS];
+    /* row sums of sym and 1 / sqrt of them, for ddg and norm */
+    double *degrees;
+    double *scale;
+    thread_pool *pool;
+    task_group group;
+    /* formatted text of every block, NULL until it is ready, and the blocks written so far */
+    char *text[PIPE_MAX_BLOCKS];
+    size_t length[PIPE_MAX_BLOCKS];
+    int written;
+    int failed;
+    FILE *out;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+/* Helper function to run a task on the pool, or on the calling thread when there is none */
+static void pipe_submit(pipeline *pipe, pool_task task, pipe_task *arg)
+{
+    if (pipe->pool == NULL || pool_submit_group(pipe->pool, &pipe->group, task, arg) != 0)
+    {
+        task(arg);
+    }
+}
+
+/* Helper function to wait for every task submitted so far */
+static void pipe_wait(pipeline *pipe)
+{
+    if (pipe->pool != NULL)
+    {
+        pool_wait(pipe->pool, &pipe->group);
+    }
+}
+
+/* task calculating tile (block, column) of sym; the diagonal tile fills both of its triangles */
+static void tile_task(void *arg)
+{
+    pipe_task *task = (pipe_task *)arg;
+    pipeline *pipe = task->pipe;
+    int b = task->block, c = task->column, d = pipe->d, width = pipe->width[b];
+    int first = c * PIPE_BLOCK_ROWS, r, s;
+    double *out = pipe->lower[b], value;
+
+    for (r = 0; r < pipe->rows[b]; r++)
+    {
+        const double *x = pipe->points[b] + (size_t)r * d;
+        int stop = c == b ? r : pipe->rows[c];
+        for (s = 0; s < stop; s++)
+        {
+            value = exp(-0.5 * pipe->distance(x, pipe->points[c] + (size_t)s * d, d));
+            out[(size_t)r * width + first + s] = value;
+            if (c == b)
+            {
+                out[(size_t)s * width + first + r] = value;
+            }
+        }
+        if (c == b)
+        {
+            out[(size_t)r * width + first + r] = 0.0;
+        }
+    }
+}
+
+/* Helper function to gather row r of block b of sym, mirroring the columns past the block */
+static void gather_row(pipeline *pipe, int b, int r, double *row)
+{
+    int i = b * PIPE_BLOCK_ROWS + r, c, s;
+
+    memcpy(row, pipe->lower[b] + (size_t)r * pipe->width[b], pipe->width[b] * sizeof(double));
+    for (c = b + 1; c < pipe->blocks; c++)
+    {
+        for (s = 0; s < pipe->rows[c]; s++)
+        {
+            row[c * PIPE_BLOCK_ROWS + s] = pipe->lower[c][(size_t)s * pipe->width[c] + i];
+        }
+    }
+}
+
+/* Helper function returning the degree of a row, summed in the column order of ddgc */
+static double row_degree(const double *row, int n)
+{
+    double degree = 0.0;
+    int j;
+
+    for (j = 0; j < n; j++)
+    {
+        degree += row[j];
+    }
+    return degree;
+}
+
+/* task summing the degrees of the rows of a block */
+static void degree_task(void *arg)
+{
+    pipe_task *task = (pipe_task *)arg;
+    pipeline *pipe = task->pipe;
+    double *row = (double *)malloc(pipe->n * sizeof(double));
+    int r;
+
+    for (r = 0; r < pipe->rows[task->block]; r++)
+    {
+        gather_row(pipe, task->block, r, row);
+        pipe->degrees[task->block * PIPE_BLOCK_ROWS + r] = row_degree(row, pipe->n);
+    }
+    free(row);
+}
+
+/* task formatting the rows of a block of the goal and handing the text to the writer */
+static void format_task(void *arg)
+{
+    pipe_task *task = (pipe_task *)arg;
+    pipeline *pipe = task->pipe;
+    int b = task->block, n = pipe->n, r, j;
+    size_t capacity = (size_t)pipe->rows[b] * n * PIPE_ENTRY_CHARS + FORMAT_FIXED4_MAX + 1, length = 0;
+    char *text = (char *)malloc(capacity);
+    double *row = (double *)malloc(n * sizeof(double)), value;
+
+    for (r = 0; r < pipe->rows[b]; r++)
+    {
+        int i = b * PIPE_BLOCK_ROWS + r;
+        double degree = 0.0;
+        gather_row(pipe, b, r, row);
+        if (pipe->goal == PIPE_DDG)
+        {
+            degree = row_degree(row, n);
+        }
+        for (j = 0; j < n; j++)
+        {
+            if (pipe->goal == PIPE_SYM)
+            {
+                value = row[j];
+            }
+            else if (pipe->goal == PIPE_DDG)
+            {
+                value = j == i ? degree : 0.0;
+            }
+            else
+            {
+                value = pipe->scale[i] * row[j] * pipe->scale[j];
+            }
+            if (length + FORMAT_FIXED4_MAX + 1 > capacity)
+            {
+                capacity *= 2;
+                text = (char *)realloc(text, capacity);
+            }
+            length += format_fixed4(text + length, value);
+            text[length++] = j < n - 1 ? ',' : '\n';
+        }
+    }
+    free(row);
+
+    pthread_mutex_lock(&pipe->lock);
+    pipe->length[b] = length;
+    pipe->text[b] = text;
+    pthread_cond_broadcast(&pipe->changed);
+    pthread_mutex_unlock(&pipe->lock);
+}
+
+/* Helper function to write the text of a block and count it written */
+static void write_block(pipeline *pipe, int b)
+{
+    if (fwrite(pipe->text[b], 1, pipe->length[b], pipe->out) != pipe->length[b])
+    {
+        pipe->failed = 1;
+    }
+    free(pipe->text[b]);
+    pthread_mutex_lock(&pipe->lock);
+    pipe->text[b] = NULL;
+    pipe->written = b + 1;
+    pthread_cond_broadcast(&pipe->changed);
+    pthread_mutex_unlock(&pipe->lock);
+}
+
+/* thread writing the formatted blocks in order as they become ready */
+static void *writer_main(void *arg)
+{
+    pipeline *pipe = (pipeline *)arg;
+    int b;
+
+    for (b = 0; b < pipe->blocks; b++)
+    {
+        pthread_mutex_lock(&pipe->lock);
+        while (pipe->text[b] == NULL)
+        {
+            pthread_cond_wait(&pipe->changed, &pipe->lock);
+        }
+        pthread_mutex_unlock(&pipe->lock);
+        write_block(pipe, b);
+    }
+    return NULL;
+}
+
+/* Helper function to allocate the next block of points, returns NULL when the tables are full */
+static double *next_block(pipeline *pipe)
+{
+    if (pipe->blocks == PIPE_MAX_BLOCKS)
+    {
+        return NULL;
+    }
+    pipe->points[pipe->blocks] = (double *)malloc((size_t)PIPE_BLOCK_ROWS * pipe->d * sizeof(double));
+    return pipe->points[pipe->blocks];
+}
+
+/* Helper function to hand a parsed block of rows to the workers as the tiles of its rows of sym */
+static void submit_block(pipeline *pipe, int rows)
+{
+    int b = pipe->blocks, c;
+
+    pipe->rows[b] = rows;
+    pipe->width[b] = b * PIPE_BLOCK_ROWS + rows;
+    pipe->lower[b] = (double *)malloc((size_t)rows * pipe->width[b] * sizeof(double));
+    pipe->tiles[b] = (pipe_task *)malloc((b + 1) * sizeof(pipe_task));
+    pipe->blocks++;
+    pipe->n += rows;
+    for (c = b; c >= 0; c--)
+    {
+        pipe->tiles[b][c].pipe = pipe;
+        pipe->tiles[b][c].block = b;
+        pipe->tiles[b][c].column = c;
+        pipe_submit(pipe, tile_task, &pipe->tiles[b][c]);
+    }
+}
+
+/* Helper function to parse one line of d comma separated values as fscanf("%lf,") would, returns
+   0 on success and -1 for anything the sequential reader may treat differently */
+static int parse_line(const char *line, int d, double *values)
+{
+    const char *p = line;
+    char *end;
+    int j;
+
+    for (j = 0; j < d; j++)
+    {
+        values[j] = strtod(p, &end);
+        if (end == p)
+        {
+            return -1;
+        }
+        p = end;
+        if (*p == ',')
+        {
+            p++;
+        }
+        else if (j < d - 1)
+        {
+            return -1;
+        }
+    }
+    while (isspace((unsigned char)*p))
+    {
+        p++;
+    }
+    return *p == '\0' ? 0 : -1;
+}
+
+/* Helper function to parse the points file, handing every full block to the workers as it is read.
+   Like read_file_dimensions, only lines ending in a newline are rows and the first one sets d */
+static int parse_points(pipeline *pipe, FILE *file)
+{
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t got;
+    double *block = NULL;
+    int row = 0, status = 0;
+    const char *p;
+
+    while ((got = getline(&line, &size, file)) > 0 && line[got - 1] == '\n')
+    {
+        if (pipe->d == 0)
+        {
+            for (pipe->d = 1, p = line; *p != '\0'; p++)
+            {
+                pipe->d += *p == ',';
+            }
+            pipe->distance = select_distance(pipe->d);
+        }
+        if (row == 0 && (block = next_block(pipe)) == NULL)
+        {
+            status = -1;
+            break;
+        }
+        if (parse_line(line, pipe->d, block + (size_t)row * pipe->d) != 0)
+        {
+            status = -1;
+            break;
+        }
+        if (++row == PIPE_BLOCK_ROWS)
+        {
+            submit_block(pipe, row);
+            row = 0;
+        }
+    }
+    if (status == 0 && row > 0)
+    {
+        submit_block(pipe, row);
+    }
+    else if (status != 0 && pipe->blocks < PIPE_MAX_BLOCKS)
+    {
+        /* the points of the block that was being filled belong to no submitted tile */
+        free(pipe->points[pipe->blocks]);
+    }
+    free(line);
+    return status;
+}
+
+/* Helper function to format and write the output, the writer thread writing while the workers
+   format; without a writer thread the blocks are formatted and written one after the other */
+static void write_output(pipeline *pipe, int threads)
+{
+    pthread_t writer;
+    int capacity = PIPE_QUEUE_PER_WORKER * (threads > 0 ? threads : 1), b;
+
+    for (b = 0; b < pipe->blocks; b++)
+    {
+        pipe->tasks[b].pipe = pipe;
+        pipe->tasks[b].block = b;
+        pipe->tasks[b].column = 0;
+    }
+    if (pthread_create(&writer, NULL, writer_main, pipe) != 0)
+    {
+        for (b = 0; b < pipe->blocks; b++)
+        {
+            format_task(&pipe->tasks[b]);
+            write_block(pipe, b);
+        }
+        return;
+    }
+    for (b = 0; b < pipe->blocks; b++)
+    {
+        /* bounded queue: wait while capacity blocks are being formatted or wait for the writer */
+        pthread_mutex_lock(&pipe->lock);
+        while (b - pipe->written >= capacity)
+        {
+            pthread_cond_wait(&pipe->changed, &pipe->lock);
+        }
+        pthread_mutex_unlock(&pipe->lock);
+        pipe_submit(pipe, format_task, &pipe->tasks[b]);
+    }
+    pthread_join(writer, NULL);
+    pipe_wait(pipe);
+}
+
+/* Helper function to free a pipeline */
+static void free_pipeline(pipeline *pipe)
+{
+    int b;
+
+    if (pipe->pool != NULL)
+    {
+        pool_destroy(pipe->pool);
+    }
+    for (b = 0; b < pipe->blocks; b++)
+    {
+        free(pipe->points[b]);
+        free(pipe->lower[b]);
+        free(pipe->tiles[b]);
+    }
+    free(pipe->degrees);
+    free(pipe->scale);
+    pthread_mutex_destroy(&pipe->lock);
+    pthread_cond_destroy(&pipe->changed);
+    free(pipe);
+}
+
+/* function to run the sym, ddg or norm goal as a pipeline */
+int pipeline_goal(const char *file_name, const char *goal, int threads, FILE *out)
+{
+    pipeline *pipe;
+    FILE *file;
+    int status, stage, b, i;
+    profile_mark mark;
+
+    if (strcmp(goal, "sym") != 0 && strcmp(goal, "ddg") != 0 && strcmp(goal, "norm") != 0)
+    {
+        return -1;
+    }
+    if ((file = fopen(file_name, "r")) == NULL)
+    {
+        return -1;
+    }
+    pipe = (pipeline *)calloc(1, sizeof(pipeline));
+    pipe->goal = strcmp(goal, "sym") == 0 ? PIPE_SYM : strcmp(goal, "ddg") == 0 ? PIPE_DDG : PIPE_NORM;
+    pipe->out = out;
+    pipe->pool = pool_create(threads > 0 ? threads : 1);
+    pthread_mutex_init(&pipe->lock, NULL);
+    pthread_cond_init(&pipe->changed, NULL);
+    stage = pipe->goal == PIPE_SYM ? PROF_SYM : pipe->goal == PIPE_DDG ? PROF_DDG : PROF_NORM;
+
+    /* parsing, with the tiles of sym computed by the workers as the blocks arrive */
+    PROFILE_BEGIN(mark);
+    status = parse_points(pipe, file);
+    fclose(file);
+    PROFILE_END(PROF_READ_DATA, mark);
+
+    /* the tiles left, then the degrees every row of norm depends on */
+    PROFILE_BEGIN(mark);
+    pipe_wait(pipe);
+    if (status == 0 && pipe->goal == PIPE_NORM)
+    {
+        pipe->degrees = (double *)malloc((pipe->n > 0 ? pipe->n : 1) * sizeof(double));
+        pipe->scale = (double *)malloc((pipe->n > 0 ? pipe->n : 1) * sizeof(double));
+        for (b = 0; b < pipe->blocks; b++)
+        {
+            pipe->tasks[b].pipe = pipe;
+            pipe->tasks[b].block = b;
+            pipe_submit(pipe, degree_task, &pipe->tasks[b]);
+        }
+        pipe_wait(pipe);
+        for (i = 0; i < pipe->n; i++)
+        {
+            pipe->scale[i] = 1.0 / sqrt(pipe->degrees[i]);
+        }
+    }
+    PROFILE_END(stage, mark);
+
+    if (status == 0)
+    {
+        PROFILE_BEGIN(mark);
+        write_output(pipe, threads);
+        fflush(out);
+        status = pipe->failed || ferror(out) ? 1 : 0;
+        PROFILE_END(PROF_PRINT, mark);
+    }
+    free_pipeline(pipe);
+    return status;
+}
@@ -0,0 +1,21 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdio.h>
+
+/* Rows per block of the pipeline: the unit parsed, multiplied and formatted at once */
+#define PIPE_BLOCK_ROWS 256
+/* Most blocks of an input, so that the tables of blocks never move while workers read them */
+#define PIPE_MAX_BLOCKS 4096
+/* Formatted output blocks that may wait for the writer per worker */
+#define PIPE_QUEUE_PER_WORKER 2
+
+/* Function to run the sym, ddg or norm goal on a points file as a pipeline: the parser hands every
+   block of rows to threads affinity workers as soon as it is read, which compute its similarities
+   with the blocks before it, and finished output rows are formatted by the workers and written by
+   a dedicated writer thread. The output is the same as print_matrix of the goal. Returns 0 on
+   success, 1 when writing failed and -1, before anything is written, when the file cannot be read
+   or does not have the regular shape the pipeline parses, so that the caller can fall back */
+int pipeline_goal(const char *file_name, const char *goal, int threads, FILE *out);
+
+#endif /* PIPELINE_H */
@@ -0,0 +1,365 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+#include "symnmf.h"
+#include "profile.h"
+#include "kernels.h"
+#include "placement.h"
+
+/* work done on the block of rows [first, first + count) by the thread that owns it */
+typedef void (*block_body)(void *shared, int first, int count);
+
+/* one thread of a parallel pass and its block */
+typedef struct
+{
+    placement *pl;
+    int t;
+    int n;
+    block_body body;
+    void *shared;
+    pthread_t thread;
+    int started;
+} block_worker;
+
+/* shared arguments of the passes below */
+typedef struct
+{
+    double **M;
+    int cols;
+    /* rows copied into M, NULL to zero them */
+    double **from;
+} zero_pass;
+
+typedef struct
+{
+    double **points;
+    int d;
+    double **W;
+    int n;
+    distance_kernel distance;
+} sym_pass;
+
+typedef struct
+{
+    double **W;
+    /* H packed row after row, shared read-only by the blocks */
+    const double *packed;
+    double **WH;
+    int n;
+    int k;
+    product_kernel product;
+    int allocate;
+} multiply_pass;
+
+/* affinity operator data: the dense matrix and how to multiply it */
+typedef struct
+{
+    double **W;
+    placement pl;
+} placement_data;
+
+/* function to fill the default placement */
+void placement_default(placement *pl)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    pl->threads = cpus > 0 ? (int)cpus : 1;
+    pl->policy = PLACEMENT_FIRST_TOUCH;
+    pl->pin = 0;
+}
+
+/* function to parse a policy name */
+int placement_policy(const char *name)
+{
+    if (strcmp(name, "first-touch") == 0)
+    {
+        return PLACEMENT_FIRST_TOUCH;
+    }
+    if (strcmp(name, "interleave") == 0)
+    {
+        return PLACEMENT_INTERLEAVE;
+    }
+    if (strcmp(name, "serial") == 0)
+    {
+        return PLACEMENT_SERIAL;
+    }
+    return -1;
+}
+
+/* function to get the rows a thread owns, the same contiguous split for every pass */
+void placement_block(int n, int threads, int t, int *first, int *count)
+{
+    *first = (int)((double)n * t / threads);
+    *count = (int)((double)n * (t + 1) / threads) - *first;
+}
+
+/* Helper function to pin the calling thread and set its memory policy before it touches its rows */
+static void prepare_thread(placement *pl, int t)
+{
+#ifdef __linux__
+    if (pl->pin)
+    {
+        cpu_set_t allowed, one;
+        int cpu, seen = 0, target;
+
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0 && CPU_COUNT(&allowed) > 0)
+        {
+            target = t % CPU_COUNT(&allowed);
+            for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            {
+                if (CPU_ISSET(cpu, &allowed) && seen++ == target)
+                {
+                    CPU_ZERO(&one);
+                    CPU_SET(cpu, &one);
+                    pthread_setaffinity_np(pthread_self(), sizeof(one), &one);
+                    break;
+                }
+            }
+        }
+    }
+    if (pl->policy == PLACEMENT_INTERLEAVE)
+    {
+        /* every node, the kernel keeps only the ones this process may use */
+        unsigned long nodes = ~0UL;
+        syscall(SYS_set_mempolicy, MPOL_INTERLEAVE, &nodes, 8 * sizeof(nodes));
+    }
+#else
+    (void)pl;
+    (void)t;
+#endif
+}
+
+/* body of a worker thread */
+static void *block_main(void *arg)
+{
+    block_worker *worker = (block_worker *)arg;
+    int first, count;
+
+    prepare_thread(worker->pl, worker->t);
+    placement_block(worker->n, worker->pl->threads, worker->t, &first, &count);
+    worker->body(worker->shared, first, count);
+    return NULL;
+}
+
+/* Helper function to run a pass over n rows with one thread per block */
+static void run_blocks(placement *pl, int n, block_body body, void *shared)
+{
+    int threads = pl->threads > 0 ? pl->threads : 1, t, first, count;
+    block_worker *workers;
+
+    if (threads == 1 && !pl->pin && pl->policy != PLACEMENT_INTERLEAVE)
+    {
+        body(shared, 0, n);
+        return;
+    }
+    workers = (block_worker *)calloc(threads, sizeof(block_worker));
+    for (t = 0; t < threads; t++)
+    {
+        workers[t].pl = pl;
+        workers[t].t = t;
+        workers[t].n = n;
+        workers[t].body = body;
+        workers[t].shared = shared;
+        workers[t].started = pthread_create(&workers[t].thread, NULL, block_main, &workers[t]) == 0;
+    }
+    for (t = 0; t < threads; t++)
+    {
+        if (workers[t].started)
+        {
+            pthread_join(workers[t].thread, NULL);
+        }
+        else
+        {
+            /* no thread for this block, the rows are placed wherever the caller runs */
+            placement_block(n, threads, t, &first, &count);
+            body(shared, first, count);
+        }
+    }
+    free(workers);
+}
+
+/* pass allocating rows and zeroing or copying them */
+static void zero_rows(void *shared, int first, int count)
+{
+    zero_pass *pass = (zero_pass *)shared;
+    int i;
+
+    for (i = first; i < first + count; i++)
+    {
+        pass->M[i] = (double *)malloc(pass->cols * sizeof(double));
+        /* fresh pages are placed by whoever writes them first, so write them here */
+        if (pass->from != NULL)
+        {
+            memcpy(pass->M[i], pass->from[i], pass->cols * sizeof(double));
+        }
+        else
+        {
+            memset(pass->M[i], 0, pass->cols * sizeof(double));
+        }
+    }
+}
+
+/* function to allocate a zeros matrix placed by the owners of its rows */
+double **placement_matrix(int rows, int cols, placement *pl)
+{
+    zero_pass pass;
+
+    if (pl->policy == PLACEMENT_SERIAL)
+    {
+        return initialize_matrix(rows, cols);
+    }
+    PROFILE_ALLOC(rows * (sizeof(double *) + cols * sizeof(double)));
+    pass.M = (double **)malloc(rows * sizeof(double *));
+    pass.cols = cols;
+    pass.from = NULL;
+    run_blocks(pl, rows, zero_rows, &pass);
+    return pass.M;
+}
+
+/* function to copy a matrix into one placed by the owners of its rows */
+double **placement_copy(double **M, int rows, int cols, placement *pl)
+{
+    zero_pass pass;
+
+    PROFILE_ALLOC(rows * (sizeof(double *) + cols * sizeof(double)));
+    pass.M = (double **)malloc(rows * sizeof(double *));
+    pass.cols = cols;
+    pass.from = M;
+    if (pl->policy == PLACEMENT_SERIAL)
+    {
+        zero_rows(&pass, 0, rows);
+    }
+    else
+    {
+        run_blocks(pl, rows, zero_rows, &pass);
+    }
+    return pass.M;
+}
+
+/* pass computing full rows of sym, allocating the rows that are not there yet */
+static void compute_sym_rows(void *shared, int first, int count)
+{
+    sym_pass *pass = (sym_pass *)shared;
+    int i, j;
+
+    for (i = first; i < first + count; i++)
+    {
+        double *row = pass->W[i];
+        if (row == NULL)
+        {
+            row = pass->W[i] = (double *)malloc(pass->n * sizeof(double));
+        }
+        /* distance(x, y) and distance(y, x) are the same bits, so the rows match symc */
+        for (j = 0; j < pass->n; j++)
+        {
+            row[j] = j == i ? 0.0 : exp(-0.5 * pass->distance(pass->points[i], pass->points[j], pass->d));
+        }
+    }
+}
+
+/* function to calculate sym with every block of rows computed by its owner */
+double **placement_sym(double **points, int n, int d, placement *pl)
+{
+    sym_pass pass;
+    profile_mark mark;
+
+    PROFILE_BEGIN(mark);
+    pass.points = points;
+    pass.d = d;
+    pass.n = n;
+    pass.distance = select_distance(d);
+    if (pl->policy == PLACEMENT_SERIAL)
+    {
+        pass.W = initialize_matrix(n, n);
+    }
+    else
+    {
+        /* computing a row is its first touch, no separate zeroing pass */
+        PROFILE_ALLOC(n * (sizeof(double *) + n * sizeof(double)));
+        pass.W = (double **)calloc(n, sizeof(double *));
+    }
+    run_blocks(pl, n, compute_sym_rows, &pass);
+    PROFILE_END(PROF_SYM, mark);
+    return pass.W;
+}
+
+/* pass multiplying rows of W by H, streaming each row of W once */
+static void multiply_rows(void *shared, int first, int count)
+{
+    multiply_pass *pass = (multiply_pass *)shared;
+    int i;
+
+    for (i = first; i < first + count; i++)
+    {
+        if (pass->allocate)
+        {
+            pass->WH[i] = (double *)calloc(pass->k, sizeof(double));
+        }
+        /* every entry still sums over j in ascending order, as matrix_multiplication does */
+        pass->product(pass->WH[i], pass->W[i], pass->packed, pass->n, pass->k);
+    }
+}
+
+/* function to calculate W*H with the blocks of rows multiplied by their owners */
+double **placement_multiply(double **W, double **H, int n, int k, placement *pl)
+{
+    multiply_pass pass;
+    double *packed = pack_matrix(H, n, k);
+
+    pass.W = W;
+    pass.packed = packed;
+    pass.n = n;
+    pass.k = k;
+    pass.product = select_product(k);
+    pass.allocate = pl->policy != PLACEMENT_SERIAL;
+    if (pass.allocate)
+    {
+        PROFILE_ALLOC(n * (sizeof(double *) + k * sizeof(double)));
+        pass.WH = (double **)malloc(n * sizeof(double *));
+    }
+    else
+    {
+        pass.WH = initialize_matrix(n, k);
+    }
+    run_blocks(pl, n, multiply_rows, &pass);
+    free(packed);
+    return pass.WH;
+}
+
+/* W*H for an affinity operator holding a placed dense matrix */
+static double **placed_multiply(void *data, double **H, int n, int k)
+{
+    placement_data *placed = (placement_data *)data;
+    return placement_multiply(placed->W, H, n, k, &placed->pl);
+}
+
+/* rows of W*H for an affinity operator holding a placed dense matrix, on the calling thread */
+static double **placed_multiply_rows(void *data, const int *rows, int count, double **H, int n, int k)
+{
+    return dense_rows_multiply(((placement_data *)data)->W, rows, count, H, n, k);
+}
+
+/* ||W||^2 for an affinity operator holding a placed dense matrix */
+static double placed_norm2(void *data, int n)
+{
+    return dense_norm2(((placement_data *)data)->W, n);
+}
+
+/* function to wrap a dense matrix as an affinity operator multiplying in parallel */
+void placement_op(double **W, placement *pl, affinity_op *op)
+{
+    placement_data *placed = (placement_data *)malloc(sizeof(placement_data));
+    placed->W = W;
+    placed->pl = *pl;
+    op->data = placed;
+    op->multiply = placed_multiply;
+    op->multiply_rows = placed_multiply_rows;
+    op->norm2 = placed_norm2;
+    op->destroy = free;
+}
@@ -0,0 +1,48 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include "symnmf.h"
+
+/* Memory policies of the large n x n and n x k matrices. Pages land on the NUMA node of the
+   thread that first touches them, so with first-touch every block of rows is zeroed (or
+   computed) by the thread that later multiplies it; interleave spreads the pages round robin
+   over all nodes instead; serial is the single-threaded allocation of initialize_matrix */
+#define PLACEMENT_FIRST_TOUCH 0
+#define PLACEMENT_INTERLEAVE 1
+#define PLACEMENT_SERIAL 2
+
+/* Threads working on a matrix and where its pages go */
+typedef struct
+{
+    int threads;
+    int policy;
+    /* pin thread t to the t-th CPU the process may run on, so a block of rows stays local */
+    int pin;
+} placement;
+
+/* Function to fill the default placement: one thread per online CPU, first-touch, no pinning */
+void placement_default(placement *pl);
+
+/* Function to parse a policy name ("first-touch", "interleave" or "serial"), returns -1 when unknown */
+int placement_policy(const char *name);
+
+/* Function to get the rows [first, first + count) that thread t of threads owns out of n */
+void placement_block(int n, int threads, int t, int *first, int *count);
+
+/* Function to allocate a zeros matrix whose rows are touched by the threads owning them */
+double **placement_matrix(int rows, int cols, placement *pl);
+
+/* Function to copy a matrix into one whose rows are touched by the threads owning them */
+double **placement_copy(double **M, int rows, int cols, placement *pl);
+
+/* Function to calculate sym with every block of rows computed, and so placed, by its owner */
+double **placement_sym(double **points, int n, int d, placement *pl);
+
+/* Function to calculate W*H with the blocks of rows of W multiplied by their owners */
+double **placement_multiply(double **W, double **H, int n, int k, placement *pl);
+
+/* Function to wrap a dense matrix as an affinity operator multiplying in parallel, the matrix stays
+   owned by the caller */
+void placement_op(double **W, placement *pl, affinity_op *op);
+
+#endif /* PLACEMENT_H */
@@ -0,0 +1,315 @@
+#define _POSIX_C_SOURCE 200112L
+#include <stdlib.h>
+#include <pthread.h>
+#include "pool.h"
+
+/* queued task */
+typedef struct
+{
+    pool_task task;
+    void *arg;
+    task_group *group;
+} pool_job;
+
+/* double-ended queue of one worker, a ring buffer that doubles when full */
+typedef struct
+{
+    pthread_mutex_t lock;
+    pool_job *jobs;
+    int capacity;
+    int top;
+    int count;
+} job_deque;
+
+/* worker thread and its deque */
+typedef struct
+{
+    thread_pool *pool;
+    pthread_t thread;
+    job_deque deque;
+    int index;
+} pool_worker;
+
+struct thread_pool
+{
+    /* guards queued, stop and the task groups; idle workers and waiters sleep on wake */
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pool_worker *workers;
+    int count;
+    int queued;
+    int stop;
+    /* deque that receives tasks submitted from outside the pool, round robin */
+    int next_deque;
+    /* identifies the worker running the current thread */
+    pthread_key_t self;
+};
+
+/* Helper function to push a job at the bottom of a deque */
+static void deque_push(job_deque *deque, pool_job job)
+{
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count == deque->capacity)
+    {
+        int capacity = deque->capacity > 0 ? deque->capacity * 2 : 16, i;
+        pool_job *jobs = (pool_job *)malloc(capacity * sizeof(pool_job));
+        for (i = 0; i < deque->count; i++)
+        {
+            jobs[i] = deque->jobs[(deque->top + i) % deque->capacity];
+        }
+        free(deque->jobs);
+        deque->jobs = jobs;
+        deque->capacity = capacity;
+        deque->top = 0;
+    }
+    deque->jobs[(deque->top + deque->count) % deque->capacity] = job;
+    deque->count++;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+/* Helper function to take a job from the bottom (the owner) or the top (a thief) of a deque */
+static int deque_pop(job_deque *deque, int from_top, pool_job *job)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count > 0)
+    {
+        if (from_top)
+        {
+            *job = deque->jobs[deque->top];
+            deque->top = (deque->top + 1) % deque->capacity;
+        }
+        else
+        {
+            *job = deque->jobs[(deque->top + deque->count - 1) % deque->capacity];
+        }
+        deque->count--;
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+/* Helper function to find a job: the newest of the own deque first (it is the hottest in
+   cache), otherwise the oldest of another deque (likely the largest piece of work left) */
+static int find_job(thread_pool *pool, pool_worker *self, pool_job *job)
+{
+    int start = self != NULL ? self->index : 0, i;
+
+    if (self != NULL && deque_pop(&self->deque, 0, job))
+    {
+        return 1;
+    }
+    for (i = 1; i <= pool->count; i++)
+    {
+        pool_worker *victim = &pool->workers[(start + i) % pool->count];
+        if (victim != self && deque_pop(&victim->deque, 1, job))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Helper function to run a job and account for it */
+static void run_job(thread_pool *pool, pool_job *job)
+{
+    job->task(job->arg);
+
+    pthread_mutex_lock(&pool->lock);
+    if (job->group != NULL && --job->group->pending == 0)
+    {
+        /* waiters of the group sleep on the same condition as idle workers */
+        pthread_cond_broadcast(&pool->wake);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* Helper function to take a job, leaving queued consistent; returns 0 when there is none */
+static int take_job(thread_pool *pool, pool_worker *self, pool_job *job)
+{
+    if (!find_job(pool, self, job))
+    {
+        return 0;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->queued--;
+    pthread_mutex_unlock(&pool->lock);
+    return 1;
+}
+
+/* body of a worker: run jobs until the pool stops and nothing is queued */
+static void *worker_main(void *arg)
+{
+    pool_worker *self = (pool_worker *)arg;
+    thread_pool *pool = self->pool;
+    pool_job job;
+
+    pthread_setspecific(pool->self, self);
+    for (;;)
+    {
+        if (take_job(pool, self, &job))
+        {
+            run_job(pool, &job);
+            continue;
+        }
+        pthread_mutex_lock(&pool->lock);
+        while (pool->queued == 0 && !pool->stop)
+        {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if (pool->queued == 0 && pool->stop)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return NULL;
+}
+
+/* function to start a pool of workers */
+thread_pool *pool_create(int threads)
+{
+    thread_pool *pool = (thread_pool *)calloc(1, sizeof(thread_pool));
+    int i;
+
+    if (threads <= 0)
+    {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_key_create(&pool->self, NULL);
+    pool->workers = (pool_worker *)calloc(threads, sizeof(pool_worker));
+    for (i = 0; i < threads; i++)
+    {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        pthread_mutex_init(&pool->workers[i].deque.lock, NULL);
+    }
+    /* deques exist before any worker starts, so the first workers may steal from all of them */
+    pool->count = threads;
+    for (i = 0; i < threads; i++)
+    {
+        if (pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i]) != 0)
+        {
+            break;
+        }
+    }
+    if (i < threads)
+    {
+        /* stop the workers that did start, the others have nothing to join */
+        pool->count = i;
+        pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+/* function to queue a task belonging to a group */
+int pool_submit_group(thread_pool *pool, task_group *group, pool_task task, void *arg)
+{
+    pool_worker *self = (pool_worker *)pthread_getspecific(pool->self);
+    pool_job job;
+
+    job.task = task;
+    job.arg = arg;
+    job.group = group;
+
+    pthread_mutex_lock(&pool->lock);
+    if (group != NULL)
+    {
+        group->pending++;
+    }
+    if (self == NULL || self->pool != pool)
+    {
+        self = &pool->workers[pool->next_deque];
+        pool->next_deque = (pool->next_deque + 1) % pool->count;
+    }
+    /* counted before it is visible, so queued never drops below the jobs that can be found */
+    pool->queued++;
+    pthread_mutex_unlock(&pool->lock);
+
+    deque_push(&self->deque, job);
+
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+/* function to queue a task */
+int pool_submit(thread_pool *pool, pool_task task, void *arg)
+{
+    return pool_submit_group(pool, NULL, task, arg);
+}
+
+/* function to wait for a group, running queued jobs meanwhile */
+void pool_wait(thread_pool *pool, task_group *group)
+{
+    pool_worker *self = (pool_worker *)pthread_getspecific(pool->self);
+    pool_job job;
+
+    if (self != NULL && self->pool != pool)
+    {
+        self = NULL;
+    }
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+        if (group->pending == 0)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            return;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        if (take_job(pool, self, &job))
+        {
+            run_job(pool, &job);
+            continue;
+        }
+        /* the rest of the group is running elsewhere */
+        pthread_mutex_lock(&pool->lock);
+        while (group->pending > 0 && pool->queued == 0)
+        {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/* function returning the number of workers */
+int pool_size(thread_pool *pool)
+{
+    return pool->count;
+}
+
+/* function to drain the queues, join the workers and free the pool */
+void pool_destroy(thread_pool *pool)
+{
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->count; i++)
+    {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+
+    for (i = 0; i < pool->count; i++)
+    {
+        pthread_mutex_destroy(&pool->workers[i].deque.lock);
+        free(pool->workers[i].deque.jobs);
+    }
+    pthread_key_delete(pool->self);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    free(pool->workers);
+    free(pool);
+}
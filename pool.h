@@ -0,0 +1,36 @@
+#ifndef POOL_H
+#define POOL_H
+
+/* Work-stealing pool of worker threads. Every worker has its own deque: tasks it submits go to
+   its bottom and are taken back from there, idle workers steal from the top of the others */
+typedef struct thread_pool thread_pool;
+
+/* Task run by a worker, arg is the pointer given to pool_submit */
+typedef void (*pool_task)(void *arg);
+
+/* Set of tasks that can be waited for together, initialize pending to 0 */
+typedef struct
+{
+    int pending;
+} task_group;
+
+/* Function to start a pool of the given number of workers, returns NULL on failure */
+thread_pool *pool_create(int threads);
+
+/* Function to queue a task, returns 0 on success */
+int pool_submit(thread_pool *pool, pool_task task, void *arg);
+
+/* Function to queue a task belonging to a group, returns 0 on success */
+int pool_submit_group(thread_pool *pool, task_group *group, pool_task task, void *arg);
+
+/* Function to wait until every task of a group ran. The caller runs queued tasks meanwhile, so a
+   task may split its work into a group and wait for it without tying up a worker */
+void pool_wait(thread_pool *pool, task_group *group);
+
+/* Function returning the number of workers */
+int pool_size(thread_pool *pool);
+
+/* Function to run the tasks still queued, stop the workers and free the pool */
+void pool_destroy(thread_pool *pool);
+
+#endif /* POOL_H */
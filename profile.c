@@ -0,0 +1,212 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "profile.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+int profile_enabled = 0;
+
+static profile_report report;
+static double allocated_bytes = 0.0;
+
+/* file descriptors of the hardware counters, -1 when they could not be opened */
+static int cycles_fd = -1;
+static int misses_fd = -1;
+
+static const char *stage_names[PROF_NUM_STAGES] = {
+    "read_data", "symc", "ddgc", "normc", "calc", "symnmfc", "print_matrix"};
+
+/* function returning a monotonic wall clock in seconds */
+double profile_clock(void)
+{
+#if defined(__linux__) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+#ifdef __linux__
+/* function to open a user-space hardware counter for the calling process; inherit makes it count the
+   threads it creates from then on as well, and reading it sums theirs in, so the pools, the placed
+   workers, the pipeline and the out-of-core scans are counted with the stage that runs them */
+static int open_counter(unsigned long config)
+{
+    struct perf_event_attr attr;
+    long fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.inherit = 1;
+
+    fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    return (int)fd;
+}
+
+/* function to read a hardware counter, returns 0 when it is not available */
+static double read_counter(int fd)
+{
+    __u64 value = 0;
+    if (fd < 0 || read(fd, &value, sizeof(value)) != (ssize_t)sizeof(value))
+    {
+        return 0.0;
+    }
+    return (double)value;
+}
+#endif
+
+/* function to open the hardware counters once, profiling works without them */
+static void open_counters(void)
+{
+#ifdef __linux__
+    if (cycles_fd < 0)
+    {
+        cycles_fd = open_counter(PERF_COUNT_HW_CPU_CYCLES);
+    }
+    if (misses_fd < 0)
+    {
+        misses_fd = open_counter(PERF_COUNT_HW_CACHE_MISSES);
+    }
+#endif
+    report.hw_available = cycles_fd >= 0 && misses_fd >= 0;
+}
+
+/* function to take a snapshot of time, allocations and hardware counters */
+static void take_mark(profile_mark *mark)
+{
+    mark->bytes = allocated_bytes;
+#ifdef __linux__
+    mark->cycles = read_counter(cycles_fd);
+    mark->llc_misses = read_counter(misses_fd);
+#else
+    mark->cycles = 0.0;
+    mark->llc_misses = 0.0;
+#endif
+    mark->seconds = profile_clock();
+}
+
+/* function to turn profiling on (resetting the report) or off; it has to be turned on before the
+   worker threads of the run are created for the counters to cover them */
+void profile_enable(int on)
+{
+    if (on)
+    {
+        free(report.iterations);
+        memset(&report, 0, sizeof(report));
+        allocated_bytes = 0.0;
+        open_counters();
+    }
+    profile_enabled = on;
+}
+
+/* function to record the start of a stage or an iteration */
+void profile_begin(profile_mark *mark)
+{
+    take_mark(mark);
+}
+
+/* function to record the end of a stage */
+void profile_end(int stage, profile_mark *mark)
+{
+    profile_mark end;
+    profile_counters *counters = &report.stages[stage];
+
+    take_mark(&end);
+    counters->calls++;
+    counters->seconds += end.seconds - mark->seconds;
+    counters->bytes += end.bytes - mark->bytes;
+    counters->cycles += end.cycles - mark->cycles;
+    counters->llc_misses += end.llc_misses - mark->llc_misses;
+}
+
+/* function to record the end of a symnmf iteration with its convergence delta and objective */
+void profile_iteration_end(profile_mark *mark, double delta, double objective)
+{
+    profile_mark end;
+    profile_iteration *iteration;
+
+    take_mark(&end);
+    if (report.num_iterations == report.iterations_capacity)
+    {
+        int capacity = report.iterations_capacity == 0 ? 64 : 2 * report.iterations_capacity;
+        profile_iteration *grown = (profile_iteration *)realloc(report.iterations, capacity * sizeof(profile_iteration));
+        if (grown == NULL)
+        {
+            return;
+        }
+        report.iterations = grown;
+        report.iterations_capacity = capacity;
+    }
+
+    iteration = &report.iterations[report.num_iterations++];
+    iteration->seconds = end.seconds - mark->seconds;
+    iteration->delta = delta;
+    iteration->objective = objective;
+    iteration->cycles = end.cycles - mark->cycles;
+    iteration->llc_misses = end.llc_misses - mark->llc_misses;
+}
+
+/* function to count bytes allocated by the current stage */
+void profile_alloc(double bytes)
+{
+    allocated_bytes += bytes;
+}
+
+/* function returning the name of a stage as used in the report */
+const char *profile_stage_name(int stage)
+{
+    return stage_names[stage];
+}
+
+/* function returning the report collected since profiling was enabled */
+const profile_report *profile_get(void)
+{
+    return &report;
+}
+
+/* function to write the report as JSON */
+void profile_print(FILE *out)
+{
+    int i;
+
+    fprintf(out, "{\"hw_counters\": %s, \"stages\": {", report.hw_available ? "true" : "false");
+    for (i = 0; i < PROF_NUM_STAGES; i++)
+    {
+        const profile_counters *c = &report.stages[i];
+        fprintf(out, "%s\"%s\": {\"calls\": %ld, \"seconds\": %.9f, \"bytes\": %.0f",
+                i > 0 ? ", " : "", stage_names[i], c->calls, c->seconds, c->bytes);
+        if (report.hw_available)
+        {
+            fprintf(out, ", \"cycles\": %.0f, \"llc_misses\": %.0f", c->cycles, c->llc_misses);
+        }
+        fprintf(out, "}");
+    }
+    fprintf(out, "}, \"iterations\": [");
+    for (i = 0; i < report.num_iterations; i++)
+    {
+        const profile_iteration *it = &report.iterations[i];
+        fprintf(out, "%s{\"seconds\": %.9f, \"delta\": %.9g, \"objective\": %.9g", i > 0 ? ", " : "",
+                it->seconds, it->delta, it->objective);
+        if (report.hw_available)
+        {
+            fprintf(out, ", \"cycles\": %.0f, \"llc_misses\": %.0f", it->cycles, it->llc_misses);
+        }
+        fprintf(out, "}");
+    }
+    fprintf(out, "]}\n");
+}
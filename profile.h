@@ -0,0 +1,111 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* Stages of the computation that are measured by the profiler */
+enum profile_stage
+{
+    PROF_READ_DATA,
+    PROF_SYM,
+    PROF_DDG,
+    PROF_NORM,
+    PROF_CALC,
+    PROF_SYMNMF,
+    PROF_PRINT,
+    PROF_NUM_STAGES
+};
+
+/* Counters accumulated over all calls of one stage (nested stages are inclusive) */
+typedef struct
+{
+    long calls;
+    double seconds;
+    double bytes;
+    double cycles;
+    double llc_misses;
+} profile_counters;
+
+/* Counters of a single iteration of symnmfc */
+typedef struct
+{
+    double seconds;
+    double delta;
+    /* ||W - H*H^T||^2 of the iterate the update started from, see symnmf_params */
+    double objective;
+    double cycles;
+    double llc_misses;
+} profile_iteration;
+
+/* Full profiling report, hardware counters are valid only when hw_available is set. They count the
+   whole process: every thread created after profiling was turned on is included */
+typedef struct
+{
+    profile_counters stages[PROF_NUM_STAGES];
+    profile_iteration *iterations;
+    int num_iterations;
+    int iterations_capacity;
+    int hw_available;
+} profile_report;
+
+/* Snapshot taken when a stage or an iteration starts */
+typedef struct
+{
+    double seconds;
+    double bytes;
+    double cycles;
+    double llc_misses;
+} profile_mark;
+
+/* Non-zero while profiling is on, every hook checks it before doing any work */
+extern int profile_enabled;
+
+/* Hooks used in the hot paths, they cost a single branch when profiling is off */
+#define PROFILE_BEGIN(mark)        \
+    do                             \
+    {                              \
+        if (profile_enabled)       \
+            profile_begin(&(mark)); \
+    } while (0)
+#define PROFILE_END(stage, mark)           \
+    do                                     \
+    {                                      \
+        if (profile_enabled)               \
+            profile_end((stage), &(mark)); \
+    } while (0)
+#define PROFILE_ALLOC(bytes)                     \
+    do                                           \
+    {                                            \
+        if (profile_enabled)                     \
+            profile_alloc((double)(bytes));      \
+    } while (0)
+
+/* Function returning a monotonic wall clock in seconds, usable with profiling off */
+double profile_clock(void);
+
+/* Function to turn profiling on (resetting the report) or off, before any worker thread is created */
+void profile_enable(int on);
+
+/* Function to record the start of a stage or an iteration */
+void profile_begin(profile_mark *mark);
+
+/* Function to record the end of a stage */
+void profile_end(int stage, profile_mark *mark);
+
+/* Function to record the end of a symnmf iteration with its convergence delta and objective */
+void profile_iteration_end(profile_mark *mark, double delta, double objective);
+
+/* Function to count bytes allocated by the current stage */
+void profile_alloc(double bytes);
+
+/* Function returning the name of a stage as used in the report */
+const char *profile_stage_name(int stage);
+
+/* Function returning the report collected since profiling was enabled */
+const profile_report *profile_get(void);
+
+/* Function to write the report as JSON */
+void profile_print(FILE *out);
+
+#endif /* PROFILE_H */
@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include "symnmf.h"
+#include "pool.h"
+#include "quantize.h"
+
+/* largest stored value of the fixed point formats */
+#define FIXED16_MAX 65535.0
+#define INT8_MAX_VALUE 255.0
+
+/* rows of W*H computed together, so that each packed row of H is loaded once for all of them */
+#define QUANT_ROWS 4
+/* rows of a task of the pool */
+#define QUANT_BLOCK_ROWS 64
+
+/*
+ * A dense W*H pass streams all n^2 entries of W once per iteration, so for n beyond the caches and
+ * several threads its speed is set by memory bandwidth. Storing W in 16 or 8 bits cuts those bytes
+ * by 4 or 8 and the entries are turned back into doubles in registers, inside the loop that
+ * multiplies them. The fixed point formats factor the row scale out of the inner loop, which then
+ * only converts small integers. bfloat16 is the top half of a float, so decoding it is a shift; this
+ * assumes 32-bit IEEE floats and unsigned ints, as on every platform the kernels are built for.
+ * H is packed into one array and four rows of W share every load of it, which keeps the decoding
+ * from making the pass compute bound again.
+ */
+
+/* function to parse a format name */
+int quantize_format(const char *name)
+{
+    if (strcmp(name, "fixed16") == 0)
+    {
+        return QUANT_FIXED16;
+    }
+    if (strcmp(name, "bf16") == 0)
+    {
+        return QUANT_BF16;
+    }
+    if (strcmp(name, "int8") == 0)
+    {
+        return QUANT_INT8;
+    }
+    return -1;
+}
+
+/* function returning the name of a format */
+const char *quantize_format_name(int format)
+{
+    static const char *names[] = {"fixed16", "bf16", "int8"};
+    return format >= QUANT_FIXED16 && format <= QUANT_INT8 ? names[format] : "unknown";
+}
+
+/* Helper function to round a value to bfloat16, to nearest with ties to even */
+static unsigned short to_bf16(double value)
+{
+    float single = (float)value;
+    unsigned int bits;
+
+    memcpy(&bits, &single, sizeof(bits));
+    bits += 0x7fffU + ((bits >> 16) & 1U);
+    return (unsigned short)(bits >> 16);
+}
+
+/* Helper function to widen a bfloat16 back to a double */
+static double from_bf16(unsigned short value)
+{
+    unsigned int bits = (unsigned int)value << 16;
+    float single;
+
+    memcpy(&single, &bits, sizeof(single));
+    return single;
+}
+
+/* function to quantize a dense matrix */
+quantized *quantize(double **W, int n, int format, int threads)
+{
+    quantized *q = (quantized *)malloc(sizeof(quantized));
+    double levels = format == QUANT_INT8 ? INT8_MAX_VALUE : FIXED16_MAX;
+    double norm2 = 0.0, error2 = 0.0;
+    size_t base;
+    int i, j;
+
+    q->n = n;
+    q->format = format;
+    q->wide = format == QUANT_INT8 ? NULL : (unsigned short *)malloc((size_t)n * n * sizeof(unsigned short));
+    q->narrow = format == QUANT_INT8 ? (unsigned char *)malloc((size_t)n * n) : NULL;
+    q->scale = (double *)malloc(n * sizeof(double));
+    q->norm2 = 0.0;
+    q->pool = threads > 1 && n > QUANT_BLOCK_ROWS ? pool_create(threads) : NULL;
+
+    for (i = 0; i < n; i++)
+    {
+        double largest = 0.0;
+        base = (size_t)i * n;
+        for (j = 0; j < n; j++)
+        {
+            largest = W[i][j] > largest ? W[i][j] : largest;
+        }
+        /* negative entries, which sym and norm never have, are stored as 0 */
+        q->scale[i] = format == QUANT_BF16 ? 1.0 : largest / levels;
+        for (j = 0; j < n; j++)
+        {
+            double value = W[i][j] > 0.0 ? W[i][j] : 0.0, stored;
+            if (format == QUANT_BF16)
+            {
+                q->wide[base + j] = to_bf16(value);
+                stored = from_bf16(q->wide[base + j]);
+            }
+            else
+            {
+                unsigned int level = largest > 0.0 ? (unsigned int)(value / q->scale[i] + 0.5) : 0U;
+                if (format == QUANT_INT8)
+                {
+                    q->narrow[base + j] = (unsigned char)level;
+                }
+                else
+                {
+                    q->wide[base + j] = (unsigned short)level;
+                }
+                stored = q->scale[i] * level;
+            }
+            norm2 += W[i][j] * W[i][j];
+            error2 += (W[i][j] - stored) * (W[i][j] - stored);
+            q->norm2 += stored * stored;
+        }
+    }
+    q->error = norm2 > 0.0 ? sqrt(error2 / norm2) : 0.0;
+    return q;
+}
+
+/* function returning the bytes a quantized matrix takes */
+size_t quantized_bytes(quantized *q)
+{
+    size_t entry = q->format == QUANT_INT8 ? 1 : sizeof(unsigned short);
+    return (size_t)q->n * q->n * entry + q->n * sizeof(double);
+}
+
+/* identity decoding of the fixed point formats, whose scale is applied once per row */
+#define DECODE_LEVEL(x) ((double)(x))
+
+/* inner loop over QUANT_ROWS rows of W, of element type TYPE, starting at w[0..3] */
+#define ROWS_BODY(TYPE, DECODE)                                                         \
+    {                                                                                   \
+        const TYPE *w0 = (const TYPE *)w[0], *w1 = (const TYPE *)w[1];                  \
+        const TYPE *w2 = (const TYPE *)w[2], *w3 = (const TYPE *)w[3];                  \
+        for (j = 0; j < n; j++)                                                         \
+        {                                                                               \
+            double a0 = DECODE(w0[j]), a1 = DECODE(w1[j]);                              \
+            double a2 = DECODE(w2[j]), a3 = DECODE(w3[j]);                              \
+            const double *h = packed + (size_t)j * k;                                   \
+            for (c = 0; c < k; c++)                                                     \
+            {                                                                           \
+                o0[c] += a0 * h[c];                                                     \
+                o1[c] += a1 * h[c];                                                     \
+                o2[c] += a2 * h[c];                                                     \
+                o3[c] += a3 * h[c];                                                     \
+            }                                                                           \
+        }                                                                               \
+    }
+
+/* rows of W*H for one task: rows[first..] of the matrix, or the rows first.. when rows is NULL */
+typedef struct
+{
+    quantized *q;
+    const int *rows;
+    int first;
+    int count;
+    const double *packed;
+    int k;
+    double **WH;
+} quant_block;
+
+/* Helper function to calculate up to QUANT_ROWS rows of W*H into out, which start zeroed; missing
+   rows repeat the last one into a scratch row */
+static void rows_multiply(quantized *q, const int *rows, int count, const double *packed, int k, double **out,
+                          double *scratch)
+{
+    const void *w[QUANT_ROWS];
+    double *o0, *o1, *o2, *o3;
+    int n = q->n, t, j, c;
+
+    for (t = 0; t < QUANT_ROWS; t++)
+    {
+        size_t base = (size_t)rows[t < count ? t : count - 1] * n;
+        w[t] = q->format == QUANT_INT8 ? (const void *)(q->narrow + base) : (const void *)(q->wide + base);
+    }
+    o0 = out[0];
+    o1 = count > 1 ? out[1] : scratch;
+    o2 = count > 2 ? out[2] : scratch;
+    o3 = count > 3 ? out[3] : scratch;
+    if (q->format == QUANT_INT8)
+    {
+        ROWS_BODY(unsigned char, DECODE_LEVEL)
+    }
+    else if (q->format == QUANT_FIXED16)
+    {
+        ROWS_BODY(unsigned short, DECODE_LEVEL)
+    }
+    else
+    {
+        ROWS_BODY(unsigned short, from_bf16)
+    }
+    /* the row scale of the fixed point formats, 1 for bfloat16 */
+    for (t = 0; t < count; t++)
+    {
+        for (c = 0; c < k; c++)
+        {
+            out[t][c] *= q->scale[rows[t]];
+        }
+    }
+}
+
+/* task calculating the rows of W*H of a block */
+static void block_multiply(void *arg)
+{
+    quant_block *block = (quant_block *)arg;
+    double *scratch = (double *)malloc(block->k * sizeof(double));
+    int rows[QUANT_ROWS], t, r;
+
+    for (t = 0; t < block->count; t += QUANT_ROWS)
+    {
+        int count = block->count - t < QUANT_ROWS ? block->count - t : QUANT_ROWS;
+        for (r = 0; r < count; r++)
+        {
+            rows[r] = block->rows != NULL ? block->rows[block->first + t + r] : block->first + t + r;
+        }
+        memset(scratch, 0, block->k * sizeof(double));
+        rows_multiply(block->q, rows, count, block->packed, block->k, block->WH + block->first + t, scratch);
+    }
+    free(scratch);
+}
+
+/* Helper function to calculate count rows of W*H (the given ones, or all when rows is NULL) on the
+   pool of the matrix, from H packed into one contiguous array */
+static double **blocks_multiply(quantized *q, const int *rows, int count, double **H, int k)
+{
+    double **WH = initialize_matrix(count, k);
+    double *packed = pack_matrix(H, q->n, k);
+    int blocks = (count + QUANT_BLOCK_ROWS - 1) / QUANT_BLOCK_ROWS, b;
+    quant_block *tasks = (quant_block *)malloc((blocks > 0 ? blocks : 1) * sizeof(quant_block));
+    task_group group;
+
+    group.pending = 0;
+    for (b = 0; b < blocks; b++)
+    {
+        tasks[b].q = q;
+        tasks[b].rows = rows;
+        tasks[b].first = b * QUANT_BLOCK_ROWS;
+        tasks[b].count = b == blocks - 1 ? count - tasks[b].first : QUANT_BLOCK_ROWS;
+        tasks[b].packed = packed;
+        tasks[b].k = k;
+        tasks[b].WH = WH;
+        if (q->pool == NULL || pool_submit_group(q->pool, &group, block_multiply, &tasks[b]) != 0)
+        {
+            block_multiply(&tasks[b]);
+        }
+    }
+    if (q->pool != NULL)
+    {
+        pool_wait(q->pool, &group);
+    }
+    free(tasks);
+    free(packed);
+    return WH;
+}
+
+/* function to calculate W*H for a quantized W */
+double **quantized_multiply(quantized *q, double **H, int k)
+{
+    return blocks_multiply(q, NULL, q->n, H, k);
+}
+
+/* function to calculate the given rows of W*H for a quantized W */
+double **quantized_rows_multiply(quantized *q, const int *rows, int count, double **H, int k)
+{
+    return blocks_multiply(q, rows, count, H, k);
+}
+
+/* W*H callback of the affinity operator */
+static double **quantized_op_multiply(void *data, double **H, int n, int k)
+{
+    (void)n;
+    return quantized_multiply((quantized *)data, H, k);
+}
+
+/* rows of W*H callback of the affinity operator */
+static double **quantized_op_multiply_rows(void *data, const int *rows, int count, double **H, int n, int k)
+{
+    (void)n;
+    return quantized_rows_multiply((quantized *)data, rows, count, H, k);
+}
+
+/* ||W||^2 callback of the affinity operator, that of the stored matrix */
+static double quantized_op_norm2(void *data, int n)
+{
+    (void)n;
+    return ((quantized *)data)->norm2;
+}
+
+/* destroy callback of the affinity operator */
+static void quantized_op_destroy(void *data)
+{
+    free_quantized((quantized *)data);
+}
+
+/* function to wrap a quantized matrix as an affinity operator that owns it */
+void quantized_op(quantized *q, affinity_op *op)
+{
+    op->data = q;
+    op->multiply = quantized_op_multiply;
+    op->multiply_rows = quantized_op_multiply_rows;
+    op->norm2 = quantized_op_norm2;
+    op->destroy = quantized_op_destroy;
+}
+
+/* Helper function to free a quantized matrix */
+void free_quantized(quantized *q)
+{
+    if (q == NULL)
+    {
+        return;
+    }
+    if (q->pool != NULL)
+    {
+        pool_destroy(q->pool);
+    }
+    free(q->wide);
+    free(q->narrow);
+    free(q->scale);
+    free(q);
+}
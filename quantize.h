@@ -0,0 +1,57 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include <stddef.h>
+#include "symnmf.h"
+#include "pool.h"
+
+/* Storage formats of a quantized affinity, for non-negative matrices such as sym and norm:
+   QUANT_FIXED16 keeps 16-bit fixed point entries of each row scaled by its largest one,
+   QUANT_BF16 keeps bfloat16 entries (8 significant bits, the exponent range of a float) and
+   QUANT_INT8 keeps 8-bit entries of each row scaled by its largest one */
+#define QUANT_FIXED16 0
+#define QUANT_BF16 1
+#define QUANT_INT8 2
+
+/* Quantized n x n matrix, row i starting at entry i * n of wide (16-bit formats) or narrow (8-bit).
+   Entry (i, j) stands for scale[i] * q for the fixed point formats and for the bfloat16 q itself */
+typedef struct
+{
+    int n;
+    int format;
+    unsigned short *wide;
+    unsigned char *narrow;
+    double *scale;
+    /* ||Q||^2 of the stored matrix and the relative Frobenius error ||W - Q|| / ||W|| */
+    double norm2;
+    double error;
+    /* workers sharing the rows of every W*H, NULL to multiply on the calling thread */
+    thread_pool *pool;
+} quantized;
+
+/* Function to parse a format name ("fixed16", "bf16" or "int8"), returns -1 when unknown */
+int quantize_format(const char *name);
+
+/* Function returning the name of a format */
+const char *quantize_format_name(int format);
+
+/* Function to quantize a dense n x n matrix, which stays owned by the caller; products with it run
+   on threads threads (0 or 1 for the calling thread only) */
+quantized *quantize(double **W, int n, int format, int threads);
+
+/* Function returning the bytes a quantized matrix takes, scales included */
+size_t quantized_bytes(quantized *q);
+
+/* Function to calculate W*H for a quantized W, dequantizing each entry as it is streamed */
+double **quantized_multiply(quantized *q, double **H, int k);
+
+/* Function to calculate the given rows of W*H for a quantized W, reading only those rows of W */
+double **quantized_rows_multiply(quantized *q, const int *rows, int count, double **H, int k);
+
+/* Function to wrap a quantized matrix as an affinity operator that owns it */
+void quantized_op(quantized *q, affinity_op *op);
+
+/* Helper function to free a quantized matrix */
+void free_quantized(quantized *q);
+
+#endif /* QUANTIZE_H */
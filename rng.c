@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include "symnmf.h"
+#include "rng.h"
+
+#define MT_SHIFT 397
+#define LOW32 0xffffffffUL
+/* 2^-53, the step between the doubles of [0, 1) NumPy draws */
+#define DOUBLE_STEP (1.0 / 9007199254740992.0)
+/* rounds of Philox4x64 in NumPy */
+#define PHILOX_ROUNDS 10
+
+/* 64-bit word of Philox as two 32-bit halves, so no 64-bit integer type is needed */
+typedef struct
+{
+    unsigned long hi;
+    unsigned long lo;
+} word64;
+
+/* function to parse a generator name */
+int rng_kind(const char *name)
+{
+    if (strcmp(name, "mt19937") == 0)
+    {
+        return RNG_MT19937;
+    }
+    if (strcmp(name, "philox") == 0)
+    {
+        return RNG_PHILOX;
+    }
+    return -1;
+}
+
+/* Helper function to refill the MT19937 state with its next 624 words */
+static void mt_twist(unsigned long *mt)
+{
+    int i;
+    for (i = 0; i < MT_WORDS; i++)
+    {
+        unsigned long y = (mt[i] & 0x80000000UL) | (mt[(i + 1) % MT_WORDS] & 0x7fffffffUL);
+        mt[i] = mt[(i + MT_SHIFT) % MT_WORDS] ^ (y >> 1) ^ ((y & 1UL) ? 0x9908b0dfUL : 0UL);
+    }
+}
+
+/* Helper function returning the next 32-bit word of MT19937 */
+static unsigned long mt_next(rng_state *rng)
+{
+    unsigned long y;
+    if (rng->used >= MT_WORDS)
+    {
+        mt_twist(rng->mt);
+        rng->used = 0;
+    }
+    y = rng->mt[rng->used++];
+    y ^= y >> 11;
+    y ^= (y << 7) & 0x9d2c5680UL;
+    y ^= (y << 15) & 0xefc60000UL;
+    y ^= y >> 18;
+    return y & LOW32;
+}
+
+/* Helper function to multiply two 32-bit words into a 64-bit one, through 16-bit halves */
+static word64 mul32(unsigned long a, unsigned long b)
+{
+    unsigned long a1 = a >> 16, a0 = a & 0xffffUL, b1 = b >> 16, b0 = b & 0xffffUL;
+    unsigned long low = a0 * b0, cross1 = a0 * b1, cross2 = a1 * b0;
+    unsigned long middle = (low >> 16) + (cross1 & 0xffffUL) + (cross2 & 0xffffUL);
+    word64 product;
+
+    product.lo = ((middle << 16) | (low & 0xffffUL)) & LOW32;
+    product.hi = (a1 * b1 + (cross1 >> 16) + (cross2 >> 16) + (middle >> 16)) & LOW32;
+    return product;
+}
+
+/* Helper function to add 32-bit words, counting the carries out of the low 32 bits */
+static unsigned long add32(unsigned long a, unsigned long b, unsigned long *carry)
+{
+    unsigned long sum = (a + b) & LOW32;
+    *carry += sum < a;
+    return sum;
+}
+
+/* Helper function to multiply two 64-bit words into the high and low halves of the 128-bit product */
+static void mulhilo64(word64 a, word64 b, word64 *hi, word64 *lo)
+{
+    word64 ll = mul32(a.lo, b.lo), lh = mul32(a.lo, b.hi), hl = mul32(a.hi, b.lo), hh = mul32(a.hi, b.hi);
+    unsigned long carry1 = 0, carry2 = 0;
+
+    lo->lo = ll.lo;
+    lo->hi = add32(add32(ll.hi, lh.lo, &carry1), hl.lo, &carry1);
+    hi->lo = add32(add32(add32(hh.lo, lh.hi, &carry2), hl.hi, &carry2), carry1, &carry2);
+    hi->hi = (hh.hi + carry2) & LOW32;
+}
+
+/* Helper function to add two 64-bit words modulo 2^64 */
+static word64 add64(word64 a, word64 b)
+{
+    unsigned long carry = 0;
+    word64 sum;
+    sum.lo = add32(a.lo, b.lo, &carry);
+    sum.hi = (a.hi + b.hi + carry) & LOW32;
+    return sum;
+}
+
+/* Helper function to compute the block-th block of four doubles of Philox4x64-10 keyed with seed,
+   NumPy's counter being block + 1 since it counts up before every block */
+static void philox_block(unsigned long seed, unsigned long block, double *out)
+{
+    static const word64 m0 = {0xD2E7470EUL, 0xE14C6C93UL}, m1 = {0xCA5A8263UL, 0x95121157UL};
+    static const word64 w0 = {0x9E3779B9UL, 0x7F4A7C15UL}, w1 = {0xBB67AE85UL, 0x84CAA73BUL};
+    word64 ctr[4], key[2], hi0, lo0, hi1, lo1, one = {0UL, 1UL};
+    int round, t;
+
+    /* the shifts go by 16 twice, so a 32-bit unsigned long is not shifted by its width */
+    ctr[0].lo = block & LOW32;
+    ctr[0].hi = (block >> 16 >> 16) & LOW32;
+    ctr[0] = add64(ctr[0], one);
+    ctr[1].hi = ctr[1].lo = ctr[2].hi = ctr[2].lo = ctr[3].hi = ctr[3].lo = 0UL;
+    key[0].lo = seed & LOW32;
+    key[0].hi = (seed >> 16 >> 16) & LOW32;
+    key[1].hi = key[1].lo = 0UL;
+    for (round = 0; round < PHILOX_ROUNDS; round++)
+    {
+        if (round > 0)
+        {
+            key[0] = add64(key[0], w0);
+            key[1] = add64(key[1], w1);
+        }
+        mulhilo64(m0, ctr[0], &hi0, &lo0);
+        mulhilo64(m1, ctr[2], &hi1, &lo1);
+        ctr[0].hi = hi1.hi ^ ctr[1].hi ^ key[0].hi;
+        ctr[0].lo = hi1.lo ^ ctr[1].lo ^ key[0].lo;
+        ctr[1] = lo1;
+        ctr[2].hi = hi0.hi ^ ctr[3].hi ^ key[1].hi;
+        ctr[2].lo = hi0.lo ^ ctr[3].lo ^ key[1].lo;
+        ctr[3] = lo0;
+    }
+    /* the top 53 bits of every word */
+    for (t = 0; t < 4; t++)
+    {
+        out[t] = ((double)ctr[t].hi * 2097152.0 + (double)(ctr[t].lo >> 11)) * DOUBLE_STEP;
+    }
+}
+
+/* function to seed a generator */
+void rng_seed(rng_state *rng, int kind, unsigned long seed)
+{
+    int i;
+
+    rng->kind = kind;
+    rng->seed = seed;
+    rng->position = 0;
+    /* np.random.seed(seed): the 32-bit seed spread by the initialization of MT19937 */
+    seed &= LOW32;
+    for (i = 0; i < MT_WORDS; i++)
+    {
+        rng->mt[i] = seed;
+        seed = (1812433253UL * (seed ^ (seed >> 30)) + (unsigned long)i + 1UL) & LOW32;
+    }
+    rng->used = MT_WORDS;
+}
+
+/* function returning the next double in [0, 1) */
+double rng_uniform(rng_state *rng)
+{
+    unsigned long a, b;
+
+    if (rng->kind == RNG_PHILOX)
+    {
+        if (rng->position % 4 == 0)
+        {
+            philox_block(rng->seed, rng->position / 4, rng->block);
+        }
+        return rng->block[rng->position++ % 4];
+    }
+    /* 27 + 26 bits of two words, as random_sample() */
+    a = mt_next(rng) >> 5;
+    b = mt_next(rng) >> 6;
+    return (a * 67108864.0 + b) * DOUBLE_STEP;
+}
+
+/* function returning the position-th double of Philox directly */
+double philox_uniform(unsigned long seed, unsigned long position)
+{
+    double block[4];
+    philox_block(seed, position / 4, block);
+    return block[position % 4];
+}
+
+/* dense n x n matrix read by dense_fill */
+typedef struct
+{
+    double **W;
+    int n;
+} dense_entries;
+
+/* Helper function to copy count entries of a dense matrix, from flat index first on */
+static void dense_fill(void *data, size_t first, size_t count, double *values)
+{
+    dense_entries *entries = (dense_entries *)data;
+    int row = (int)(first / entries->n), col = (int)(first % entries->n);
+    size_t t;
+
+    for (t = 0; t < count; t++)
+    {
+        values[t] = entries->W[row][col];
+        if (++col == entries->n)
+        {
+            row++;
+            col = 0;
+        }
+    }
+}
+
+/* function to sum count entries from flat index first on, in the order of NumPy's pairwise
+   summation; the blocks are filled from left to right */
+double pairwise_sum(entry_fill fill, void *data, size_t first, size_t count)
+{
+    double values[PAIRWISE_BLOCK], partial[8], sum;
+    size_t t, half;
+
+    if (count > PAIRWISE_BLOCK)
+    {
+        half = count / 2;
+        half -= half % 8;
+        return pairwise_sum(fill, data, first, half) + pairwise_sum(fill, data, first + half, count - half);
+    }
+    fill(data, first, count, values);
+    if (count < 8)
+    {
+        sum = 0.0;
+        for (t = 0; t < count; t++)
+        {
+            sum += values[t];
+        }
+        return sum;
+    }
+    /* eight running sums, combined as a tree, then the tail one by one */
+    memcpy(partial, values, sizeof(partial));
+    for (t = 8; t < count - count % 8; t += 8)
+    {
+        partial[0] += values[t];
+        partial[1] += values[t + 1];
+        partial[2] += values[t + 2];
+        partial[3] += values[t + 3];
+        partial[4] += values[t + 4];
+        partial[5] += values[t + 5];
+        partial[6] += values[t + 6];
+        partial[7] += values[t + 7];
+    }
+    sum = ((partial[0] + partial[1]) + (partial[2] + partial[3])) + ((partial[4] + partial[5]) + (partial[6] + partial[7]));
+    for (; t < count; t++)
+    {
+        sum += values[t];
+    }
+    return sum;
+}
+
+/* function to calculate the mean of entries read through a callback like np.mean */
+double pairwise_mean(entry_fill fill, void *data, size_t count)
+{
+    return pairwise_sum(fill, data, 0, count) / (double)count;
+}
+
+/* function to calculate the mean entry of a matrix like np.mean */
+double numpy_mean(double **W, int n)
+{
+    dense_entries entries;
+
+    entries.W = W;
+    entries.n = n;
+    return pairwise_sum(dense_fill, &entries, 0, (size_t)n * n) / ((double)n * n);
+}
+
+/* function to draw the starting H of symnmf */
+double **random_H(int n, int k, double mean, int kind, unsigned long seed)
+{
+    double **H = initialize_matrix(n, k);
+    double high = 2.0 * sqrt(mean / k);
+    rng_state *rng = (rng_state *)malloc(sizeof(rng_state));
+    int i, j;
+
+    rng_seed(rng, kind, seed);
+    for (i = 0; i < n; i++)
+    {
+        for (j = 0; j < k; j++)
+        {
+            /* low + (high - low) * u with low = 0 */
+            H[i][j] = 0.0 + high * rng_uniform(rng);
+        }
+    }
+    free(rng);
+    return H;
+}
+
+/* function to run symnmf from the uniform starting H of symnmf.py */
+double **random_symnmf(double **W, int n, int k, int kind, unsigned long seed, symnmf_params *params)
+{
+    double **H = random_H(n, k, numpy_mean(W, n), kind, seed), **output;
+    affinity_op op;
+
+    dense_op(W, &op);
+    output = symnmf_op(H, &op, n, k, params);
+    free_matrix(H, n);
+    return output;
+}
@@ -0,0 +1,67 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stddef.h>
+#include "symnmf.h"
+
+/* Random number generators of the uniform initial H, matching NumPy bit for bit:
+   RNG_MT19937 is np.random.seed(seed) followed by the legacy np.random functions (what symnmf.py
+   and analysis.py use), RNG_PHILOX is np.random.Generator(np.random.Philox(key=seed)). Philox is
+   counter based: the value at any position is computed directly, without the ones before it */
+#define RNG_MT19937 0
+#define RNG_PHILOX 1
+
+/* pairwise summation of NumPy: blocks of at most this many values are summed 8 ways, larger
+   ranges split in two at half their length rounded down to a multiple of 8 */
+#define PAIRWISE_BLOCK 128
+
+/* Words of the MT19937 state */
+#define MT_WORDS 624
+
+/* State of a generator; every word holds 32 bits, whatever the width of unsigned long */
+typedef struct
+{
+    int kind;
+    unsigned long mt[MT_WORDS];
+    int used;
+    /* Philox: the seed, the position of the next double and the block of four holding it */
+    unsigned long seed;
+    unsigned long position;
+    double block[4];
+} rng_state;
+
+/* Function to parse a generator name ("mt19937" or "philox"), returns -1 when unknown */
+int rng_kind(const char *name);
+
+/* Function to seed a generator of the given kind */
+void rng_seed(rng_state *rng, int kind, unsigned long seed);
+
+/* Function returning the next double in [0, 1), as NumPy's random() would */
+double rng_uniform(rng_state *rng);
+
+/* Function returning the position-th double of RNG_PHILOX seeded with seed, in O(1) */
+double philox_uniform(unsigned long seed, unsigned long position);
+
+/* Callback copying count entries of a row-major matrix, from flat index first on, into values */
+typedef void (*entry_fill)(void *data, size_t first, size_t count, double *values);
+
+/* Function to sum count entries read through fill from flat index first on, in the order np.add
+   sums an array of count entries; the tree only depends on count, so a range can be summed alone */
+double pairwise_sum(entry_fill fill, void *data, size_t first, size_t count);
+
+/* Function to calculate the mean entry of an n x n matrix with the pairwise summation of np.mean */
+double numpy_mean(double **W, int n);
+
+/* Function to calculate the mean of count entries read through fill, in the order of np.mean; fill
+   is called on consecutive ranges from the first entry to the last */
+double pairwise_mean(entry_fill fill, void *data, size_t count);
+
+/* Function to draw the n x k starting H of symnmf, uniform in [0, 2 * sqrt(mean / k)) and filled
+   row by row like np.random.uniform(0, 2 * math.sqrt(mean / k), size=(n, k)) */
+double **random_H(int n, int k, double mean, int kind, unsigned long seed);
+
+/* Function to run symnmf on the dense normalized similarity W as symnmf.py does: from
+   random_H(n, k, numpy_mean(W), kind, seed), with the stopping rule and checkpoints of params */
+double **random_symnmf(double **W, int n, int k, int kind, unsigned long seed, symnmf_params *params);
+
+#endif /* RNG_H */
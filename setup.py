@@ -1,4 +1,6 @@
 from setuptools import setup, Extension
 
-module = Extension('mysymnmf', sources=['symnmf.c', 'symnmfmodule.c'])
+module = Extension('mysymnmf', sources=['symnmf.c', 'profile.c', 'lowrank.c', 'model.c', 'checkpoint.c', 'kernels.c', 'batch.c', 'pool.c', 'placement.c', 'init.c', 'multilevel.c', 'stochastic.c', 'knn.c', 'rng.c', 'quantize.c', 'pipeline.c', 'outofcore.c', 'hierarchy.c', 'symnmfmodule.c'],
+                   # no FMA contraction, so every kernel set and the CLI give identical results
+                   extra_compile_args=['-ffp-contract=off'])
 setup(name='mysymnmf', version='1.0', description='SymNMF extension module', ext_modules=[module])
\ No newline at end of file
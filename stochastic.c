@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include "symnmf.h"
+#include "profile.h"
+#include "rng.h"
+#include "stochastic.h"
+
+/* function to fill the default stochastic parameters */
+void stochastic_default_params(stochastic_params *stochastic)
+{
+    stochastic->batch = 256;
+    stochastic->epochs = 10;
+    stochastic->beta = 1.0;
+    stochastic->decay = 0.0;
+    stochastic->seed = 0;
+    stochastic->steps = 0;
+}
+
+/* Helper function to get the given rows of W*H, from the whole product when the operator has no row panels */
+static double **panel_multiply(affinity_op *op, const int *rows, int count, double **H, int n, int k)
+{
+    double **WH, **panel;
+    int t;
+
+    if (op->multiply_rows != NULL)
+    {
+        return op->multiply_rows(op->data, rows, count, H, n, k);
+    }
+    WH = op->multiply(op->data, H, n, k);
+    panel = initialize_matrix(count, k);
+    for (t = 0; t < count; t++)
+    {
+        memcpy(panel[t], WH[rows[t]], k * sizeof(double));
+    }
+    free_matrix(WH, n);
+    return panel;
+}
+
+/* Helper function to add sign * h h^T to the Gram matrix H^T H */
+static void gram_update(double *gram, const double *h, int k, double sign)
+{
+    int j, l;
+    for (j = 0; j < k; j++)
+    {
+        for (l = 0; l < k; l++)
+        {
+            gram[j * k + l] += sign * h[j] * h[l];
+        }
+    }
+}
+
+/* Helper function to update a block of rows of H from their rows of W*H and the Gram matrix of H */
+static void update_block(double **H, const int *rows, int count, double **WH, double *gram, double *next,
+                         int k, double beta)
+{
+    int t, j, l;
+
+    for (t = 0; t < count; t++)
+    {
+        double *h = H[rows[t]];
+        for (j = 0; j < k; j++)
+        {
+            /* an approximated W*H can dip below zero, which must not flip the sign */
+            double w = WH[t][j] > 0.0 ? WH[t][j] : 0.0;
+            double hhth = 0.0;
+            for (l = 0; l < k; l++)
+            {
+                hhth += h[l] * gram[j * k + l];
+            }
+            next[t * k + j] = hhth > 0.0 ? h[j] * (1.0 - beta + beta * (w / hhth)) : h[j];
+        }
+    }
+    /* the whole block moved against the same H^T H, which then follows the new rows */
+    for (t = 0; t < count; t++)
+    {
+        gram_update(gram, H[rows[t]], k, -1.0);
+        memcpy(H[rows[t]], &next[t * k], k * sizeof(double));
+        gram_update(gram, H[rows[t]], k, 1.0);
+    }
+}
+
+/* A function to do the symnmf with mini-batch updates followed by full-batch ones */
+double **symnmf_stochastic(double **H, affinity_op *op, int n, int k, stochastic_params *stochastic,
+                           symnmf_params *params)
+{
+    int batch = stochastic->batch > 0 && stochastic->batch < n ? stochastic->batch : n;
+    int *order = (int *)malloc(n * sizeof(int));
+    double *gram = (double *)malloc(k * k * sizeof(double));
+    double *next = (double *)malloc(batch * k * sizeof(double));
+    int epoch, first, i, stopped = 0;
+    double start = profile_clock(), deadline_ms = params->deadline_ms;
+    double **output;
+    rng_state rng;
+
+    rng_seed(&rng, RNG_MT19937, stochastic->seed);
+    stochastic->steps = 0;
+    for (i = 0; i < n; i++)
+    {
+        order[i] = i;
+    }
+    for (epoch = 0; epoch < stochastic->epochs && !stopped; epoch++)
+    {
+        double beta = stochastic->beta / (1.0 + stochastic->decay * epoch);
+
+        for (i = n - 1; i > 0; i--)
+        {
+            int r = (int)(rng_uniform(&rng) * (i + 1)), tmp = order[i];
+            order[i] = order[r];
+            order[r] = tmp;
+        }
+        /* rebuilt every epoch so the rank-one corrections do not drift */
+        memset(gram, 0, k * k * sizeof(double));
+        for (i = 0; i < n; i++)
+        {
+            gram_update(gram, H[i], k, 1.0);
+        }
+        for (first = 0; first < n && !stopped; first += batch)
+        {
+            int count = n - first < batch ? n - first : batch;
+            double **WH = panel_multiply(op, order + first, count, H, n, k);
+            update_block(H, order + first, count, WH, gram, next, k, beta);
+            free_matrix(WH, count);
+            stochastic->steps++;
+            /* the deadline and cancellation of params hold between steps too; the deadline keeps room
+               for one more step and the full iteration that follows, about an epoch of steps */
+            if (deadline_ms > 0.0)
+            {
+                double elapsed = (profile_clock() - start) * 1000.0;
+                double step = elapsed / stochastic->steps;
+                stopped = elapsed + step * (1.0 + (double)n / batch) > deadline_ms;
+            }
+            stopped = stopped || (params->cancel != NULL && *params->cancel);
+        }
+    }
+    free(order);
+    free(gram);
+    free(next);
+
+    /* the full-batch iterations get what is left of the deadline, at least one iteration runs */
+    if (deadline_ms > 0.0)
+    {
+        double left = deadline_ms - (profile_clock() - start) * 1000.0;
+        params->deadline_ms = left > 1e-3 ? left : 1e-3;
+    }
+    output = symnmf_op(H, op, n, k, params);
+    params->deadline_ms = deadline_ms;
+    params->elapsed_ms = (profile_clock() - start) * 1000.0;
+    return output;
+}
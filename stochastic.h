@@ -0,0 +1,33 @@
+#ifndef STOCHASTIC_H
+#define STOCHASTIC_H
+
+#include "symnmf.h"
+
+/* Parameters of the mini-batch phase of a stochastic symnmf run, the fields after seed are filled on return */
+typedef struct
+{
+    /* rows of H updated per step */
+    int batch;
+    /* passes over all rows in random order before the full-batch iterations */
+    int epochs;
+    /* step of the first epoch: h *= 1 - beta + beta * (W H)_i / (H H^T H)_i. calc damps with 0.5,
+       a block of rows moving alone tolerates the full step */
+    double beta;
+    /* epoch e steps with beta / (1 + decay * e) */
+    double decay;
+    unsigned int seed;
+    int steps;
+} stochastic_params;
+
+/* Function to fill the default stochastic parameters (256 rows, 10 epochs, beta 1, no decay) */
+void stochastic_default_params(stochastic_params *stochastic);
+
+/* Function to perform the symnmf with mini-batch updates: every step updates a random block of rows
+   of H from the same rows of W*H, so it reads b rows of W instead of all n, and H^T H is kept up to
+   date in O(b k^2). The run ends with full-batch iterations until params->epsilon or params->max_iter,
+   as symnmf_op does (checkpoints included, a resumed H replaces the mini-batch one). The deadline and
+   cancellation of params also end the mini-batch phase between steps */
+double **symnmf_stochastic(double **H, affinity_op *op, int n, int k, stochastic_params *stochastic,
+                           symnmf_params *params);
+
+#endif /* STOCHASTIC_H */
@@ -3,6 +3,17 @@
 #include <math.h>
 #include <string.h>
 #include "symnmf.h"
+#include "profile.h"
+#include "model.h"
+#include "checkpoint.h"
+#include "kernels.h"
+#include "batch.h"
+#include "placement.h"
+#include "rng.h"
+#include "quantize.h"
+#include "pipeline.h"
+#include "outofcore.h"
+#include "hierarchy.h"
 
 /* function to initialize zeros matrix */
 double **initialize_matrix(int numRows, int numCols)
@@ -11,6 +22,8 @@ double **initialize_matrix(int numRows, int numCols)
     int rowIndex = 0;
     int colIndex = 0;
 
+    PROFILE_ALLOC(numRows * (sizeof(double *) + numCols * sizeof(double)));
+
     for (rowIndex = 0; rowIndex < numRows; rowIndex++)
     {
         mat[rowIndex] = (double *)malloc(numCols * sizeof(double));
@@ -29,6 +42,8 @@ double **transpose(double **mat, int numRows, int numCols)
     int rowIndex = 0;
     int colIndex = 0;
 
+    PROFILE_ALLOC(numCols * (sizeof(double *) + numRows * sizeof(double)));
+
     for (colIndex = 0; colIndex < numCols; colIndex++)
     {
         transposed[colIndex] = (double *)malloc(numRows * sizeof(double));
@@ -40,13 +55,25 @@ double **transpose(double **mat, int numRows, int numCols)
     return transposed;
 }
 
+/* function to copy the rows of a matrix into one contiguous array, row after row */
+double *pack_matrix(double **mat, int numRows, int numCols)
+{
+    double *packed = (double *)malloc(((size_t)numRows * numCols + 1) * sizeof(double));
+    int rowIndex;
+
+    for (rowIndex = 0; rowIndex < numRows; rowIndex++)
+    {
+        memcpy(packed + (size_t)rowIndex * numCols, mat[rowIndex], numCols * sizeof(double));
+    }
+    return packed;
+}
+
 /* Function for matrix multiplication */
 double **matrix_multiplication(double **mat1, int rows1, int cols1, double **mat2, int rows2, int cols2)
 {
-    double **output;
+    double **output, *packed;
+    product_kernel product;
     int r1_index;
-    int c2_index;
-    int c1_index;
 
     if (cols1 != rows2)
     {
@@ -55,16 +82,15 @@ double **matrix_multiplication(double **mat1, int rows1, int cols1, double **mat
 
     output = initialize_matrix(rows1, cols2);
 
+    /* every row of mat1 streams once against mat2 packed row after row, each entry of the output
+       still adding its terms over the columns of mat1 in order */
+    packed = pack_matrix(mat2, rows2, cols2);
+    product = select_product(cols2);
     for (r1_index = 0; r1_index < rows1; r1_index++)
     {
-        for (c2_index = 0; c2_index < cols2; c2_index++)
-        {
-            for (c1_index = 0; c1_index < cols1; c1_index++)
-            {
-                output[r1_index][c2_index] += mat1[r1_index][c1_index] * mat2[c1_index][c2_index];
-            }
-        }
+        product(output[r1_index], mat1[r1_index], packed, cols1, cols2);
     }
+    free(packed);
     return output;
 }
 
@@ -88,13 +114,7 @@ double frobidean_distance(double **mat1, double **mat2, int rows, int cols)
 /* function to calculate Euclidean distance between two given vectors */
 double euclidean_distance(double *vec1, double *vec2, int dim)
 {
-    int i;
-    double distance = 0.0;
-    for (i = 0; i < dim; i++)
-    {
-        distance += pow(vec1[i] - vec2[i], 2);
-    }
-    return distance;
+    return select_distance(dim)(vec1, vec2, dim);
 }
 
 /* Helper function to free allocated memory for a matrix */
@@ -113,28 +133,52 @@ double **symc(double **points, int n, int d)
 {
     int i;
     int j;
-    double **sym_matrix = initialize_matrix(n, n);
+    double **sym_matrix;
+    distance_kernel distance = select_distance(d);
+    profile_mark mark;
 
+    PROFILE_BEGIN(mark);
+    sym_matrix = initialize_matrix(n, n);
     for (i = 0; i < n; i++)
     {
         for (j = 0; j < i; j++)
         {
-            sym_matrix[i][j] = exp(-0.5 * euclidean_distance(points[i], points[j], d));
+            sym_matrix[i][j] = exp(-0.5 * distance(points[i], points[j], d));
             sym_matrix[j][i] = sym_matrix[i][j];
         }
         sym_matrix[i][i] = 0;
     }
+    PROFILE_END(PROF_SYM, mark);
     return sym_matrix;
 }
 
-/* function for ddg */
-double **ddgc(double **points, int n, int d)
+/* function to calculate the degree of every point (row sums of sym) without building the matrix */
+double *degree_vector(double **points, int n, int d)
 {
     int i;
     int j;
-    double **C, **output;
-    C = symc(points, n, d);
-    output = initialize_matrix(n, n);
+    double *degrees = (double *)calloc(n, sizeof(double));
+    distance_kernel distance = select_distance(d);
+
+    PROFILE_ALLOC(n * sizeof(double));
+    for (i = 0; i < n; i++)
+    {
+        for (j = 0; j < i; j++)
+        {
+            double similarity = exp(-0.5 * distance(points[i], points[j], d));
+            degrees[i] += similarity;
+            degrees[j] += similarity;
+        }
+    }
+    return degrees;
+}
+
+/* Helper function to build the diagonal degree matrix of a similarity matrix */
+static double **degree_matrix(double **C, int n)
+{
+    int i;
+    int j;
+    double **output = initialize_matrix(n, n);
 
     for (i = 0; i < n; i++)
     {
@@ -143,123 +187,523 @@ double **ddgc(double **points, int n, int d)
             output[i][i] += C[i][j];
         }
     }
+    return output;
+}
+
+/* function for ddg */
+double **ddgc(double **points, int n, int d)
+{
+    double **C, **output;
+    profile_mark mark;
+
+    PROFILE_BEGIN(mark);
+    C = symc(points, n, d);
+    output = degree_matrix(C, n);
 
     /* Free allocated memory */
     free_matrix(C, n);
 
+    PROFILE_END(PROF_DDG, mark);
     return output;
 }
 
-/* function to calculate norm */
-double **normc(double **points, int n, int d)
+/* Helper function to turn a similarity matrix into D^-1/2 * A * D^-1/2 in place */
+static void normalize_affinity(double **norm_matrix, int n)
 {
-    double **D = ddgc(points, n, d);
-    double **A = symc(points, n, d);
-    double **norm_matrix;
-    double **temp_matrix;
+    double *scale = (double *)malloc(n * sizeof(double));
     int i;
+    int j;
 
+    /* D^-1/2 from the row sums, added in the same order as ddgc */
     for (i = 0; i < n; i++)
     {
-        D[i][i] = 1.0 / sqrt(D[i][i]);
+        double degree = 0.0;
+        for (j = 0; j < n; j++)
+        {
+            degree += norm_matrix[i][j];
+        }
+        scale[i] = 1.0 / sqrt(degree);
     }
-    /* calculate norm matrix */
-    temp_matrix = matrix_multiplication(D, n, n, A, n, n);
-    norm_matrix = matrix_multiplication(temp_matrix, n, n, D, n, n);
-
-    /* free allocated memory */
+    /* D^-1/2 * A * D^-1/2 scales entry (i, j) by both factors; the dense products only added
+       exact zeros to the same values */
     for (i = 0; i < n; i++)
     {
-        free(D[i]);
-        free(A[i]);
-        free(temp_matrix[i]);
+        for (j = 0; j < n; j++)
+        {
+            norm_matrix[i][j] = scale[i] * norm_matrix[i][j] * scale[j];
+        }
     }
-    free(D);
-    free(A);
-    free(temp_matrix);
+    free(scale);
+}
+
+/* function to calculate norm */
+double **normc(double **points, int n, int d)
+{
+    double **norm_matrix;
+    profile_mark mark;
 
+    PROFILE_BEGIN(mark);
+    norm_matrix = symc(points, n, d);
+    normalize_affinity(norm_matrix, n);
+
+    PROFILE_END(PROF_NORM, mark);
     return norm_matrix;
 }
 
-/* function for iteration of symnmf */
-double **calc(double **H, double **W, int n, int k)
+/* function to calculate rows [first, last) of sym */
+double **sym_rows(double **points, int n, int d, int first, int last)
 {
+    double **rows = initialize_matrix(last - first, n);
+    distance_kernel distance = select_distance(d);
+    int i, j;
+
+    /* distance(x, y) and distance(y, x) are the same bits, so the rows match symc */
+    for (i = first; i < last; i++)
+    {
+        for (j = 0; j < n; j++)
+        {
+            rows[i - first][j] = j == i ? 0.0 : exp(-0.5 * distance(points[i], points[j], d));
+        }
+    }
+    return rows;
+}
+
+/* function to calculate rows [first, last) of ddg given the degrees */
+double **ddg_rows(const double *degrees, int n, int first, int last)
+{
+    double **rows = initialize_matrix(last - first, n);
     int i;
-    int j;
-    double **WH = matrix_multiplication(W, n, n, H, n, k);
-    double **Ht = transpose(H, n, k);
-    double **HHt = matrix_multiplication(H, n, k, Ht, k, n);
-    double **HHtH = matrix_multiplication(HHt, n, n, H, n, k);
+
+    for (i = first; i < last; i++)
+    {
+        rows[i - first][i] = degrees[i];
+    }
+    return rows;
+}
+
+/* function to calculate rows [first, last) of norm given the degrees */
+double **norm_rows(double **points, int n, int d, const double *degrees, int first, int last)
+{
+    double **rows = sym_rows(points, n, d, first, last);
+    double *scale = (double *)malloc(n * sizeof(double));
+    int i, j;
+
+    /* the same factors and product order as normalize_affinity */
+    for (j = 0; j < n; j++)
+    {
+        scale[j] = 1.0 / sqrt(degrees[j]);
+    }
+    for (i = first; i < last; i++)
+    {
+        for (j = 0; j < n; j++)
+        {
+            rows[i - first][j] = scale[i] * rows[i - first][j] * scale[j];
+        }
+    }
+    free(scale);
+    return rows;
+}
+
+/* function to apply the multiplicative update to H given the product W*H */
+double **update_H(double **H, double **WH, int n, int k)
+{
     double **next_H = initialize_matrix(n, k);
 
+    update_into(H, WH, next_H, n, k, NULL);
+    return next_H;
+}
+
+/* function to write the multiplicative update of H into next_H, returning the squared step */
+double update_into(double **H, double **WH, double **next_H, int n, int k, double *terms)
+{
+    int i;
+    double *HtH = (double *)calloc(k * k, sizeof(double));
+    double sums[2] = {0.0, 0.0};
+    gram_kernel accumulate = select_gram(k);
+    update_kernel update = select_update(k);
+
+    /* H^T * H row by row, then H * (H^T * H) is formed one row at a time inside the update, which
+       also adds up the step and the trace while the row is in registers */
     for (i = 0; i < n; i++)
     {
-        for (j = 0; j < k; j++)
+        accumulate(HtH, H[i], k);
+    }
+    for (i = 0; i < n; i++)
+    {
+        update(next_H[i], H[i], WH[i], HtH, k, sums);
+    }
+    if (terms != NULL)
+    {
+        terms[0] = sums[1];
+        terms[1] = 0.0;
+        for (i = 0; i < k * k; i++)
         {
-            next_H[i][j] = H[i][j] * (0.5 + 0.5 * (WH[i][j] / HHtH[i][j]));
+            terms[1] += HtH[i] * HtH[i];
         }
     }
 
     /* free allocated memory */
+    free(HtH);
+
+    return sums[0];
+}
+
+/* Helper function for an iteration of symnmf against an affinity operator into next_H, returning the squared step */
+static double calc_into(double **H, affinity_op *op, double **next_H, int n, int k, double *terms)
+{
+    double **WH, delta;
+    profile_mark mark;
+
+    PROFILE_BEGIN(mark);
+    WH = op->multiply(op->data, H, n, k);
+    delta = update_into(H, WH, next_H, n, k, terms);
     free_matrix(WH, n);
-    free_matrix(Ht, k);
-    free_matrix(HHt, n);
-    free_matrix(HHtH, n);
 
-    return next_H;
+    PROFILE_END(PROF_CALC, mark);
+    return delta;
 }
 
-/* A function to do the symnmf */
-double **symnmfc(double **H, double **W, int n, int k)
+/* function for iteration of symnmf against an affinity operator */
+double **calc_op(double **H, affinity_op *op, int n, int k)
 {
-    int iter, i, j;
     double **next_H = initialize_matrix(n, k);
-    iter = 0;
-    for (iter = 0; iter < 300; iter ++)
+
+    calc_into(H, op, next_H, n, k, NULL);
+    return next_H;
+}
+
+/* function for iteration of symnmf */
+double **calc(double **H, double **W, int n, int k)
+{
+    affinity_op op;
+    dense_op(W, &op);
+    return calc_op(H, &op, n, k);
+}
+
+/* function to fill the default symnmf parameters */
+void symnmf_default_params(symnmf_params *params)
+{
+    params->max_iter = 300;
+    params->epsilon = EPSILON;
+    params->checkpoint = NULL;
+    params->checkpoint_every = 10;
+    params->resume = 0;
+    params->deadline_ms = 0.0;
+    params->progress = NULL;
+    params->progress_arg = NULL;
+    params->progress_every = 1;
+    params->cancel = NULL;
+    params->track_objective = 0;
+    params->iterations = 0;
+    params->delta = 0.0;
+    params->resumed = 0;
+    params->checkpoint_failed = 0;
+    params->stop_reason = SYMNMF_CONVERGED;
+    params->elapsed_ms = 0.0;
+    params->objective = 0.0;
+}
+
+/* Helper function to restore H and the history from the checkpoint file, returns -1 when it does not match */
+static int resume_checkpoint(double **H, int n, int k, symnmf_params *params, unsigned long fingerprint,
+                             int *iter, double *history, int *done)
+{
+    int status = checkpoint_load(params->checkpoint, n, k, params->max_iter, fingerprint, H, iter, history, done);
+    params->resumed = status == 0 ? 1 : (status < 0 ? -1 : 0);
+    return params->resumed;
+}
+
+/* Helper function to decide whether the run stops after an iteration, returns the reason or -1 to go on.
+   The deadline counts an iteration as long as the average one so far, so the run stops before
+   starting one it cannot finish in time */
+static int stop_after(symnmf_params *params, int iter, double delta, double start, int iterations_run)
+{
+    double elapsed;
+
+    if (delta < params->epsilon)
+    {
+        return SYMNMF_CONVERGED;
+    }
+    if (iter >= params->max_iter)
+    {
+        return SYMNMF_MAX_ITER;
+    }
+    if (params->progress != NULL && params->progress_every > 0 && iter % params->progress_every == 0 &&
+        params->progress(params->progress_arg, iter, delta))
+    {
+        return SYMNMF_CANCELLED;
+    }
+    if (params->cancel != NULL && *params->cancel)
+    {
+        return SYMNMF_CANCELLED;
+    }
+    if (params->deadline_ms > 0.0)
     {
-        next_H = calc(H, W, n, k);
+        elapsed = (profile_clock() - start) * 1000.0;
+        if (elapsed + elapsed / iterations_run > params->deadline_ms)
+        {
+            return SYMNMF_DEADLINE;
+        }
+    }
+    return -1;
+}
 
-        if (pow(frobidean_distance(H, next_H, n, k), 2) < EPSILON)
+/* Helper function for ||W - H*H^T||^2 of H (less ||W||^2 when norm2 is 0) through the trace identity,
+   at the cost of one product W*H */
+static double op_objective(affinity_op *op, double **H, int n, int k, double norm2)
+{
+    double **WH = op->multiply(op->data, H, n, k);
+    double *HtH = (double *)calloc(k * k, sizeof(double));
+    double trace = 0.0, squares = 0.0;
+    gram_kernel accumulate = select_gram(k);
+    int i, j;
+
+    for (i = 0; i < n; i++)
+    {
+        accumulate(HtH, H[i], k);
+        for (j = 0; j < k; j++)
         {
-            return next_H;
+            trace += H[i][j] * WH[i][j];
         }
+    }
+    for (i = 0; i < k * k; i++)
+    {
+        squares += HtH[i] * HtH[i];
+    }
+    free_matrix(WH, n);
+    free(HtH);
+    return norm2 - 2.0 * trace + squares;
+}
+
+/* A function to do the symnmf against an affinity operator */
+double **symnmf_op(double **H, affinity_op *op, int n, int k, symnmf_params *params)
+{
+    int iter = 0, first_iter, i, done = 0, track = params->track_objective || profile_enabled;
+    double delta = 0.0, start = profile_clock(), norm2 = 0.0, terms[2];
+    double **current = H, **next_H = initialize_matrix(n, k), **swap;
+    double *history = (double *)malloc((params->max_iter > 0 ? params->max_iter : 1) * sizeof(double));
+    checkpoint_writer *writer = NULL;
+    unsigned long fingerprint = 0;
+    profile_mark mark, iteration_mark;
 
+    PROFILE_BEGIN(mark);
+    params->resumed = 0;
+    params->checkpoint_failed = 0;
+    params->stop_reason = SYMNMF_CONVERGED;
+    params->objective = 0.0;
+    if (params->checkpoint != NULL)
+    {
+        fingerprint = affinity_fingerprint(op, n, k);
+        if (params->resume && resume_checkpoint(H, n, k, params, fingerprint, &iter, history, &done) < 0)
+        {
+            free_matrix(next_H, n);
+            free(history);
+            PROFILE_END(PROF_SYMNMF, mark);
+            return NULL;
+        }
+        writer = checkpoint_open(params->checkpoint, n, k, params->max_iter, fingerprint);
+        params->checkpoint_failed = writer == NULL;
+    }
+    if (track && op->norm2 != NULL)
+    {
+        norm2 = op->norm2(op->data, n);
+    }
+
+    if (done)
+    {
+        /* the checkpoint already holds the final H */
         for (i = 0; i < n; i++)
         {
-            for (j = 0; j < k; j++)
-            {
-                H[i][j] = next_H[i][j];
-            }
+            memcpy(next_H[i], H[i], k * sizeof(double));
+        }
+        delta = iter > 0 ? history[iter - 1] : 0.0;
+        params->stop_reason = delta < params->epsilon ? SYMNMF_CONVERGED : SYMNMF_MAX_ITER;
+    }
+    first_iter = iter;
+    while (!done)
+    {
+        PROFILE_BEGIN(iteration_mark);
+        delta = calc_into(current, op, next_H, n, k, track ? terms : NULL);
+        if (track)
+        {
+            params->objective = norm2 - 2.0 * terms[0] + terms[1];
+        }
+        history[iter++] = delta;
+        if (profile_enabled)
+        {
+            profile_iteration_end(&iteration_mark, delta, params->objective);
+        }
+        params->stop_reason = stop_after(params, iter, delta, start, iter - first_iter);
+        if (params->stop_reason >= 0)
+        {
+            break;
+        }
+
+        /* the new iterate becomes the current one and the old buffer is written next */
+        swap = current;
+        current = next_H;
+        next_H = swap;
+        if (writer != NULL && params->checkpoint_every > 0 && iter % params->checkpoint_every == 0)
+        {
+            checkpoint_submit(writer, current, iter, history, 0, 0);
+        }
+    }
+    if (next_H == H)
+    {
+        /* the last iterate landed in the caller's H, the other buffer is the one returned */
+        for (i = 0; i < n; i++)
+        {
+            memcpy(current[i], H[i], k * sizeof(double));
         }
+        next_H = current;
+    }
+    /* the iterations saw the objective of the H each update started from, the caller gets that of H */
+    if (params->track_objective)
+    {
+        params->objective = op_objective(op, next_H, n, k, norm2);
+    }
+    params->iterations = iter;
+    params->delta = delta;
+    params->elapsed_ms = (profile_clock() - start) * 1000.0;
+
+    if (writer != NULL)
+    {
+        /* a run stopped by its deadline or cancelled can still be resumed */
+        checkpoint_submit(writer, next_H, iter, history,
+                          params->stop_reason == SYMNMF_CONVERGED || params->stop_reason == SYMNMF_MAX_ITER, 1);
+        params->checkpoint_failed = checkpoint_close(writer);
     }
+    free(history);
 
+    PROFILE_END(PROF_SYMNMF, mark);
     return next_H;
 }
 
-/* function that for each point return its cluster index */
-int *analysisc(double **H, int n, int k)
+/* A function to do the symnmf */
+double **symnmfc(double **H, double **W, int n, int k)
+{
+    affinity_op op;
+    symnmf_params params;
+
+    dense_op(W, &op);
+    symnmf_default_params(&params);
+    return symnmf_op(H, &op, n, k, &params);
+}
+
+/* W*H for an affinity operator holding the dense n x n matrix */
+static double **dense_multiply(void *data, double **H, int n, int k)
+{
+    return matrix_multiplication((double **)data, n, n, H, n, k);
+}
+
+/* function to calculate the given rows of W*H for a dense W */
+double **dense_rows_multiply(double **W, const int *rows, int count, double **H, int n, int k)
+{
+    double **WH = initialize_matrix(count, k);
+    double *packed = pack_matrix(H, n, k);
+    product_kernel product = select_product(k);
+    int t;
+
+    for (t = 0; t < count; t++)
+    {
+        product(WH[t], W[rows[t]], packed, n, k);
+    }
+    free(packed);
+    return WH;
+}
+
+/* rows of W*H for an affinity operator holding the dense n x n matrix */
+static double **dense_multiply_rows(void *data, const int *rows, int count, double **H, int n, int k)
+{
+    return dense_rows_multiply((double **)data, rows, count, H, n, k);
+}
+
+/* ||W||^2 for an affinity operator holding the dense n x n matrix */
+static double dense_op_norm2(void *data, int n)
+{
+    return dense_norm2((double **)data, n);
+}
+
+/* function to wrap a dense matrix as an affinity operator, the matrix stays owned by the caller */
+void dense_op(double **W, affinity_op *op)
+{
+    op->data = W;
+    op->multiply = dense_multiply;
+    op->multiply_rows = dense_multiply_rows;
+    op->norm2 = dense_op_norm2;
+    op->destroy = NULL;
+}
+
+/* function to calculate the mean entry of the matrix behind an affinity operator */
+double affinity_mean(affinity_op *op, int n)
 {
     int i;
-    int j;
-    int *labels = (int*) malloc(n * sizeof(int));
+    double sum = 0.0;
+    double **ones = initialize_matrix(n, 1);
+    double **row_sums;
 
     for (i = 0; i < n; i++)
     {
-        /* initialization of max to first value of point */
-        double max_val = H[i][0];
-        int max_index = 0;
+        ones[i][0] = 1.0;
+    }
+    row_sums = op->multiply(op->data, ones, n, 1);
+    for (i = 0; i < n; i++)
+    {
+        sum += row_sums[i][0];
+    }
+    free_matrix(ones, n);
+    free_matrix(row_sums, n);
+    return sum / ((double)n * n);
+}
+
+/* function to calculate the symnmf objective ||W - H*H^T||^2 (squared Frobenius norm) */
+double symnmf_objective(double **W, double **H, int n, int k)
+{
+    int i, j, c;
+    double objective = 0.0;
 
-        for (j = 1; j < k; j++)
+    for (i = 0; i < n; i++)
+    {
+        for (j = 0; j < n; j++)
         {
-            /* if new max value then update */
-            if (H[i][j] > max_val)
+            double hh = 0.0;
+            for (c = 0; c < k; c++)
             {
-                max_val = H[i][j];
-                max_index = j;
+                hh += H[i][c] * H[j][c];
             }
+            objective += (W[i][j] - hh) * (W[i][j] - hh);
         }
+    }
+    return objective;
+}
+
+/* function to calculate ||W||^2 of a dense matrix */
+double dense_norm2(double **W, int n)
+{
+    int i, j;
+    double norm2 = 0.0;
 
-        labels[i] = max_index;
+    for (i = 0; i < n; i++)
+    {
+        for (j = 0; j < n; j++)
+        {
+            norm2 += W[i][j] * W[i][j];
+        }
+    }
+    return norm2;
+}
+
+/* function that for each point return its cluster index */
+int *analysisc(double **H, int n, int k)
+{
+    int i;
+    int *labels = (int*) malloc(n * sizeof(int));
+    argmax_kernel argmax = select_argmax(k);
+
+    PROFILE_ALLOC(n * sizeof(int));
+
+    for (i = 0; i < n; i++)
+    {
+        labels[i] = argmax(H[i], k);
     }
 
     return labels;
@@ -301,7 +745,9 @@ double **read_data(char *file_name, int n, int d)
     double **data;
     int i;
     int j;
-    
+    profile_mark mark;
+
+    PROFILE_BEGIN(mark);
     file = fopen(file_name, "r");
     if (!file)
     {
@@ -309,6 +755,7 @@ double **read_data(char *file_name, int n, int d)
     }
 
     data = (double **)malloc(n * sizeof(double *));
+    PROFILE_ALLOC(n * (sizeof(double *) + d * sizeof(double)));
     for (i = 0; i < n; i++)
     {
         data[i] = (double *)malloc(d * sizeof(double));
@@ -321,9 +768,58 @@ double **read_data(char *file_name, int n, int d)
         }
     }
     fclose(file);
+    PROFILE_END(PROF_READ_DATA, mark);
     return data;
 }
 
+/* function to read a points file like read_data, but returning NULL instead of exiting */
+double **load_points(const char *file_name, int *n, int *d)
+{
+    FILE *file = fopen(file_name, "r");
+    double **points;
+    int ch, i, j;
+
+    if (!file)
+    {
+        return NULL;
+    }
+    *n = 0;
+    *d = 1;
+    while ((ch = fgetc(file)) != EOF)
+    {
+        if (ch == '\n')
+        {
+            (*n)++;
+        }
+        else if (ch == ',' && *n == 0)
+        {
+            (*d)++;
+        }
+    }
+    if (*n == 0)
+    {
+        fclose(file);
+        return NULL;
+    }
+
+    rewind(file);
+    points = initialize_matrix(*n, *d);
+    for (i = 0; i < *n; i++)
+    {
+        for (j = 0; j < *d; j++)
+        {
+            if (fscanf(file, "%lf,", &points[i][j]) != 1)
+            {
+                free_matrix(points, *n);
+                fclose(file);
+                return NULL;
+            }
+        }
+    }
+    fclose(file);
+    return points;
+}
+
 /* Helper function to initialize the matrix based on the goal */
 double **initialize_matrix_goal(double **data, int n, int d, char *goal)
 {
@@ -335,53 +831,511 @@ double **initialize_matrix_goal(double **data, int n, int d, char *goal)
     {
         return ddgc(data, n, d);
     }
-    else
+    else if (strcmp(goal, "norm") == 0)
     {
         return normc(data, n, d);
     }
+    return NULL;
 }
 
 /* Helper function to print the matrix */
 void print_matrix(double **matrix, int n)
 {
+    print_rows(matrix, n, n);
+}
+
+/* Helper function to print rows of n columns */
+void print_rows(double **rows, int count, int n)
+{
+    char text[FORMAT_FIXED4_MAX];
     int i;
     int j;
+    profile_mark mark;
+
+    PROFILE_BEGIN(mark);
+    for (i = 0; i < count; i++)
+    {
+        for (j = 0; j < n; j++)
+        {
+            fwrite(text, 1, format_fixed4(text, rows[i][j]), stdout);
+            putchar(j < n - 1 ? ',' : '\n');
+        }
+    }
+    fflush(stdout);
+    PROFILE_END(PROF_PRINT, mark);
+}
+
+/* values whose scaled fraction is this close to one half are left to printf to round */
+#define FORMAT_GUARD 1e-6
+/* values scaled by 10^4 stay below this, so their digits fit an unsigned long */
+#define FORMAT_LIMIT 2147483647.0
+
+/* function to write a value as "%.4f" does. Printing the n^2 entries of sym, ddg and norm through
+   printf takes far longer than computing them; this rounds value * 10^4 to an integer directly.
+   Below FORMAT_LIMIT the product is off from the exact one by less than FORMAT_GUARD, so a fraction
+   further than that from one half rounds the same way as printf's exact decimal expansion would.
+   Ties, negative values, -0.0, NaN and large values go through sprintf */
+int format_fixed4(char *out, double value)
+{
+    double scaled = value * 10000.0, whole, fraction;
+    unsigned long digits, integral;
+    char reversed[16];
+    int length = 0, count = 0, t;
+
+    if (!(value >= 0.0) || scaled >= FORMAT_LIMIT || (value == 0.0 && 1.0 / value < 0.0))
+    {
+        return sprintf(out, "%.4f", value);
+    }
+    whole = floor(scaled);
+    fraction = scaled - whole;
+    if (fabs(fraction - 0.5) < FORMAT_GUARD)
+    {
+        return sprintf(out, "%.4f", value);
+    }
+    digits = (unsigned long)whole + (fraction > 0.5 ? 1UL : 0UL);
+    integral = digits / 10000UL;
+    do
+    {
+        reversed[count++] = (char)('0' + integral % 10UL);
+        integral /= 10UL;
+    } while (integral > 0UL);
+    while (count > 0)
+    {
+        out[length++] = reversed[--count];
+    }
+    out[length++] = '.';
+    digits %= 10000UL;
+    for (t = 3; t >= 0; t--)
+    {
+        out[length + t] = (char)('0' + digits % 10UL);
+        digits /= 10UL;
+    }
+    length += 4;
+    out[length] = '\0';
+    return length;
+}
+
+/* the MPI build links these routines with its own main, see symnmf_mpi.c */
+#ifndef SYMNMF_NO_MAIN
+/* rows of sym, ddg or norm held at a time when the CLI streams them with --rows */
+#define STREAM_ROWS 256
+
+/* Helper function to label the points of a file with a saved model, printing one label per line */
+static int assign_goal(char *model_file, char *file_name)
+{
+    symnmf_model *model = model_load(model_file);
+    double **data;
+    int *labels;
+    int n, d, i;
+
+    if (model == NULL)
+    {
+        printf("An Error Has Occurred\n");
+        return 1;
+    }
+    read_file_dimensions(file_name, &n, &d);
+    if (d != model->d)
+    {
+        printf("An Error Has Occurred\n");
+        free_model(model);
+        return 1;
+    }
+    data = read_data(file_name, n, d);
+    labels = model_assign(model, data, n);
     for (i = 0; i < n; i++)
     {
-        for ( j = 0; j < n; j++)
+        printf("%d\n", labels[i]);
+    }
+
+    free(labels);
+    free_matrix(data, n);
+    free_model(model);
+    return 0;
+}
+
+/* Helper function to initialize the matrix based on the goal, with sym computed in parallel by the
+   threads that own its rows */
+static double **placed_matrix_goal(double **data, int n, int d, char *goal, placement *pl)
+{
+    double **A = placement_sym(data, n, d, pl), **D;
+
+    if (strcmp(goal, "sym") == 0)
+    {
+        return A;
+    }
+    else if (strcmp(goal, "ddg") == 0)
+    {
+        D = degree_matrix(A, n);
+        free_matrix(A, n);
+        return D;
+    }
+    normalize_affinity(A, n);
+    return A;
+}
+
+/* Helper function to print rows [first, last) of sym, ddg or norm block by block, holding at most
+   STREAM_ROWS rows of the matrix at a time; last < 0 stands for n */
+static int stream_goal_rows(double **data, int n, int d, char *goal, int first, int last)
+{
+    double *degrees = NULL, **rows;
+    int start, stop;
+
+    last = last < 0 ? n : last;
+    if (first < 0 || first >= last || last > n)
+    {
+        return 1;
+    }
+    if (strcmp(goal, "sym") != 0 && strcmp(goal, "ddg") != 0 && strcmp(goal, "norm") != 0)
+    {
+        return 1;
+    }
+    if (strcmp(goal, "sym") != 0)
+    {
+        degrees = degree_vector(data, n, d);
+    }
+    for (start = first; start < last; start += STREAM_ROWS)
+    {
+        stop = start + STREAM_ROWS < last ? start + STREAM_ROWS : last;
+        if (strcmp(goal, "sym") == 0)
         {
-            printf("%.4f", matrix[i][j]);
-            if (j < n - 1)
-            {
-                printf(",");
-            }
+            rows = sym_rows(data, n, d, start, stop);
+        }
+        else if (strcmp(goal, "ddg") == 0)
+        {
+            rows = ddg_rows(degrees, n, start, stop);
         }
-        printf("\n");
+        else
+        {
+            rows = norm_rows(data, n, d, degrees, start, stop);
+        }
+        print_rows(rows, stop - start, n);
+        free_matrix(rows, stop - start);
     }
+    free(degrees);
+    return 0;
+}
+
+/* Helper function to run symnmf on the norm of the points from the uniform H of symnmf.py, printing
+   H for the symnmf goal and one label per line for analysis. A format of quantize_format keeps W
+   quantized during the iterations, -1 keeps it dense. When the dense W would take more than budget
+   bytes (0 for no limit), W is kept out of core in a scratch file in directory scratch instead */
+static int factorize_goal(double **data, int n, int d, char *goal, int k, int rng, unsigned long seed,
+                          symnmf_params *params, placement *pl, int placed, int format, size_t budget,
+                          const char *scratch)
+{
+    double **W, **H, **start;
+    int *labels, i;
+    affinity_op op;
+    ooc_matrix *m;
+
+    if (k <= 0 || k >= n)
+    {
+        printf("An Error Has Occurred\n");
+        return 1;
+    }
+    if (budget > 0 && (double)n * n * sizeof(double) > (double)budget)
+    {
+        /* the mean and the products are those of the dense W, so the run gives the same H */
+        if ((m = ooc_norm(data, n, d, scratch, budget, placed ? pl->threads : 1)) == NULL)
+        {
+            printf("An Error Has Occurred\n");
+            return 1;
+        }
+        start = random_H(n, k, m->mean, rng, seed);
+        ooc_op(m, &op);
+        H = symnmf_op(start, &op, n, k, params);
+        op.destroy(op.data);
+        free_matrix(start, n);
+    }
+    else if (format < 0)
+    {
+        W = placed ? placed_matrix_goal(data, n, d, "norm", pl) : normc(data, n, d);
+        H = random_symnmf(W, n, k, rng, seed, params);
+        free_matrix(W, n);
+    }
+    else
+    {
+        /* H is drawn from the exact W, which is then dropped for its quantized copy */
+        W = placed ? placed_matrix_goal(data, n, d, "norm", pl) : normc(data, n, d);
+        start = random_H(n, k, numpy_mean(W, n), rng, seed);
+        quantized_op(quantize(W, n, format, placed ? pl->threads : 1), &op);
+        free_matrix(W, n);
+        H = symnmf_op(start, &op, n, k, params);
+        op.destroy(op.data);
+        free_matrix(start, n);
+    }
+    if (H == NULL)
+    {
+        /* the checkpoint to resume from belongs to another run */
+        printf("An Error Has Occurred\n");
+        return 1;
+    }
+    if (strcmp(goal, "symnmf") == 0)
+    {
+        print_rows(H, n, k);
+    }
+    else
+    {
+        labels = analysisc(H, n, k);
+        for (i = 0; i < n; i++)
+        {
+            printf("%d\n", labels[i]);
+        }
+        free(labels);
+    }
+    free_matrix(H, n);
+    return 0;
+}
+
+/* Helper function to grow the cluster tree of the norm of the points up to k leaves, printing for every
+   point its labels for 1 .. k clusters on one line */
+static int hierarchy_goal(double **data, int n, int d, int k, unsigned long seed, placement *pl, int placed)
+{
+    double **W;
+    cluster_tree *tree;
+    int **labels, c, i;
+
+    if (k <= 0 || k >= n)
+    {
+        printf("An Error Has Occurred\n");
+        return 1;
+    }
+    W = placed ? placed_matrix_goal(data, n, d, "norm", pl) : normc(data, n, d);
+    tree = hierarchy_build(W, n, k, seed);
+    free_matrix(W, n);
+    labels = (int **)malloc(k * sizeof(int *));
+    for (c = 0; c < k; c++)
+    {
+        labels[c] = hierarchy_labels(tree, c + 1);
+    }
+    for (i = 0; i < n; i++)
+    {
+        for (c = 0; c < k; c++)
+        {
+            printf(c < k - 1 ? "%d," : "%d\n", labels[c][i]);
+        }
+    }
+    for (c = 0; c < k; c++)
+    {
+        free(labels[c]);
+    }
+    free(labels);
+    free_cluster_tree(tree);
+    return 0;
 }
 
 int main(int argc, char *argv[])
 {
-    char *goal, *file_name;
+    char *positional[3], *goal, *file_name;
     double **data, **A;
-    int n, d;
+    int n, d, i, count = 0, status, threads = 0, placed = 0, streamed = 0, first = 0, last = -1;
+    int k = 0, rng = RNG_MT19937, format = -1, sequential = 0;
+    unsigned long seed = 0;
+    size_t budget = 0;
+    char *scratch = NULL;
+    placement pl;
+    symnmf_params params;
+
+    placement_default(&pl);
+    symnmf_default_params(&params);
 
-    if (argc != 3)
+    /* positional arguments are the goal and the file(s), options start with "--" */
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--profile") == 0)
+        {
+            profile_enable(1);
+        }
+        else if (strncmp(argv[i], "--threads=", 10) == 0)
+        {
+            threads = atoi(argv[i] + 10);
+            pl.threads = threads > 0 ? threads : pl.threads;
+            placed = 1;
+        }
+        else if (strncmp(argv[i], "--numa=", 7) == 0)
+        {
+            if ((pl.policy = placement_policy(argv[i] + 7)) < 0)
+            {
+                return 1;
+            }
+            placed = 1;
+        }
+        else if (strcmp(argv[i], "--pin") == 0)
+        {
+            pl.pin = 1;
+            placed = 1;
+        }
+        else if (strcmp(argv[i], "--rows") == 0)
+        {
+            streamed = 1;
+        }
+        else if (strcmp(argv[i], "--sequential") == 0)
+        {
+            sequential = 1;
+        }
+        else if (strncmp(argv[i], "--k=", 4) == 0)
+        {
+            k = atoi(argv[i] + 4);
+        }
+        /* symnmf and analysis start from H drawn as symnmf.py does (np.random.seed(0)) unless told otherwise */
+        else if (strncmp(argv[i], "--seed=", 7) == 0)
+        {
+            seed = strtoul(argv[i] + 7, NULL, 10);
+        }
+        else if (strncmp(argv[i], "--rng=", 6) == 0)
+        {
+            if ((rng = rng_kind(argv[i] + 6)) < 0)
+            {
+                return 1;
+            }
+        }
+        else if (strncmp(argv[i], "--quantize=", 11) == 0)
+        {
+            if ((format = quantize_format(argv[i] + 11)) < 0)
+            {
+                return 1;
+            }
+        }
+        /* --memory=MB keeps W out of core when it would take more, in --scratch=DIR */
+        else if (strncmp(argv[i], "--memory=", 9) == 0)
+        {
+            budget = (size_t)strtoul(argv[i] + 9, NULL, 10) << 20;
+        }
+        else if (strncmp(argv[i], "--scratch=", 10) == 0)
+        {
+            scratch = argv[i] + 10;
+        }
+        else if (strncmp(argv[i], "--checkpoint=", 13) == 0)
+        {
+            params.checkpoint = argv[i] + 13;
+        }
+        else if (strncmp(argv[i], "--checkpoint-every=", 19) == 0)
+        {
+            params.checkpoint_every = atoi(argv[i] + 19);
+        }
+        else if (strcmp(argv[i], "--resume") == 0)
+        {
+            params.resume = 1;
+        }
+        else if (strncmp(argv[i], "--rows=", 7) == 0)
+        {
+            /* --rows=i0:i1 prints rows [i0, i1) only */
+            if (sscanf(argv[i] + 7, "%d:%d", &first, &last) != 2)
+            {
+                return 1;
+            }
+            streamed = 1;
+        }
+        else if (count < 3)
+        {
+            positional[count++] = argv[i];
+        }
+        else
+        {
+            return 1;
+        }
+    }
+    if (count < 2)
+    {
+        return 1;
+    }
+    goal = positional[0];
+    file_name = positional[1];
+
+    /* "assign <model> <file>" labels new points with a saved model */
+    if (strcmp(goal, "assign") == 0)
+    {
+        if (count != 3)
+        {
+            return 1;
+        }
+        status = assign_goal(positional[1], positional[2]);
+        if (profile_enabled)
+        {
+            profile_print(stderr);
+            profile_enable(0);
+        }
+        return status;
+    }
+    if (count != 2)
     {
         return 1;
     }
 
-    goal = argv[1];
-    file_name = argv[2];
+    /* "batch <manifest>" runs many jobs in this one process */
+    if (strcmp(goal, "batch") == 0)
+    {
+        return run_batch(file_name, threads);
+    }
+    if (strcmp(goal, "sym") != 0 && strcmp(goal, "ddg") != 0 && strcmp(goal, "norm") != 0 &&
+        strcmp(goal, "symnmf") != 0 && strcmp(goal, "analysis") != 0 && strcmp(goal, "hierarchy") != 0)
+    {
+        printf("An Error Has Occurred\n");
+        return 1;
+    }
 
+    /* sym, ddg and norm of a whole file overlap parsing, the affinity and the output, unless the
+       rows are placed on NUMA nodes or the file is irregular, which the stages below handle */
+    if (!sequential && !streamed && !pl.pin && pl.policy == PLACEMENT_FIRST_TOUCH &&
+        strcmp(goal, "symnmf") != 0 && strcmp(goal, "analysis") != 0 && strcmp(goal, "hierarchy") != 0 &&
+        (status = pipeline_goal(file_name, goal, pl.threads, stdout)) >= 0)
+    {
+        if (profile_enabled)
+        {
+            profile_print(stderr);
+            profile_enable(0);
+        }
+        return status;
+    }
     read_file_dimensions(file_name, &n, &d);
     data = read_data(file_name, n, d);
-    A = initialize_matrix_goal(data, n, d, goal);
+    /* "hierarchy" prints the labels for every number of clusters up to --k, read off one tree */
+    if (strcmp(goal, "hierarchy") == 0)
+    {
+        status = streamed ? 1 : hierarchy_goal(data, n, d, k, seed, &pl, placed);
+        free_matrix(data, n);
+        if (profile_enabled)
+        {
+            profile_print(stderr);
+            profile_enable(0);
+        }
+        return status;
+    }
+    if (strcmp(goal, "symnmf") == 0 || strcmp(goal, "analysis") == 0)
+    {
+        status = streamed ? 1 : factorize_goal(data, n, d, goal, k, rng, seed, &params, &pl, placed, format,
+                                                        budget, scratch);
+        free_matrix(data, n);
+        if (profile_enabled)
+        {
+            profile_print(stderr);
+            profile_enable(0);
+        }
+        return status;
+    }
+    if (streamed)
+    {
+        status = stream_goal_rows(data, n, d, goal, first, last);
+        free_matrix(data, n);
+        if (profile_enabled)
+        {
+            profile_print(stderr);
+            profile_enable(0);
+        }
+        return status;
+    }
+    A = placed ? placed_matrix_goal(data, n, d, goal, &pl) : initialize_matrix_goal(data, n, d, goal);
 
     print_matrix(A, n);
 
     free_matrix(data, n);
     free_matrix(A, n);
 
+    if (profile_enabled)
+    {
+        profile_print(stderr);
+        profile_enable(0);
+    }
     return 0;
 }
+#endif /* SYMNMF_NO_MAIN */
@@ -8,12 +8,77 @@
 
 #define EPSILON 0.0001
 
+/* Longest text format_fixed4 writes, its terminating null included */
+#define FORMAT_FIXED4_MAX 320
+
+/* Why a symnmf run stopped, as reported in symnmf_params */
+#define SYMNMF_CONVERGED 0
+#define SYMNMF_MAX_ITER 1
+#define SYMNMF_DEADLINE 2
+#define SYMNMF_CANCELLED 3
+
+/* Symmetric affinity matrix W seen only through the product W*H, so that dense,
+   low-rank or otherwise compressed forms can all drive the symnmf updates */
+typedef struct affinity_op
+{
+    void *data;
+    /* returns a newly allocated n x k matrix W*H */
+    double **(*multiply)(void *data, double **H, int n, int k);
+    /* returns a newly allocated count x k matrix holding the given rows of W*H, NULL when only
+       whole products are available */
+    double **(*multiply_rows)(void *data, const int *rows, int count, double **H, int n, int k);
+    /* returns ||W||^2 (squared Frobenius norm), NULL when it is not known */
+    double (*norm2)(void *data, int n);
+    /* frees data, NULL when data is owned by someone else */
+    void (*destroy)(void *data);
+} affinity_op;
+
+/* Parameters of a symnmf run, the fields after resume are filled on return */
+typedef struct
+{
+    int max_iter;
+    double epsilon;
+    /* file written every checkpoint_every iterations by a background thread, NULL for none */
+    const char *checkpoint;
+    int checkpoint_every;
+    /* continue from the checkpoint file when there is one */
+    int resume;
+    /* stop before an iteration that would end after this many milliseconds, 0 for no deadline */
+    double deadline_ms;
+    /* called every progress_every iterations with the iteration and its delta, a non-zero return
+       cancels the run; NULL for none */
+    int (*progress)(void *arg, int iteration, double delta);
+    void *progress_arg;
+    int progress_every;
+    /* set to non-zero by another thread to stop the run between iterations, NULL for none */
+    volatile int *cancel;
+    /* track ||W - H*H^T||^2 through the trace identity, at O(n*k) per iteration and one ||W||^2 */
+    int track_objective;
+    int iterations;
+    double delta;
+    /* 1 when the run continued from a checkpoint, -1 when the checkpoint belongs to another
+       run (symnmf_op then returns NULL) */
+    int resumed;
+    int checkpoint_failed;
+    /* SYMNMF_CONVERGED, SYMNMF_MAX_ITER, SYMNMF_DEADLINE or SYMNMF_CANCELLED; H is the last iterate
+       in every case, the damped updates lower the objective at every step so it is also the best */
+    int stop_reason;
+    double elapsed_ms;
+    /* while the run goes on (as progress sees it), the objective of the iterate the last update started
+       from; on return, with track_objective, that of the returned H, at the cost of one more W*H.
+       Without the norm2 of the operator it lacks the constant ||W||^2 */
+    double objective;
+} symnmf_params;
+
 /* Function to initialize a zeros matrix */
 double **initialize_matrix(int numRows, int numCols);
 
 /* Function to transpose a given matrix */
 double **transpose(double **mat, int numRows, int numCols);
 
+/* Function to copy the rows of a matrix into one contiguous array, row after row */
+double *pack_matrix(double **mat, int numRows, int numCols);
+
 /* Function for matrix multiplication */
 double **matrix_multiplication(double **mat1, int rows1, int cols1, double **mat2, int rows2, int cols2);
 
@@ -29,18 +94,64 @@ void free_matrix(double **matrix, int n);
 /* Function to calculate sym function */
 double **symc(double **points, int n, int d);
 
+/* Function to calculate the degree of every point (row sums of sym) without building the matrix */
+double *degree_vector(double **points, int n, int d);
+
 /* Function for ddg */
 double **ddgc(double **points, int n, int d);
 
 /* Function to calculate norm */
 double **normc(double **points, int n, int d);
 
+/* Function to calculate rows [first, last) of sym, a (last - first) x n matrix equal to those rows of symc */
+double **sym_rows(double **points, int n, int d, int first, int last);
+
+/* Function to calculate rows [first, last) of ddg from the degree_vector of the points */
+double **ddg_rows(const double *degrees, int n, int first, int last);
+
+/* Function to calculate rows [first, last) of norm from the degree_vector of the points, equal to
+   those rows of normc without building the n x n matrix */
+double **norm_rows(double **points, int n, int d, const double *degrees, int first, int last);
+
+/* Function to apply the multiplicative update to H given the product W*H */
+double **update_H(double **H, double **WH, int n, int k);
+
+/* Function to write the multiplicative update of H given W*H into next_H in a single pass, returning
+   ||next_H - H||^2. terms, when not NULL, receives tr(H^T W H) and ||H^T H||^2, so that
+   ||W - H*H^T||^2 = ||W||^2 - 2 * terms[0] + terms[1] */
+double update_into(double **H, double **WH, double **next_H, int n, int k, double *terms);
+
+/* Function for iteration of symnmf against an affinity operator */
+double **calc_op(double **H, affinity_op *op, int n, int k);
+
 /* Function for iteration of symnmf */
 double **calc(double **H, double **W, int n, int k);
 
+/* Function to fill the default symnmf parameters (300 iterations, EPSILON, no checkpoints, no deadline,
+   progress callback or cancellation) */
+void symnmf_default_params(symnmf_params *params);
+
+/* Function to perform the symnmf against an affinity operator */
+double **symnmf_op(double **H, affinity_op *op, int n, int k, symnmf_params *params);
+
 /* Function to perform the symnmf */
 double **symnmfc(double **H, double **W, int n, int k);
 
+/* Function to calculate the given rows of W*H for a dense W, reading only those rows of W */
+double **dense_rows_multiply(double **W, const int *rows, int count, double **H, int n, int k);
+
+/* Function to wrap a dense matrix as an affinity operator */
+void dense_op(double **W, affinity_op *op);
+
+/* Function to calculate the mean entry of the matrix behind an affinity operator */
+double affinity_mean(affinity_op *op, int n);
+
+/* Function to calculate the symnmf objective ||W - H*H^T||^2 (squared Frobenius norm) */
+double symnmf_objective(double **W, double **H, int n, int k);
+
+/* Function to calculate ||W||^2 of a dense n x n matrix */
+double dense_norm2(double **W, int n);
+
 /* Function that for each point returns its cluster index */
 int *analysisc(double **H, int n, int k);
 
@@ -50,10 +161,19 @@ void read_file_dimensions(char *file_name, int *n, int *d);
 /* Helper function to read data from file into matrix */
 double **read_data(char *file_name, int n, int d);
 
-/* Helper function to initialize the matrix based on the goal */
+/* Helper function to read a points file, filling n and d, returns NULL instead of exiting on errors */
+double **load_points(const char *file_name, int *n, int *d);
+
+/* Helper function to initialize the matrix based on the goal (sym, ddg or norm), NULL for any other goal */
 double **initialize_matrix_goal(double **data, int n, int d, char *goal);
 
 /* Helper function to print the matrix */
 void print_matrix(double **matrix, int n);
 
+/* Helper function to print rows of n columns */
+void print_rows(double **rows, int count, int n);
+
+/* Function to write value as printf("%.4f") does into out (FORMAT_FIXED4_MAX chars), returns its length */
+int format_fixed4(char *out, double value);
+
 #endif /* SYMNMF_H */
@@ -1,3 +1,4 @@
+import json
 import math
 import sys
 import pandas as pd
@@ -6,45 +7,238 @@ import mysymnmf
 
 np.random.seed(0)
 
+# command line options given as --name or --name=value, filled by parse_args
+options = {}
+# profiling reports of every extension call when --profile is given
+reports = []
+
+
+# split the command line into positional arguments and options
+def parse_args(argv):
+    args = []
+    for arg in argv:
+        if arg.startswith("--"):
+            name, _, value = arg[2:].partition("=")
+            options[name] = value if value else True
+        else:
+            args.append(arg)
+    return args
+
+
+# call a function of the extension, collecting its profiling report when asked to
+def call(func, *args):
+    if "profile" not in options:
+        return func(*args)
+    output, report = func(*args, profile=True)
+    reports.append(report)
+    return output
+
 # for each value of goal input, call relevant method with interface to return correct output
 def sym(points, n_points, dim):
-    output = mysymnmf.sym(points, n_points, dim)
+    output = call(mysymnmf.sym, points, n_points, dim)
     return output
 
 
 def ddg(points, n_points, dim):
-    output = mysymnmf.ddg(points, n_points, dim)
+    output = call(mysymnmf.ddg, points, n_points, dim)
     return output
 
 
 def norm(points, n_points, dim):
-    output = mysymnmf.norm(points, n_points, dim)
+    output = call(mysymnmf.norm, points, n_points, dim)
     return output
 
 
+# rows [first, last) of sym, ddg or norm in blocks of block_rows rows, yielded as (first row, rows), so
+# only block_rows x n values are held at once; norm and ddg compute the degrees of the points once
+def row_blocks(goal, points, n_points, dim, first=0, last=None, block_rows=256):
+    row_func = {"sym": mysymnmf.sym_rows, "ddg": mysymnmf.ddg_rows, "norm": mysymnmf.norm_rows}[goal]
+    last = n_points if last is None else last
+    kwargs = {} if goal == "sym" else {"degrees": mysymnmf.degrees(points, n_points, dim)}
+    for start in range(first, last, block_rows):
+        stop = min(start + block_rows, last)
+        yield start, row_func(points, n_points, dim, start, stop, **kwargs)
+
+
 def symnmf(k, points, n_points, dim):
+    if options.get("affinity", "exact") == "nystrom":
+        return symnmf_approx(k, nystrom(points, n_points, dim), n_points)
+    if options.get("affinity", "exact") == "multilevel":
+        return symnmf_multilevel(k, points, n_points, dim)
     W = norm(points, n_points, dim)
-    m = np.mean(W)
-    H = np.random.uniform(0, 2 * math.sqrt(m / k), size=(n_points, k))
-    H_list = H.tolist()
-    output = mysymnmf.symnmf(H_list, W, n_points, k)
+    if "sketch" in options:
+        return symnmf_approx(k, sketch(W, n_points), n_points)
+    # W kept in 16 or 8 bits during the iterations, H still drawn from the exact W
+    if "quantize" in options:
+        quantized = mysymnmf.quantize(W, n_points, options["quantize"], threads=int(options.get("threads", 0)))
+        return symnmf_approx(k, quantized, n_points, np.mean(W))
+    H_list = initial_H(W, n_points, k, np.mean(W))
+    if solve_options():
+        output, info = mysymnmf.solve(H_list, W, n_points, k, profile="profile" in options, **solve_options())
+        if "profile" in info:
+            reports.append(info.pop("profile"))
+        print(json.dumps(info), file=sys.stderr)
+        return output
+    output = call(mysymnmf.symnmf, H_list, W, n_points, k)
     return output
 
 
+# starting H: uniform in [0, 2*sqrt(mean(W)/k)], or --init=spectral / --init=kmeans++ computed from W
+def initial_H(W, n_points, k, mean):
+    if options.get("init", "random") != "random":
+        return mysymnmf.initialize(W, n_points, k, method=options["init"], seed=int(options.get("seed", 0)))
+    return np.random.uniform(0, 2 * math.sqrt(mean / k), size=(n_points, k)).tolist()
+
+
+# progress callback of mysymnmf.solve, one JSON line on stderr every --progress=N iterations,
+# with the objective of the H the iteration started from when --objective tracks it (the JSON info of
+# the run holds that of the returned H)
+def report_progress(iteration, delta, elapsed_ms, objective=None):
+    line = {"iteration": iteration, "delta": delta, "elapsed_ms": round(elapsed_ms, 3)}
+    if objective is not None:
+        line["objective"] = objective
+    print(json.dumps(line), file=sys.stderr)
+
+
+# keyword arguments of mysymnmf.solve given on the command line
+def solve_options():
+    kwargs = {}
+    if "checkpoint" in options:
+        kwargs["checkpoint"] = options["checkpoint"]
+        kwargs["checkpoint_every"] = int(options.get("checkpoint-every", 10))
+        kwargs["resume"] = "resume" in options
+    # W*H on several threads, with W placed on the NUMA nodes of the threads using it
+    if "threads" in options:
+        kwargs["threads"] = int(options["threads"])
+    if "numa" in options:
+        kwargs["numa"] = options["numa"]
+    if "pin" in options:
+        kwargs["pin"] = True
+    # time budget of the solve, which then returns its last H and why it stopped
+    if "deadline-ms" in options:
+        kwargs["deadline_ms"] = float(options["deadline-ms"])
+    if "progress" in options:
+        kwargs["progress"] = report_progress
+        kwargs["progress_every"] = int(options["progress"]) if options["progress"] is not True else 10
+    # ||W - H*H^T||^2 from the trace identity, nearly free next to an iteration
+    if "objective" in options:
+        kwargs["objective"] = True
+    # mini-batch epochs over random blocks of rows before the full-batch iterations
+    if "batch" in options:
+        kwargs["batch"] = int(options["batch"])
+        kwargs["seed"] = int(options.get("seed", 0))
+        if "epochs" in options:
+            kwargs["epochs"] = int(options["epochs"])
+        for name in ("beta", "decay"):
+            if name in options:
+                kwargs[name] = float(options[name])
+    return kwargs
+
+
+# Nystrom approximation of the normalized similarity matrix built from landmark points
+def nystrom(points, n_points, dim):
+    landmarks = int(options.get("landmarks", 100))
+    sampling = options.get("sampling", "uniform")
+    return mysymnmf.nystrom(points, n_points, dim, landmarks, sampling=sampling)
+
+
+# randomized rank-r eigendecomposition of the normalized similarity matrix
+def sketch(W, n_points):
+    rank = int(options["sketch"])
+    power_iters = int(options.get("power-iters", 2))
+    return mysymnmf.sketch(W, n_points, rank, power_iters=power_iters)
+
+
+# symnmf on an approximated affinity, reporting the approximation to stderr; H is drawn from the
+# mean of the approximation unless the exact one is given
+def symnmf_approx(k, W, n_points, mean=None):
+    info = mysymnmf.affinity_info(W)
+    mean = info["mean"] if mean is None else mean
+    output, solve_info = mysymnmf.solve(initial_H(W, n_points, k, mean), W, n_points, k, profile="profile" in options, **solve_options())
+    if "profile" in solve_info:
+        reports.append(solve_info.pop("profile"))
+
+    # the approximation error goes to stderr so the matrix output keeps its format
+    info.update(solve_info)
+    print(json.dumps(info), file=sys.stderr)
+    return output
+
+
+# symnmf on the nearest neighbour affinity through coarser graphs, for inputs too large for a dense W
+def symnmf_multilevel(k, points, n_points, dim):
+    kwargs = {"seed": int(options.get("seed", 0))}
+    for name in ("neighbors", "coarsest", "refine", "threads"):
+        if name in options:
+            kwargs[name] = int(options[name])
+    if "knn" in options:
+        kwargs["knn"] = options["knn"]
+    output, info = mysymnmf.multilevel(points, n_points, dim, k, **kwargs)
+    print(json.dumps(info), file=sys.stderr)
+    return output
+
+
+# cluster tree of W grown by rank-2 splits up to k leaves, printing for every point its labels for
+# 1 .. k clusters on one line; the tree goes to stderr
+def hierarchy(k, points, n_points, dim):
+    W = norm(points, n_points, dim)
+    labels, info = mysymnmf.hierarchy(W, n_points, k, seed=int(options.get("seed", 0)))
+    print(json.dumps(info), file=sys.stderr)
+    for point in range(n_points):
+        print(",".join(str(labels[c][point]) for c in range(k)))
+
+
+# print a matrix with 4 decimal places, one row per line
+def print_matrix(mat):
+    for row in mat:
+        print(",".join(str("{:.4f}".format(round(x, 4))) for x in row))
+
+
 def main():
     try:
-        k = sys.argv[1]
-        goal = sys.argv[2]
-        file_name = sys.argv[3]
+        args = parse_args(sys.argv[1:])
+        k = args[0]
+        goal = args[1]
+        file_name = args[2]
 
         # to read file we will use try-except block as learned
         data = pd.read_csv(file_name, header=None)
 
         points = [x.tolist() for index, x in data.iterrows()]
+
+        # label new points with a model saved by --save-model, one label per line
+        if goal == "assign":
+            for label in mysymnmf.assign(options["model"], points, len(points), len(points[0])):
+                print(label)
+            return
+
+        # append new points to a model saved by --save-model, warm-starting from its H
+        if goal == "refit":
+            mat, info = mysymnmf.refit(options["model"], points, len(points), len(points[0]),
+                                       save_to=options.get("save-model"))
+            print(json.dumps(info), file=sys.stderr)
+            print_matrix(mat)
+            return
+
         if int(k) >= len(points) or len(points) == 0:
             print("An Error Has Occurred")
             sys.exit(1)
 
+        # --rows streams the whole matrix and --rows=i0:i1 only rows [i0, i1), block by block
+        if "rows" in options and goal in ("sym", "ddg", "norm"):
+            first, last = 0, len(points)
+            if options["rows"] is not True:
+                first, last = (int(x) for x in options["rows"].split(":"))
+            if not 0 <= first < last <= len(points):
+                raise Exception
+            for _, rows in row_blocks(goal, points, len(points), len(points[0]), first, last):
+                print_matrix(rows)
+            return
+
+        # labels for every number of clusters up to k, read off one cluster tree
+        if goal == "hierarchy":
+            hierarchy(int(k), points, len(points), len(points[0]))
+            return
+
         # call the required method
         if goal == "sym":
             mat = sym(points, len(points), len(points[0]))
@@ -54,13 +248,20 @@ def main():
             mat = norm(points, len(points), len(points[0]))
         elif goal == "symnmf":
             mat = symnmf(int(k), points, len(points), len(points[0]))
+            # --keep-affinity stores the similarity matrix too, so refits of the model compute only new rows
+            if "save-model" in options:
+                mysymnmf.save_model(options["save-model"], points, mat, len(points), len(points[0]), int(k),
+                                    keep_affinity="keep-affinity" in options)
         else:
             raise Exception
 
 
         # print the relevant output matrix
-        for row in mat:
-            print(",".join(str("{:.4f}".format(round(x, 4))) for x in row))
+        print_matrix(mat)
+
+        # the profiling report goes to stderr so the matrix output is unchanged
+        for report in reports:
+            print(json.dumps(report), file=sys.stderr)
     
     except Exception as e:
         print("An Error Has Occurred")
@@ -0,0 +1,562 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <mpi.h>
+#include "symnmf.h"
+#include "kernels.h"
+#include "rng.h"
+
+/*
+ * Row-partitioned symnmf over MPI, run as
+ *     mpirun -np P ./symnmf_mpi <sym|ddg|norm|symnmf> <file> [--k=K] [--seed=S] [--rng=mt19937|philox]
+ * Every rank owns a block of rows of the points, of W and of H, so neither W nor the points ever
+ * have to fit in the memory of one node: the blocks of the points and of H that a rank needs for
+ * its columns are passed around a ring of ranks. Rank 0 prints the result block by block.
+ * symnmf starts from the H of ./symnmf symnmf with the same --seed and --rng, so on one rank it
+ * prints the same H; on more ranks W*H and H^T*H add their terms in another order, so an entry
+ * can round to another last digit (and the run can stop an iteration earlier or later).
+ */
+
+#define MPI_TAG_ROWS 1
+#define MPI_TAG_RING 2
+
+/* rows owned by one rank: [first, first + count) */
+typedef struct
+{
+    int first;
+    int count;
+} row_block;
+
+/* Helper function to split n rows into balanced contiguous blocks */
+static row_block block_of(int rank, int size, int n)
+{
+    row_block block;
+    int base = n / size, extra = n % size;
+
+    block.count = base + (rank < extra ? 1 : 0);
+    block.first = rank * base + (rank < extra ? rank : extra);
+    return block;
+}
+
+/* Helper function to read the owned rows of the points, row i at i * d; the rows before them are
+   parsed and dropped, so no rank ever holds all the points */
+static double *read_block(char *file_name, int d, row_block own)
+{
+    FILE *file = fopen(file_name, "r");
+    double *rows = (double *)malloc(((size_t)own.count * d + 1) * sizeof(double));
+    double value;
+    int i, j;
+
+    if (!file)
+    {
+        exit(1);
+    }
+    for (i = 0; i < own.first + own.count; i++)
+    {
+        for (j = 0; j < d; j++)
+        {
+            if (fscanf(file, "%lf,", i < own.first ? &value : &rows[(size_t)(i - own.first) * d + j]) != 1)
+            {
+                exit(1);
+            }
+        }
+    }
+    fclose(file);
+    return rows;
+}
+
+/* Helper function to pass the held block one step around the ring: it goes to the previous rank and
+   the block of the next rank arrives, sent and received doubles long; the buffers are then swapped */
+static void ring_shift(double **block, double **incoming, int sent, int received, int rank, int size)
+{
+    double *swap;
+
+    MPI_Sendrecv(*block, sent, MPI_DOUBLE, (rank + size - 1) % size, MPI_TAG_RING,
+                 *incoming, received, MPI_DOUBLE, (rank + 1) % size, MPI_TAG_RING,
+                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    swap = *block;
+    *block = *incoming;
+    *incoming = swap;
+}
+
+/* function to calculate the owned rows of sym, all n columns of each, from the owned points and
+   the blocks of the others passed around the ring */
+static double **local_sym(double *points, int n, int d, row_block own, int rank, int size)
+{
+    double **A = initialize_matrix(own.count, n);
+    distance_kernel distance = select_distance(d);
+    int capacity = (n + size - 1) / size * d;
+    double *block = (double *)malloc((capacity > 0 ? capacity : 1) * sizeof(double));
+    double *incoming = (double *)malloc((capacity > 0 ? capacity : 1) * sizeof(double));
+    int step, i, l;
+
+    memcpy(block, points, (size_t)own.count * d * sizeof(double));
+    for (step = 0; step < size; step++)
+    {
+        /* after "step" shifts this rank holds the points owned by rank + step */
+        row_block held = block_of((rank + step) % size, size, n);
+
+        for (i = 0; i < own.count; i++)
+        {
+            for (l = 0; l < held.count; l++)
+            {
+                A[i][held.first + l] = exp(-0.5 * distance(points + (size_t)i * d, block + (size_t)l * d, d));
+            }
+        }
+        if (step < size - 1)
+        {
+            ring_shift(&block, &incoming, held.count * d, block_of((rank + step + 1) % size, size, n).count * d,
+                       rank, size);
+        }
+    }
+    /* sym has a zero diagonal */
+    for (i = 0; i < own.count; i++)
+    {
+        A[i][own.first + i] = 0.0;
+    }
+    free(block);
+    free(incoming);
+    return A;
+}
+
+/* function to calculate the full degree vector: every rank sums its rows, an allreduce joins them */
+static double *global_degrees(double **A, int n, row_block own)
+{
+    double *local = (double *)calloc(n, sizeof(double));
+    double *degrees = (double *)malloc(n * sizeof(double));
+    int i, j;
+
+    for (i = 0; i < own.count; i++)
+    {
+        for (j = 0; j < n; j++)
+        {
+            local[own.first + i] += A[i][j];
+        }
+    }
+    MPI_Allreduce(local, degrees, n, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    free(local);
+    return degrees;
+}
+
+/* function to turn the owned rows of sym into the owned rows of D^-1/2 * A * D^-1/2, in place */
+static void normalize_rows(double **A, double *degrees, int n, row_block own)
+{
+    int i, j;
+
+    for (i = 0; i < n; i++)
+    {
+        degrees[i] = 1.0 / sqrt(degrees[i]);
+    }
+    for (i = 0; i < own.count; i++)
+    {
+        for (j = 0; j < n; j++)
+        {
+            A[i][j] = degrees[own.first + i] * A[i][j] * degrees[j];
+        }
+    }
+}
+
+/* function to calculate the owned rows of W*H, passing the blocks of H around a ring of ranks
+   so that no rank ever holds more than one foreign block */
+static double **ring_multiply(double **W, double **H, int n, int k, row_block own, int rank, int size)
+{
+    double **WH = initialize_matrix(own.count, k);
+    int capacity = (n + size - 1) / size * k;
+    double *block = (double *)malloc((capacity > 0 ? capacity : 1) * sizeof(double));
+    double *incoming = (double *)malloc((capacity > 0 ? capacity : 1) * sizeof(double));
+    product_kernel product = select_product(k);
+    int step, i;
+
+    for (i = 0; i < own.count; i++)
+    {
+        memcpy(block + i * k, H[i], k * sizeof(double));
+    }
+    for (step = 0; step < size; step++)
+    {
+        /* after "step" shifts this rank holds the block of H owned by rank + step */
+        row_block held = block_of((rank + step) % size, size, n);
+
+        for (i = 0; i < own.count; i++)
+        {
+            product(WH[i], W[i] + held.first, block, held.count, k);
+        }
+        if (step < size - 1)
+        {
+            ring_shift(&block, &incoming, held.count * k, block_of((rank + step + 1) % size, size, n).count * k,
+                       rank, size);
+        }
+    }
+    free(block);
+    free(incoming);
+    return WH;
+}
+
+/* function for one distributed iteration: the k x k Gram matrix is reduced globally, the
+   update itself only touches owned rows. Returns the next H rows and the global delta */
+static double **distributed_calc(double **W, double **H, int n, int k, row_block own, int rank, int size,
+                                 double *delta)
+{
+    double **WH = ring_multiply(W, H, n, k, own, rank, size);
+    double **next_H = initialize_matrix(own.count, k);
+    double *local = (double *)calloc(k * k, sizeof(double));
+    double *gram = (double *)malloc(k * k * sizeof(double));
+    gram_kernel accumulate = select_gram(k);
+    update_kernel update = select_update(k);
+    double sums[2] = {0.0, 0.0};
+    int i;
+
+    for (i = 0; i < own.count; i++)
+    {
+        accumulate(local, H[i], k);
+    }
+    MPI_Allreduce(local, gram, k * k, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+
+    for (i = 0; i < own.count; i++)
+    {
+        update(next_H[i], H[i], WH[i], gram, k, sums);
+    }
+    MPI_Allreduce(&sums[0], delta, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+
+    free_matrix(WH, own.count);
+    free(local);
+    free(gram);
+    return next_H;
+}
+
+/* Helper function to find the rank owning a row, the inverse of block_of */
+static int owner_of(int row, int size, int n)
+{
+    int base = n / size, extra = n % size;
+
+    if (row < extra * (base + 1))
+    {
+        return row / (base + 1);
+    }
+    return extra + (row - extra * (base + 1)) / base;
+}
+
+/* owned rows of W read by pairwise_sum, or reduced entries held flat from flat index offset on */
+typedef struct
+{
+    double **W;
+    int n;
+    row_block own;
+    int rank;
+    int size;
+    const double *flat;
+    size_t offset;
+} mean_entries;
+
+/* Helper function to copy count entries of the owned rows, from global flat index first on */
+static void owned_fill(void *data, size_t first, size_t count, double *values)
+{
+    mean_entries *entries = (mean_entries *)data;
+    int row = (int)(first / entries->n) - entries->own.first, col = (int)(first % entries->n);
+    size_t t;
+
+    for (t = 0; t < count; t++)
+    {
+        values[t] = entries->W[row][col];
+        if (++col == entries->n)
+        {
+            row++;
+            col = 0;
+        }
+    }
+}
+
+/* Helper function to copy count reduced entries, from global flat index first on */
+static void flat_fill(void *data, size_t first, size_t count, double *values)
+{
+    mean_entries *entries = (mean_entries *)data;
+
+    memcpy(values, entries->flat + (first - entries->offset), count * sizeof(double));
+}
+
+/* Helper function to walk the pairwise tree of np.mean over the flat entries [first, first + count)
+   of W. A node whose rows all belong to one rank takes one slot, summed by that rank; a leaf across
+   ranks takes one slot per entry; other nodes split like pairwise_sum. With slots NULL the slots are
+   only counted, then filled with what this rank owns and 0.0 elsewhere, so that an MPI_SUM over the
+   ranks yields every slot exactly; with combine the reduced slots are summed back up the tree */
+static double mean_walk(mean_entries *entries, size_t first, size_t count, double *slots, size_t *used,
+                        int combine)
+{
+    int n = entries->n, owner = owner_of((int)(first / n), entries->size, n);
+    double left, right;
+    size_t half, t;
+
+    if (owner == owner_of((int)((first + count - 1) / n), entries->size, n))
+    {
+        if (slots != NULL && !combine)
+        {
+            slots[*used] = owner == entries->rank ? pairwise_sum(owned_fill, entries, first, count) : 0.0;
+        }
+        left = slots != NULL && combine ? slots[*used] : 0.0;
+        (*used)++;
+        return left;
+    }
+    if (count <= PAIRWISE_BLOCK)
+    {
+        left = 0.0;
+        if (slots != NULL && combine)
+        {
+            entries->flat = slots + *used;
+            entries->offset = first;
+            left = pairwise_sum(flat_fill, entries, first, count);
+        }
+        else if (slots != NULL)
+        {
+            for (t = 0; t < count; t++)
+            {
+                int row = (int)((first + t) / n) - entries->own.first;
+                slots[*used + t] = row >= 0 && row < entries->own.count ? entries->W[row][(first + t) % n] : 0.0;
+            }
+        }
+        *used += count;
+        return left;
+    }
+    half = count / 2;
+    half -= half % 8;
+    /* in this order, the slots are numbered left to right */
+    left = mean_walk(entries, first, half, slots, used, combine);
+    right = mean_walk(entries, first + half, count - half, slots, used, combine);
+    return left + right;
+}
+
+/* Helper function to calculate the mean of the row-partitioned W bit for bit as numpy_mean does
+   on the whole matrix, with a single reduction of the partial sums and of the few entries whose
+   pairwise leaf spans two ranks */
+static double distributed_mean(double **W, int n, row_block own, int rank, int size)
+{
+    mean_entries entries;
+    size_t total = (size_t)n * n, used = 0;
+    double *slots, *reduced, mean;
+
+    entries.W = W;
+    entries.n = n;
+    entries.own = own;
+    entries.rank = rank;
+    entries.size = size;
+    mean_walk(&entries, 0, total, NULL, &used, 0);
+    slots = (double *)malloc(used * sizeof(double));
+    reduced = (double *)malloc(used * sizeof(double));
+    used = 0;
+    mean_walk(&entries, 0, total, slots, &used, 0);
+    MPI_Allreduce(slots, reduced, (int)used, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    used = 0;
+    mean = mean_walk(&entries, 0, total, reduced, &used, 1) / ((double)n * n);
+    free(slots);
+    free(reduced);
+    return mean;
+}
+
+/* Helper function to draw the owned rows of the starting H of random_H: Philox computes every value
+   from its position, MT19937 draws and drops the values of the rows before the owned ones */
+static double **owned_H(double mean, int k, int kind, unsigned long seed, row_block own)
+{
+    double **H = initialize_matrix(own.count, k);
+    double high = 2.0 * sqrt(mean / k);
+    rng_state *rng;
+    size_t skip = (size_t)own.first * k, t;
+    int i, j;
+
+    if (kind == RNG_PHILOX)
+    {
+        for (i = 0; i < own.count; i++)
+        {
+            for (j = 0; j < k; j++)
+            {
+                H[i][j] = 0.0 + high * philox_uniform(seed, (unsigned long)(skip + (size_t)i * k + j));
+            }
+        }
+        return H;
+    }
+    rng = (rng_state *)malloc(sizeof(rng_state));
+    rng_seed(rng, kind, seed);
+    for (t = 0; t < skip; t++)
+    {
+        rng_uniform(rng);
+    }
+    for (i = 0; i < own.count; i++)
+    {
+        for (j = 0; j < k; j++)
+        {
+            H[i][j] = 0.0 + high * rng_uniform(rng);
+        }
+    }
+    free(rng);
+    return H;
+}
+
+/* function to run symnmf on the owned rows of W from the owned rows of the starting H of the CLI */
+static double **distributed_symnmf(double **W, int n, int k, int kind, unsigned long seed, row_block own, int rank,
+                                   int size)
+{
+    double **H = owned_H(distributed_mean(W, n, own, rank, size), k, kind, seed, own);
+    double **next_H;
+    double delta;
+    int iter;
+
+    for (iter = 0; iter < 300; iter++)
+    {
+        next_H = distributed_calc(W, H, n, k, own, rank, size, &delta);
+        free_matrix(H, own.count);
+        H = next_H;
+        /* every rank sees the same reduced delta, so all of them stop together */
+        if (delta < EPSILON)
+        {
+            break;
+        }
+    }
+    return H;
+}
+
+/* Helper function to print rows in the format of print_matrix */
+static void print_flat_rows(double *rows, int count, int cols)
+{
+    char text[FORMAT_FIXED4_MAX];
+    int i, j;
+    for (i = 0; i < count; i++)
+    {
+        for (j = 0; j < cols; j++)
+        {
+            fwrite(text, 1, format_fixed4(text, rows[i * cols + j]), stdout);
+            putchar(j < cols - 1 ? ',' : '\n');
+        }
+    }
+}
+
+/* function to print a row-partitioned matrix: rank 0 prints its block, then receives and prints
+   the others in order, so at most one block is ever gathered */
+static void print_distributed(double **M, int n, int cols, row_block own, int rank, int size)
+{
+    int capacity = ((n + size - 1) / size) * cols;
+    double *rows = (double *)malloc((capacity > 0 ? capacity : 1) * sizeof(double));
+    int i, source;
+
+    for (i = 0; i < own.count; i++)
+    {
+        memcpy(rows + i * cols, M[i], cols * sizeof(double));
+    }
+    if (rank != 0)
+    {
+        MPI_Send(rows, own.count * cols, MPI_DOUBLE, 0, MPI_TAG_ROWS, MPI_COMM_WORLD);
+        free(rows);
+        return;
+    }
+    print_flat_rows(rows, own.count, cols);
+    for (source = 1; source < size; source++)
+    {
+        row_block block = block_of(source, size, n);
+        MPI_Recv(rows, block.count * cols, MPI_DOUBLE, source, MPI_TAG_ROWS, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        print_flat_rows(rows, block.count, cols);
+    }
+    fflush(stdout);
+    free(rows);
+}
+
+/* Helper function to report a usage error from rank 0 and shut MPI down */
+static int fail(int rank)
+{
+    if (rank == 0)
+    {
+        printf("An Error Has Occurred\n");
+    }
+    MPI_Finalize();
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    char *goal = NULL, *file_name = NULL;
+    double *points, **A, **H, *degrees;
+    int rank, size, n, d, k = 0, i;
+    unsigned long seed = 0;
+    int kind = RNG_MT19937;
+    row_block own;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--k=", 4) == 0)
+        {
+            k = atoi(argv[i] + 4);
+        }
+        else if (strncmp(argv[i], "--seed=", 7) == 0)
+        {
+            seed = strtoul(argv[i] + 7, NULL, 10);
+        }
+        else if (strncmp(argv[i], "--rng=", 6) == 0)
+        {
+            if ((kind = rng_kind(argv[i] + 6)) < 0)
+            {
+                return fail(rank);
+            }
+        }
+        else if (goal == NULL)
+        {
+            goal = argv[i];
+        }
+        else if (file_name == NULL)
+        {
+            file_name = argv[i];
+        }
+        else
+        {
+            return fail(rank);
+        }
+    }
+    if (file_name == NULL || (strcmp(goal, "sym") != 0 && strcmp(goal, "ddg") != 0 &&
+                              strcmp(goal, "norm") != 0 && strcmp(goal, "symnmf") != 0))
+    {
+        return fail(rank);
+    }
+
+    read_file_dimensions(file_name, &n, &d);
+    if (strcmp(goal, "symnmf") == 0 && (k <= 0 || k >= n))
+    {
+        return fail(rank);
+    }
+    own = block_of(rank, size, n);
+    points = read_block(file_name, d, own);
+
+    A = local_sym(points, n, d, own, rank, size);
+    if (strcmp(goal, "sym") != 0)
+    {
+        degrees = global_degrees(A, n, own);
+        if (strcmp(goal, "ddg") == 0)
+        {
+            /* the owned rows of the diagonal degree matrix replace those of sym */
+            for (i = 0; i < own.count; i++)
+            {
+                memset(A[i], 0, n * sizeof(double));
+                A[i][own.first + i] = degrees[own.first + i];
+            }
+        }
+        else
+        {
+            normalize_rows(A, degrees, n, own);
+        }
+        free(degrees);
+    }
+
+    if (strcmp(goal, "symnmf") == 0)
+    {
+        H = distributed_symnmf(A, n, k, kind, seed, own, rank, size);
+        print_distributed(H, n, k, own, rank, size);
+        free_matrix(H, own.count);
+    }
+    else
+    {
+        print_distributed(A, n, n, own, rank, size);
+    }
+
+    free_matrix(A, own.count);
+    free(points);
+    MPI_Finalize();
+    return 0;
+}
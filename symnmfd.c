@@ -0,0 +1,652 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "symnmf.h"
+#include "pool.h"
+#include "rng.h"
+
+/*
+ * Clustering daemon, run as
+ *     ./symnmfd <socket> [--threads=N] [--cache-mb=M]
+ * It listens on a Unix domain socket and answers one request per connection on a pool of
+ * workers. Requests are a single line, optionally followed by binary data:
+ *     FILE <goal> <k> <path>      input read from a file on the daemon's host
+ *     DATA <goal> <k> <n> <d>     followed by n*d native doubles, row by row
+ *     STATS                       cache counters as JSON
+ *     SHUTDOWN                    stop accepting, finish running jobs and exit
+ * The goals are those of the CLI; k is only used by symnmf and analysis, which start from the same
+ * H as the CLI and so give the same answer.
+ * The answer is "OK <bytes>\n" and the output the CLI would print, or "ERR <message>\n".
+ * Points and the matrices derived from them are kept in an LRU cache, keyed by path, device, inode,
+ * size and nanosecond modification time for files and by a hash of the contents for inline data,
+ * whose points are compared on every hit so that a hash collision is a miss.
+ */
+
+#define DEFAULT_THREADS 4
+#define DEFAULT_CACHE_MB 256
+#define MAX_LINE 4096
+
+/* cached dataset: the points and whatever matrices were derived from them so far */
+typedef struct dataset
+{
+    char *key;
+    int n;
+    int d;
+    double **points;
+    double **sym;
+    double *degrees;
+    double **norm;
+    size_t bytes;
+    /* requests using the dataset, it is only evicted when none are */
+    int refs;
+    /* held while a derived matrix is computed, so concurrent requests compute it once */
+    pthread_mutex_t lock;
+    struct dataset *prev;
+    struct dataset *next;
+} dataset;
+
+/* LRU list of datasets, most recently used first */
+static struct
+{
+    pthread_mutex_t lock;
+    dataset *head;
+    dataset *tail;
+    size_t bytes;
+    size_t capacity;
+    long hits;
+    long misses;
+    long evictions;
+} cache = {PTHREAD_MUTEX_INITIALIZER, NULL, NULL, 0, 0, 0, 0, 0};
+
+static volatile sig_atomic_t stopping = 0;
+static int listen_fd = -1;
+
+/* growing text buffer for answers */
+typedef struct
+{
+    char *data;
+    size_t length;
+    size_t capacity;
+} text;
+
+/* Helper function to append a string to a text buffer */
+static void text_append(text *out, const char *string, size_t length)
+{
+    if (out->length + length + 1 > out->capacity)
+    {
+        out->capacity = (out->length + length + 1) * 2;
+        out->data = (char *)realloc(out->data, out->capacity);
+    }
+    memcpy(out->data + out->length, string, length);
+    out->length += length;
+    out->data[out->length] = '\0';
+}
+
+/* Helper function to append a matrix in the format of print_matrix, diagonal gives a diagonal
+   matrix instead (M is then ignored) */
+static void text_matrix(text *out, double **M, double *diagonal, int rows, int cols)
+{
+    char number[FORMAT_FIXED4_MAX + 1];
+    int i, j, length;
+
+    for (i = 0; i < rows; i++)
+    {
+        for (j = 0; j < cols; j++)
+        {
+            double value = diagonal != NULL ? (i == j ? diagonal[i] : 0.0) : M[i][j];
+            length = format_fixed4(number, value);
+            number[length++] = j < cols - 1 ? ',' : '\n';
+            text_append(out, number, length);
+        }
+    }
+}
+
+/* Helper function to release the memory of a dataset */
+static void free_dataset(dataset *set)
+{
+    free_matrix(set->points, set->n);
+    if (set->sym != NULL)
+    {
+        free_matrix(set->sym, set->n);
+    }
+    if (set->norm != NULL)
+    {
+        free_matrix(set->norm, set->n);
+    }
+    free(set->degrees);
+    pthread_mutex_destroy(&set->lock);
+    free(set->key);
+    free(set);
+}
+
+/* Helper function to unlink a dataset from the LRU list, cache lock held */
+static void cache_unlink(dataset *set)
+{
+    if (set->prev != NULL)
+    {
+        set->prev->next = set->next;
+    }
+    else
+    {
+        cache.head = set->next;
+    }
+    if (set->next != NULL)
+    {
+        set->next->prev = set->prev;
+    }
+    else
+    {
+        cache.tail = set->prev;
+    }
+    set->prev = NULL;
+    set->next = NULL;
+}
+
+/* Helper function to put a dataset at the front of the LRU list, cache lock held */
+static void cache_push_front(dataset *set)
+{
+    set->prev = NULL;
+    set->next = cache.head;
+    if (cache.head != NULL)
+    {
+        cache.head->prev = set;
+    }
+    cache.head = set;
+    if (cache.tail == NULL)
+    {
+        cache.tail = set;
+    }
+}
+
+/* Helper function to evict unused datasets from the back until the cache fits, cache lock held */
+static void cache_evict(void)
+{
+    dataset *set = cache.tail;
+
+    while (set != NULL && cache.bytes > cache.capacity)
+    {
+        dataset *previous = set->prev;
+        if (set->refs == 0)
+        {
+            cache_unlink(set);
+            cache.bytes -= set->bytes;
+            cache.evictions++;
+            free_dataset(set);
+        }
+        set = previous;
+    }
+}
+
+/* Helper function to tell whether a dataset is the one of a key, and holds the given points unless
+   points is NULL */
+static int dataset_matches(const dataset *set, const char *key, double **points, int n, int d)
+{
+    int i;
+
+    if (strcmp(set->key, key) != 0)
+    {
+        return 0;
+    }
+    if (points == NULL)
+    {
+        return 1;
+    }
+    if (set->n != n || set->d != d)
+    {
+        return 0;
+    }
+    for (i = 0; i < n; i++)
+    {
+        if (memcmp(set->points[i], points[i], d * sizeof(double)) != 0)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* function to find a dataset by key (and by its points unless points is NULL), taking a reference
+   to it */
+static dataset *cache_lookup(const char *key, double **points, int n, int d)
+{
+    dataset *set;
+
+    pthread_mutex_lock(&cache.lock);
+    for (set = cache.head; set != NULL; set = set->next)
+    {
+        if (dataset_matches(set, key, points, n, d))
+        {
+            cache_unlink(set);
+            cache_push_front(set);
+            set->refs++;
+            cache.hits++;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cache.lock);
+    return set;
+}
+
+/* function to add freshly loaded points under a key, taking a reference. When another request
+   inserted the same key meanwhile (with the same points when compare is set), its dataset is
+   returned and the points are freed */
+static dataset *cache_insert(const char *key, double **points, int n, int d, int compare)
+{
+    dataset *set;
+
+    pthread_mutex_lock(&cache.lock);
+    for (set = cache.head; set != NULL; set = set->next)
+    {
+        if (dataset_matches(set, key, compare ? points : NULL, n, d))
+        {
+            set->refs++;
+            pthread_mutex_unlock(&cache.lock);
+            free_matrix(points, n);
+            return set;
+        }
+    }
+    set = (dataset *)calloc(1, sizeof(dataset));
+    set->key = (char *)malloc(strlen(key) + 1);
+    strcpy(set->key, key);
+    set->n = n;
+    set->d = d;
+    set->points = points;
+    set->bytes = (size_t)n * d * sizeof(double);
+    set->refs = 1;
+    pthread_mutex_init(&set->lock, NULL);
+    cache_push_front(set);
+    cache.bytes += set->bytes;
+    cache.misses++;
+    cache_evict();
+    pthread_mutex_unlock(&cache.lock);
+    return set;
+}
+
+/* function to drop the reference of a request, evicting if the cache is over its capacity */
+static void cache_release(dataset *set, size_t added_bytes)
+{
+    pthread_mutex_lock(&cache.lock);
+    set->bytes += added_bytes;
+    cache.bytes += added_bytes;
+    set->refs--;
+    cache_evict();
+    pthread_mutex_unlock(&cache.lock);
+}
+
+/* Helper function to get the similarity matrix of a dataset, computing it on first use */
+static double **dataset_sym(dataset *set, size_t *added_bytes)
+{
+    if (set->sym == NULL)
+    {
+        set->sym = symc(set->points, set->n, set->d);
+        *added_bytes += (size_t)set->n * set->n * sizeof(double);
+    }
+    return set->sym;
+}
+
+/* Helper function to get the degrees of a dataset, summed from its similarity rows like ddgc */
+static double *dataset_degrees(dataset *set, size_t *added_bytes)
+{
+    double **A = dataset_sym(set, added_bytes);
+    int i, j;
+
+    if (set->degrees == NULL)
+    {
+        set->degrees = (double *)calloc(set->n, sizeof(double));
+        for (i = 0; i < set->n; i++)
+        {
+            for (j = 0; j < set->n; j++)
+            {
+                set->degrees[i] += A[i][j];
+            }
+        }
+        *added_bytes += (size_t)set->n * sizeof(double);
+    }
+    return set->degrees;
+}
+
+/* Helper function to get the normalized similarity matrix of a dataset, as normc computes it */
+static double **dataset_norm(dataset *set, size_t *added_bytes)
+{
+    double **A = dataset_sym(set, added_bytes);
+    double *degrees = dataset_degrees(set, added_bytes);
+    double *scale;
+    int i, j;
+
+    if (set->norm == NULL)
+    {
+        scale = (double *)malloc(set->n * sizeof(double));
+        for (i = 0; i < set->n; i++)
+        {
+            scale[i] = 1.0 / sqrt(degrees[i]);
+        }
+        set->norm = initialize_matrix(set->n, set->n);
+        for (i = 0; i < set->n; i++)
+        {
+            for (j = 0; j < set->n; j++)
+            {
+                set->norm[i][j] = scale[i] * A[i][j] * scale[j];
+            }
+        }
+        free(scale);
+        *added_bytes += (size_t)set->n * set->n * sizeof(double);
+    }
+    return set->norm;
+}
+
+/* Helper function to hash inline data into a cache key */
+static void data_key(char *key, double **points, int n, int d)
+{
+    unsigned long hash = 2166136261UL;
+    const unsigned char *bytes;
+    int i;
+    size_t b;
+
+    for (i = 0; i < n; i++)
+    {
+        bytes = (const unsigned char *)points[i];
+        for (b = 0; b < d * sizeof(double); b++)
+        {
+            hash = ((hash ^ bytes[b]) * 16777619UL) & 0xffffffffUL;
+        }
+    }
+    sprintf(key, "data:%d:%d:%08lx", n, d, hash);
+}
+
+/* function to get the dataset of a request, from the cache when possible */
+static dataset *request_dataset(FILE *in, const char *source, char *arguments, const char **error)
+{
+    char key[MAX_LINE + 64];
+    double **points;
+    dataset *set;
+    struct stat info;
+    int n, d, i;
+
+    if (strcmp(source, "FILE") == 0)
+    {
+        if (stat(arguments, &info) != 0)
+        {
+            *error = "cannot read input";
+            return NULL;
+        }
+        /* a rewrite within the same second still changes the nanoseconds, a replaced file the inode */
+        sprintf(key, "file:%s:%lu:%lu:%ld:%ld.%09ld", arguments, (unsigned long)info.st_dev,
+                (unsigned long)info.st_ino, (long)info.st_size, (long)info.st_mtim.tv_sec,
+                (long)info.st_mtim.tv_nsec);
+        set = cache_lookup(key, NULL, 0, 0);
+        if (set == NULL && (points = load_points(arguments, &n, &d)) != NULL)
+        {
+            set = cache_insert(key, points, n, d, 0);
+        }
+        if (set == NULL)
+        {
+            *error = "cannot read input";
+        }
+        return set;
+    }
+
+    if (sscanf(arguments, "%d %d", &n, &d) != 2 || n <= 0 || d <= 0)
+    {
+        *error = "bad dimensions";
+        return NULL;
+    }
+    points = initialize_matrix(n, d);
+    for (i = 0; i < n; i++)
+    {
+        if (fread(points[i], sizeof(double), d, in) != (size_t)d)
+        {
+            free_matrix(points, n);
+            *error = "truncated data";
+            return NULL;
+        }
+    }
+    /* the hash only narrows the search, the points themselves decide a hit */
+    data_key(key, points, n, d);
+    set = cache_lookup(key, points, n, d);
+    if (set != NULL)
+    {
+        free_matrix(points, n);
+        return set;
+    }
+    return cache_insert(key, points, n, d, 1);
+}
+
+/* function to run one job on a dataset, appending its output. Derived matrices are computed
+   under the dataset lock and never change afterwards, so the output is written without it */
+static const char *run_job(dataset *set, const char *goal, int k, text *out, size_t *added_bytes)
+{
+    double **M = NULL, *diagonal = NULL, **H;
+    int factorized = strcmp(goal, "symnmf") == 0 || strcmp(goal, "analysis") == 0, *labels, i, length;
+    symnmf_params params;
+    char number[32];
+
+    if (factorized && (k <= 0 || k >= set->n))
+    {
+        return "bad k";
+    }
+    pthread_mutex_lock(&set->lock);
+    if (strcmp(goal, "sym") == 0)
+    {
+        M = dataset_sym(set, added_bytes);
+    }
+    else if (strcmp(goal, "ddg") == 0)
+    {
+        diagonal = dataset_degrees(set, added_bytes);
+    }
+    else if (strcmp(goal, "norm") == 0 || factorized)
+    {
+        M = dataset_norm(set, added_bytes);
+    }
+    pthread_mutex_unlock(&set->lock);
+
+    if (M == NULL && diagonal == NULL)
+    {
+        return "unknown goal";
+    }
+    if (!factorized)
+    {
+        text_matrix(out, M, diagonal, set->n, set->n);
+        return NULL;
+    }
+    /* the cached norm is only read, so concurrent jobs on it run in parallel */
+    symnmf_default_params(&params);
+    H = random_symnmf(M, set->n, k, RNG_MT19937, 0, &params);
+    if (strcmp(goal, "symnmf") == 0)
+    {
+        text_matrix(out, H, NULL, set->n, k);
+    }
+    else
+    {
+        labels = analysisc(H, set->n, k);
+        for (i = 0; i < set->n; i++)
+        {
+            length = sprintf(number, "%d\n", labels[i]);
+            text_append(out, number, length);
+        }
+        free(labels);
+    }
+    free_matrix(H, set->n);
+    return NULL;
+}
+
+/* Helper function to write an answer */
+static void answer(FILE *out, const char *error, text *body)
+{
+    if (error != NULL)
+    {
+        fprintf(out, "ERR %s\n", error);
+    }
+    else
+    {
+        fprintf(out, "OK %lu\n", (unsigned long)body->length);
+        if (body->length > 0)
+        {
+            fwrite(body->data, 1, body->length, out);
+        }
+    }
+    fflush(out);
+}
+
+/* task of a worker: read one request from a connection and answer it */
+static void serve(void *arg)
+{
+    int fd = *(int *)arg;
+    FILE *in = fdopen(fd, "r");
+    FILE *out = fdopen(dup(fd), "w");
+    char line[MAX_LINE], source[16], goal[16], arguments[MAX_LINE];
+    const char *error = NULL;
+    text body = {NULL, 0, 0};
+    size_t added_bytes = 0;
+    dataset *set;
+    int k, offset = 0;
+
+    free(arg);
+    if (in == NULL || out == NULL || fgets(line, sizeof(line), in) == NULL)
+    {
+        error = "bad request";
+    }
+    else
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (strcmp(line, "STATS") == 0)
+        {
+            pthread_mutex_lock(&cache.lock);
+            sprintf(arguments, "{\"bytes\": %lu, \"capacity\": %lu, \"hits\": %ld, \"misses\": %ld, \"evictions\": %ld}\n",
+                    (unsigned long)cache.bytes, (unsigned long)cache.capacity, cache.hits, cache.misses, cache.evictions);
+            pthread_mutex_unlock(&cache.lock);
+            text_append(&body, arguments, strlen(arguments));
+        }
+        else if (strcmp(line, "SHUTDOWN") == 0)
+        {
+            stopping = 1;
+            shutdown(listen_fd, SHUT_RDWR);
+        }
+        else if (sscanf(line, "%15s %15s %d %n", source, goal, &k, &offset) != 3 || offset == 0 ||
+                 (strcmp(source, "FILE") != 0 && strcmp(source, "DATA") != 0))
+        {
+            error = "bad request";
+        }
+        else if ((set = request_dataset(in, source, line + offset, &error)) != NULL)
+        {
+            error = run_job(set, goal, k, &body, &added_bytes);
+            cache_release(set, added_bytes);
+        }
+    }
+
+    if (out != NULL)
+    {
+        answer(out, error, &body);
+        fclose(out);
+    }
+    if (in != NULL)
+    {
+        fclose(in);
+    }
+    else
+    {
+        close(fd);
+    }
+    free(body.data);
+}
+
+/* signal handler: stop accepting, the main loop then shuts the pool down */
+static void on_signal(int signal_number)
+{
+    (void)signal_number;
+    stopping = 1;
+    shutdown(listen_fd, SHUT_RDWR);
+}
+
+int main(int argc, char *argv[])
+{
+    struct sockaddr_un address;
+    struct sigaction action;
+    char *socket_path = NULL;
+    int threads = DEFAULT_THREADS, cache_mb = DEFAULT_CACHE_MB, i, fd, *connection;
+    thread_pool *pool;
+    dataset *set;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--threads=", 10) == 0)
+        {
+            threads = atoi(argv[i] + 10);
+        }
+        else if (strncmp(argv[i], "--cache-mb=", 11) == 0)
+        {
+            cache_mb = atoi(argv[i] + 11);
+        }
+        else if (socket_path == NULL)
+        {
+            socket_path = argv[i];
+        }
+        else
+        {
+            socket_path = NULL;
+            break;
+        }
+    }
+    if (socket_path == NULL || threads <= 0 || cache_mb < 0 || strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        printf("An Error Has Occurred\n");
+        return 1;
+    }
+    cache.capacity = (size_t)cache_mb << 20;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    /* a client hanging up early must not kill the daemon */
+    signal(SIGPIPE, SIG_IGN);
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(listen_fd, 128) != 0 || (pool = pool_create(threads)) == NULL)
+    {
+        printf("An Error Has Occurred\n");
+        return 1;
+    }
+
+    while (!stopping)
+    {
+        fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        connection = (int *)malloc(sizeof(int));
+        *connection = fd;
+        if (pool_submit(pool, serve, connection) != 0)
+        {
+            close(fd);
+            free(connection);
+        }
+    }
+
+    pool_destroy(pool);
+    close(listen_fd);
+    unlink(socket_path);
+    while ((set = cache.head) != NULL)
+    {
+        cache_unlink(set);
+        free_dataset(set);
+    }
+    return 0;
+}
@@ -3,19 +3,91 @@
 #include <stdlib.h>
 #include <string.h>
 #include "symnmf.h"
+#include "profile.h"
+#include "lowrank.h"
+#include "model.h"
+#include "kernels.h"
+#include "placement.h"
+#include "init.h"
+#include "multilevel.h"
+#include "stochastic.h"
+#include "knn.h"
+#include "quantize.h"
+#include "outofcore.h"
+#include "hierarchy.h"
+
+/* convert the collected profiling report to a Python dictionary */
+static PyObject *profile_report_dict(void)
+{
+    const profile_report *report = profile_get();
+    PyObject *py_stages = PyDict_New();
+    PyObject *py_iterations = PyList_New(report->num_iterations);
+
+    for (int i = 0; i < PROF_NUM_STAGES; i++)
+    {
+        const profile_counters *c = &report->stages[i];
+        PyObject *py_stage;
+        if (report->hw_available)
+        {
+            py_stage = Py_BuildValue("{s:l,s:d,s:d,s:d,s:d}", "calls", c->calls, "seconds", c->seconds,
+                                     "bytes", c->bytes, "cycles", c->cycles, "llc_misses", c->llc_misses);
+        }
+        else
+        {
+            py_stage = Py_BuildValue("{s:l,s:d,s:d}", "calls", c->calls, "seconds", c->seconds, "bytes", c->bytes);
+        }
+        PyDict_SetItemString(py_stages, profile_stage_name(i), py_stage);
+        Py_DECREF(py_stage);
+    }
+
+    for (int i = 0; i < report->num_iterations; i++)
+    {
+        const profile_iteration *it = &report->iterations[i];
+        PyObject *py_iteration;
+        if (report->hw_available)
+        {
+            py_iteration = Py_BuildValue("{s:d,s:d,s:d,s:d,s:d}", "seconds", it->seconds, "delta", it->delta,
+                                         "objective", it->objective, "cycles", it->cycles,
+                                         "llc_misses", it->llc_misses);
+        }
+        else
+        {
+            py_iteration = Py_BuildValue("{s:d,s:d,s:d}", "seconds", it->seconds, "delta", it->delta,
+                                         "objective", it->objective);
+        }
+        PyList_SET_ITEM(py_iterations, i, py_iteration);
+    }
+
+    return Py_BuildValue("{s:O,s:N,s:N}", "hw_counters", report->hw_available ? Py_True : Py_False,
+                         "stages", py_stages, "iterations", py_iterations);
+}
+
+/* when profiling was requested, stop it and return the pair (result, report) instead of result */
+static PyObject *with_profile(PyObject *py_result, int profile)
+{
+    if (!profile || py_result == NULL)
+    {
+        return py_result;
+    }
+    profile_enable(0);
+    return Py_BuildValue("(NN)", py_result, profile_report_dict());
+}
 
 /* implementation for symn function given matrix and its dimension: matrix, rows, cols */
-static PyObject *symnmf_sym(PyObject *self, PyObject *args)
+static PyObject *symnmf_sym(PyObject *self, PyObject *args, PyObject *kwargs)
 {
     (void)self;
+    static char *kwlist[] = {"points", "rows", "cols", "profile", NULL};
+    int profile = 0;
     PyObject *py_data;
     int rows, cols;
 
     /* parse arguments from Python */
-    if (!PyArg_ParseTuple(args, "Oii", &py_data, &rows, &cols))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Oii|p", kwlist, &py_data, &rows, &cols, &profile))
     {
         return NULL;
     }
+    profile_enable(profile);
 
     /* convert Python input to C array of doubles */
     double **data = malloc(rows * sizeof(double *));
@@ -58,21 +130,24 @@ static PyObject *symnmf_sym(PyObject *self, PyObject *args)
     free(data);
     free(result);
 
-    return py_result;
+    return with_profile(py_result, profile);
 }
 
 /* implementation of the ddg function given a matrix and its dimension: matrix, rows, cols */
-static PyObject *symnmf_ddg(PyObject *self, PyObject *args)
+static PyObject *symnmf_ddg(PyObject *self, PyObject *args, PyObject *kwargs)
 {
     (void)self;
+    static char *kwlist[] = {"points", "rows", "cols", "profile", NULL};
+    int profile = 0;
     PyObject *py_data;
     int cols, rows;
 
     /* parse arguments from Python */
-    if (!PyArg_ParseTuple(args, "Oii", &py_data, &rows, &cols))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Oii|p", kwlist, &py_data, &rows, &cols, &profile))
     {
         return NULL;
     }
+    profile_enable(profile);
 
     /* convert Python input to a C array of doubles */
     double **data = malloc(rows * sizeof(double *));
@@ -116,21 +191,24 @@ static PyObject *symnmf_ddg(PyObject *self, PyObject *args)
     free(data);
     free(output);
 
-    return py_result;
+    return with_profile(py_result, profile);
 }
 
 /* implementation of normalized similarity matrix function given a matrix and its dimension: matrix, rows, cols */
-static PyObject *symnmf_norm(PyObject *self, PyObject *args)
+static PyObject *symnmf_norm(PyObject *self, PyObject *args, PyObject *kwargs)
 {
     (void)self;
+    static char *kwlist[] = {"points", "rows", "cols", "profile", NULL};
+    int profile = 0;
     PyObject *py_data;
     int cols, rows;
 
     /* parse arguments from Python */
-    if (!PyArg_ParseTuple(args, "Oii", &py_data, &rows, &cols))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Oii|p", kwlist, &py_data, &rows, &cols, &profile))
     {
         return NULL;
     }
+    profile_enable(profile);
 
     /* convert Python input to a C array of doubles */
     double **data = malloc(rows * sizeof(double *));
@@ -174,22 +252,25 @@ static PyObject *symnmf_norm(PyObject *self, PyObject *args)
     free(data);
     free(output);
 
-    return py_result;
+    return with_profile(py_result, profile);
 }
 
 /* implementation of the symnmf function, given initialized H, norm matrix, dimention (n), number of clusters (k)  */
-static PyObject *symnmf_symnmf(PyObject *self, PyObject *args)
+static PyObject *symnmf_symnmf(PyObject *self, PyObject *args, PyObject *kwargs)
 {
     (void)self;
+    static char *kwlist[] = {"H", "W", "n", "k", "profile", NULL};
+    int profile = 0;
     PyObject *py_H;
     PyObject *py_W;
     int n, k;
 
     /* parse the arguments from Python */
-    if (!PyArg_ParseTuple(args, "O!O!ii", &PyList_Type, &py_H, &PyList_Type, &py_W, &n, &k))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!O!ii|p", kwlist, &PyList_Type, &py_H, &PyList_Type, &py_W, &n, &k, &profile))
     {
         return NULL;
     }
+    profile_enable(profile);
 
     /* convert the Python input H matrix to a C array of doubles */
     double **H = malloc(n * sizeof(double *));
@@ -253,21 +334,24 @@ static PyObject *symnmf_symnmf(PyObject *self, PyObject *args)
     free(W);
     free(output);
 
-    return py_result;
+    return with_profile(py_result, profile);
 }
 
 /* implementation for analysis function, given matrix returned from symnmf (final H), dimention (n), number of clusters (k) */
-static PyObject *symnmf_analysis(PyObject *self, PyObject *args)
+static PyObject *symnmf_analysis(PyObject *self, PyObject *args, PyObject *kwargs)
 {
     (void)self;
+    static char *kwlist[] = {"H", "n", "k", "profile", NULL};
+    int profile = 0;
     PyObject *py_H;
     int n, k;
 
     /* parse the arguments from Python */
-    if (!PyArg_ParseTuple(args, "O!ii", &PyList_Type, &py_H, &n, &k))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!ii|p", kwlist, &PyList_Type, &py_H, &n, &k, &profile))
     {
         return NULL;
     }
+    profile_enable(profile);
 
     /* convert the Python input H matrix to a C array of doubles */
     double **H = malloc(n * sizeof(double *));
@@ -305,35 +389,1201 @@ static PyObject *symnmf_analysis(PyObject *self, PyObject *args)
     free(H);
     free(output);
 
+    return with_profile(py_result, profile);
+}
+
+/* convert a Python list of lists to a C matrix, returns NULL with an exception set on bad input */
+static double **list_to_matrix(PyObject *py_list, int rows, int cols)
+{
+    if (!PyList_Check(py_list) || PyList_Size(py_list) != rows)
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid input matrix");
+        return NULL;
+    }
+
+    double **matrix = malloc(rows * sizeof(double *));
+    for (int i = 0; i < rows; i++)
+    {
+        PyObject *row = PyList_GetItem(py_list, i);
+        if (!PyList_Check(row) || PyList_Size(row) != cols)
+        {
+            free_matrix(matrix, i);
+            PyErr_SetString(PyExc_ValueError, "Invalid input matrix");
+            return NULL;
+        }
+
+        matrix[i] = malloc(cols * sizeof(double));
+        for (int j = 0; j < cols; j++)
+        {
+            matrix[i][j] = PyFloat_AsDouble(PyList_GetItem(row, j));
+        }
+    }
+    return matrix;
+}
+
+/* convert a C matrix to a Python list of lists */
+static PyObject *matrix_to_list(double **matrix, int rows, int cols)
+{
+    PyObject *py_result = PyList_New(rows);
+    for (int i = 0; i < rows; i++)
+    {
+        PyObject *py_row = PyList_New(cols);
+        for (int j = 0; j < cols; j++)
+        {
+            PyList_SET_ITEM(py_row, j, PyFloat_FromDouble(matrix[i][j]));
+        }
+        PyList_SET_ITEM(py_result, i, py_row);
+    }
     return py_result;
 }
 
-/* list of Python methods in the module to call them by given name here */
-static PyMethodDef symnmf_methods[] = {
-    {"sym", symnmf_sym, METH_VARARGS, "Compute the similarity matrix"},
-    {"ddg", symnmf_ddg, METH_VARARGS, "Compute the diagonal degree matrix"},
-    {"norm", symnmf_norm, METH_VARARGS, "Compute the normalized similarity matrix"},
-    {"symnmf", symnmf_symnmf, METH_VARARGS, "Perform 'symnmf'"},
-    {"analysis", symnmf_analysis, METH_VARARGS, "Perform 'analysis'"},
-    {NULL, NULL, 0, NULL}};
+/* affinity operator handed to Python as a capsule, with the details reported by affinity_info */
+typedef struct
+{
+    affinity_op op;
+    int n;
+    const char *kind;
+    int rank;
+    double error;
+} py_affinity;
 
-/* module definition, naming it mysymnmf */
-static struct PyModuleDef symnmf_module = {
-    PyModuleDef_HEAD_INIT,
-    "mysymnmf",
-    NULL,
-    -1,
-    symnmf_methods,
-};
+#define AFFINITY_CAPSULE "mysymnmf.affinity"
 
-/* module initialization function */
-PyMODINIT_FUNC PyInit_mysymnmf(void)
+/* capsule destructor releasing the operator */
+static void affinity_capsule_free(PyObject *capsule)
 {
-    PyObject *module;
+    py_affinity *affinity = PyCapsule_GetPointer(capsule, AFFINITY_CAPSULE);
+    if (affinity->op.destroy != NULL)
+    {
+        affinity->op.destroy(affinity->op.data);
+    }
+    free(affinity);
+}
 
-    module = PyModule_Create(&symnmf_module);
-    if (module == NULL)
+/* wrap a factorized matrix into an affinity capsule */
+static PyObject *lowrank_capsule(lowrank *lr, const char *kind)
+{
+    py_affinity *affinity = malloc(sizeof(py_affinity));
+    affinity->n = lr->n;
+    affinity->kind = kind;
+    affinity->rank = lr->rank;
+    affinity->error = lr->error;
+    lowrank_op(lr, &affinity->op);
+    return PyCapsule_New(affinity, AFFINITY_CAPSULE, affinity_capsule_free);
+}
+
+/* implementation of the Nystrom approximation given points, n, d and the number of landmarks m */
+static PyObject *symnmf_nystrom(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    (void)self;
+    static char *kwlist[] = {"points", "n", "d", "m", "sampling", "seed", NULL};
+    PyObject *py_data;
+    int n, d, m;
+    const char *sampling = "uniform";
+    unsigned int seed = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Oiii|sI", kwlist, &py_data, &n, &d, &m, &sampling, &seed))
+    {
+        return NULL;
+    }
+    if (strcmp(sampling, "uniform") != 0 && strcmp(sampling, "kmeans++") != 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "sampling must be 'uniform' or 'kmeans++'");
+        return NULL;
+    }
+    if (n < 1 || m < 1)
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid number of points or landmarks");
+        return NULL;
+    }
+
+    double **data = list_to_matrix(py_data, n, d);
+    if (data == NULL)
+    {
+        return NULL;
+    }
+    lowrank *lr = nystrom(data, n, d, m, strcmp(sampling, "kmeans++") == 0 ? SAMPLING_KMEANSPP : SAMPLING_UNIFORM, seed);
+    free_matrix(data, n);
+
+    return lowrank_capsule(lr, "nystrom");
+}
+
+/* implementation of the randomized sketch given the dense W, n and the rank r */
+static PyObject *symnmf_sketch(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    (void)self;
+    static char *kwlist[] = {"W", "n", "r", "power_iters", "oversample", "seed", NULL};
+    PyObject *py_W;
+    int n, r, power_iters = 2, oversample = 10;
+    unsigned int seed = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Oii|iiI", kwlist, &py_W, &n, &r, &power_iters, &oversample, &seed))
+    {
+        return NULL;
+    }
+    if (n < 1 || r < 1 || power_iters < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid size, rank or number of power iterations");
+        return NULL;
+    }
+
+    double **W = list_to_matrix(py_W, n, n);
+    if (W == NULL)
+    {
+        return NULL;
+    }
+    lowrank *lr = randomized_eigen(W, n, r, oversample, power_iters, seed);
+    free_matrix(W, n);
+
+    return lowrank_capsule(lr, "sketch");
+}
+
+/* implementation of quantize given the dense W, n and the storage format, products with the result
+   running on threads threads */
+static PyObject *symnmf_quantize(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    (void)self;
+    static char *kwlist[] = {"W", "n", "format", "threads", NULL};
+    PyObject *py_W;
+    int n, format, threads = 0;
+    const char *name = "fixed16";
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Oi|si", kwlist, &py_W, &n, &name, &threads))
+    {
+        return NULL;
+    }
+    if ((format = quantize_format(name)) < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "format must be 'fixed16', 'bf16' or 'int8'");
+        return NULL;
+    }
+    if (n < 1 || threads < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid size or number of threads");
+        return NULL;
+    }
+
+    double **W = list_to_matrix(py_W, n, n);
+    if (W == NULL)
+    {
+        return NULL;
+    }
+    quantized *q = quantize(W, n, format, threads);
+    free_matrix(W, n);
+
+    py_affinity *affinity = malloc(sizeof(py_affinity));
+    affinity->n = n;
+    affinity->kind = quantize_format_name(format);
+    affinity->rank = n;
+    affinity->error = q->error;
+    quantized_op(q, &affinity->op);
+    return PyCapsule_New(affinity, AFFINITY_CAPSULE, affinity_capsule_free);
+}
+
+/* implementation of outofcore given points, n and d: norm of the points written to a scratch file in
+   directory scratch, memory MB of it resident at once during products running on up to threads
+   threads, one strip each */
+static PyObject *symnmf_outofcore(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    (void)self;
+    static char *kwlist[] = {"points", "n", "d", "memory", "scratch", "threads", NULL};
+    PyObject *py_data;
+    int n, d, memory = 0, threads = 0;
+    const char *scratch = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Oii|izi", kwlist, &py_data, &n, &d, &memory, &scratch, &threads))
+    {
+        return NULL;
+    }
+    if (n < 1 || d < 1 || memory < 0 || threads < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid dimensions, memory or number of threads");
+        return NULL;
+    }
+    if (memory > 0 && ((size_t)memory << 20) < ooc_strip_bytes(n))
+    {
+        PyErr_Format(PyExc_ValueError, "memory must hold one strip of W, %zu MB",
+                     (ooc_strip_bytes(n) + (1 << 20) - 1) >> 20);
+        return NULL;
+    }
+
+    double **data = list_to_matrix(py_data, n, d);
+    if (data == NULL)
+    {
+        return NULL;
+    }
+    ooc_matrix *m = ooc_norm(data, n, d, scratch, (size_t)memory << 20, threads);
+    free_matrix(data, n);
+    if (m == NULL)
+    {
+        PyErr_SetString(PyExc_OSError, "Could not write the scratch file of W");
+        return NULL;
+    }
+
+    py_affinity *affinity = malloc(sizeof(py_affinity));
+    affinity->n = n;
+    affinity->kind = "outofcore";
+    affinity->rank = n;
+    affinity->error = 0.0;
+    ooc_op(m, &affinity->op);
+    return PyCapsule_New(affinity, AFFINITY_CAPSULE, affinity_capsule_free);
+}
+
+/* implementation of the objective ||W - H*H^T||^2 given W, H, n and k */
+static PyObject *symnmf_objective_py(PyObject *self, PyObject *args)
+{
+    (void)self;
+    PyObject *py_W, *py_H;
+    int n, k;
+
+    if (!PyArg_ParseTuple(args, "OOii", &py_W, &py_H, &n, &k))
+    {
+        return NULL;
+    }
+
+    double **W = list_to_matrix(py_W, n, n);
+    if (W == NULL)
+    {
+        return NULL;
+    }
+    double **H = list_to_matrix(py_H, n, k);
+    if (H == NULL)
+    {
+        free_matrix(W, n);
+        return NULL;
+    }
+    double objective = symnmf_objective(W, H, n, k);
+    free_matrix(W, n);
+    free_matrix(H, n);
+
+    return PyFloat_FromDouble(objective);
+}
+
+/* implementation of affinity_info, describing an affinity capsule */
+static PyObject *symnmf_affinity_info(PyObject *self, PyObject *args)
+{
+    (void)self;
+    PyObject *capsule;
+
+    if (!PyArg_ParseTuple(args, "O", &capsule))
+    {
+        return NULL;
+    }
+    py_affinity *affinity = PyCapsule_GetPointer(capsule, AFFINITY_CAPSULE);
+    if (affinity == NULL)
+    {
+        return NULL;
+    }
+
+    return Py_BuildValue("{s:s,s:i,s:i,s:d,s:d}", "kind", affinity->kind, "n", affinity->n, "rank", affinity->rank,
+                         "error", affinity->error, "mean", affinity_mean(&affinity->op, affinity->n));
+}
+
+/* implementation of degrees: the row sums of sym, all that norm_rows and ddg_rows need besides the points */
+static PyObject *symnmf_degrees(PyObject *self, PyObject *args)
+{
+    (void)self;
+    PyObject *py_data;
+    int n, d;
+
+    if (!PyArg_ParseTuple(args, "Oii", &py_data, &n, &d))
+    {
+        return NULL;
+    }
+    if (n < 1 || d < 1)
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid dimensions");
+        return NULL;
+    }
+    double **data = list_to_matrix(py_data, n, d);
+    if (data == NULL)
+    {
+        return NULL;
+    }
+    double *degrees = degree_vector(data, n, d);
+    PyObject *py_result = PyList_New(n);
+    for (int i = 0; i < n; i++)
+    {
+        PyList_SET_ITEM(py_result, i, PyFloat_FromDouble(degrees[i]));
+    }
+    free(degrees);
+    free_matrix(data, n);
+    return py_result;
+}
+
+/* Helper function to compute rows [first, last) of sym, ddg or norm; the degrees are taken from
+   py_degrees when it is a list, so streaming callers compute them once */
+static PyObject *goal_rows(PyObject *args, PyObject *kwargs, const char *goal)
+{
+    static char *kwlist[] = {"points", "n", "d", "first", "last", "degrees", NULL};
+    PyObject *py_data, *py_degrees = Py_None;
+    int n, d, first, last;
+    double *degrees = NULL, **rows;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Oiiii|O", kwlist, &py_data, &n, &d, &first, &last, &py_degrees))
+    {
+        return NULL;
+    }
+    if (n < 1 || d < 1 || first < 0 || first >= last || last > n)
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid dimensions or row range");
+        return NULL;
+    }
+    if (py_degrees != Py_None && (!PyList_Check(py_degrees) || PyList_Size(py_degrees) != n))
+    {
+        PyErr_SetString(PyExc_ValueError, "degrees must be a list of n values");
+        return NULL;
+    }
+    double **data = list_to_matrix(py_data, n, d);
+    if (data == NULL)
+    {
+        return NULL;
+    }
+
+    if (strcmp(goal, "sym") != 0)
+    {
+        if (py_degrees == Py_None)
+        {
+            degrees = degree_vector(data, n, d);
+        }
+        else
+        {
+            degrees = (double *)malloc(n * sizeof(double));
+            for (int i = 0; i < n; i++)
+            {
+                degrees[i] = PyFloat_AsDouble(PyList_GetItem(py_degrees, i));
+            }
+            if (PyErr_Occurred())
+            {
+                free(degrees);
+                free_matrix(data, n);
+                return NULL;
+            }
+        }
+    }
+    if (strcmp(goal, "sym") == 0)
+    {
+        rows = sym_rows(data, n, d, first, last);
+    }
+    else if (strcmp(goal, "ddg") == 0)
+    {
+        rows = ddg_rows(degrees, n, first, last);
+    }
+    else
+    {
+        rows = norm_rows(data, n, d, degrees, first, last);
+    }
+
+    PyObject *py_result = PyList_New(last - first);
+    for (int i = 0; i < last - first; i++)
+    {
+        PyObject *py_row = PyList_New(n);
+        for (int j = 0; j < n; j++)
+        {
+            PyList_SET_ITEM(py_row, j, PyFloat_FromDouble(rows[i][j]));
+        }
+        PyList_SET_ITEM(py_result, i, py_row);
+    }
+    free_matrix(rows, last - first);
+    free_matrix(data, n);
+    free(degrees);
+    return py_result;
+}
+
+/* implementation of sym_rows: rows [first, last) of sym */
+static PyObject *symnmf_sym_rows(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    (void)self;
+    return goal_rows(args, kwargs, "sym");
+}
+
+/* implementation of ddg_rows: rows [first, last) of ddg */
+static PyObject *symnmf_ddg_rows(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    (void)self;
+    return goal_rows(args, kwargs, "ddg");
+}
+
+/* implementation of norm_rows: rows [first, last) of norm */
+static PyObject *symnmf_norm_rows(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    (void)self;
+    return goal_rows(args, kwargs, "norm");
+}
+
+/* release the dense W that solve converted from a list and the operator wrapping it */
+static void free_dense(double **W, affinity_op *op, int n)
+{
+    if (W == NULL)
+    {
+        return;
+    }
+    free_matrix(W, n);
+    if (op->destroy != NULL)
+    {
+        op->destroy(op->data);
+    }
+}
+
+/* cancellation token: cancel() from any thread stops a solve holding it before its next iteration */
+typedef struct
+{
+    PyObject_HEAD
+    volatile int cancelled;
+} cancel_token;
+
+static PyObject *cancel_token_cancel(PyObject *self, PyObject *args)
+{
+    (void)args;
+    ((cancel_token *)self)->cancelled = 1;
+    Py_RETURN_NONE;
+}
+
+static PyObject *cancel_token_get_cancelled(PyObject *self, void *closure)
+{
+    (void)closure;
+    return PyBool_FromLong(((cancel_token *)self)->cancelled);
+}
+
+static PyMethodDef cancel_token_methods[] = {
+    {"cancel", cancel_token_cancel, METH_NOARGS, "Stop the solves holding this token before their next iteration"},
+    {NULL, NULL, 0, NULL}};
+
+static PyGetSetDef cancel_token_getset[] = {
+    {"cancelled", cancel_token_get_cancelled, NULL, "Whether cancel() was called", NULL},
+    {NULL, NULL, NULL, NULL, NULL}};
+
+static PyTypeObject cancel_token_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mysymnmf.CancelToken",
+    .tp_basicsize = sizeof(cancel_token),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Token cancelling the solves it is passed to",
+    .tp_new = PyType_GenericNew,
+    .tp_methods = cancel_token_methods,
+    .tp_getset = cancel_token_getset,
+};
+
+/* progress callable of a solve and the exception it raised, if any */
+typedef struct
+{
+    PyObject *callable;
+    double start;
+    /* the run's parameters, whose objective is passed along when it is tracked */
+    symnmf_params *params;
+    PyObject *error_type;
+    PyObject *error_value;
+    PyObject *error_traceback;
+} progress_call;
+
+/* progress hook of symnmf_op, running with the GIL released: takes the GIL to call
+   callable(iteration, delta, elapsed_ms), or callable(iteration, delta, elapsed_ms, objective) when
+   the objective is tracked, objective being that of the H the iteration started from; the run stops
+   when it returns False or raises */
+static int call_progress(void *arg, int iteration, double delta)
+{
+    progress_call *call = (progress_call *)arg;
+    PyGILState_STATE state = PyGILState_Ensure();
+    int stop = 0;
+    double elapsed_ms = (profile_clock() - call->start) * 1000.0;
+    PyObject *result = call->params->track_objective
+                           ? PyObject_CallFunction(call->callable, "iddd", iteration, delta, elapsed_ms,
+                                                   call->params->objective)
+                           : PyObject_CallFunction(call->callable, "idd", iteration, delta, elapsed_ms);
+
+    if (result == NULL)
+    {
+        PyErr_Fetch(&call->error_type, &call->error_value, &call->error_traceback);
+        stop = 1;
+    }
+    else
+    {
+        stop = result == Py_False;
+        Py_DECREF(result);
+    }
+    PyGILState_Release(state);
+    return stop;
+}
+
+/* names of the stop reasons of symnmf_params */
+static const char *stop_reason_name(int reason)
+{
+    static const char *names[] = {"converged", "max_iter", "deadline", "cancelled"};
+    return reason >= 0 && reason <= SYMNMF_CANCELLED ? names[reason] : "unknown";
+}
+
+/* implementation of solve: symnmf given initialized H, W as a list of lists or an affinity capsule, n and k;
+   a batch size starts with mini-batch epochs over random blocks of rows. The solve runs with the GIL
+   released, bounded by deadline_ms, reporting to progress every progress_every iterations and
+   stopping when the cancel token is cancelled; objective tracks ||W - H*H^T||^2 at every iteration,
+   passing progress that of the H each iteration started from, and info["objective"] is that of the
+   returned H */
+static PyObject *symnmf_solve(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    (void)self;
+    static char *kwlist[] = {"H", "W", "n", "k", "profile", "checkpoint", "checkpoint_every", "resume",
+                             "threads", "numa", "pin", "batch", "epochs", "beta", "decay", "seed",
+                             "deadline_ms", "progress", "progress_every", "cancel", "objective", NULL};
+    PyObject *py_H, *py_W;
+    int n, k, profile = 0, threads = 0;
+    const char *numa = NULL;
+    affinity_op op;
+    double **W = NULL;
+    symnmf_params params;
+    placement pl;
+    stochastic_params stochastic;
+    PyObject *py_progress = Py_None, *py_cancel = Py_None;
+    progress_call progress = {NULL, 0.0, NULL, NULL, NULL, NULL};
+
+    symnmf_default_params(&params);
+    placement_default(&pl);
+    stochastic_default_params(&stochastic);
+    stochastic.batch = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOii|pzipizpiiddIdOiOp", kwlist, &py_H, &py_W, &n, &k, &profile,
+                                     &params.checkpoint, &params.checkpoint_every, &params.resume,
+                                     &threads, &numa, &pl.pin, &stochastic.batch, &stochastic.epochs,
+                                     &stochastic.beta, &stochastic.decay, &stochastic.seed, &params.deadline_ms,
+                                     &py_progress, &params.progress_every, &py_cancel, &params.track_objective))
+    {
+        return NULL;
+    }
+    if (params.deadline_ms < 0.0 || params.progress_every <= 0 || (py_progress != Py_None && !PyCallable_Check(py_progress)))
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid deadline, progress callable or progress interval");
+        return NULL;
+    }
+    if (py_cancel != Py_None && !PyObject_TypeCheck(py_cancel, &cancel_token_type))
+    {
+        PyErr_SetString(PyExc_TypeError, "cancel must be a mysymnmf.CancelToken");
+        return NULL;
+    }
+    if (py_progress != Py_None)
+    {
+        progress.callable = py_progress;
+        progress.params = &params;
+        params.progress = call_progress;
+        params.progress_arg = &progress;
+    }
+    if (py_cancel != Py_None)
+    {
+        params.cancel = &((cancel_token *)py_cancel)->cancelled;
+    }
+    if (stochastic.batch < 0 || stochastic.epochs < 0 || stochastic.beta <= 0.0 || stochastic.beta > 1.0 ||
+        stochastic.decay < 0.0)
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid batch size, epochs, beta or decay");
+        return NULL;
+    }
+    if (numa != NULL && (pl.policy = placement_policy(numa)) < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "Unknown NUMA policy");
+        return NULL;
+    }
+    if (threads > 0)
+    {
+        pl.threads = threads;
+    }
+
+    if (PyCapsule_CheckExact(py_W))
+    {
+        py_affinity *affinity = PyCapsule_GetPointer(py_W, AFFINITY_CAPSULE);
+        if (affinity == NULL)
+        {
+            return NULL;
+        }
+        if (affinity->n != n)
+        {
+            PyErr_SetString(PyExc_ValueError, "Affinity size does not match n");
+            return NULL;
+        }
+        op = affinity->op;
+    }
+    else
+    {
+        W = list_to_matrix(py_W, n, n);
+        if (W == NULL)
+        {
+            return NULL;
+        }
+        if (threads > 0 || numa != NULL || pl.pin)
+        {
+            /* W*H in parallel, each block of rows of W on the node of the thread multiplying it */
+            double **placed = placement_copy(W, n, n, &pl);
+            free_matrix(W, n);
+            W = placed;
+            placement_op(W, &pl, &op);
+        }
+        else
+        {
+            dense_op(W, &op);
+        }
+    }
+
+    double **H = list_to_matrix(py_H, n, k);
+    if (H == NULL)
+    {
+        free_dense(W, &op, n);
+        return NULL;
+    }
+
+    /* the arguments are C copies by now; the token and callable stay referenced by the caller's frame */
+    double **output;
+    profile_enable(profile);
+    progress.start = profile_clock();
+    Py_BEGIN_ALLOW_THREADS
+    output = stochastic.batch > 0 ? symnmf_stochastic(H, &op, n, k, &stochastic, &params)
+                                  : symnmf_op(H, &op, n, k, &params);
+    Py_END_ALLOW_THREADS
+    profile_enable(0);
+    if (progress.error_type != NULL)
+    {
+        /* the callback raised: the run stopped there and its exception propagates */
+        free_matrix(H, n);
+        if (output != NULL)
+        {
+            free_matrix(output, n);
+        }
+        free_dense(W, &op, n);
+        PyErr_Restore(progress.error_type, progress.error_value, progress.error_traceback);
+        return NULL;
+    }
+    if (output == NULL)
+    {
+        free_matrix(H, n);
+        free_dense(W, &op, n);
+        PyErr_SetString(PyExc_ValueError, "The checkpoint belongs to a different input");
+        return NULL;
+    }
+
+    PyObject *py_info = Py_BuildValue("{s:i,s:d,s:O,s:O,s:i,s:s,s:d}", "iterations", params.iterations,
+                                      "delta", params.delta, "resumed", params.resumed ? Py_True : Py_False,
+                                      "checkpoint_failed", params.checkpoint_failed ? Py_True : Py_False,
+                                      "stochastic_steps", stochastic.steps,
+                                      "stop_reason", stop_reason_name(params.stop_reason),
+                                      "elapsed_ms", params.elapsed_ms);
+    if (params.track_objective)
+    {
+        PyObject *py_objective = PyFloat_FromDouble(params.objective);
+        PyDict_SetItemString(py_info, "objective", py_objective);
+        Py_DECREF(py_objective);
+    }
+    if (profile)
+    {
+        PyObject *py_report = profile_report_dict();
+        PyDict_SetItemString(py_info, "profile", py_report);
+        Py_DECREF(py_report);
+    }
+    PyObject *py_result = Py_BuildValue("(NN)", matrix_to_list(output, n, k), py_info);
+
+    free_matrix(H, n);
+    free_matrix(output, n);
+    free_dense(W, &op, n);
+    return py_result;
+}
+
+/* implementation of initialize: H from the spectrum or from a k-means of the rows of a dense or
+   approximated W */
+static PyObject *symnmf_initialize(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    (void)self;
+    static char *kwlist[] = {"W", "n", "k", "method", "seed", NULL};
+    PyObject *py_W;
+    int n, k, method;
+    const char *method_name = "spectral";
+    unsigned int seed = 0;
+    affinity_op op;
+    double **W = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Oii|sI", kwlist, &py_W, &n, &k, &method_name, &seed))
+    {
+        return NULL;
+    }
+    if ((method = init_method(method_name)) < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "Unknown initialization, expected spectral or kmeans++");
+        return NULL;
+    }
+    if (n <= 0 || k <= 0 || k > n)
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid dimensions");
+        return NULL;
+    }
+
+    if (PyCapsule_CheckExact(py_W))
+    {
+        py_affinity *affinity = PyCapsule_GetPointer(py_W, AFFINITY_CAPSULE);
+        if (affinity == NULL)
+        {
+            return NULL;
+        }
+        if (affinity->n != n)
+        {
+            PyErr_SetString(PyExc_ValueError, "Affinity size does not match n");
+            return NULL;
+        }
+        op = affinity->op;
+    }
+    else
+    {
+        W = list_to_matrix(py_W, n, n);
+        if (W == NULL)
+        {
+            return NULL;
+        }
+        dense_op(W, &op);
+    }
+
+    double **H = initialize_H(&op, n, k, method, seed);
+    PyObject *py_result = matrix_to_list(H, n, k);
+    free_matrix(H, n);
+    if (W != NULL)
+    {
+        free_matrix(W, n);
+    }
+    return py_result;
+}
+
+/* implementation of knn: the k nearest neighbours of every point by brute force, KD-tree or
+   NN-descent, returning (neighbors, info); with recall=True the brute force graph is computed too
+   and info reports the fraction of its neighbours found */
+static PyObject *symnmf_knn(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    (void)self;
+    static char *kwlist[] = {"points", "n", "d", "k", "method", "threads", "seed", "recall", NULL};
+    PyObject *py_data;
+    int n, d, k, i, t, method, threads = 1, recall = 0;
+    const char *method_name = "auto";
+    unsigned int seed = 0;
+    double start;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Oiii|siIp", kwlist, &py_data, &n, &d, &k, &method_name,
+                                     &threads, &seed, &recall))
+    {
+        return NULL;
+    }
+    method = knn_method(method_name);
+    if (method < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "method must be 'auto', 'brute', 'kdtree' or 'descent'");
+        return NULL;
+    }
+    if (n <= 0 || d <= 0 || k <= 0 || k >= n)
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid dimensions or number of neighbours");
+        return NULL;
+    }
+
+    double **data = list_to_matrix(py_data, n, d);
+    if (data == NULL)
+    {
+        return NULL;
+    }
+    method = knn_resolve(method, n, d);
+    start = profile_clock();
+    knn_graph *graph = knn_search(data, n, d, k, method, threads, seed, NULL);
+    PyObject *py_info = Py_BuildValue("{s:s,s:d}", "method", knn_method_name(method), "seconds", profile_clock() - start);
+    if (recall)
+    {
+        start = profile_clock();
+        knn_graph *exact = knn_search(data, n, d, k, KNN_BRUTE, threads, seed, NULL);
+        PyObject *py_brute = PyFloat_FromDouble(profile_clock() - start);
+        PyObject *py_recall = PyFloat_FromDouble(knn_recall(graph, exact));
+        PyDict_SetItemString(py_info, "brute_seconds", py_brute);
+        PyDict_SetItemString(py_info, "recall", py_recall);
+        Py_DECREF(py_brute);
+        Py_DECREF(py_recall);
+        free_knn(exact);
+    }
+    free_matrix(data, n);
+
+    PyObject *py_neighbors = PyList_New(n);
+    for (i = 0; i < n; i++)
+    {
+        PyObject *py_row = PyList_New(k);
+        for (t = 0; t < k; t++)
+        {
+            PyList_SET_ITEM(py_row, t, PyLong_FromLong(graph->neighbors[(size_t)i * k + t]));
+        }
+        PyList_SET_ITEM(py_neighbors, i, py_row);
+    }
+    free_knn(graph);
+    return Py_BuildValue("(NN)", py_neighbors, py_info);
+}
+
+/* implementation of multilevel: symnmf of the points on their nearest neighbour affinity, coarsened
+   down to a few thousand super-nodes, solved there and refined back up, returning (H, info) */
+static PyObject *symnmf_multilevel(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    (void)self;
+    static char *kwlist[] = {"points", "n", "d", "k", "neighbors", "coarsest", "refine", "threads", "seed", "knn", NULL};
+    PyObject *py_data;
+    int n, d, k, level;
+    const char *knn = "auto";
+    multilevel_params params;
+
+    multilevel_default_params(&params);
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Oiii|iiiiIs", kwlist, &py_data, &n, &d, &k, &params.neighbors,
+                                     &params.coarsest, &params.refine_iters, &params.threads, &params.seed, &knn))
+    {
+        return NULL;
+    }
+    params.knn = knn_method(knn);
+    if (params.knn < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "knn must be 'auto', 'brute', 'kdtree' or 'descent'");
+        return NULL;
+    }
+    if (n <= 0 || d <= 0 || k <= 0 || k >= n || params.neighbors <= 0 || params.coarsest <= k ||
+        params.refine_iters < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid dimensions or multilevel parameters");
+        return NULL;
+    }
+
+    double **data = list_to_matrix(py_data, n, d);
+    if (data == NULL)
+    {
+        return NULL;
+    }
+    double **H = multilevel_symnmf(data, n, d, k, &params);
+    free_matrix(data, n);
+
+    PyObject *py_sizes = PyList_New(params.levels);
+    for (level = 0; level < params.levels; level++)
+    {
+        PyList_SET_ITEM(py_sizes, level, PyLong_FromLong(params.level_sizes[level]));
+    }
+    PyObject *py_info = Py_BuildValue("{s:N,s:s,s:i,s:i}", "levels", py_sizes, "knn", knn_method_name(params.knn),
+                                      "coarsest_iterations", params.coarsest_iterations, "refine_iterations",
+                                      params.refine_iterations);
+    PyObject *py_result = Py_BuildValue("(NN)", matrix_to_list(H, n, k), py_info);
+    free_matrix(H, n);
+    return py_result;
+}
+
+#define MODEL_CAPSULE "mysymnmf.model"
+
+/* capsule destructor releasing a loaded model */
+static void model_capsule_free(PyObject *capsule)
+{
+    free_model(PyCapsule_GetPointer(capsule, MODEL_CAPSULE));
+}
+
+/* implementation of hierarchy: a cluster tree of the dense W grown by rank-2 splits up to k leaves,
+   returning the labels for 1 .. k clusters and the tree */
+static PyObject *symnmf_hierarchy(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    (void)self;
+    static char *kwlist[] = {"W", "n", "k", "seed", NULL};
+    PyObject *py_W;
+    int n, k, c, i;
+    unsigned long seed = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Oii|k", kwlist, &py_W, &n, &k, &seed))
+    {
+        return NULL;
+    }
+    if (n <= 0 || k <= 0 || k >= n)
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid dimensions or number of clusters");
+        return NULL;
+    }
+
+    double **W = list_to_matrix(py_W, n, n);
+    if (W == NULL)
+    {
+        return NULL;
+    }
+    cluster_tree *tree = hierarchy_build(W, n, k, seed);
+    free_matrix(W, n);
+
+    PyObject *py_labels = PyList_New(k);
+    for (c = 1; c <= k; c++)
+    {
+        int *labels = hierarchy_labels(tree, c);
+        PyObject *py_row = PyList_New(n);
+        for (i = 0; i < n; i++)
+        {
+            PyList_SET_ITEM(py_row, i, PyLong_FromLong(labels[i]));
+        }
+        PyList_SET_ITEM(py_labels, c - 1, py_row);
+        free(labels);
+    }
+    /* every node as parent, children (-1 for leaves), size and the normalized cut of its split */
+    PyObject *py_nodes = PyList_New(tree->count);
+    for (i = 0; i < tree->count; i++)
+    {
+        cluster_node *node = &tree->nodes[i];
+        PyObject *py_ncut = Py_None;
+        if (node->left >= 0)
+        {
+            py_ncut = PyFloat_FromDouble(node->ncut);
+        }
+        else
+        {
+            Py_INCREF(Py_None);
+        }
+        PyList_SET_ITEM(py_nodes, i, Py_BuildValue("{s:i,s:i,s:i,s:i,s:i,s:N}", "parent", node->parent, "left",
+                                                   node->left, "right", node->right, "size", node->size,
+                                                   "iterations", node->iterations, "ncut", py_ncut));
+    }
+    PyObject *py_splits = PyList_New(tree->num_splits);
+    for (i = 0; i < tree->num_splits; i++)
+    {
+        PyList_SET_ITEM(py_splits, i, PyLong_FromLong(tree->splits[i]));
+    }
+    PyObject *py_info = Py_BuildValue("{s:N,s:N,s:i,s:i}", "nodes", py_nodes, "splits", py_splits, "leaves",
+                                      tree->num_splits + 1, "iterations", tree->iterations);
+    free_cluster_tree(tree);
+    return Py_BuildValue("(NN)", py_labels, py_info);
+}
+
+/* implementation of save_model given the file name, training points, final H, n, d and k */
+static PyObject *symnmf_save_model(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    (void)self;
+    static char *kwlist[] = {"file_name", "points", "H", "n", "d", "k", "keep_affinity", NULL};
+    const char *file_name;
+    PyObject *py_data, *py_H;
+    int n, d, k, keep_affinity = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sOOiii|p", kwlist, &file_name, &py_data, &py_H, &n, &d, &k, &keep_affinity))
+    {
+        return NULL;
+    }
+
+    double **data = list_to_matrix(py_data, n, d);
+    if (data == NULL)
+    {
+        return NULL;
+    }
+    double **H = list_to_matrix(py_H, n, k);
+    if (H == NULL)
+    {
+        free_matrix(data, n);
+        return NULL;
+    }
+
+    symnmf_model *model = model_create(data, H, n, d, k, keep_affinity);
+    int failed = model_save(model, file_name);
+    free_model(model);
+    free_matrix(data, n);
+    free_matrix(H, n);
+
+    if (failed)
+    {
+        PyErr_SetString(PyExc_OSError, "Could not write the model file");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+/* implementation of load_model given the file name, returning a model capsule */
+static PyObject *symnmf_load_model(PyObject *self, PyObject *args)
+{
+    (void)self;
+    const char *file_name;
+
+    if (!PyArg_ParseTuple(args, "s", &file_name))
+    {
+        return NULL;
+    }
+    symnmf_model *model = model_load(file_name);
+    if (model == NULL)
+    {
+        PyErr_SetString(PyExc_OSError, "Could not read the model file");
+        return NULL;
+    }
+    return PyCapsule_New(model, MODEL_CAPSULE, model_capsule_free);
+}
+
+/* resolve a model argument given as a capsule or a file name, *loaded is set when the caller must free it */
+static symnmf_model *model_argument(PyObject *py_model, symnmf_model **loaded)
+{
+    *loaded = NULL;
+    if (PyUnicode_Check(py_model))
+    {
+        *loaded = model_load(PyUnicode_AsUTF8(py_model));
+        if (*loaded == NULL)
+        {
+            PyErr_SetString(PyExc_OSError, "Could not read the model file");
+        }
+        return *loaded;
+    }
+    return PyCapsule_GetPointer(py_model, MODEL_CAPSULE);
+}
+
+/* implementation of assign given a model (capsule or file name) and the new points with their count and d */
+static PyObject *symnmf_assign(PyObject *self, PyObject *args)
+{
+    (void)self;
+    PyObject *py_model, *py_data;
+    int count, d;
+    symnmf_model *model, *loaded;
+
+    if (!PyArg_ParseTuple(args, "OOii", &py_model, &py_data, &count, &d))
+    {
+        return NULL;
+    }
+    model = model_argument(py_model, &loaded);
+    if (model == NULL)
+    {
+        return NULL;
+    }
+
+    double **data = d == model->d ? list_to_matrix(py_data, count, d) : NULL;
+    if (data == NULL)
+    {
+        if (!PyErr_Occurred())
+        {
+            PyErr_SetString(PyExc_ValueError, "Points dimension does not match the model");
+        }
+        free_model(loaded);
+        return NULL;
+    }
+
+    int *labels = model_assign(model, data, count);
+    PyObject *py_result = PyList_New(count);
+    for (int i = 0; i < count; i++)
+    {
+        PyList_SET_ITEM(py_result, i, PyLong_FromLong(labels[i]));
+    }
+
+    free(labels);
+    free_matrix(data, count);
+    free_model(loaded);
+    return py_result;
+}
+
+/* implementation of refit given a model (capsule or file name), the appended points with their count and d,
+   returning (H, info) and writing the refitted model to save_to when given */
+static PyObject *symnmf_refit(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    (void)self;
+    static char *kwlist[] = {"model", "points", "count", "d", "save_to", NULL};
+    PyObject *py_model, *py_data;
+    const char *save_to = NULL;
+    int count, d;
+    symnmf_model *model, *loaded;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOii|z", kwlist, &py_model, &py_data, &count, &d, &save_to))
+    {
+        return NULL;
+    }
+    model = model_argument(py_model, &loaded);
+    if (model == NULL)
+    {
+        return NULL;
+    }
+
+    double **data = d == model->d ? list_to_matrix(py_data, count, d) : NULL;
+    if (data == NULL)
+    {
+        if (!PyErr_Occurred())
+        {
+            PyErr_SetString(PyExc_ValueError, "Points dimension does not match the model");
+        }
+        free_model(loaded);
+        return NULL;
+    }
+
+    symnmf_params params;
+    symnmf_default_params(&params);
+    symnmf_model *refit = model_refit(model, data, count, &params);
+    int failed = save_to != NULL && model_save(refit, save_to);
+
+    PyObject *py_result = NULL;
+    if (failed)
+    {
+        PyErr_SetString(PyExc_OSError, "Could not write the model file");
+    }
+    else
+    {
+        PyObject *py_info = Py_BuildValue("{s:i,s:d}", "iterations", params.iterations, "delta", params.delta);
+        py_result = Py_BuildValue("(NN)", matrix_to_list(refit->H, refit->n, refit->k), py_info);
+    }
+
+    free_model(refit);
+    free_matrix(data, count);
+    free_model(loaded);
+    return py_result;
+}
+
+/* implementation of kernels: the instruction set of the kernels in use, switching first when one is named */
+static PyObject *symnmf_kernels(PyObject *self, PyObject *args)
+{
+    (void)self;
+    const char *isa = NULL;
+
+    if (!PyArg_ParseTuple(args, "|z", &isa))
+    {
+        return NULL;
+    }
+    if (isa != NULL && use_kernels(isa) != 0)
+    {
+        PyErr_Format(PyExc_ValueError, "Kernels '%s' are not supported here", isa);
+        return NULL;
+    }
+    return PyUnicode_FromString(active_kernels()->isa);
+}
+
+/* list of Python methods in the module to call them by given name here */
+static PyMethodDef symnmf_methods[] = {
+    {"sym", (PyCFunction)(void (*)(void))symnmf_sym, METH_VARARGS | METH_KEYWORDS, "Compute the similarity matrix"},
+    {"ddg", (PyCFunction)(void (*)(void))symnmf_ddg, METH_VARARGS | METH_KEYWORDS, "Compute the diagonal degree matrix"},
+    {"norm", (PyCFunction)(void (*)(void))symnmf_norm, METH_VARARGS | METH_KEYWORDS, "Compute the normalized similarity matrix"},
+    {"degrees", symnmf_degrees, METH_VARARGS, "Compute the degree of every point (row sums of sym)"},
+    {"sym_rows", (PyCFunction)(void (*)(void))symnmf_sym_rows, METH_VARARGS | METH_KEYWORDS, "Compute rows [first, last) of the similarity matrix"},
+    {"ddg_rows", (PyCFunction)(void (*)(void))symnmf_ddg_rows, METH_VARARGS | METH_KEYWORDS, "Compute rows [first, last) of the diagonal degree matrix, optionally from given degrees"},
+    {"norm_rows", (PyCFunction)(void (*)(void))symnmf_norm_rows, METH_VARARGS | METH_KEYWORDS, "Compute rows [first, last) of the normalized similarity matrix, optionally from given degrees"},
+    {"symnmf", (PyCFunction)(void (*)(void))symnmf_symnmf, METH_VARARGS | METH_KEYWORDS, "Perform 'symnmf'"},
+    {"analysis", (PyCFunction)(void (*)(void))symnmf_analysis, METH_VARARGS | METH_KEYWORDS, "Perform 'analysis'"},
+    {"nystrom", (PyCFunction)(void (*)(void))symnmf_nystrom, METH_VARARGS | METH_KEYWORDS, "Build a Nystrom approximation of the normalized similarity matrix"},
+    {"sketch", (PyCFunction)(void (*)(void))symnmf_sketch, METH_VARARGS | METH_KEYWORDS, "Build a randomized rank-r eigendecomposition of W"},
+    {"quantize", (PyCFunction)(void (*)(void))symnmf_quantize, METH_VARARGS | METH_KEYWORDS, "Store W in 16 or 8 bits per entry"},
+    {"outofcore", (PyCFunction)(void (*)(void))symnmf_outofcore, METH_VARARGS | METH_KEYWORDS, "Keep norm in a tiled scratch file, streamed by every W*H"},
+    {"objective", symnmf_objective_py, METH_VARARGS, "Compute ||W - H*H^T||^2"},
+    {"affinity_info", symnmf_affinity_info, METH_VARARGS, "Describe an approximated affinity"},
+    {"solve", (PyCFunction)(void (*)(void))symnmf_solve, METH_VARARGS | METH_KEYWORDS, "Perform 'symnmf' on a dense or approximated affinity, returning (H, info)"},
+    {"initialize", (PyCFunction)(void (*)(void))symnmf_initialize, METH_VARARGS | METH_KEYWORDS, "Initialize H from the top eigenvectors of W (spectral) or a k-means of its rows (kmeans++)"},
+    {"knn", (PyCFunction)(void (*)(void))symnmf_knn, METH_VARARGS | METH_KEYWORDS, "Find the k nearest neighbours of every point, returning (neighbors, info)"},
+    {"multilevel", (PyCFunction)(void (*)(void))symnmf_multilevel, METH_VARARGS | METH_KEYWORDS, "Perform 'symnmf' on the nearest neighbour affinity through coarser levels, returning (H, info)"},
+    {"hierarchy", (PyCFunction)(void (*)(void))symnmf_hierarchy, METH_VARARGS | METH_KEYWORDS, "Grow a cluster tree by rank-2 splits"},
+    {"save_model", (PyCFunction)(void (*)(void))symnmf_save_model, METH_VARARGS | METH_KEYWORDS, "Save a fitted model (points, degrees, H) to a file, keep_affinity=True making refits compute only the new rows"},
+    {"load_model", symnmf_load_model, METH_VARARGS, "Load a fitted model from a file"},
+    {"assign", symnmf_assign, METH_VARARGS, "Assign new points to clusters of a fitted model"},
+    {"refit", (PyCFunction)(void (*)(void))symnmf_refit, METH_VARARGS | METH_KEYWORDS, "Refit a model after appending points, warm-starting from its H"},
+    {"kernels", symnmf_kernels, METH_VARARGS, "Report (or switch) the instruction set of the kernels: base, avx2, avx512 or auto"},
+    {NULL, NULL, 0, NULL}};
+
+/* module definition, naming it mysymnmf */
+static struct PyModuleDef symnmf_module = {
+    PyModuleDef_HEAD_INIT,
+    "mysymnmf",
+    NULL,
+    -1,
+    symnmf_methods,
+};
+
+/* module initialization function */
+PyMODINIT_FUNC PyInit_mysymnmf(void)
+{
+    PyObject *module;
+
+    if (PyType_Ready(&cancel_token_type) < 0)
+    {
+        return NULL;
+    }
+    module = PyModule_Create(&symnmf_module);
+    if (module == NULL)
+    {
+        return NULL;
+    }
+    Py_INCREF(&cancel_token_type);
+    if (PyModule_AddObject(module, "CancelToken", (PyObject *)&cancel_token_type) < 0)
     {
+        Py_DECREF(&cancel_token_type);
+        Py_DECREF(module);
         return NULL;
     }
 